@@ -0,0 +1,644 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <r.h>
+#include <rcom.h>
+
+#include "registry_priv.h"
+
+/*
+ * rcdump reads the dumps through the memory-mapped reader. The info
+ * and cat commands split a dump in ranges along its index and scan
+ * them in parallel, one thread per range. cat processes the ranges
+ * in rounds of as many ranges as there are threads, and prints the
+ * output of a round in order before starting the next one, so the
+ * memory use doesn't grow with the size of the dump.
+ */
+
+// The approximate size of the ranges of cat
+#define RCDUMP_CHUNK_SIZE (8 * 1024 * 1024)
+
+static int num_threads = 1;
+static int codec = DUMP_COMPRESSION_NONE;
+
+typedef struct _chunk_t {
+        dump_cursor_t cursor;
+        uint64_t end_time;
+        // Set when a record at or after end_time was reached
+        int done;
+        
+        // info
+        uint64_t count[256];
+        uint64_t bytes[256];
+        uint64_t first_timestamp;
+        uint64_t last_timestamp;
+        
+        // cat
+        membuf_t *out;
+        data_t *data;
+        membuf_t *text;
+} chunk_t;
+
+static const char *record_type_str(int type)
+{
+        switch (type) {
+        case DUMP_RECORD_DATA: return "data";
+        case DUMP_RECORD_BUFFER: return "buffer";
+        case DUMP_RECORD_MESSAGE: return "message";
+        case DUMP_RECORD_FRAME: return "frame";
+        default: return NULL;
+        }
+}
+
+static uint64_t seconds_to_us(const char *s)
+{
+        return (uint64_t) (strtod(s, NULL) * 1000000.0);
+}
+
+static void run_chunks(chunk_t *chunks, int n, thread_run_t run)
+{
+        thread_t **threads;
+
+        if (n == 1) {
+                run(&chunks[0]);
+                return;
+        }
+        threads = (thread_t **) r_alloc(n * sizeof(thread_t *));
+        if (threads == NULL) {
+                for (int i = 0; i < n; i++)
+                        run(&chunks[i]);
+                return;
+        }
+        for (int i = 0; i < n; i++)
+                threads[i] = new_thread(run, &chunks[i]);
+        for (int i = 0; i < n; i++) {
+                if (threads[i] == NULL) {
+                        run(&chunks[i]);
+                } else {
+                        thread_join(threads[i]);
+                        delete_thread(threads[i]);
+                }
+        }
+        r_free(threads);
+}
+
+/***********************************************************/
+
+static void info_chunk(void *arg)
+{
+        chunk_t *chunk = (chunk_t *) arg;
+        dump_view_t view;
+
+        while (dump_mmap_next(&chunk->cursor, &view) == 0) {
+                chunk->count[view.type & 0xff]++;
+                chunk->bytes[view.type & 0xff] += view.len;
+                if (chunk->first_timestamp == 0 || view.timestamp < chunk->first_timestamp)
+                        chunk->first_timestamp = view.timestamp;
+                if (view.timestamp > chunk->last_timestamp)
+                        chunk->last_timestamp = view.timestamp;
+        }
+}
+
+static int info_dump(const char *path)
+{
+        dump_map_t *map;
+        dump_t *dump;
+        chunk_t *chunks;
+        uint64_t count[256] = {0};
+        uint64_t bytes[256] = {0};
+        uint64_t first = 0, last = 0, total = 0;
+        
+        map = dump_mmap_open(path);
+        if (map == NULL) {
+                fprintf(stderr, "Failed to open %s\n", path);
+                return 1;
+        }
+        dump = dump_mmap_dump(map);
+        
+        chunks = (chunk_t *) r_alloc(num_threads * sizeof(chunk_t));
+        if (chunks == NULL) {
+                dump_mmap_close(map);
+                return 1;
+        }
+        memset(chunks, 0, num_threads * sizeof(chunk_t));
+        for (int i = 0; i < num_threads; i++)
+                dump_mmap_partition(map, i, num_threads, &chunks[i].cursor);
+
+        run_chunks(chunks, num_threads, info_chunk);
+
+        for (int i = 0; i < num_threads; i++) {
+                for (int t = 0; t < 256; t++) {
+                        count[t] += chunks[i].count[t];
+                        bytes[t] += chunks[i].bytes[t];
+                        total += chunks[i].count[t];
+                }
+                if (chunks[i].first_timestamp != 0
+                    && (first == 0 || chunks[i].first_timestamp < first))
+                        first = chunks[i].first_timestamp;
+                if (chunks[i].last_timestamp > last)
+                        last = chunks[i].last_timestamp;
+                dump_mmap_cursor_release(&chunks[i].cursor);
+        }
+        
+        printf("File:      %s\n", path);
+        printf("Name:      %s\n", dump_name(dump));
+        printf("Type:      %s\n", registry_type_to_str(dump_type(dump)));
+        printf("Topic:     %s\n", dump_topic(dump));
+        printf("Mimetype:  %s\n", dump_mimetype(dump));
+        printf("Records:   %llu\n", (unsigned long long) total);
+        if (total > 0) {
+                printf("Start:     %.6f\n", (double) first / 1000000.0);
+                printf("End:       %.6f\n", (double) last / 1000000.0);
+                printf("Duration:  %.3f s\n", (double) (last - first) / 1000000.0);
+        }
+        for (int t = 0; t < 256; t++) {
+                const char *s = record_type_str(t);
+                if (count[t] == 0)
+                        continue;
+                if (s)
+                        printf("  %-8s %llu records, %llu bytes\n", s,
+                               (unsigned long long) count[t],
+                               (unsigned long long) bytes[t]);
+                else
+                        printf("  type %-3d %llu records, %llu bytes\n", t,
+                               (unsigned long long) count[t],
+                               (unsigned long long) bytes[t]);
+        }
+        
+        r_free(chunks);
+        dump_mmap_close(map);
+        return 0;
+}
+
+static int info(int argc, char **argv)
+{
+        int exit_code = 0;
+        for (int i = 0; i < argc; i++) {
+                if (i > 0)
+                        printf("\n");
+                if (info_dump(argv[i]) != 0)
+                        exit_code = 1;
+        }
+        return exit_code;
+}
+
+/***********************************************************/
+
+static void print_string(membuf_t *out, const char *s, uint32_t len)
+{
+        membuf_put(out, '"');
+        for (uint32_t i = 0; i < len; i++) {
+                unsigned char c = (unsigned char) s[i];
+                switch (c) {
+                case '"': membuf_append(out, "\\\"", 2); break;
+                case '\\': membuf_append(out, "\\\\", 2); break;
+                case '\n': membuf_append(out, "\\n", 2); break;
+                case '\r': membuf_append(out, "\\r", 2); break;
+                case '\t': membuf_append(out, "\\t", 2); break;
+                default:
+                        if (c < 0x20)
+                                membuf_printf(out, "\\u%04x", c);
+                        else
+                                membuf_put(out, (char) c);
+                        break;
+                }
+        }
+        membuf_put(out, '"');
+}
+
+// Prints the value, or the text as a string if it isn't valid JSON.
+static void print_value(membuf_t *out, json_object_t value,
+                        const char *text, uint32_t len)
+{
+        if (json_isnull(value)) {
+                membuf_printf(out, ", \"text\": ");
+                print_string(out, text, len);
+        } else {
+                membuf_printf(out, ", \"value\": ");
+                membuf_print_obj(out, value);
+        }
+        json_unref(value);
+}
+
+static void cat_record(chunk_t *chunk, dump_view_t *view)
+{
+        membuf_t *out = chunk->out;
+        const char *type = record_type_str(view->type);
+        const char *payload = (const char *) view->data;
+        const char *mimetype;
+        const char *data;
+        uint32_t len;
+        double time;
+        
+        membuf_printf(out, "{\"record\": %llu, \"timestamp\": %llu, ",
+                      (unsigned long long) view->record,
+                      (unsigned long long) view->timestamp);
+        if (type)
+                membuf_printf(out, "\"type\": \"%s\"", type);
+        else
+                membuf_printf(out, "\"type\": %d", view->type);
+
+        switch (view->type) {
+        case DUMP_RECORD_DATA:
+                if (view->len < PACKET_HEADER || view->len > PACKET_MAXLEN)
+                        break;
+                memcpy(data_packet(chunk->data), view->data, view->len);
+                data_set_len(chunk->data, (int) (view->len - PACKET_HEADER));
+                print_value(out, data_parse(chunk->data, NULL),
+                            data_data(chunk->data), view->len - PACKET_HEADER);
+                break;
+                
+        case DUMP_RECORD_MESSAGE:
+                // The parser needs a zero-terminated string
+                membuf_clear(chunk->text);
+                membuf_append(chunk->text, payload, (int) view->len);
+                membuf_append_zero(chunk->text);
+                print_value(out, json_parser_eval(data_thread_parser(),
+                                                  membuf_data(chunk->text)),
+                            payload, view->len);
+                break;
+                
+        case DUMP_RECORD_FRAME:
+                if (dump_parse_frame(view->data, view->len, &mimetype,
+                                     &time, &data, &len) != 0)
+                        break;
+                membuf_printf(out, ", \"time\": %f, \"mimetype\": ", time);
+                print_string(out, mimetype, (uint32_t) strlen(mimetype));
+                membuf_printf(out, ", \"length\": %u", len);
+                break;
+                
+        default:
+                membuf_printf(out, ", \"text\": ");
+                print_string(out, payload, view->len);
+                break;
+        }
+        membuf_printf(out, "}\n");
+}
+
+static void cat_chunk(void *arg)
+{
+        chunk_t *chunk = (chunk_t *) arg;
+        dump_view_t view;
+
+        while (dump_mmap_next(&chunk->cursor, &view) == 0) {
+                if (chunk->end_time != 0 && view.timestamp >= chunk->end_time) {
+                        chunk->done = 1;
+                        break;
+                }
+                cat_record(chunk, &view);
+        }
+}
+
+// The offset of the first record of the cursor, or the offset of the
+// block that holds it.
+static uint64_t cursor_position(dump_cursor_t *cursor)
+{
+        return (cursor->block_len > 0)? cursor->block_offset : cursor->offset;
+}
+
+static int cat(const char *path, uint64_t start, uint64_t end)
+{
+        dump_map_t *map;
+        dump_t *dump;
+        dump_cursor_t first;
+        chunk_t *chunks;
+        uint64_t first_timestamp = 0, last_timestamp;
+        uint64_t position;
+        struct stat st;
+        int parts, done = 0;
+        int exit_code = 0;
+        
+        map = dump_mmap_open(path);
+        if (map == NULL) {
+                fprintf(stderr, "Failed to open %s\n", path);
+                return 1;
+        }
+        dump = dump_mmap_dump(map);
+        dump_time_range(dump, &first_timestamp, &last_timestamp);
+
+        // The records before the start time are skipped using the
+        // index. The first range that remains starts at the first
+        // record to print.
+        if (dump_mmap_seek_time(map, first_timestamp + start, &first) != 0) {
+                dump_mmap_cursor_release(&first);
+                dump_mmap_close(map);
+                return 0;
+        }
+        position = cursor_position(&first);
+        
+        parts = num_threads;
+        if (stat(path, &st) == 0 && st.st_size / RCDUMP_CHUNK_SIZE > parts)
+                parts = (int) (st.st_size / RCDUMP_CHUNK_SIZE);
+        
+        chunks = (chunk_t *) r_alloc(num_threads * sizeof(chunk_t));
+        if (chunks == NULL) {
+                dump_mmap_cursor_release(&first);
+                dump_mmap_close(map);
+                return 1;
+        }
+        memset(chunks, 0, num_threads * sizeof(chunk_t));
+        for (int i = 0; i < num_threads; i++) {
+                chunks[i].out = new_membuf();
+                chunks[i].text = new_membuf();
+                chunks[i].data = new_data();
+                chunks[i].end_time = (end != 0)? first_timestamp + end : 0;
+        }
+        
+        for (int part = 0; part < parts && !done; ) {
+                int n = 0;
+                
+                while (n < num_threads && part < parts) {
+                        chunk_t *chunk = &chunks[n];
+                        dump_mmap_partition(map, part++, parts, &chunk->cursor);
+                        if (chunk->cursor.end <= position)
+                                continue;
+                        if (chunk->cursor.offset <= position
+                            && first.map != NULL) {
+                                // The range that holds the first record
+                                uint64_t range_end = chunk->cursor.end;
+                                chunk->cursor = first;
+                                chunk->cursor.end = range_end;
+                                first.map = NULL;
+                        }
+                        membuf_clear(chunk->out);
+                        chunk->done = 0;
+                        n++;
+                }
+                if (n == 0)
+                        break;
+
+                run_chunks(chunks, n, cat_chunk);
+
+                for (int i = 0; i < n; i++) {
+                        if (!done && membuf_len(chunks[i].out) > 0)
+                                fwrite(membuf_data(chunks[i].out), 1,
+                                       membuf_len(chunks[i].out), stdout);
+                        if (chunks[i].done)
+                                done = 1;
+                        dump_mmap_cursor_release(&chunks[i].cursor);
+                }
+        }
+        
+        if (first.map != NULL)
+                dump_mmap_cursor_release(&first);
+        for (int i = 0; i < num_threads; i++) {
+                delete_membuf(chunks[i].out);
+                delete_membuf(chunks[i].text);
+                delete_data(chunks[i].data);
+        }
+        r_free(chunks);
+        dump_mmap_close(map);
+        if (fflush(stdout) != 0)
+                exit_code = 1;
+        return exit_code;
+}
+
+/***********************************************************/
+
+static dump_t *create_output(const char *path, dump_t *input)
+{
+        dump_t *dump = dump_create_file(path, dump_name(input), dump_type(input),
+                                        dump_topic(input), dump_mimetype(input));
+        if (dump == NULL)
+                return NULL;
+        if (codec != DUMP_COMPRESSION_NONE
+            && dump_set_compression(dump, codec, 0) != 0) {
+                delete_dump(dump);
+                return NULL;
+        }
+        return dump;
+}
+
+static int slice(const char *input, const char *output,
+                 uint64_t start, uint64_t end)
+{
+        dump_map_t *map;
+        dump_t *dump;
+        dump_cursor_t cursor;
+        dump_view_t view;
+        uint64_t first = 0, last, count = 0;
+        int exit_code = 0;
+        
+        map = dump_mmap_open(input);
+        if (map == NULL) {
+                fprintf(stderr, "Failed to open %s\n", input);
+                return 1;
+        }
+        dump_time_range(dump_mmap_dump(map), &first, &last);
+        
+        dump = create_output(output, dump_mmap_dump(map));
+        if (dump == NULL) {
+                dump_mmap_close(map);
+                return 1;
+        }
+
+        if (dump_mmap_seek_time(map, first + start, &cursor) == 0) {
+                while (dump_mmap_next(&cursor, &view) == 0) {
+                        if (end != 0 && view.timestamp >= first + end)
+                                break;
+                        if (dump_write_record(dump, view.type, view.timestamp,
+                                              view.data, view.len) != 0) {
+                                exit_code = 1;
+                                break;
+                        }
+                        count++;
+                }
+        }
+        dump_mmap_cursor_release(&cursor);
+
+        delete_dump(dump);
+        dump_mmap_close(map);
+        fprintf(stderr, "%llu records written to %s\n",
+                (unsigned long long) count, output);
+        return exit_code;
+}
+
+/***********************************************************/
+
+typedef struct _source_t {
+        dump_map_t *map;
+        dump_cursor_t cursor;
+        dump_view_t next;
+        int done;
+} source_t;
+
+static void merge_advance(source_t *source)
+{
+        if (dump_mmap_next(&source->cursor, &source->next) != 0)
+                source->done = 1;
+}
+
+// The inputs are merged in the order of the timestamps. There are
+// only a handful of them, so the next record is found with a linear
+// search, as in the replay.
+static int merge(const char *output, int argc, char **argv)
+{
+        source_t *sources;
+        dump_t *dump = NULL;
+        uint64_t count = 0;
+        int exit_code = 0;
+
+        sources = (source_t *) r_alloc(argc * sizeof(source_t));
+        if (sources == NULL)
+                return 1;
+        memset(sources, 0, argc * sizeof(source_t));
+        
+        for (int i = 0; i < argc; i++) {
+                sources[i].map = dump_mmap_open(argv[i]);
+                if (sources[i].map == NULL) {
+                        fprintf(stderr, "Failed to open %s\n", argv[i]);
+                        exit_code = 1;
+                        goto cleanup;
+                }
+                dump_mmap_cursor(sources[i].map, &sources[i].cursor);
+                merge_advance(&sources[i]);
+        }
+
+        // The output takes the header of the first input
+        dump = create_output(output, dump_mmap_dump(sources[0].map));
+        if (dump == NULL) {
+                exit_code = 1;
+                goto cleanup;
+        }
+        
+        while (1) {
+                source_t *next = NULL;
+                for (int i = 0; i < argc; i++) {
+                        if (!sources[i].done
+                            && (next == NULL
+                                || sources[i].next.timestamp < next->next.timestamp))
+                                next = &sources[i];
+                }
+                if (next == NULL)
+                        break;
+                if (dump_write_record(dump, next->next.type, next->next.timestamp,
+                                      next->next.data, next->next.len) != 0) {
+                        exit_code = 1;
+                        break;
+                }
+                count++;
+                merge_advance(next);
+        }
+        fprintf(stderr, "%llu records written to %s\n",
+                (unsigned long long) count, output);
+        
+cleanup:
+        delete_dump(dump);
+        for (int i = 0; i < argc; i++) {
+                if (sources[i].map) {
+                        dump_mmap_cursor_release(&sources[i].cursor);
+                        dump_mmap_close(sources[i].map);
+                }
+        }
+        r_free(sources);
+        return exit_code;
+}
+
+/***********************************************************/
+
+static void print_usage()
+{
+        printf("Usage: rcdump [-j threads] [-c lz4|zstd] command [options]\n");
+        printf("  info <dump>...\n");
+        printf("      Prints the header, the number of records and the time range\n");
+        printf("  cat <dump> [<start> [<end>]]\n");
+        printf("      Prints the records as JSON lines\n");
+        printf("  slice <dump> <output> <start> [<end>]\n");
+        printf("      Copies the records in the time window to a new dump\n");
+        printf("  merge <output> <dump>...\n");
+        printf("      Merges the dumps into a new dump, in the order of the timestamps\n");
+        printf("The times are in seconds since the first record of the dump.\n");
+        printf("The window stops at the first record at or after the end time.\n");
+        printf("-j sets the number of threads used by info and cat (default: the\n");
+        printf("number of processors). -c compresses the output of slice and merge.\n");
+}
+
+int main(int argc, char **argv)
+{
+        const char *command;
+        int exit_code = 0;
+        int opt;
+
+        num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+        while ((opt = getopt(argc, argv, "+j:c:h")) != -1) {
+                switch (opt) {
+                case 'j':
+                        num_threads = atoi(optarg);
+                        break;
+                case 'c':
+                        if (rstreq(optarg, "lz4"))
+                                codec = DUMP_COMPRESSION_LZ4;
+                        else if (rstreq(optarg, "zstd"))
+                                codec = DUMP_COMPRESSION_ZSTD;
+                        else if (rstreq(optarg, "none"))
+                                codec = DUMP_COMPRESSION_NONE;
+                        else {
+                                fprintf(stderr, "Unknown compression: %s\n", optarg);
+                                return 1;
+                        }
+                        break;
+                default:
+                        print_usage();
+                        return 1;
+                }
+        }
+        if (num_threads < 1)
+                num_threads = 1;
+        
+        argc -= optind;
+        argv += optind;
+        if (argc < 1) {
+                print_usage();
+                return 1;
+        }
+        command = argv[0];
+
+        if (rstreq(command, "info") && argc >= 2) {
+                exit_code = info(argc - 1, argv + 1);
+                
+        } else if (rstreq(command, "cat") && argc >= 2) {
+                exit_code = cat(argv[1],
+                                (argc >= 3)? seconds_to_us(argv[2]) : 0,
+                                (argc >= 4)? seconds_to_us(argv[3]) : 0);
+                
+        } else if (rstreq(command, "slice") && argc >= 4) {
+                exit_code = slice(argv[1], argv[2], seconds_to_us(argv[3]),
+                                  (argc >= 5)? seconds_to_us(argv[4]) : 0);
+                
+        } else if (rstreq(command, "merge") && argc >= 3) {
+                exit_code = merge(argv[1], argc - 2, argv + 2);
+                
+        } else {
+                print_usage();
+                exit_code = rstreq(command, "help")? 0 : 1;
+        }
+        
+        return exit_code;
+}
@@ -0,0 +1,70 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef _RCOM_CBOR_H_
+#define _RCOM_CBOR_H_
+
+#include <r.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A minimal CBOR (RFC 8949) codec for JSON values. Numbers are encoded
+ * in the smallest form that preserves their value: small integers in
+ * one to five bytes, other numbers as single or double precision
+ * floats. Objects are encoded as maps with text keys.
+ *
+ * Arrays of numbers can also be encoded as typed arrays (RFC 8746,
+ * tag 86: float64, little endian), which are copied in and out with
+ * a single memcpy on little-endian hosts.
+ */
+
+// The self-describe tag (55799). Prefixed to binary data_t payloads
+// so that receivers can tell them apart from JSON text.
+#define CBOR_MAGIC_LEN 3
+extern const unsigned char cbor_magic[CBOR_MAGIC_LEN];
+
+// Returns the length of the encoded value, or -1 if the buffer is too
+// small or the value can't be encoded.
+int cbor_encode(json_object_t value, unsigned char *buf, int len);
+
+// Returns json_null() and sets *error to -1 if the data is invalid.
+// The error pointer may be NULL.
+json_object_t cbor_decode(const unsigned char *buf, int len, int *error);
+
+// Encodes the numbers as a typed array. Returns the length of the
+// encoded value, or -1 if the buffer is too small.
+int cbor_encode_array(const double *values, int n, unsigned char *buf, int len);
+
+// Decodes a typed array, or a regular array of numbers, without
+// creating JSON objects. Returns the number of values, or -1 if the
+// data is not an array of numbers or has more than max values.
+int cbor_decode_array(const unsigned char *buf, int len, double *values, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _RCOM_CBOR_H_
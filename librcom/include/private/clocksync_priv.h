@@ -0,0 +1,61 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef _RCOM_CLOCKSYNC_PRIV_H_
+#define _RCOM_CLOCKSYNC_PRIV_H_
+
+#include "clocksync.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The ping exchanges are carried in the payload of the messages. A
+ * request is "\xffSYN" followed by t0, a reply is "\xffSYR" followed
+ * by t0, t1, and t2, all as 64-bit big-endian integers. The datahubs
+ * answer the requests of the datalinks, and the messagelinks answer
+ * the requests sent in a websocket ping. Other websocket peers just
+ * echo the request, which is ignored.
+ */
+#define CLOCK_SYNC_REQUEST_LEN 12
+#define CLOCK_SYNC_REPLY_LEN 28
+
+int clock_sync_is_request(const char *data, int len);
+int clock_sync_is_reply(const char *data, int len);
+
+// Returns the length of the message
+int clock_sync_make_request(char *buf, uint64_t t0);
+
+// Reply to a request received at t1. The time t2 is taken when the
+// reply is made. Returns -1 if the data is not a request.
+int clock_sync_make_reply(const char *request, int len, char *buf, uint64_t t1);
+
+int clock_sync_parse_reply(const char *data, int len,
+                           uint64_t *t0, uint64_t *t1, uint64_t *t2);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _RCOM_CLOCKSYNC_PRIV_H_
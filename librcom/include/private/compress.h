@@ -0,0 +1,65 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef _RCOM_COMPRESS_H_
+#define _RCOM_COMPRESS_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Block compression for the dumps. LZ4 is built in: the encoder is a
+ * simple greedy compressor that produces the standard LZ4 block
+ * format, so blocks can also be decoded with liblz4. zstd is used when
+ * the library was found at build time (HAVE_ZSTD).
+ */
+enum {
+        COMPRESS_NONE = 0,
+        COMPRESS_LZ4 = 1,
+        COMPRESS_ZSTD = 2
+};
+
+int compress_available(int codec);
+
+// The maximum size of the compressed data.
+size_t compress_bound(int codec, size_t len);
+
+// Returns the size of the compressed data, or -1 on failure.
+long compress_block(int codec, int level,
+                    const void *src, size_t len,
+                    void *dst, size_t capacity);
+
+// The size of the decompressed data must be known. Returns 0 if the
+// data was decompressed to exactly that size, and -1 otherwise.
+int decompress_block(int codec,
+                     const void *src, size_t len,
+                     void *dst, size_t raw_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _RCOM_COMPRESS_H_
@@ -26,6 +26,7 @@
 
 #include "addr.h"
 #include "datahub.h"
+#include "dump.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -38,10 +39,31 @@ datahub_t* new_datahub(datahub_onbroadcast_t onbroadcast,
 void delete_datahub(datahub_t* hub);
 
 int datahub_add_link(datahub_t* hub, addr_t *addr);
+
+// Adds a link that runs on the same host. The data is written to the
+// shared-memory ring of the link instead of being sent over UDP. If
+// the ring can't be opened, the link is added as a regular link.
+int datahub_add_local_link(datahub_t* hub, addr_t *addr, const char *ring_name);
+
 int datahub_remove_link(datahub_t* hub, addr_t *addr);
 
 addr_t *datahub_addr(datahub_t* hub);
 
+// Switches the hub to multicast mode: broadcasts are sent once to the
+// group instead of to each link. The links on other hosts are
+// expected to join the group. The links on the same host still
+// receive the data directly. Returns -1 if multicast is not
+// available on this host, in which case the hub keeps sending to each
+// link.
+int datahub_set_group(datahub_t* hub, addr_t *group);
+
+// Returns the multicast group, or NULL if the hub sends to each link.
+addr_t *datahub_group(datahub_t* hub);
+
+// Records the broadcast data in the dump. The hub takes ownership of
+// the dump. Must be called before the hub is used.
+void datahub_set_dump(datahub_t* hub, dump_t *dump);
+
 #ifdef __cplusplus
 }
 #endif
@@ -37,6 +37,30 @@ addr_t *datalink_addr(datalink_t *datalink);
 addr_t *datalink_remote_addr(datalink_t *datalink);
 void datalink_set_remote_addr(datalink_t *datalink, addr_t *addr);
 
+// Joins the multicast group of the remote hub, or leaves the current
+// group if group is NULL. The data sent by the hub to its individual
+// links is still received.
+void datalink_set_group(datalink_t *datalink, addr_t *group);
+
+// A link that joined the multicast group of its hub tells the hub with
+// a DATALINK_JOINED_LEN-byte message: "\xffGRP" followed by the IPv4
+// address and the port of the group, in network byte order. The hub
+// only stops sending the broadcasts to the links that did. The message
+// is repeated every DATALINK_JOINED_INTERVAL seconds because it may
+// be lost.
+#define DATALINK_JOINED_LEN 10
+#define DATALINK_JOINED_INTERVAL 1.0
+
+int datalink_make_joined(char *buf, addr_t *group);
+
+// Returns 0 and sets the group if the data is such a message, -1
+// otherwise.
+int datalink_parse_joined(const char *data, int len, addr_t *group);
+
+// The name of the shared-memory ring through which a datahub on the
+// same host can send its data, or NULL.
+const char *datalink_ring_name(datalink_t *datalink);
+
 int datalink_sendto(datalink_t *datalink, addr_t *addr, data_t *data);
 
 
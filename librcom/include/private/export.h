@@ -24,6 +24,7 @@
 #ifndef _RCOM_EXPORT_H_
 #define _RCOM_EXPORT_H_
 
+#include <r.h>
 #include "service.h"
 #include "response.h"
 
@@ -47,13 +48,29 @@ int export_json_out(export_t* e);
 
 int export_matches(export_t* e, const char *name);
 
-export_t *export_clone(export_t* e);
 int export_set_mimetypes(export_t* e,
                          const char* mimetype_in,
                          const char* mimetype_out);
 void export_set_onrequest(export_t* e, void *userdata, service_onrequest_t onrequest);
 void export_callback(export_t* e, request_t *request, response_t *response);
 
+/*
+ * export_table_t
+ *
+ * A read-only index of a list of exports, keyed by name. The table
+ * borrows the exports; they must outlive it. A table is built once and
+ * never modified, so it can be shared between threads without
+ * locking.
+ */
+typedef struct _export_table_t export_table_t;
+
+export_table_t *new_export_table(list_t *exports);
+void delete_export_table(export_table_t *table);
+
+// Returns the export matching the name, the wildcard export "*" if
+// there is no match, or NULL.
+export_t *export_table_get(export_table_t *table, const char *name);
+
 #ifdef __cplusplus
 }
 #endif
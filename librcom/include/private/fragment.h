@@ -0,0 +1,100 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef _RCOM_FRAGMENT_H_
+#define _RCOM_FRAGMENT_H_
+
+#include <stdint.h>
+#include "addr.h"
+#include "data.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Messages that are larger than DATA_MAXLEN are sent as a series of
+ * fragments. Each fragment is a regular packet whose data starts with
+ * a fragment header:
+ *
+ *   magic[4]   0xff 'F' 'R' 'G'
+ *   msgid[4]   identifies the message, per sender
+ *   index[2]   index of the fragment
+ *   count[2]   number of fragments in the message
+ *   total[4]   total length of the message
+ *
+ * All numbers are big-endian. All fragments of a message carry the
+ * same timestamp.
+ */
+#define FRAGMENT_HEADER 16
+#define FRAGMENT_DATA_MAXLEN (DATA_MAXLEN - FRAGMENT_HEADER)
+#define FRAGMENT_MAX_COUNT 1024
+#define FRAGMENT_MESSAGE_MAXLEN (FRAGMENT_MAX_COUNT * FRAGMENT_DATA_MAXLEN)
+
+// The number of seconds after which an incomplete message is dropped
+#define FRAGMENT_TIMEOUT 0.5
+
+int data_is_fragment(data_t *data);
+
+// Returns 1 if the payload starts with the byte that is reserved for
+// the protocol, 0xff. The fragments and the clock sync messages start
+// with it, and the receivers don't pass them to ondata.
+int data_is_reserved(const char *data, int len);
+
+typedef int (*fragment_send_t)(void *userdata, data_t *fragment);
+
+// Splits the message into fragments, using the data_t out as the
+// buffer, and calls send for each fragment. Returns 0 if all the
+// fragments were sent, -1 otherwise.
+int fragment_split(const char *message, int len, uint32_t msgid,
+                   data_t *out, fragment_send_t send, void *userdata);
+
+/*
+ * reassembler_t
+ *
+ * Collects the fragments received from one or more senders. The
+ * number of incomplete messages is bounded, and incomplete messages
+ * are dropped after the timeout.
+ */
+typedef struct _reassembler_t reassembler_t;
+
+reassembler_t *new_reassembler(double timeout);
+void delete_reassembler(reassembler_t *r);
+
+// Returns:
+// -1: the fragment is invalid
+// 0: the message is not yet complete
+// 1: the message is complete. The message and its length are returned
+//    in the message and len arguments and remain valid until the
+//    next call to reassembler_push().
+int reassembler_push(reassembler_t *r, addr_t *from, data_t *fragment,
+                     const char **message, int *len);
+
+// Statistics
+uint32_t reassembler_dropped(reassembler_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _RCOM_FRAGMENT_H_
@@ -0,0 +1,99 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef _RCOM_FRAMERING_H_
+#define _RCOM_FRAMERING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "defines.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * framering_t
+ *
+ * A ring of video frames in POSIX shared memory. A streamer writes
+ * its frames into the ring and the streamerlinks on the same host
+ * read them in place, without copies. Each frame carries its
+ * mimetype (for example "image/jpeg", or a raw format such as
+ * "image/x-raw; format=rgb24; width=640; height=480") and its
+ * timestamp, the value that is sent as X-LT-Timestamp over HTTP.
+ *
+ * There is one writer and any number of readers. The writer never
+ * waits for the readers: a reader that is slower than the camera
+ * skips frames. A frame handed to a reader remains valid as long as
+ * the reader is faster than the slots - 1 frames that follow it.
+ */
+typedef struct _framering_t framering_t;
+
+#define FRAMERING_SLOTS 4
+#define FRAMERING_FRAME_MAXLEN (8 * 1024 * 1024)
+#define FRAMERING_MIMETYPE_MAXLEN 64
+#define FRAMERING_NAMELEN 64
+
+// Creates a new ring. The name must start with a slash. The shared
+// memory is removed when the ring is deleted. The memory for the
+// frames is only allocated when it is written.
+framering_t *new_framering(const char *name, int slots, size_t frame_maxlen);
+
+// Attaches a reader to an existing ring.
+framering_t *open_framering(const char *name);
+
+void delete_framering(framering_t *ring);
+
+const char *framering_name(framering_t *ring);
+
+// Writer: returns 1 if readers are attached and one of them called
+// framering_read() in the last three seconds, so that a reader that
+// crashed doesn't keep the streamer copying frames. The streamer only
+// copies its frames into the ring when somebody reads them.
+int framering_has_readers(framering_t *ring);
+
+// Writer: returns -1 if the frame is too large, 0 otherwise.
+int framering_write(framering_t *ring, const char *data, size_t length,
+                    const char *mimetype, double timestamp);
+
+// Reader: the data points into the shared memory.
+typedef int (*framering_onframe_t)(void *userdata, const char *mimetype,
+                                   const char *data, int length,
+                                   double timestamp);
+
+// Reader: waits for the next frame and passes it to the callback.
+// Call it at least every few seconds, with a timeout of a second or
+// so. Returns: RCOM_WAIT_OK, RCOM_WAIT_TIMEOUT, or RCOM_WAIT_ERROR.
+// RCOM_WAIT_ERROR also means that the writer deleted the ring.
+int framering_read(framering_t *ring, double timeout,
+                   framering_onframe_t onframe, void *userdata);
+
+// Reader: the number of frames that were skipped, or that were
+// overwritten before or while the callback used them.
+uint32_t framering_overruns(framering_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _RCOM_FRAMERING_H_
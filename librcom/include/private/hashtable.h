@@ -0,0 +1,74 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef _RCOM_HASHTABLE_H_
+#define _RCOM_HASHTABLE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * hashtable_t
+ *
+ * A simple hash table with open addressing. The keys are arbitrary
+ * byte sequences (strings, addresses, ...) and are copied into the
+ * table. The values are borrowed pointers. The table is not
+ * thread-safe: the caller must either hold a lock or treat the table
+ * as read-only once it is published.
+ */
+typedef struct _hashtable_t hashtable_t;
+
+typedef void (*hashtable_foreach_t)(void *userdata, const void *key,
+                                    int keylen, void *value);
+
+hashtable_t *new_hashtable(int size_hint);
+void delete_hashtable(hashtable_t *table);
+
+// Returns 0 on success, -1 if out of memory. An existing value with
+// the same key is replaced.
+int hashtable_set(hashtable_t *table, const void *key, int keylen, void *value);
+
+// Returns the value, or NULL if the key is not in the table.
+void *hashtable_get(hashtable_t *table, const void *key, int keylen);
+
+// Returns the removed value, or NULL if the key is not in the table.
+void *hashtable_remove(hashtable_t *table, const void *key, int keylen);
+
+int hashtable_size(hashtable_t *table);
+void hashtable_foreach(hashtable_t *table, hashtable_foreach_t callback, void *userdata);
+
+// Convenience functions for zero-terminated string keys.
+int hashtable_set_str(hashtable_t *table, const char *key, void *value);
+void *hashtable_get_str(hashtable_t *table, const char *key);
+void *hashtable_remove_str(hashtable_t *table, const char *key);
+
+uint32_t hash_bytes(const void *key, int keylen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _RCOM_HASHTABLE_H_
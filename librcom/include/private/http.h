@@ -56,12 +56,16 @@ int http_header_set_value(http_header_t *h, const char *value);
 
 const char *http_status_string(int status);
 
+// The Content-Length header is left out if content_length is
+// negative: the body then ends when the connection is closed.
 int http_send_headers(tcp_socket_t socket, int status,
                       const char *mimetype, int content_length);
 int http_send_response(tcp_socket_t socket, response_t* r);
 int http_send_error_headers(tcp_socket_t socket, int status);
 int http_send_streaming_headers(tcp_socket_t socket, const char *mimetype);
 int http_send_chunk(tcp_socket_t socket, const char *data, int datalen);
+int http_send_last_chunk(tcp_socket_t socket);
+int http_send_chunked_response_headers(tcp_socket_t socket, response_t* r);
 
 int http_get(addr_t *addr, const char *resource, response_t **response_handle);
 int http_post(addr_t *addr,
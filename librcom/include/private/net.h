@@ -24,6 +24,8 @@
 #ifndef _RCOM_NET_H_
 #define _RCOM_NET_H_
 
+#include <sys/types.h>
+#include <sys/uio.h>
 #include "data.h"
 #include "addr.h"
 #include "defines.h"
@@ -55,6 +57,50 @@ int udp_socket_wait_data(udp_socket_t socket, int timeout);
 // 0: ok
 int udp_socket_read(udp_socket_t socket, data_t *data, addr_t *addr);
 
+// The maximum number of datagrams handled by a single system call in
+// the batched functions below.
+#define UDP_BATCH_SIZE 64
+
+// Sends the same data to all the addresses, using as few system calls
+// as possible. If failed is not NULL, failed[i] is set to 1 if the
+// data could not be sent to addrs[i], and to 0 otherwise.
+// Returns:
+// -1: the data could not be sent to one or more addresses
+// 0: ok
+int udp_socket_send_many(udp_socket_t socket, addr_t **addrs, int count,
+                         data_t *data, int *failed);
+
+// Reads the datagrams that are available, up to count, without
+// blocking. The sender of data[i] is stored in addrs[i].
+// Returns:
+// -1: error
+// >=0: the number of datagrams read
+int udp_socket_read_many(udp_socket_t socket, data_t **data,
+                         addr_t *addrs, int count);
+
+// Waits until one of the sockets has data available. On return,
+// ready[i] is set to 1 if sockets[i] can be read, and to 0 otherwise.
+// Invalid sockets are skipped.
+// Returns: RCOM_WAIT_OK, RCOM_WAIT_TIMEOUT, or RCOM_WAIT_ERROR
+int udp_socket_wait_any(udp_socket_t *sockets, int count,
+                        int timeout, int *ready);
+
+// Returns 1 if the address is an IPv4 multicast group, 0 otherwise.
+int addr_is_multicast(addr_t *addr);
+
+// Prepares the socket for sending to multicast groups. The datagrams
+// leave through the interface of app_ip() and are looped back to the
+// sockets on the local host that joined the group.
+// Returns:
+// -1: multicast is not available
+// 0: ok
+int udp_socket_set_multicast(udp_socket_t socket, int ttl);
+
+// Opens a socket that is bound to the port of the group and that
+// joins the group on the interface of app_ip(). Several sockets on
+// the same host can join the same group.
+udp_socket_t open_udp_multicast_socket(addr_t *group);
+
 
 
 typedef int tcp_socket_t;
@@ -67,6 +113,20 @@ void close_tcp_socket(tcp_socket_t socket);
 
 int tcp_socket_send(tcp_socket_t socket, const char *data, int len);
 
+// Sends the buffers in a single system call when possible. The iovec
+// array is modified when the data is only partially sent.
+// Returns:
+// -1: error
+// 0: ok
+int tcp_socket_sendv(tcp_socket_t socket, struct iovec *iov, int iovcnt);
+
+// Sends len bytes of the file fd, starting at offset, without copying
+// the data through user space.
+// Returns:
+// -1: error
+// 0: ok
+int tcp_socket_sendfile(tcp_socket_t socket, int fd, off_t offset, size_t len);
+
 // Returns number of bytes read. This number may be smaller than the
 // number of bytes requested (len). In case an error occurs then -1 is
 // returned. In case the socket was shut down, zero is returned.
@@ -54,12 +54,20 @@ typedef struct _registry_entry_t
         char *topic;
         int type;
         addr_t *addr;
+        // The multicast group of a datahub, or NULL. Optional.
+        addr_t *group;
+        // The name of the shared-memory ring through which peers on
+        // the same host can reach the end-point, or NULL. Optional.
+        char *shm;
         void *endpoint;
 } registry_entry_t;
 
 registry_entry_t *new_registry_entry(const char *id, const char *name, const char *topic,
                                      int type, addr_t *addr, void *endpoint);
 void delete_registry_entry(registry_entry_t *entry);
+registry_entry_t *registry_entry_clone(registry_entry_t *entry);
+int registry_entry_set_group(registry_entry_t *entry, addr_t *group);
+int registry_entry_set_shm(registry_entry_t *entry, const char *shm);
 
 // Returns: 0: all ok, -1: invalid name, -2: invalid topic, -3: invalid type, -4: invalid addr, -5: invalid ID
 registry_entry_t *registry_entry_parse(json_object_t obj, int *error);
@@ -91,6 +99,30 @@ list_t *registry_select(registry_t* registry, const char *id, const char *name,
                         const char *topic, int type, addr_t *addr, void *endpoint);
 list_t *registry_select_all(registry_t* registry);
 
+// A view borrows the matching entries instead of cloning them. The
+// registry stays locked for reading until the view is released: the
+// entries must be treated as read-only, and the thread that holds the
+// view must not modify the registry before it releases the view. Nor
+// should it call into the endpoints, which may block: use
+// registry_select() for that.
+#define REGISTRY_VIEW_INLINE 8
+
+typedef struct _registry_view_t {
+        registry_entry_t **entries;
+        int length;
+        // Internal
+        int size;
+        registry_entry_t **allocated;
+        registry_entry_t *inline_entries[REGISTRY_VIEW_INLINE];
+} registry_view_t;
+
+// Returns the number of entries in the view. The view must always be
+// released, even when it is empty.
+int registry_select_view(registry_t* registry, registry_view_t *view,
+                         const char *id, const char *name, const char *topic,
+                         int type, addr_t *addr, void *endpoint);
+void registry_release_view(registry_t* registry, registry_view_t *view);
+
 int registry_count(registry_t* registry, const char *id, const char *name,
                    const char *topic, int type, addr_t *addr, void *endpoint);
 
@@ -99,6 +131,22 @@ int registry_geti(registry_t* registry, int i,
                   int *type, addr_t *addr);
 
 int registry_update_addr(registry_t* registry, const char *id, const char *addr);
+
+// The revision is incremented by each insert, delete, and address
+// update.
+uint64_t registry_revision(registry_t* registry);
+
+// Returns clones of all the entries, and the revision they reflect.
+list_t *registry_snapshot(registry_t* registry, uint64_t *revision);
+
+// Collects the entries that changed after revision 'since': the
+// entries that were inserted or updated, in their current state, and
+// the ids of the entries that were deleted. Each entry is listed only
+// once. Returns -1 if the registry no longer remembers all the
+// changes since that revision, in which case a snapshot is needed.
+int registry_changes(registry_t* registry, uint64_t since, uint64_t *revision,
+                     list_t **entries, list_t **removed);
+void registry_delete_id_list(list_t *list);
 //int registry_update_id(registry_t* registry, int old_id, int new_id);
 
 /**************************************************/
@@ -44,4 +44,15 @@ int response_parse_html(response_t *r, tcp_socket_t socket, int what);
 list_t *response_headers(response_t *r);
 int response_send(response_t *r, tcp_socket_t client_socket);
 
+// Sets the connection used by streaming responses.
+void response_set_socket(response_t *r, tcp_socket_t socket);
+
+// Returns the file descriptor of the body, or -1 if the body is not a
+// file.
+int response_body_fd(response_t *r, off_t *offset, size_t *length);
+
+// Returns the data of the in-memory body: either the region set with
+// response_set_data() or the contents of the body buffer.
+const char *response_body_data(response_t *r, size_t *length);
+
 #endif // _RCOM_RESPONSE_PRIV_H_
@@ -0,0 +1,61 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef _RCOM_SEQWINDOW_H_
+#define _RCOM_SEQWINDOW_H_
+
+#include <stdint.h>
+#include "data.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * seq_window_t
+ *
+ * Tracks the sequence numbers of the packets received from one
+ * sender. The last 64 sequence numbers are remembered in a bit mask so
+ * that duplicates can be told apart from packets that arrive late. A
+ * jump of more than SEQ_WINDOW_RESTART in either direction is taken as
+ * a restart of the sender and resets the window.
+ */
+#define SEQ_WINDOW_RESTART 65536
+
+typedef struct _seq_window_t {
+        int initialized;
+        uint32_t last;          // Highest sequence number received
+        uint64_t window;        // Bit i is set if packet (last - i) was received
+        data_stats_t stats;
+} seq_window_t;
+
+// Updates the window and the statistics with the packet. Returns 1 if
+// the packet is stale, i.e. it is a duplicate or it is older than a
+// packet that was received before, and 0 otherwise.
+int seq_window_update(seq_window_t *seq, data_t *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _RCOM_SEQWINDOW_H_
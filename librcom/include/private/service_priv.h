@@ -36,6 +36,9 @@ service_t *new_service(const char *name, int port);
 
 void delete_service(service_t *service);
 
+// The returned export may be freed once it is replaced by
+// service_export(). The client threads only use it in a read-side
+// section.
 export_t *service_get_export(service_t *service, const char *name);
                 
 #ifdef __cplusplus
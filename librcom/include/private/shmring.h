@@ -0,0 +1,91 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef _RCOM_SHMRING_H_
+#define _RCOM_SHMRING_H_
+
+#include <stdint.h>
+#include "data.h"
+#include "defines.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * shm_ring_t
+ *
+ * A ring of packets in POSIX shared memory, used by a datahub and a
+ * datalink that run on the same host instead of the UDP socket. The
+ * reader creates the ring and publishes its name in the registry.
+ * The writer attaches to it by name.
+ *
+ * There is a single writer and a single reader. The reader first
+ * spins for a short while and then sleeps on a futex in the shared
+ * memory. The writer only makes the wakeup system call when the
+ * reader is asleep. When the ring is full, the packet is dropped, as
+ * it would be by the network.
+ */
+typedef struct _shm_ring_t shm_ring_t;
+
+// The number of packets in a ring, a power of two
+#define SHM_RING_SLOTS 256
+
+// The maximum length of the name, including the terminating zero
+#define SHM_RING_NAMELEN 64
+
+// Creates a new ring. The name must start with a slash. The shared
+// memory is removed when the ring is deleted.
+shm_ring_t *new_shm_ring(const char *name, int slots);
+
+// Attaches to an existing ring.
+shm_ring_t *open_shm_ring(const char *name);
+
+void delete_shm_ring(shm_ring_t *ring);
+
+const char *shm_ring_name(shm_ring_t *ring);
+
+// Returns:
+// -1: the ring is full and the packet was dropped
+// 0: ok
+int shm_ring_write(shm_ring_t *ring, data_t *data);
+
+// Waits until a packet is available. 
+// Returns: RCOM_WAIT_OK, RCOM_WAIT_TIMEOUT, or RCOM_WAIT_ERROR
+int shm_ring_wait(shm_ring_t *ring, double timeout);
+
+// Copies the next packet into data, without blocking.
+// Returns:
+// -1: the packet is invalid and was skipped
+// 0: the ring is empty
+// 1: ok
+int shm_ring_read(shm_ring_t *ring, data_t *data);
+
+// The number of packets dropped because the ring was full
+uint32_t shm_ring_dropped(shm_ring_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _RCOM_SHMRING_H_
@@ -37,4 +37,8 @@ streamer_t *new_streamer(const char *name,
 
 void delete_streamer(streamer_t *streamer);
 
+// The name of the shared-memory frame ring for the streamerlinks on
+// the same host, or NULL.
+const char *streamer_ring_name(streamer_t *streamer);
+
 #endif // _RCOM_STREAMER_PRIV_H_
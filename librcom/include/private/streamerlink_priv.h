@@ -36,7 +36,9 @@ streamerlink_t *new_streamerlink(streamerlink_ondata_t ondata,
         
 void delete_streamerlink(streamerlink_t *link);
 
-int streamerlink_set_remote(streamerlink_t *link, addr_t *addr);
+// The ring is the name of the streamer's frame ring when it runs on
+// the same host, and NULL otherwise.
+int streamerlink_set_remote(streamerlink_t *link, addr_t *addr, const char *ring);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,73 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef _RCOM_CLOCKSYNC_H_
+#define _RCOM_CLOCKSYNC_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Estimates the offset between the clock of a remote node and the
+ * local clock from ping exchanges, in the way NTP does: a request is
+ * sent at local time t0, received at remote time t1, answered at
+ * remote time t2, and the answer is received at local time t3. The
+ * offset of the exchange is ((t1 - t0) + (t2 - t3)) / 2 and its
+ * round-trip delay is (t3 - t0) - (t2 - t1). The estimate uses the
+ * exchange with the smallest delay among the most recent ones. The
+ * skew is fitted on the older exchanges that had a small delay.
+ *
+ * All times are in microseconds, as returned by data_clock_now().
+ */
+
+typedef struct _clock_sync_t clock_sync_t;
+
+typedef struct _clock_offset_t {
+        double offset;  // Remote clock minus local clock, in seconds
+        double delay;   // Round-trip delay of the best exchange, in seconds
+        double skew;    // Drift of the remote clock, in seconds per second
+        int samples;    // Number of exchanges used
+} clock_offset_t;
+
+clock_sync_t *new_clock_sync();
+void delete_clock_sync(clock_sync_t *sync);
+
+void clock_sync_add(clock_sync_t *sync, uint64_t t0, uint64_t t1,
+                    uint64_t t2, uint64_t t3);
+void clock_sync_reset(clock_sync_t *sync);
+
+// Returns -1 if no exchange has been completed yet.
+int clock_sync_get(clock_sync_t *sync, clock_offset_t *offset);
+
+// Converts a timestamp of the remote clock to the local clock. The
+// timestamp is returned unchanged if there is no estimate yet.
+uint64_t clock_sync_to_local(clock_sync_t *sync, uint64_t remote);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _RCOM_CLOCKSYNC_H_
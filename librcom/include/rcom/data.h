@@ -73,6 +73,29 @@ uint32_t data_seqnum(data_t *m);
 //double data_timestamp(data_t *m);
 uint64_t data_timestamp(data_t *m);
 
+/*
+ * The clock used to stamp the data. DATA_CLOCK_REALTIME is the wall
+ * clock (the default). DATA_CLOCK_MONOTONIC follows CLOCK_MONOTONIC
+ * from the moment it is selected, offset so that it still counts the
+ * microseconds since the Unix epoch. It is not affected when NTP steps
+ * the wall clock, so latencies measured with it don't jump. Use a
+ * clock_sync_t (clocksync.h) to relate it to the clock of other hosts.
+ */
+typedef enum _data_clock_t {
+        DATA_CLOCK_REALTIME = 0,
+        DATA_CLOCK_MONOTONIC = 1
+} data_clock_t;
+
+void data_set_clock(data_clock_t clock);
+data_clock_t data_get_clock();
+
+// Current time of the selected clock, in microseconds
+uint64_t data_clock_now();
+
+// Reads CLOCK_MONOTONIC and CLOCK_REALTIME at (nearly) the same
+// instant, in microseconds.
+void data_clock_pair(uint64_t *monotonic, uint64_t *realtime);
+
 void data_set_data(data_t *m, const char *s, int len);
 void data_set_len(data_t *m, int len);
 void data_append_zero(data_t *m);
@@ -81,14 +104,55 @@ int data_printf(data_t *m, const char *format, ...);
 int data_vprintf(data_t *m, const char *format, va_list ap);
 int data_serialise(data_t *m, json_object_t value);
 
-// If parser==NULL, a new parser will be created to parse the data.
+// If parser==NULL, the parser of the calling thread is used (see
+// data_thread_parser). Binary payloads are detected and decoded with data_parse_bin().
 json_object_t data_parse(data_t *m, json_parser_t *parser);
 
+// Returns a parser that is private to the calling thread. It is
+// created on first use and destroyed when the thread exits.
+json_parser_t *data_thread_parser();
+
+// Binary payloads are encoded in CBOR (RFC 8949) and start with the
+// CBOR self-describe tag (0xd9 0xd9 0xf7), which can never start a
+// JSON text. They are typically two to four times smaller than the
+// JSON text for numeric sensor data and are faster to encode and
+// decode. data_serialise_bin() returns -1, without logging an error,
+// if the value does not fit in DATA_MAXLEN bytes.
+int data_is_bin(data_t *m);
+int data_serialise_bin(data_t *m, json_object_t value);
+json_object_t data_parse_bin(data_t *m);
+
+// Fast path for arrays of numbers. The values are copied as a typed
+// array of little-endian doubles. data_parse_array() also accepts
+// plain CBOR arrays of numbers. It returns the number of values, or
+// -1 if the data is not an array of numbers or has more than max
+// values.
+int data_serialise_array(data_t *m, const double *values, int n);
+int data_parse_array(data_t *m, double *values, int max);
+
 packet_t *data_packet(data_t *m);
 void data_clear_timestamp(data_t *m);
 void data_set_timestamp(data_t *m);
+void data_set_timestamp_value(data_t *m, uint64_t timestamp);
 void data_set_seqnum(data_t *m, uint32_t n);
 
+/*
+ * Every packet sent by a datahub or a datalink carries a sequence
+ * number. The receiving end uses them to keep statistics on the data
+ * it receives from the other end. The latency is computed from the
+ * timestamp in the packet and assumes that the clocks of the two hosts
+ * are synchronised.
+ */
+typedef struct _data_stats_t {
+        uint32_t received;      // Number of packets received
+        uint32_t lost;          // Number of packets missing in the sequence
+        uint32_t duplicates;    // Number of packets received more than once
+        uint32_t reordered;     // Number of packets received out of order
+        double latency;         // Smoothed one-way latency, in seconds
+        double latency_min;
+        double latency_max;
+} data_stats_t;
+
 #ifdef __cplusplus
 }
 #endif
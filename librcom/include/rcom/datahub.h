@@ -42,6 +42,52 @@ typedef int (*datahub_ondata_t)(void *userdata,
 typedef int (*datahub_onbroadcast_t)(void *userdata,
                                      datahub_t* hub);
 
+// Called with the messages that were larger than DATA_MAXLEN and had
+// to be sent in fragments. The data remains valid until the callback
+// returns.
+typedef int (*datahub_onmessage_t)(void *userdata,
+                                   datahub_t* hub,
+                                   addr_t *link,
+                                   const char *data,
+                                   int len);
+
+void datahub_set_onmessage(datahub_t* hub, datahub_onmessage_t onmessage);
+
+// Parses the data that was passed to the ondata callback. The hub
+// owns the returned value: it remains valid until the callback returns
+// and must not be unref'ed by the caller. Use json_ref() to keep it
+// longer. This function must only be called from within ondata.
+json_object_t datahub_parse(datahub_t* hub, data_t *data);
+
+// The hub keeps statistics on the packets it receives from each of its
+// links, see data_stats_t. Each link numbers the packets it sends.
+typedef data_stats_t datahub_stats_t;
+
+// Returns 0 and fills in the stats if data was received from the
+// link, and -1 otherwise.
+int datahub_get_stats(datahub_t* hub, addr_t *link, datahub_stats_t *stats);
+
+// If enabled, packets that are duplicates or that arrive after a more
+// recent packet from the same link are not passed to ondata.
+void datahub_set_drop_stale(datahub_t* hub, int enable);
+
+// If enabled, the _obj functions send the values in the compact
+// binary encoding (see data_serialise_bin). The receivers decode both
+// encodings transparently. Values that don't fit in a single packet
+// are still sent as JSON text in fragments.
+void datahub_set_binary(datahub_t* hub, int enable);
+
+// The send and broadcast functions can be called from several threads
+// at once. They format the data in buffers that are private to the
+// calling thread and don't take the hub's lock, so publishers don't
+// wait for each other or for the thread that receives the data.
+
+// Payloads that start with the byte 0xff are reserved: the receivers
+// take them for fragments or clock sync requests. The _bin functions
+// refuse them, and the _message functions send them as fragments.
+// Data passed to datahub_send() and datahub_broadcast() must not start
+// with it either.
+
 // Send to a single remote link
 int datahub_send_num(datahub_t* hub, addr_t *link, double value);
 int datahub_send_str(datahub_t* hub, addr_t *link, const char* value);
@@ -51,6 +97,18 @@ int datahub_send_bin(datahub_t* hub, addr_t *link, const char *data, int len);
 int datahub_send_v(datahub_t* hub, addr_t *link, const char* format, va_list ap);
 int datahub_send(datahub_t* hub, addr_t *link, data_t* data);
 
+// Sends an array of numbers in the binary encoding, regardless of the
+// binary setting (see data_serialise_array). At most
+// (DATA_MAXLEN - 8) / 8 = 176 values fit in a packet.
+int datahub_send_array(datahub_t* hub, addr_t *link, const double *values, int n);
+
+// Messages that do not fit in a data_t are sent in fragments and
+// delivered to the onmessage callback of the receiving hub. Smaller
+// messages are sent as usual and delivered to ondata, unless they
+// start with the reserved byte 0xff. The _obj
+// functions also fall back to fragments for large objects.
+int datahub_send_message(datahub_t* hub, addr_t *link, const char *data, int len);
+
 // Broadcast to all links.
 int datahub_broadcast_num(datahub_t* hub, addr_t *exclude, double value);
 int datahub_broadcast_str(datahub_t* hub, addr_t *exclude, const char* value);
@@ -59,6 +117,8 @@ int datahub_broadcast_obj(datahub_t* hub, addr_t *exclude, json_object_t value);
 int datahub_broadcast_bin(datahub_t* hub, addr_t *exclude, const char *data, int len);
 int datahub_broadcast_v(datahub_t* hub, addr_t *exclude, const char* format, va_list ap);
 int datahub_broadcast(datahub_t* hub, addr_t *exclude, data_t* data);
+int datahub_broadcast_array(datahub_t* hub, addr_t *exclude, const double *values, int n);
+int datahub_broadcast_message(datahub_t* hub, addr_t *exclude, const char *data, int len);
 
 
 #ifdef __cplusplus
@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <r.h>
 #include "data.h"
+#include "clocksync.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -39,7 +40,19 @@ typedef void (*datalink_ondata_t)(void *userdata,
                                   data_t *input,
                                   data_t *output);
 
+// Called by the datalink's thread with the messages that were larger
+// than DATA_MAXLEN and had to be sent in fragments.
+typedef void (*datalink_onmessage_t)(void *userdata,
+                                     datalink_t *datalink,
+                                     const char *data,
+                                     int len);
 
+void datalink_set_onmessage(datalink_t *datalink, datalink_onmessage_t onmessage);
+
+// The data must not start with the byte 0xff. It is reserved for the
+// fragments and the clock sync messages, which the hub doesn't pass to
+// ondata. The same holds for the replies written to the output of
+// datalink_ondata_t.
 int datalink_send(datalink_t *datalink, data_t *data);
 
 // The wait_status value is set to RCOM_WAIT_ERROR, RCOM_WAIT_OK, or
@@ -51,6 +64,41 @@ json_object_t datalink_read_obj(datalink_t *datalink, int timeout);
 int datalink_send_f(datalink_t *datalink, const char *format, ...);
 int datalink_send_obj(datalink_t *datalink, json_object_t obj);
 
+// Sends an array of numbers in the binary encoding (see
+// data_serialise_array).
+int datalink_send_array(datalink_t *datalink, const double *values, int n);
+
+// If enabled, datalink_send_obj() sends the values in the compact
+// binary encoding when they fit in a single packet.
+void datalink_set_binary(datalink_t *datalink, int enable);
+
+// Returns 0 and fills in the statistics of the packets received from
+// the hub (see data_stats_t), or -1 if nothing was received yet. The
+// hub numbers its packets with a single counter for all its links, so
+// the packets that the hub sends to other links count as lost.
+int datalink_get_stats(datalink_t *datalink, data_stats_t *stats);
+
+// If enabled, packets that are duplicates or that arrive after a more
+// recent packet from the hub are not passed to ondata.
+void datalink_set_drop_stale(datalink_t *datalink, int enable);
+
+// Sends the message in fragments if it is larger than DATA_MAXLEN, or
+// if it starts with the reserved byte 0xff.
+int datalink_send_message(datalink_t *datalink, const char *data, int len);
+
+
+// Sends a clock sync request to the remote datahub. The reply is
+// handled by the thread of the link, or by datalink_read(), and
+// updates the estimate of the offset between the hub's clock and the
+// local clock. Call it periodically, e.g. every few seconds.
+int datalink_sync_clock(datalink_t *datalink);
+
+// Returns -1 if no reply has been received yet.
+int datalink_get_clock_offset(datalink_t *datalink, clock_offset_t *offset);
+
+// Converts a timestamp of the remote datahub (see data_timestamp) to
+// the local clock.
+uint64_t datalink_to_local_time(datalink_t *datalink, uint64_t timestamp);
 
 data_t *datalink_get_output(datalink_t* datalink);
 json_object_t datalink_parse(datalink_t *datalink, data_t *data);
@@ -47,17 +47,230 @@ dump_t *dump_create(const char *name,
                     const char *topic,
                     const char *mimetype);
 
+// Creates a dump at the given path instead of in the dumping
+// directory. An existing file is overwritten.
+dump_t *dump_create_file(const char *path,
+                         const char *name,
+                         int type,
+                         const char *topic,
+                         const char *mimetype);
+
+// Used by the hubs to record their traffic. Returns NULL when dumping
+// is off or when the background writer can't be started. Otherwise,
+// creates a dump that is written in the background
+// (see dump_start_writer()), compressed with the codec selected by
+// set_dumping_compression().
+dump_t *dump_start_recording(const char *name,
+                             int type,
+                             const char *topic,
+                             const char *mimetype);
+
 dump_t *dump_open(const char *path);
 
 int dump_type(dump_t *dump);
+const char *dump_name(dump_t *dump);
+const char *dump_topic(dump_t *dump);
+const char *dump_mimetype(dump_t *dump);
 
+// Closes the dump. A dump that was created for writing gets its time
+// index appended first.
 void delete_dump(dump_t *dump);
+
+typedef enum _dump_record_type_t {
+        DUMP_RECORD_DATA = 1,
+        DUMP_RECORD_BUFFER = 2,
+        DUMP_RECORD_MESSAGE = 3,        // A text message of a messagehub
+        DUMP_RECORD_FRAME = 4,          // A frame of a streamer
+        DUMP_RECORD_INDEX = 255
+} dump_record_type_t;
+
+typedef struct _dump_record_t {
+        int type;
+        uint64_t timestamp;     // In microseconds
+        uint32_t len;           // The length of the payload
+} dump_record_t;
+
+int dump_write_record(dump_t *dump, int type, uint64_t timestamp,
+                      const void *data, uint32_t len);
+
+// Reads the next record into the buffer. Returns -1 at the end of the
+// dump, or if the buffer is too small, in which case the position in
+// the dump doesn't change.
+int dump_read_record(dump_t *dump, dump_record_t *record,
+                     void *buffer, uint32_t len);
+
+// Writes the data with its own timestamp, or the current time if it
+// has none.
 int dump_write_data(dump_t *dump, data_t *data);
 int dump_read_data(dump_t *dump, data_t *data);
 
+// Returns the length of the buffer that was read, or -1.
 int dump_write_buffer(dump_t *dump, char *data, uint32_t len);
 int dump_read_buffer(dump_t *dump, char *data, uint32_t len);
 
+// Returns the header of the next record without advancing.
+int dump_peek_record(dump_t *dump, dump_record_t *record);
+
+// Writes a message record, timestamped with the current time.
+int dump_write_message(dump_t *dump, const char *data, int len);
+
+// Writes a frame record, timestamped with the current time. The
+// payload of the record holds the stream time as a big-endian double,
+// the mimetype, terminated by a zero, and the data.
+int dump_write_frame(dump_t *dump, const char *data, int len,
+                     const char *mimetype, double time);
+
+// Splits the payload of a frame record. The pointers point into the
+// payload.
+int dump_parse_frame(const void *payload, uint32_t len,
+                     const char **mimetype, double *time,
+                     const char **data, uint32_t *data_len);
+
+// The number of records and the timestamps of the first and last
+// records in a dump opened for reading.
+uint64_t dump_count(dump_t *dump);
+int dump_time_range(dump_t *dump, uint64_t *first, uint64_t *last);
+
+// Positions the dump on the first record with a timestamp equal to or
+// later than the given time, using the index. Returns -1 if there is
+// no such record.
+int dump_seek_time(dump_t *dump, uint64_t timestamp);
+
+// Positions the dump on the n-th record (0 is the first one).
+// Seeking to dump_count() positions the dump at the end.
+int dump_seek_record(dump_t *dump, uint64_t n);
+
+// Compresses the records of a dump created with dump_create() in
+// blocks. Must be called before the first record is written and
+// before the writer is started. The level is only used by zstd; 0
+// selects its default.
+enum {
+        DUMP_COMPRESSION_NONE = 0,
+        DUMP_COMPRESSION_LZ4 = 1,
+        DUMP_COMPRESSION_ZSTD = 2
+};
+
+int dump_set_compression(dump_t *dump, int codec, int level);
+
+// Selects the compression of the dumps created by
+// dump_start_recording(). Returns -1 if the codec is not available.
+int set_dumping_compression(int codec, int level);
+
+/*
+ * By default, the records are written to the file by the thread that
+ * calls dump_write_record() and its variants. After
+ * dump_start_writer(), they are queued and written by a background
+ * thread instead, and the write functions never wait for the disk.
+ * They can then also be called from several threads at once. When the
+ * queued records use up the memory budget, new records are dropped
+ * and the write functions return -1. delete_dump() writes the queued
+ * records before closing the file. If a write fails, the writer stops
+ * and drops the later records. delete_dump() then reports the error
+ * and leaves out the index, so that the readers only find the records
+ * that made it to the file.
+ */
+typedef enum _dump_sync_t {
+        DUMP_SYNC_NONE,         // Leave it to the operating system
+        DUMP_SYNC_BATCH,        // fdatasync() after each write
+        DUMP_SYNC_PERIODIC      // fdatasync() every sync_period seconds
+} dump_sync_t;
+
+typedef struct _dump_writer_options_t {
+        size_t buffer_size;     // The size of the writes, rounded to 4 kB
+        size_t memory_budget;   // The maximum size of the queued records
+        int direct;             // Bypass the page cache with O_DIRECT
+        int sync;
+        double sync_period;
+} dump_writer_options_t;
+
+typedef struct _dump_writer_stats_t {
+        uint64_t records;       // Number of records written
+        uint64_t bytes;
+        uint64_t writes;        // Number of write system calls
+        uint64_t dropped;       // Number of records dropped
+        uint64_t dropped_bytes;
+        uint64_t pending;       // Memory used by the queued records
+        uint64_t max_pending;
+        int failed;             // Set when a write failed. The writer
+                                // then stops and drops the records.
+} dump_writer_stats_t;
+
+// Sets the defaults: 1 MB writes, a 16 MB budget, no O_DIRECT, no sync.
+void dump_writer_options_init(dump_writer_options_t *options);
+
+// Starts the background writer of a dump created with dump_create().
+// The options can be NULL.
+int dump_start_writer(dump_t *dump, const dump_writer_options_t *options);
+
+int dump_get_writer_stats(dump_t *dump, dump_writer_stats_t *stats);
+
+/*
+ * The memory-mapped reader gives access to the records of a dump
+ * without copying them. The views point into the mapping and remain
+ * valid until the map is closed. A map can be read by several threads
+ * at once, each with its own cursor.
+ *
+ * The records of a compressed dump are decompressed one block at a
+ * time into a buffer of the cursor. Their views remain valid until the
+ * next call with the same cursor. The buffer is freed with
+ * dump_mmap_cursor_release(), which must be called before the cursor
+ * is discarded or initialised again.
+ */
+typedef struct _dump_map_t dump_map_t;
+
+typedef struct _dump_view_t {
+        int type;
+        uint64_t timestamp;
+        uint64_t record;
+        uint32_t len;
+        // For data records, the data packet, including its header
+        const unsigned char *data;
+} dump_view_t;
+
+typedef struct _dump_cursor_t {
+        dump_map_t *map;
+        uint64_t record;
+        uint64_t offset;
+        uint64_t end;
+        // The decompressed block of a compressed dump
+        unsigned char *block;
+        uint32_t block_size;
+        uint32_t block_len;
+        uint32_t block_pos;
+        uint64_t block_offset;
+} dump_cursor_t;
+
+dump_map_t *dump_mmap_open(const char *path);
+void dump_mmap_close(dump_map_t *map);
+
+// The dump that holds the header and the index of the map. It must
+// not be read from or closed.
+dump_t *dump_mmap_dump(dump_map_t *map);
+
+// Initialises the cursor on the first record.
+void dump_mmap_cursor(dump_map_t *map, dump_cursor_t *cursor);
+
+void dump_mmap_cursor_release(dump_cursor_t *cursor);
+
+// Initialises the cursor on one of the given number of disjoint
+// ranges that together cover all the records. The ranges are split
+// along the index and have a similar number of records. A range can
+// be empty.
+int dump_mmap_partition(dump_map_t *map, int part, int parts,
+                        dump_cursor_t *cursor);
+
+// Initialises the cursor on the first record with a timestamp equal
+// to or later than the given time.
+int dump_mmap_seek_time(dump_map_t *map, uint64_t timestamp,
+                        dump_cursor_t *cursor);
+
+// Returns the record under the cursor and advances the cursor, or
+// returns -1 at the end of the range.
+int dump_mmap_next(dump_cursor_t *cursor, dump_view_t *view);
+
+// The payload of a data record, without the packet header.
+int dump_view_payload(dump_view_t *view, const char **data, uint32_t *len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -25,6 +25,7 @@
 #define _RCOM_MESSAGELINK_H_
 
 #include <r.h>
+#include "clocksync.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -70,6 +71,18 @@ json_object_t messagelink_send_command_f(messagelink_t *link, const char *format
 json_object_t messagelink_send_command(messagelink_t *link, json_object_t command);
 
 int messagelink_is_connected(messagelink_t *link);
+
+// Sends a clock sync request in a websocket ping. The remote
+// messagelink answers with its timestamps, which update the estimate
+// of the offset between its clock and the local clock. The reply is
+// handled by the thread that reads the messages of the link.
+int messagelink_sync_clock(messagelink_t *link);
+
+// Returns -1 if no reply has been received yet.
+int messagelink_get_clock_offset(messagelink_t *link, clock_offset_t *offset);
+
+// Converts a timestamp of the remote node to the local clock.
+uint64_t messagelink_to_local_time(messagelink_t *link, uint64_t timestamp);
         
 #ifdef __cplusplus
 }
@@ -27,6 +27,7 @@
 #include <app.h>
 #include <addr.h>
 #include <data.h>
+#include <clocksync.h>
 #include <circular.h>
 #include <request.h>
 #include <response.h>
@@ -41,6 +42,7 @@
 #include <streamerlink.h>
 #include <multipart_parser.h>
 #include <dump.h>
+#include <replay.h>
 #include <util.h>
 
 #endif // _RCOM_H_
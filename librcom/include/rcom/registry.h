@@ -55,6 +55,18 @@ datahub_t *registry_open_datahub(const char *name,
                                  datahub_ondata_t ondata,
                                  void* userdata);
 
+// Same as above but the hub broadcasts its data once to the given
+// multicast group (for example 239.255.42.1:10201) and the datalinks
+// on the topic join the group. When multicast is not available, the
+// hub falls back to sending the data to each datalink. The hub also
+// keeps sending the data to the datalinks that couldn't join.
+datahub_t *registry_open_datahub_multicast(const char *name,
+                                           const char *topic,
+                                           addr_t *group,
+                                           datahub_onbroadcast_t onbroadcast,
+                                           datahub_ondata_t ondata,
+                                           void* userdata);
+
 void registry_close_datahub(datahub_t *hub);
 
 
@@ -0,0 +1,89 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef _RCOM_REPLAY_H_
+#define _RCOM_REPLAY_H_
+
+#include "dump.h"
+#include "datahub.h"
+#include "messagehub.h"
+#include "streamer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The replay engine reads one or more dumps, merges their records by
+ * timestamp, and passes them on to the hub they were recorded from.
+ * The speed sets the pacing: 1 replays in real time, 20 replays twenty
+ * times faster, and 0 replays as fast as possible.
+ */
+typedef struct _replay_t replay_t;
+
+// Called for each record of a dump added with replay_add(). The
+// payload remains valid until the callback returns.
+typedef int (*replay_onrecord_t)(void *userdata,
+                                 dump_t *dump,
+                                 dump_record_t *record,
+                                 const void *payload);
+
+typedef struct _replay_stats_t {
+        uint64_t records;       // Number of records replayed
+        uint64_t late;          // Number of records replayed late
+        double max_lateness;    // In seconds
+} replay_stats_t;
+
+replay_t *new_replay();
+void delete_replay(replay_t *replay);
+
+void replay_set_speed(replay_t *replay, double speed);
+
+// Only replays the records with a timestamp in [start, end). Zero
+// means no limit.
+void replay_set_range(replay_t *replay, uint64_t start, uint64_t end);
+
+// The data records are broadcast by the datahub.
+int replay_add_datahub(replay_t *replay, const char *path, datahub_t *hub);
+
+// The message records are broadcast by the messagehub.
+int replay_add_messagehub(replay_t *replay, const char *path, messagehub_t *hub);
+
+// The frame records are sent by the streamer.
+int replay_add_streamer(replay_t *replay, const char *path, streamer_t *streamer);
+
+int replay_add(replay_t *replay, const char *path,
+               replay_onrecord_t onrecord, void *userdata);
+
+// Replays the dumps. Returns when all the records were replayed, or
+// when replay_stop() is called from another thread.
+int replay_run(replay_t *replay);
+void replay_stop(replay_t *replay);
+
+void replay_get_stats(replay_t *replay, replay_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _RCOM_REPLAY_H_
@@ -24,6 +24,7 @@
 #ifndef _RCOM_RESPONSE_H_
 #define _RCOM_RESPONSE_H_
 
+#include <sys/types.h>
 #include <r.h>
 
 #ifdef __cplusplus
@@ -96,6 +97,31 @@ int response_append(response_t *r, const char *data, int len);
 int response_json(response_t *r, json_object_t obj);
 int response_printf(response_t *r, const char *format, ...);
 
+// Switches the response to streaming mode. The headers are sent with
+// "Transfer-Encoding: chunked" on the first flush, and the data
+// written to the body is sent as a chunk whenever the buffer grows
+// larger than RESPONSE_CHUNK_SIZE or response_flush() is called. This
+// can only be used in the request handler of a service export.
+#define RESPONSE_CHUNK_SIZE (64 * 1024)
+
+int response_set_streaming(response_t *r);
+int response_flush(response_t *r);
+
+// The functions below replace the body buffer with a body that is
+// sent as is, without being copied into the response. 
+
+// Sends the file with sendfile(). The Content-Type is derived from
+// the filename if it has not been set.
+int response_set_file(response_t *r, const char *path);
+
+// Sends length bytes of the file descriptor, starting at offset. The
+// response takes ownership of the file descriptor and closes it.
+int response_set_fd(response_t *r, int fd, off_t offset, size_t length);
+
+// Sends the memory region, for example a mapped file. The region is
+// not copied and must remain valid until the response is sent.
+int response_set_data(response_t *r, const void *data, size_t length);
+
 // For debugging
 int response_dumpto(response_t *r, const char *file);
 FILE *response_dumpfile(response_t *r);
@@ -35,6 +35,17 @@ typedef int (*streamerlink_ondata_t)(void *userdata, response_t *response,
                                      const char *buf, int len);
 typedef int (*streamerlink_onresponse_t)(void *userdata, response_t *response);
 
+// Called with the frames of a streamer that runs on the same host.
+// The data points into shared memory and is valid until the callback
+// returns. The timestamp is the value sent as X-LT-Timestamp over
+// HTTP. When set, the link reads the frames of a co-located streamer
+// this way instead of through HTTP.
+typedef int (*streamerlink_onframe_t)(void *userdata, const char *mimetype,
+                                      const char *data, int len,
+                                      double timestamp);
+
+void streamerlink_set_onframe(streamerlink_t *link, streamerlink_onframe_t onframe);
+
 addr_t *streamerlink_addr(streamerlink_t *link);
 int streamerlink_connect(streamerlink_t *link);
 int streamerlink_disconnect(streamerlink_t *link);
@@ -0,0 +1,542 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <r.h>
+#include "cbor.h"
+
+const unsigned char cbor_magic[CBOR_MAGIC_LEN] = { 0xd9, 0xd9, 0xf7 };
+
+enum {
+        CBOR_UINT = 0,
+        CBOR_NEGINT = 1,
+        CBOR_BYTES = 2,
+        CBOR_TEXT = 3,
+        CBOR_ARRAY = 4,
+        CBOR_MAP = 5,
+        CBOR_TAG = 6,
+        CBOR_SIMPLE = 7
+};
+
+#define CBOR_FALSE 0xf4
+#define CBOR_TRUE 0xf5
+#define CBOR_NULL 0xf6
+#define CBOR_FLOAT16 0xf9
+#define CBOR_FLOAT32 0xfa
+#define CBOR_FLOAT64 0xfb
+#define CBOR_BREAK 0xff
+#define CBOR_INDEFINITE 31
+
+#define CBOR_TAG_SELF_DESCRIBE 55799
+#define CBOR_TAG_FLOAT64_LE 86
+
+// Protects against stack exhaustion on malicious input
+#define CBOR_MAX_DEPTH 32
+
+/**************************************************************/
+
+typedef struct _cbor_writer_t {
+        unsigned char *p;
+        int len;
+        int max;
+} cbor_writer_t;
+
+static int cbor_put(cbor_writer_t *w, const void *data, int n)
+{
+        if (w->len + n > w->max)
+                return -1;
+        memcpy(w->p + w->len, data, n);
+        w->len += n;
+        return 0;
+}
+
+static int cbor_put_byte(cbor_writer_t *w, unsigned char c)
+{
+        return cbor_put(w, &c, 1);
+}
+
+static int cbor_put_head(cbor_writer_t *w, int major, uint64_t value)
+{
+        unsigned char b[9];
+        int n;
+        
+        b[0] = (unsigned char) (major << 5);
+        if (value < 24) {
+                b[0] |= (unsigned char) value;
+                n = 1;
+        } else if (value <= 0xff) {
+                b[0] |= 24;
+                n = 2;
+        } else if (value <= 0xffff) {
+                b[0] |= 25;
+                n = 3;
+        } else if (value <= 0xffffffff) {
+                b[0] |= 26;
+                n = 5;
+        } else {
+                b[0] |= 27;
+                n = 9;
+        }
+        for (int i = n - 1; i > 0; i--) {
+                b[i] = (unsigned char) value;
+                value >>= 8;
+        }
+        return cbor_put(w, b, n);
+}
+
+static int cbor_put_number(cbor_writer_t *w, double v)
+{
+        unsigned char b[9];
+        
+        if (v == floor(v) && !signbit(v) && v <= 4294967295.0)
+                return cbor_put_head(w, CBOR_UINT, (uint64_t) v);
+        if (v == floor(v) && v < 0 && v >= -4294967296.0)
+                return cbor_put_head(w, CBOR_NEGINT, (uint64_t) (-1.0 - v));
+        
+        float f = (float) v;
+        if ((double) f == v || isnan(v)) {
+                uint32_t u;
+                memcpy(&u, &f, 4);
+                b[0] = CBOR_FLOAT32;
+                for (int i = 4; i > 0; i--, u >>= 8)
+                        b[i] = (unsigned char) u;
+                return cbor_put(w, b, 5);
+        } else {
+                uint64_t u;
+                memcpy(&u, &v, 8);
+                b[0] = CBOR_FLOAT64;
+                for (int i = 8; i > 0; i--, u >>= 8)
+                        b[i] = (unsigned char) u;
+                return cbor_put(w, b, 9);
+        }
+}
+
+static int cbor_put_text(cbor_writer_t *w, const char *s, int len)
+{
+        if (cbor_put_head(w, CBOR_TEXT, (uint64_t) len) != 0)
+                return -1;
+        return cbor_put(w, s, len);
+}
+
+static int cbor_put_value(cbor_writer_t *w, json_object_t value, int depth);
+
+typedef struct _cbor_member_t {
+        cbor_writer_t *w;
+        int depth;
+        int err;
+} cbor_member_t;
+
+static int32_t cbor_put_member(const char* key, json_object_t value, void *data)
+{
+        cbor_member_t *m = (cbor_member_t *) data;
+        if (m->err == 0) {
+                if (cbor_put_text(m->w, key, (int) strlen(key)) != 0
+                    || cbor_put_value(m->w, value, m->depth) != 0)
+                        m->err = -1;
+        }
+        return 0;
+}
+
+static int cbor_put_value(cbor_writer_t *w, json_object_t value, int depth)
+{
+        if (depth > CBOR_MAX_DEPTH)
+                return -1;
+        
+        if (json_isnull(value)) {
+                return cbor_put_byte(w, CBOR_NULL);
+        } else if (json_istrue(value)) {
+                return cbor_put_byte(w, CBOR_TRUE);
+        } else if (json_isfalse(value)) {
+                return cbor_put_byte(w, CBOR_FALSE);
+        } else if (json_isnumber(value)) {
+                return cbor_put_number(w, json_number_value(value));
+        } else if (json_isstring(value)) {
+                return cbor_put_text(w, json_string_value(value),
+                                     json_string_length(value));
+        } else if (json_isarray(value)) {
+                int n = json_array_length(value);
+                if (cbor_put_head(w, CBOR_ARRAY, (uint64_t) n) != 0)
+                        return -1;
+                for (int i = 0; i < n; i++)
+                        if (cbor_put_value(w, json_array_get(value, i), depth + 1) != 0)
+                                return -1;
+                return 0;
+        } else if (json_isobject(value)) {
+                // Use an indefinite-length map so that the members are
+                // only visited once.
+                cbor_member_t m = { w, depth + 1, 0 };
+                if (cbor_put_byte(w, (CBOR_MAP << 5) | CBOR_INDEFINITE) != 0)
+                        return -1;
+                json_object_foreach(value, cbor_put_member, &m);
+                if (m.err != 0)
+                        return -1;
+                return cbor_put_byte(w, CBOR_BREAK);
+        }
+        return -1;
+}
+
+int cbor_encode(json_object_t value, unsigned char *buf, int len)
+{
+        cbor_writer_t w = { buf, 0, len };
+        if (cbor_put_value(&w, value, 0) != 0)
+                return -1;
+        return w.len;
+}
+
+int cbor_encode_array(const double *values, int n, unsigned char *buf, int len)
+{
+        cbor_writer_t w = { buf, 0, len };
+        int size;
+        
+        if (n < 0 || n > len / (int) sizeof(double))
+                return -1;
+        size = n * (int) sizeof(double);
+        
+        if (cbor_put_head(&w, CBOR_TAG, CBOR_TAG_FLOAT64_LE) != 0
+            || cbor_put_head(&w, CBOR_BYTES, (uint64_t) size) != 0
+            || w.len + size > w.max)
+                return -1;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        memcpy(w.p + w.len, values, size);
+#else
+        for (int i = 0; i < n; i++) {
+                uint64_t u;
+                memcpy(&u, &values[i], 8);
+                u = __builtin_bswap64(u);
+                memcpy(w.p + w.len + 8 * i, &u, 8);
+        }
+#endif
+        return w.len + size;
+}
+
+/**************************************************************/
+
+typedef struct _cbor_reader_t {
+        const unsigned char *p;
+        int len;
+        int pos;
+} cbor_reader_t;
+
+// Reads the initial byte and the argument of a data item. For the
+// simple values and the floats, the argument holds the raw bits.
+static int cbor_get_head(cbor_reader_t *r, int *major, int *info, uint64_t *value)
+{
+        int n;
+        
+        if (r->pos >= r->len)
+                return -1;
+        
+        *major = r->p[r->pos] >> 5;
+        *info = r->p[r->pos] & 0x1f;
+        r->pos++;
+        
+        if (*info < 24) {
+                *value = (uint64_t) *info;
+                return 0;
+        } else if (*info == CBOR_INDEFINITE) {
+                // Only the strings, arrays, and maps can have an
+                // indefinite length
+                if (*major < CBOR_BYTES || *major > CBOR_MAP)
+                        return -1;
+                *value = 0;
+                return 0;
+        } else if (*info > 27) {
+                return -1;
+        }
+
+        n = 1 << (*info - 24);
+        if (r->pos + n > r->len)
+                return -1;
+        *value = 0;
+        for (int i = 0; i < n; i++)
+                *value = (*value << 8) | r->p[r->pos++];
+        return 0;
+}
+
+static int cbor_at_break(cbor_reader_t *r)
+{
+        if (r->pos < r->len && r->p[r->pos] == CBOR_BREAK) {
+                r->pos++;
+                return 1;
+        }
+        return 0;
+}
+
+static double cbor_half_to_double(uint16_t h)
+{
+        int exp = (h >> 10) & 0x1f;
+        int mant = h & 0x3ff;
+        double v;
+        
+        if (exp == 0)
+                v = ldexp(mant, -24);
+        else if (exp != 31)
+                v = ldexp(mant + 1024, exp - 25);
+        else
+                v = (mant == 0)? INFINITY : NAN;
+        return (h & 0x8000)? -v : v;
+}
+
+// Decodes a number. Returns -1 if the item is not a number.
+static int cbor_get_number(int major, int info, uint64_t value, double *v)
+{
+        if (major == CBOR_UINT) {
+                *v = (double) value;
+        } else if (major == CBOR_NEGINT) {
+                *v = -1.0 - (double) value;
+        } else if (major == CBOR_SIMPLE && info == 25) {
+                *v = cbor_half_to_double((uint16_t) value);
+        } else if (major == CBOR_SIMPLE && info == 26) {
+                uint32_t u = (uint32_t) value;
+                float f;
+                memcpy(&f, &u, 4);
+                *v = f;
+        } else if (major == CBOR_SIMPLE && info == 27) {
+                memcpy(v, &value, 8);
+        } else {
+                return -1;
+        }
+        return 0;
+}
+
+static int cbor_get_typed_array(cbor_reader_t *r, const unsigned char **data, int *count)
+{
+        int major, info;
+        uint64_t size;
+        
+        if (cbor_get_head(r, &major, &info, &size) != 0
+            || major != CBOR_BYTES || info == CBOR_INDEFINITE
+            || size % 8 != 0 || size > (uint64_t) (r->len - r->pos))
+                return -1;
+        *data = r->p + r->pos;
+        *count = (int) (size / 8);
+        r->pos += (int) size;
+        return 0;
+}
+
+static double cbor_typed_array_get(const unsigned char *data, int i)
+{
+        uint64_t u;
+        double v;
+        memcpy(&u, data + 8 * i, 8);
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+        u = __builtin_bswap64(u);
+#endif
+        memcpy(&v, &u, 8);
+        return v;
+}
+
+static json_object_t cbor_get_value(cbor_reader_t *r, int depth, int *err);
+
+static json_object_t cbor_get_text(cbor_reader_t *r, uint64_t len, int *err)
+{
+        char buffer[256];
+        char *s = buffer;
+        json_object_t obj;
+        
+        if (len > (uint64_t) (r->len - r->pos)) {
+                *err = -1;
+                return json_null();
+        }
+        if (len >= sizeof(buffer)) {
+                s = r_alloc(len + 1);
+                if (s == NULL) {
+                        *err = -1;
+                        return json_null();
+                }
+        }
+        memcpy(s, r->p + r->pos, len);
+        s[len] = 0;
+        r->pos += (int) len;
+        
+        obj = json_string_create(s);
+        if (s != buffer)
+                r_free(s);
+        return obj;
+}
+
+static json_object_t cbor_get_array(cbor_reader_t *r, int info, uint64_t n,
+                                    int depth, int *err)
+{
+        json_object_t array = json_array_create();
+        
+        for (uint64_t i = 0; *err == 0; i++) {
+                if (info == CBOR_INDEFINITE) {
+                        if (cbor_at_break(r))
+                                break;
+                } else if (i == n) {
+                        break;
+                }
+                json_object_t v = cbor_get_value(r, depth + 1, err);
+                json_array_push(array, v);
+                json_unref(v);
+        }
+        return array;
+}
+
+static json_object_t cbor_get_map(cbor_reader_t *r, int info, uint64_t n,
+                                  int depth, int *err)
+{
+        json_object_t object = json_object_create();
+        
+        for (uint64_t i = 0; *err == 0; i++) {
+                if (info == CBOR_INDEFINITE) {
+                        if (cbor_at_break(r))
+                                break;
+                } else if (i == n) {
+                        break;
+                }
+                json_object_t key = cbor_get_value(r, depth + 1, err);
+                if (*err != 0 || !json_isstring(key)) {
+                        json_unref(key);
+                        *err = -1;
+                        break;
+                }
+                json_object_t v = cbor_get_value(r, depth + 1, err);
+                json_object_set(object, json_string_value(key), v);
+                json_unref(key);
+                json_unref(v);
+        }
+        return object;
+}
+
+static json_object_t cbor_get_value(cbor_reader_t *r, int depth, int *err)
+{
+        int major, info;
+        uint64_t value;
+        double number;
+        
+        if (depth > CBOR_MAX_DEPTH || cbor_get_head(r, &major, &info, &value) != 0) {
+                *err = -1;
+                return json_null();
+        }
+
+        switch (major) {
+        case CBOR_TEXT:
+                if (info == CBOR_INDEFINITE)
+                        break;
+                return cbor_get_text(r, value, err);
+        case CBOR_ARRAY:
+                return cbor_get_array(r, info, value, depth, err);
+        case CBOR_MAP:
+                return cbor_get_map(r, info, value, depth, err);
+        case CBOR_TAG:
+                if (value == CBOR_TAG_SELF_DESCRIBE)
+                        return cbor_get_value(r, depth + 1, err);
+                if (value == CBOR_TAG_FLOAT64_LE) {
+                        const unsigned char *data;
+                        int count;
+                        if (cbor_get_typed_array(r, &data, &count) != 0)
+                                break;
+                        json_object_t array = json_array_create();
+                        for (int i = 0; i < count; i++) {
+                                json_object_t v = json_number_create(
+                                        cbor_typed_array_get(data, i));
+                                json_array_push(array, v);
+                                json_unref(v);
+                        }
+                        return array;
+                }
+                break;
+        case CBOR_SIMPLE:
+                if (info == (CBOR_NULL & 0x1f))
+                        return json_null();
+                if (info == (CBOR_TRUE & 0x1f))
+                        return json_true();
+                if (info == (CBOR_FALSE & 0x1f))
+                        return json_false();
+                if (cbor_get_number(major, info, value, &number) == 0)
+                        return json_number_create(number);
+                break;
+        default:
+                if (cbor_get_number(major, info, value, &number) == 0)
+                        return json_number_create(number);
+                break;
+        }
+        
+        *err = -1;
+        return json_null();
+}
+
+json_object_t cbor_decode(const unsigned char *buf, int len, int *error)
+{
+        cbor_reader_t r = { buf, len, 0 };
+        int err = 0;
+        json_object_t value = cbor_get_value(&r, 0, &err);
+        if (err != 0) {
+                json_unref(value);
+                value = json_null();
+        }
+        if (error != NULL)
+                *error = err;
+        return value;
+}
+
+int cbor_decode_array(const unsigned char *buf, int len, double *values, int max)
+{
+        cbor_reader_t r = { buf, len, 0 };
+        int major, info;
+        uint64_t value;
+        int count = 0;
+
+        do {
+                if (cbor_get_head(&r, &major, &info, &value) != 0)
+                        return -1;
+        } while (major == CBOR_TAG && value == CBOR_TAG_SELF_DESCRIBE);
+
+        if (major == CBOR_TAG && value == CBOR_TAG_FLOAT64_LE) {
+                const unsigned char *data;
+                if (cbor_get_typed_array(&r, &data, &count) != 0 || count > max)
+                        return -1;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                memcpy(values, data, count * sizeof(double));
+#else
+                for (int i = 0; i < count; i++)
+                        values[i] = cbor_typed_array_get(data, i);
+#endif
+                return count;
+        }
+
+        if (major != CBOR_ARRAY)
+                return -1;
+        
+        for (uint64_t i = 0; ; i++) {
+                int m, inf;
+                uint64_t v;
+                if (info == CBOR_INDEFINITE) {
+                        if (cbor_at_break(&r))
+                                break;
+                } else if (i == value) {
+                        break;
+                }
+                if (count == max
+                    || cbor_get_head(&r, &m, &inf, &v) != 0
+                    || cbor_get_number(m, inf, v, &values[count]) != 0)
+                        return -1;
+                count++;
+        }
+        return count;
+}
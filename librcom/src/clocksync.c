@@ -0,0 +1,248 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#include <string.h>
+#include <r.h>
+#include "data.h"
+#include "clocksync_priv.h"
+
+// The number of exchanges that are kept
+#define CLOCK_SYNC_SAMPLES 32
+
+// The offset is taken from the best of the most recent exchanges
+#define CLOCK_SYNC_FILTER 8
+
+// The skew is only estimated when the exchanges span at least 10 s
+#define CLOCK_SYNC_MIN_SPAN 10000000.0
+
+typedef struct _clock_sample_t {
+        uint64_t local;
+        int64_t offset;
+        int64_t delay;
+} clock_sample_t;
+
+struct _clock_sync_t {
+        mutex_t *mutex;
+        clock_sample_t samples[CLOCK_SYNC_SAMPLES];
+        int count;
+        int next;
+};
+
+clock_sync_t *new_clock_sync()
+{
+        clock_sync_t *sync = r_new(clock_sync_t);
+        sync->mutex = new_mutex();
+        return sync;
+}
+
+void delete_clock_sync(clock_sync_t *sync)
+{
+        if (sync) {
+                delete_mutex(sync->mutex);
+                r_delete(sync);
+        }
+}
+
+void clock_sync_add(clock_sync_t *sync, uint64_t t0, uint64_t t1,
+                    uint64_t t2, uint64_t t3)
+{
+        clock_sample_t *s;
+        int64_t a = (int64_t) (t1 - t0);
+        int64_t b = (int64_t) (t2 - t3);
+        int64_t delay = (int64_t) (t3 - t0) - (int64_t) (t2 - t1);
+
+        mutex_lock(sync->mutex);
+        s = &sync->samples[sync->next];
+        s->local = t3;
+        s->offset = (a + b) / 2;
+        s->delay = (delay < 0)? 0 : delay;
+        sync->next = (sync->next + 1) % CLOCK_SYNC_SAMPLES;
+        if (sync->count < CLOCK_SYNC_SAMPLES)
+                sync->count++;
+        mutex_unlock(sync->mutex);
+}
+
+void clock_sync_reset(clock_sync_t *sync)
+{
+        mutex_lock(sync->mutex);
+        sync->count = 0;
+        sync->next = 0;
+        mutex_unlock(sync->mutex);
+}
+
+static clock_sample_t *clock_sync_sample(clock_sync_t *sync, int age)
+{
+        int i = (sync->next - 1 - age + CLOCK_SYNC_SAMPLES) % CLOCK_SYNC_SAMPLES;
+        return &sync->samples[i];
+}
+
+// Fits offset = best->offset + skew * (local - best->local) on the
+// exchanges whose delay is close to the smallest one.
+static double clock_sync_skew(clock_sync_t *sync, clock_sample_t *best,
+                              int64_t min_delay)
+{
+        double sxx = 0.0, sxy = 0.0;
+        double first = 0.0, last = 0.0;
+        int n = 0;
+        
+        for (int age = 0; age < sync->count; age++) {
+                clock_sample_t *s = clock_sync_sample(sync, age);
+                if (s->delay > 2 * min_delay + 1000)
+                        continue;
+                double x = (double) (int64_t) (s->local - best->local);
+                double y = (double) (s->offset - best->offset);
+                sxx += x * x;
+                sxy += x * y;
+                if (n == 0 || x < first)
+                        first = x;
+                if (n == 0 || x > last)
+                        last = x;
+                n++;
+        }
+        
+        if (n < 2 || last - first < CLOCK_SYNC_MIN_SPAN || sxx == 0.0)
+                return 0.0;
+        return sxy / sxx;
+}
+
+static int clock_sync_estimate(clock_sync_t *sync, clock_sample_t *best,
+                               double *skew)
+{
+        int64_t min_delay;
+        
+        if (sync->count == 0)
+                return -1;
+
+        *best = *clock_sync_sample(sync, 0);
+        for (int age = 1; age < sync->count && age < CLOCK_SYNC_FILTER; age++) {
+                clock_sample_t *s = clock_sync_sample(sync, age);
+                if (s->delay < best->delay)
+                        *best = *s;
+        }
+        
+        min_delay = best->delay;
+        for (int age = 0; age < sync->count; age++) {
+                clock_sample_t *s = clock_sync_sample(sync, age);
+                if (s->delay < min_delay)
+                        min_delay = s->delay;
+        }
+
+        *skew = clock_sync_skew(sync, best, min_delay);
+        return 0;
+}
+
+int clock_sync_get(clock_sync_t *sync, clock_offset_t *offset)
+{
+        clock_sample_t best;
+        double skew;
+        int err;
+        
+        mutex_lock(sync->mutex);
+        err = clock_sync_estimate(sync, &best, &skew);
+        if (err == 0) {
+                offset->offset = (double) best.offset / 1000000.0;
+                offset->delay = (double) best.delay / 1000000.0;
+                offset->skew = skew;
+                offset->samples = sync->count;
+        }
+        mutex_unlock(sync->mutex);
+        return err;
+}
+
+uint64_t clock_sync_to_local(clock_sync_t *sync, uint64_t remote)
+{
+        clock_sample_t best;
+        double skew;
+        int err;
+        
+        mutex_lock(sync->mutex);
+        err = clock_sync_estimate(sync, &best, &skew);
+        mutex_unlock(sync->mutex);
+        
+        if (err != 0)
+                return remote;
+
+        uint64_t local = remote - (uint64_t) best.offset;
+        double drift = skew * (double) (int64_t) (local - best.local);
+        return local - (uint64_t) (int64_t) drift;
+}
+
+/**************************************************************/
+
+static const char clock_sync_request_magic[4] = { (char) 0xff, 'S', 'Y', 'N' };
+static const char clock_sync_reply_magic[4] = { (char) 0xff, 'S', 'Y', 'R' };
+
+static void clock_sync_put(char *p, uint64_t t)
+{
+        for (int i = 7; i >= 0; i--, t >>= 8)
+                p[i] = (char) (t & 0xff);
+}
+
+static uint64_t clock_sync_get_time(const char *p)
+{
+        uint64_t t = 0;
+        for (int i = 0; i < 8; i++)
+                t = (t << 8) | (unsigned char) p[i];
+        return t;
+}
+
+int clock_sync_is_request(const char *data, int len)
+{
+        return (len == CLOCK_SYNC_REQUEST_LEN
+                && memcmp(data, clock_sync_request_magic, 4) == 0);
+}
+
+int clock_sync_is_reply(const char *data, int len)
+{
+        return (len == CLOCK_SYNC_REPLY_LEN
+                && memcmp(data, clock_sync_reply_magic, 4) == 0);
+}
+
+int clock_sync_make_request(char *buf, uint64_t t0)
+{
+        memcpy(buf, clock_sync_request_magic, 4);
+        clock_sync_put(buf + 4, t0);
+        return CLOCK_SYNC_REQUEST_LEN;
+}
+
+int clock_sync_make_reply(const char *request, int len, char *buf, uint64_t t1)
+{
+        if (!clock_sync_is_request(request, len))
+                return -1;
+        memcpy(buf, clock_sync_reply_magic, 4);
+        memcpy(buf + 4, request + 4, 8);
+        clock_sync_put(buf + 12, t1);
+        clock_sync_put(buf + 20, data_clock_now());
+        return CLOCK_SYNC_REPLY_LEN;
+}
+
+int clock_sync_parse_reply(const char *data, int len,
+                           uint64_t *t0, uint64_t *t1, uint64_t *t2)
+{
+        if (!clock_sync_is_reply(data, len))
+                return -1;
+        *t0 = clock_sync_get_time(data + 4);
+        *t1 = clock_sync_get_time(data + 12);
+        *t2 = clock_sync_get_time(data + 20);
+        return 0;
+}
@@ -0,0 +1,272 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#include <stdint.h>
+#include <string.h>
+#include <r.h>
+#include "compress.h"
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/***********************************************************/
+
+#define LZ4_MIN_MATCH 4
+// The last match must start at least 12 bytes before the end, and the
+// last 5 bytes are always literals.
+#define LZ4_MF_LIMIT 12
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 12
+
+static inline uint32_t lz4_read32(const unsigned char *p)
+{
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+}
+
+static inline uint32_t lz4_hash(uint32_t v)
+{
+        return (v * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+static unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+        while (len >= 255) {
+                *op++ = 255;
+                len -= 255;
+        }
+        *op++ = (unsigned char) len;
+        return op;
+}
+
+static unsigned char *lz4_put_sequence(unsigned char *op,
+                                       const unsigned char *literals,
+                                       size_t literal_len,
+                                       size_t offset, size_t match_len)
+{
+        unsigned char *token = op++;
+        size_t m = match_len - LZ4_MIN_MATCH;
+        
+        *token = (unsigned char) (((literal_len < 15)? literal_len : 15) << 4);
+        if (literal_len >= 15)
+                op = lz4_put_length(op, literal_len - 15);
+        memcpy(op, literals, literal_len);
+        op += literal_len;
+
+        if (match_len == 0)
+                return op;
+        
+        *op++ = (unsigned char) (offset & 0xff);
+        *op++ = (unsigned char) (offset >> 8);
+        *token |= (unsigned char) ((m < 15)? m : 15);
+        if (m >= 15)
+                op = lz4_put_length(op, m - 15);
+        return op;
+}
+
+static long lz4_compress(const unsigned char *src, size_t len,
+                         unsigned char *dst, size_t capacity)
+{
+        uint32_t table[1 << LZ4_HASH_BITS];
+        size_t ip = 0;
+        size_t anchor = 0;
+        unsigned char *op = dst;
+
+        if (capacity < compress_bound(COMPRESS_LZ4, len))
+                return -1;
+
+        // Positions are stored plus one, zero means empty
+        memset(table, 0, sizeof(table));
+
+        if (len > LZ4_MF_LIMIT) {
+                size_t limit = len - LZ4_MF_LIMIT;
+                size_t match_limit = len - LZ4_LAST_LITERALS;
+                while (ip < limit) {
+                        uint32_t seq = lz4_read32(src + ip);
+                        uint32_t h = lz4_hash(seq);
+                        size_t ref = table[h];
+                        table[h] = (uint32_t) ip + 1;
+                        
+                        if (ref == 0 || ip - (ref - 1) > LZ4_MAX_OFFSET
+                            || lz4_read32(src + ref - 1) != seq) {
+                                ip++;
+                                continue;
+                        }
+                        ref--;
+                        
+                        size_t match_len = LZ4_MIN_MATCH;
+                        while (ip + match_len < match_limit
+                               && src[ref + match_len] == src[ip + match_len])
+                                match_len++;
+                        
+                        op = lz4_put_sequence(op, src + anchor, ip - anchor,
+                                              ip - ref, match_len);
+                        ip += match_len;
+                        anchor = ip;
+                }
+        }
+        
+        op = lz4_put_sequence(op, src + anchor, len - anchor, 0, 0);
+        return (long) (op - dst);
+}
+
+static int lz4_get_length(const unsigned char **ip, const unsigned char *end,
+                          size_t *len)
+{
+        unsigned char b;
+        do {
+                if (*ip >= end)
+                        return -1;
+                b = *(*ip)++;
+                *len += b;
+        } while (b == 255);
+        return 0;
+}
+
+static int lz4_decompress(const unsigned char *src, size_t len,
+                          unsigned char *dst, size_t raw_len)
+{
+        const unsigned char *ip = src;
+        const unsigned char *end = src + len;
+        size_t op = 0;
+
+        while (ip < end) {
+                unsigned char token = *ip++;
+                size_t literal_len = token >> 4;
+                size_t match_len = token & 0x0f;
+                size_t offset;
+                
+                if (literal_len == 15 && lz4_get_length(&ip, end, &literal_len) != 0)
+                        return -1;
+                if (literal_len > (size_t) (end - ip) || literal_len > raw_len - op)
+                        return -1;
+                memcpy(dst + op, ip, literal_len);
+                ip += literal_len;
+                op += literal_len;
+
+                // The last sequence has no match
+                if (ip == end)
+                        break;
+                
+                if (end - ip < 2)
+                        return -1;
+                offset = (size_t) ip[0] | ((size_t) ip[1] << 8);
+                ip += 2;
+                if (offset == 0 || offset > op)
+                        return -1;
+                if (match_len == 15 && lz4_get_length(&ip, end, &match_len) != 0)
+                        return -1;
+                match_len += LZ4_MIN_MATCH;
+                if (match_len > raw_len - op)
+                        return -1;
+                
+                // The match can overlap the output
+                for (size_t i = 0; i < match_len; i++, op++)
+                        dst[op] = dst[op - offset];
+        }
+        
+        return (op == raw_len)? 0 : -1;
+}
+
+/***********************************************************/
+
+int compress_available(int codec)
+{
+        switch (codec) {
+        case COMPRESS_NONE:
+        case COMPRESS_LZ4:
+                return 1;
+#ifdef HAVE_ZSTD
+        case COMPRESS_ZSTD:
+                return 1;
+#endif
+        default:
+                return 0;
+        }
+}
+
+size_t compress_bound(int codec, size_t len)
+{
+        switch (codec) {
+        case COMPRESS_LZ4:
+                return len + len / 255 + 16;
+#ifdef HAVE_ZSTD
+        case COMPRESS_ZSTD:
+                return ZSTD_compressBound(len);
+#endif
+        default:
+                return len;
+        }
+}
+
+long compress_block(int codec, int level,
+                    const void *src, size_t len,
+                    void *dst, size_t capacity)
+{
+        switch (codec) {
+        case COMPRESS_NONE:
+                if (capacity < len)
+                        return -1;
+                memcpy(dst, src, len);
+                return (long) len;
+        case COMPRESS_LZ4:
+                (void) level;
+                return lz4_compress(src, len, dst, capacity);
+#ifdef HAVE_ZSTD
+        case COMPRESS_ZSTD: {
+                size_t n = ZSTD_compress(dst, capacity, src, len, level);
+                return ZSTD_isError(n)? -1 : (long) n;
+        }
+#endif
+        default:
+                r_err("compress_block: unsupported codec %d", codec);
+                return -1;
+        }
+}
+
+int decompress_block(int codec,
+                     const void *src, size_t len,
+                     void *dst, size_t raw_len)
+{
+        switch (codec) {
+        case COMPRESS_NONE:
+                if (len != raw_len)
+                        return -1;
+                memcpy(dst, src, len);
+                return 0;
+        case COMPRESS_LZ4:
+                return lz4_decompress(src, len, dst, raw_len);
+#ifdef HAVE_ZSTD
+        case COMPRESS_ZSTD: {
+                size_t n = ZSTD_decompress(dst, raw_len, src, len);
+                return (ZSTD_isError(n) || n != raw_len)? -1 : 0;
+        }
+#endif
+        default:
+                r_err("decompress_block: unsupported codec %d", codec);
+                return -1;
+        }
+}
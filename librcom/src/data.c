@@ -24,9 +24,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
 #include <r.h>
 
 #include "data.h"
+#include "cbor.h"
 
 data_t* new_data()
 {
@@ -126,26 +129,107 @@ int data_serialise(data_t* m, json_object_t obj)
         return 0;
 }
 
-json_object_t data_parse(data_t* m, json_parser_t* parser)
+// Each thread that calls data_parse() without a parser gets its own
+// parser. It is kept until the thread exits so that high-rate
+// receivers don't create and destroy a parser for every packet.
+static pthread_key_t data_parser_key;
+static pthread_once_t data_parser_once = PTHREAD_ONCE_INIT;
+
+static void data_destroy_thread_parser(void *parser)
 {
-        int destroy_parser = 0;
-        json_object_t obj;
+        json_parser_destroy((json_parser_t *) parser);
+}
+
+static void data_create_parser_key()
+{
+        pthread_key_create(&data_parser_key, data_destroy_thread_parser);
+}
+
+json_parser_t *data_thread_parser()
+{
+        json_parser_t *parser;
         
+        pthread_once(&data_parser_once, data_create_parser_key);
+        parser = (json_parser_t *) pthread_getspecific(data_parser_key);
         if (parser == NULL) {
-                destroy_parser = 1;
                 parser = json_parser_create();
+                if (parser != NULL)
+                        pthread_setspecific(data_parser_key, parser);
         }
+        return parser;
+}
 
-        data_append_zero(m);
-        obj = json_parser_eval(parser, m->p.data);
+json_object_t data_parse(data_t* m, json_parser_t* parser)
+{
+        if (data_is_bin(m))
+                return data_parse_bin(m);
         
-        if (destroy_parser) {
-                json_parser_destroy(parser);
+        if (parser == NULL) {
+                parser = data_thread_parser();
+                if (parser == NULL)
+                        return json_null();
         }
 
+        data_append_zero(m);
+        return json_parser_eval(parser, m->p.data);
+}
+
+int data_is_bin(data_t* m)
+{
+        return (m->len >= CBOR_MAGIC_LEN
+                && memcmp(m->p.data, cbor_magic, CBOR_MAGIC_LEN) == 0);
+}
+
+int data_serialise_bin(data_t* m, json_object_t obj)
+{
+        unsigned char *p = (unsigned char *) m->p.data;
+        int len;
+        
+        memcpy(p, cbor_magic, CBOR_MAGIC_LEN);
+        len = cbor_encode(obj, p + CBOR_MAGIC_LEN, DATA_MAXLEN - CBOR_MAGIC_LEN);
+        if (len < 0)
+                return -1;
+        m->len = CBOR_MAGIC_LEN + len;
+        return 0;
+}
+
+json_object_t data_parse_bin(data_t* m)
+{
+        int err;
+        json_object_t obj;
+        
+        if (!data_is_bin(m))
+                return json_null();
+        
+        obj = cbor_decode((unsigned char *) m->p.data + CBOR_MAGIC_LEN,
+                          m->len - CBOR_MAGIC_LEN, &err);
+        if (err != 0)
+                r_warn("data_parse_bin: invalid data");
         return obj;
 }
 
+int data_serialise_array(data_t* m, const double *values, int n)
+{
+        unsigned char *p = (unsigned char *) m->p.data;
+        int len;
+        
+        memcpy(p, cbor_magic, CBOR_MAGIC_LEN);
+        len = cbor_encode_array(values, n, p + CBOR_MAGIC_LEN,
+                                DATA_MAXLEN - CBOR_MAGIC_LEN);
+        if (len < 0)
+                return -1;
+        m->len = CBOR_MAGIC_LEN + len;
+        return 0;
+}
+
+int data_parse_array(data_t* m, double *values, int max)
+{
+        if (!data_is_bin(m))
+                return -1;
+        return cbor_decode_array((unsigned char *) m->p.data + CBOR_MAGIC_LEN,
+                                 m->len - CBOR_MAGIC_LEN, values, max);
+}
+
 packet_t *data_packet(data_t* m)
 {
         return &m->p;
@@ -168,26 +252,77 @@ void data_clear_timestamp(data_t* m)
 
 uint64_t data_timestamp(data_t* m)
 {
-        unsigned char *p = m->p.timestamp;
-        uint64_t t = (((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48)
-                      | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32)
-                      | ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16)
-                      | ((uint64_t)p[6] << 8) | (uint64_t)p[7]);
+        uint64_t t;
+        memcpy(&t, m->p.timestamp, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        t = __builtin_bswap64(t);
+#endif
         return t;
 }
 
+void data_set_timestamp_value(data_t* m, uint64_t t)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        t = __builtin_bswap64(t);
+#endif
+        memcpy(m->p.timestamp, &t, 8);
+}
+
 void data_set_timestamp(data_t* m)
 {
-        uint64_t t = clock_timestamp();
-        unsigned char *p = m->p.timestamp;
-        p[0] = (unsigned char) ((t & 0xff00000000000000) >> 56);
-        p[1] = (unsigned char) ((t & 0x00ff000000000000) >> 48);
-        p[2] = (unsigned char) ((t & 0x0000ff0000000000) >> 40);
-        p[3] = (unsigned char) ((t & 0x000000ff00000000) >> 32);
-        p[4] = (unsigned char) ((t & 0x00000000ff000000) >> 24);
-        p[5] = (unsigned char) ((t & 0x0000000000ff0000) >> 16);
-        p[6] = (unsigned char) ((t & 0x000000000000ff00) >> 8);
-        p[7] = (unsigned char) (t & 0x00000000000000ff);
+        data_set_timestamp_value(m, data_clock_now());
+}
+
+// The monotonic clock is expressed in microseconds since the Unix
+// epoch by anchoring it to the wall clock when it is selected.
+static int data_clock = DATA_CLOCK_REALTIME;
+static int64_t data_clock_anchor = 0;
+
+static uint64_t data_timespec_us(struct timespec *t)
+{
+        return (uint64_t) t->tv_sec * 1000000 + (uint64_t) t->tv_nsec / 1000;
+}
+
+void data_clock_pair(uint64_t *monotonic, uint64_t *realtime)
+{
+        struct timespec m0, r, m1;
+
+        // Read the monotonic clock on both sides of the wall clock
+        // and take the middle.
+        clock_gettime(CLOCK_MONOTONIC, &m0);
+        clock_gettime(CLOCK_REALTIME, &r);
+        clock_gettime(CLOCK_MONOTONIC, &m1);
+        *monotonic = (data_timespec_us(&m0) + data_timespec_us(&m1)) / 2;
+        *realtime = data_timespec_us(&r);
+}
+
+void data_set_clock(data_clock_t clock)
+{
+        if (clock == DATA_CLOCK_MONOTONIC) {
+                uint64_t monotonic, realtime;
+                data_clock_pair(&monotonic, &realtime);
+                __atomic_store_n(&data_clock_anchor,
+                                 (int64_t) (realtime - monotonic),
+                                 __ATOMIC_RELEASE);
+        }
+        __atomic_store_n(&data_clock, (int) clock, __ATOMIC_RELEASE);
+}
+
+data_clock_t data_get_clock()
+{
+        return (data_clock_t) __atomic_load_n(&data_clock, __ATOMIC_ACQUIRE);
+}
+
+uint64_t data_clock_now()
+{
+        struct timespec t;
+        
+        if (data_get_clock() == DATA_CLOCK_REALTIME)
+                return clock_timestamp();
+        
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return data_timespec_us(&t)
+                + (uint64_t) __atomic_load_n(&data_clock_anchor, __ATOMIC_ACQUIRE);
 }
 
 uint32_t data_seqnum(data_t* m)
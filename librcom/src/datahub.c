@@ -22,35 +22,139 @@
 
  */
 
+#include <pthread.h>
+#include <sched.h>
 #include <r.h>
 #include "app.h"
 
 #include "util_priv.h"
 #include "datalink_priv.h"
 #include "datahub_priv.h"
+#include "fragment.h"
+#include "seqwindow.h"
+#include "clocksync_priv.h"
+#include "hashtable.h"
+#include "shmring.h"
 #include "net.h"
+#include "dump.h"
+
+// The number of datagrams read per system call
+#define DATAHUB_READ_BATCH 16
+
+// The maximum number of values returned by datahub_parse() in a single
+// ondata callback
+#define DATAHUB_MAX_PARSED 16
+
+// The maximum number of links for which statistics are kept
+#define DATAHUB_MAX_STATS 1024
+
+// The links are identified by their IPv4 address and port
+#define DATAHUB_KEYLEN 6
+
+static inline void datahub_key(addr_t *addr, unsigned char *key)
+{
+        memcpy(key, &addr->sin_addr, 4);
+        memcpy(key + 4, &addr->sin_port, 2);
+}
+
+typedef struct _datahub_link_t {
+        addr_t addr;
+        // The ring of a link on the same host, or NULL. Publishers on
+        // different threads take turns to write to it.
+        shm_ring_t *ring;
+        int ring_lock;
+        // Set when the link said that it joined the multicast group.
+        // The broadcasts sent to the group skip the link from then
+        // on. Set in place by the data thread.
+        int member;
+} datahub_link_t;
+
+/*
+ * The publishers read the list of links without taking the hub's
+ * mutex. The list is an immutable snapshot that the writers replace
+ * as a whole (read-copy-update). A reader announces itself in the
+ * counter of the current epoch. A writer publishes the new snapshot,
+ * flips the epoch, and waits for the readers of the previous epoch to
+ * leave before it frees the old snapshot. The writers are serialised
+ * by the hub's mutex.
+ */
+typedef struct _datahub_links_t {
+        int has_group;
+        addr_t group;
+        // Open-addressing hash table on the address of the links. The
+        // slots hold the position of the link plus one, or zero when
+        // empty. NULL if it couldn't be allocated.
+        int *table;
+        uint32_t mask;
+        int count;
+        datahub_link_t *links[];
+} datahub_links_t;
 
 struct _datahub_t {
         udp_socket_t socket;
         addr_t *addr;
-        list_t *links;
+        addr_t *group;
+        datahub_links_t *links;
+        int epoch;
+        int readers[2];
         datahub_onbroadcast_t onbroadcast;
         datahub_ondata_t ondata;
+        datahub_onmessage_t onmessage;
         mutex_t *mutex;
-        data_t *input;
-        data_t *output;
+        data_t *input[DATAHUB_READ_BATCH];
+        addr_t senders[DATAHUB_READ_BATCH];
+        // The replies to the clock sync requests, sent by the data thread
+        data_t *sync_reply;
+        uint32_t msgid;
+        reassembler_t *reassembler;
+        uint32_t seqnum;
+        hashtable_t *stats;
+        mutex_t *stats_mutex;
+        int drop_stale;
+        int binary;
+        // Records the broadcast data when dumping is on
+        dump_t *dump;
+        // Used by datahub_parse() in the data thread only. The parsed
+        // values are released after each ondata callback.
+        json_parser_t *parser;
+        json_object_t parsed[DATAHUB_MAX_PARSED];
+        int num_parsed;
         void *userdata;
         thread_t *data_thread;
         thread_t *broadcast_thread;
         int quit_thread;
 };
 
+// The output buffers are private to the publishing thread and shared
+// by all the hubs.
+typedef struct _datahub_buffers_t {
+        data_t output;
+        membuf_t *message;
+} datahub_buffers_t;
+
+static pthread_key_t datahub_buffers_key;
+static pthread_once_t datahub_buffers_once = PTHREAD_ONCE_INIT;
+
 static void datahub_lock(datahub_t *d);
 static void datahub_unlock(datahub_t *d);
-static int datahub_send_locked(datahub_t *d, addr_t *exclude,
-                               data_t *data, int stamp);
-static int datahub_broadcast_locked(datahub_t *d, addr_t *exclude,
+// The links to which a send failed. They are removed once the
+// publisher left the read-side section.
+typedef struct _datahub_failures_t {
+        list_t *links;
+        int multicast;
+} datahub_failures_t;
+
+static int datahub_send_data(datahub_t *hub, datahub_links_t *links,
+                             addr_t *link, data_t *data, int stamp,
+                             datahub_failures_t *failures);
+static int datahub_broadcast_data(datahub_t *hub, datahub_links_t *links,
+                                  addr_t *exclude, data_t *data, int stamp,
+                                  datahub_failures_t *failures);
+static int datahub_broadcast_output(datahub_t *hub, addr_t *exclude,
                                     data_t *data, int stamp);
+static int datahub_send_message_data(datahub_t *hub, addr_t *addr,
+                                     const char *data, int len,
+                                     int broadcast);
 static void datahub_run_data(datahub_t *hub);
 static void datahub_run_broadcast(datahub_t *hub);
 
@@ -75,12 +179,21 @@ datahub_t *new_datahub(datahub_onbroadcast_t onbroadcast,
         hub->userdata = userdata;
         hub->quit_thread = 0;
         
-        hub->output = new_data();
-        hub->input = new_data();        
+        hub->links = r_new(datahub_links_t);
+        hub->sync_reply = new_data();
+        hub->reassembler = new_reassembler(FRAGMENT_TIMEOUT);
+        hub->stats = new_hashtable(0);
+        hub->stats_mutex = new_mutex();
+        // A random start lets the receivers tell a restart of the hub
+        // from a burst of late packets.
+        r_random(&hub->seqnum, sizeof(hub->seqnum));
+        for (int i = 0; i < DATAHUB_READ_BATCH; i++)
+                hub->input[i] = new_data();
         hub->mutex = new_mutex();
 
-        if (hub->ondata)
-                hub->data_thread = new_thread((thread_run_t) datahub_run_data, hub);
+        // The data thread also answers the clock sync requests of the
+        // links, so it runs even if there is no ondata callback.
+        hub->data_thread = new_thread((thread_run_t) datahub_run_data, hub);
 
         if (hub->onbroadcast)
                 hub->broadcast_thread = new_thread((thread_run_t) datahub_run_broadcast, hub);
@@ -92,10 +205,24 @@ error_recovery:
         return NULL;
 }
 
+static void datahub_free_seq(void *userdata __attribute__((unused)),
+                             const void *key __attribute__((unused)),
+                             int keylen __attribute__((unused)),
+                             void *value)
+{
+        r_delete((seq_window_t *) value);
+}
+
+static void delete_datahub_link(datahub_link_t *link)
+{
+        if (link) {
+                delete_shm_ring(link->ring);
+                r_delete(link);
+        }
+}
+
 void delete_datahub(datahub_t *hub)
 {
-        list_t *l;
-        
         if (hub) {
                 
                 hub->quit_thread = 1;
@@ -109,23 +236,30 @@ void delete_datahub(datahub_t *hub)
                         thread_join(hub->broadcast_thread);
                         delete_thread(hub->broadcast_thread);
                 }
-                
-                if (hub->mutex)
-                        datahub_lock(hub);
-                l = hub->links;
-                while (l) {
-                        addr_t *link = list_get(l, addr_t);
-                        delete_addr(link);
-                        l = list_next(l);
+
+                // No publisher may be using the hub anymore.
+                if (hub->links) {
+                        for (int i = 0; i < hub->links->count; i++)
+                                delete_datahub_link(hub->links->links[i]);
+                        r_free(hub->links->table);
+                        r_free(hub->links);
                 }
-                delete_list(hub->links);
-                hub->links = NULL;
-                if (hub->mutex)
-                        datahub_unlock(hub);                
                 
-                delete_data(hub->output);
-                delete_data(hub->input);
+                if (hub->parser)
+                        json_parser_destroy(hub->parser);
+                
+                delete_data(hub->sync_reply);
+                delete_dump(hub->dump);
+                delete_reassembler(hub->reassembler);
+                if (hub->stats) {
+                        hashtable_foreach(hub->stats, datahub_free_seq, NULL);
+                        delete_hashtable(hub->stats);
+                }
+                delete_mutex(hub->stats_mutex);
+                for (int i = 0; i < DATAHUB_READ_BATCH; i++)
+                        delete_data(hub->input[i]);
                 delete_addr(hub->addr);
+                delete_addr(hub->group);
                 delete_mutex(hub->mutex);
                 
                 r_delete(hub);
@@ -137,6 +271,11 @@ addr_t *datahub_addr(datahub_t* hub)
         return hub->addr;
 }
 
+void datahub_set_onmessage(datahub_t* hub, datahub_onmessage_t onmessage)
+{
+        hub->onmessage = onmessage;
+}
+
 static void datahub_lock(datahub_t *hub)
 {
         mutex_lock(hub->mutex);
@@ -147,14 +286,241 @@ static void datahub_unlock(datahub_t *hub)
         mutex_unlock(hub->mutex);
 }
 
-static addr_t *datahub_find(datahub_t *hub, addr_t *addr)
+/**************************************************************/
+
+static void datahub_free_buffers(void *ptr)
+{
+        datahub_buffers_t *buffers = (datahub_buffers_t *) ptr;
+        delete_membuf(buffers->message);
+        r_delete(buffers);
+}
+
+static void datahub_create_buffers_key()
 {
-        for (list_t *l = hub->links; l != NULL; l = list_next(l)) {
-                addr_t *a = list_get(l, addr_t);
-                if (addr_eq(addr, a))
-                        return a;
+        pthread_key_create(&datahub_buffers_key, datahub_free_buffers);
+}
+
+static datahub_buffers_t *datahub_buffers()
+{
+        datahub_buffers_t *buffers;
+        
+        pthread_once(&datahub_buffers_once, datahub_create_buffers_key);
+        buffers = (datahub_buffers_t *) pthread_getspecific(datahub_buffers_key);
+        if (buffers == NULL) {
+                buffers = r_new(datahub_buffers_t);
+                buffers->message = new_membuf();
+                pthread_setspecific(datahub_buffers_key, buffers);
         }
-        return NULL;
+        return buffers;
+}
+
+/**************************************************************/
+
+// Enters a read-side section. The returned snapshot remains valid
+// until datahub_read_end() is called. Don't call the functions that
+// change the links in between.
+static datahub_links_t *datahub_read_begin(datahub_t *hub, int *epoch)
+{
+        while (1) {
+                int e = __atomic_load_n(&hub->epoch, __ATOMIC_SEQ_CST);
+                __atomic_fetch_add(&hub->readers[e], 1, __ATOMIC_SEQ_CST);
+                if (__atomic_load_n(&hub->epoch, __ATOMIC_SEQ_CST) == e) {
+                        *epoch = e;
+                        return __atomic_load_n(&hub->links, __ATOMIC_SEQ_CST);
+                }
+                // A writer flipped the epoch in between. Try again so
+                // that it doesn't miss this reader.
+                __atomic_fetch_sub(&hub->readers[e], 1, __ATOMIC_SEQ_CST);
+        }
+}
+
+static void datahub_read_end(datahub_t *hub, int epoch)
+{
+        __atomic_fetch_sub(&hub->readers[epoch], 1, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t datahub_hash(addr_t *addr)
+{
+        uint32_t h = (uint32_t) addr->sin_addr.s_addr * 0x9e3779b1u;
+        h ^= (uint32_t) addr->sin_port * 0x85ebca77u;
+        return h ^ (h >> 16);
+}
+
+static void datahub_links_build_table(datahub_links_t *links)
+{
+        uint32_t size = 8;
+        
+        while (size < 2 * (uint32_t) links->count)
+                size *= 2;
+        links->mask = size - 1;
+        links->table = (int *) r_alloc(size * sizeof(int));
+        if (links->table == NULL)
+                return;
+        memset(links->table, 0, size * sizeof(int));
+        
+        for (int i = 0; i < links->count; i++) {
+                uint32_t slot = datahub_hash(&links->links[i]->addr) & links->mask;
+                while (links->table[slot] != 0)
+                        slot = (slot + 1) & links->mask;
+                links->table[slot] = i + 1;
+        }
+}
+
+// Replaces the snapshot and frees the old one, together with the
+// retired link, once no reader can be using them anymore. Must be
+// called with the hub locked.
+static void datahub_publish(datahub_t *hub, datahub_links_t *links,
+                            datahub_link_t *retired)
+{
+        datahub_links_t *old;
+        int e;
+
+        datahub_links_build_table(links);
+        
+        old = __atomic_exchange_n(&hub->links, links, __ATOMIC_SEQ_CST);
+        e = __atomic_load_n(&hub->epoch, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&hub->epoch, 1 - e, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&hub->readers[e], __ATOMIC_SEQ_CST) != 0)
+                sched_yield();
+        
+        r_free(old->table);
+        r_free(old);
+        delete_datahub_link(retired);
+}
+
+// Returns a copy of the current snapshot with room for extra links.
+// Must be called with the hub locked.
+static datahub_links_t *datahub_copy_links(datahub_t *hub, int extra)
+{
+        datahub_links_t *old = hub->links;
+        size_t size = sizeof(datahub_links_t)
+                + (size_t) (old->count + extra) * sizeof(datahub_link_t *);
+        datahub_links_t *links = (datahub_links_t *) r_alloc(size);
+        if (links == NULL)
+                return NULL;
+        links->has_group = old->has_group;
+        links->group = old->group;
+        links->table = NULL;
+        links->mask = 0;
+        links->count = old->count;
+        memcpy(links->links, old->links, old->count * sizeof(datahub_link_t *));
+        return links;
+}
+
+static inline int datahub_addr_eq(addr_t *a, addr_t *b)
+{
+        return (a->sin_addr.s_addr == b->sin_addr.s_addr
+                && a->sin_port == b->sin_port);
+}
+
+static int datahub_links_index(datahub_links_t *links, addr_t *addr)
+{
+        if (links->table == NULL) {
+                for (int i = 0; i < links->count; i++) {
+                        if (datahub_addr_eq(addr, &links->links[i]->addr))
+                                return i;
+                }
+                return -1;
+        }
+        
+        uint32_t slot = datahub_hash(addr) & links->mask;
+        while (links->table[slot] != 0) {
+                int i = links->table[slot] - 1;
+                if (datahub_addr_eq(addr, &links->links[i]->addr))
+                        return i;
+                slot = (slot + 1) & links->mask;
+        }
+        return -1;
+}
+
+static datahub_link_t *datahub_links_find(datahub_links_t *links, addr_t *addr)
+{
+        int i = datahub_links_index(links, addr);
+        return (i < 0)? NULL : links->links[i];
+}
+
+// Adds the link, or replaces the listed link with the same address.
+// Must be called with the hub locked.
+static int datahub_put_link(datahub_t *hub, addr_t *addr, shm_ring_t *ring)
+{
+        datahub_link_t *link;
+        datahub_links_t *links;
+        datahub_link_t *retired = NULL;
+        int i;
+        
+        link = r_new(datahub_link_t);
+        links = datahub_copy_links(hub, 1);
+        if (link == NULL || links == NULL) {
+                r_delete(link);
+                r_free(links);
+                return -1;
+        }
+        
+        link->addr = *addr;
+        link->ring = ring;
+        
+        i = datahub_links_index(links, addr);
+        if (i < 0) {
+                links->links[links->count++] = link;
+        } else {
+                retired = links->links[i];
+                link->member = __atomic_load_n(&retired->member, __ATOMIC_RELAXED);
+                links->links[i] = link;
+        }
+        
+        datahub_publish(hub, links, retired);
+        return 0;
+}
+
+int datahub_set_group(datahub_t* hub, addr_t *group)
+{
+        datahub_links_t *links;
+        int err = -1;
+        
+        if (!addr_is_multicast(group)) {
+                r_err("datahub_set_group: not a multicast address");
+                return -1;
+        }
+        
+        datahub_lock(hub);
+        if (udp_socket_set_multicast(hub->socket, 1) == 0) {
+                links = datahub_copy_links(hub, 0);
+                if (links != NULL) {
+                        delete_addr(hub->group);
+                        hub->group = addr_clone(group);
+                        links->has_group = 1;
+                        links->group = *group;
+                        datahub_publish(hub, links, NULL);
+                        err = 0;
+                }
+        }
+        datahub_unlock(hub);
+        return err;
+}
+
+static void datahub_clear_group(datahub_t* hub)
+{
+        datahub_links_t *links;
+        
+        datahub_lock(hub);
+        links = datahub_copy_links(hub, 0);
+        if (links != NULL) {
+                delete_addr(hub->group);
+                hub->group = NULL;
+                links->has_group = 0;
+                datahub_publish(hub, links, NULL);
+        }
+        datahub_unlock(hub);
+}
+
+addr_t *datahub_group(datahub_t* hub)
+{
+        return hub->group;
+}
+
+static inline int datahub_same_host(datahub_t *hub, addr_t *addr)
+{
+        return addr->sin_addr.s_addr == hub->addr->sin_addr.s_addr;
 }
 
 int datahub_add_link(datahub_t* hub, addr_t *addr)
@@ -164,22 +530,37 @@ int datahub_add_link(datahub_t* hub, addr_t *addr)
         char b[64];
         r_debug("datahub_add_link: %s", addr_string(addr, b, sizeof(b)));
 
+        // The writers are serialised by the mutex, so they can use the
+        // current snapshot without entering a read-side section.
         datahub_lock(hub);
-        addr_t *a = datahub_find(hub, addr);
-        if (a != NULL) {
+        if (datahub_links_find(hub->links, addr) != NULL) {
                 r_debug("datahub_add_link: %s is already listed",
                         addr_string(addr, b, sizeof(b)));
-                datahub_unlock(hub);
-                return 0;
+        } else {
+                ret = datahub_put_link(hub, addr, NULL);
         }
         datahub_unlock(hub);
+        
+        return ret;
+}
 
-        addr_t *clone = addr_clone(addr);
+int datahub_add_local_link(datahub_t* hub, addr_t *addr, const char *ring_name)
+{
+        shm_ring_t *ring;
+        int ret;
         
+        ring = open_shm_ring(ring_name);
+        if (ring == NULL) {
+                r_warn("datahub_add_local_link: failed to open the ring, "
+                       "using UDP");
+        }
+
         datahub_lock(hub);
-        hub->links = list_append(hub->links, clone);
+        ret = datahub_put_link(hub, addr, ring);
         datahub_unlock(hub);
         
+        if (ret != 0)
+                delete_shm_ring(ring);
         return ret;
 }
 
@@ -187,278 +568,614 @@ int datahub_remove_link(datahub_t* hub, addr_t *addr)
 {
         int ret = 0;
         char b[64];
+        unsigned char key[DATAHUB_KEYLEN];
         r_debug("datahub_remove_link: %s", addr_string(addr, b, sizeof(b)));
 
+        datahub_key(addr, key);
+        
         datahub_lock(hub);
-        addr_t *a = datahub_find(hub, addr);
-        if (a != NULL)
-                hub->links = list_remove(hub->links, a);
+        int i = datahub_links_index(hub->links, addr);
+        if (i >= 0) {
+                datahub_links_t *links = datahub_copy_links(hub, 0);
+                if (links != NULL) {
+                        datahub_link_t *retired = links->links[i];
+                        links->links[i] = links->links[--links->count];
+                        datahub_publish(hub, links, retired);
+                } else {
+                        ret = -1;
+                }
+        }
         datahub_unlock(hub);
+
+        mutex_lock(hub->stats_mutex);
+        r_delete((seq_window_t *) hashtable_remove(hub->stats, key, DATAHUB_KEYLEN));
+        mutex_unlock(hub->stats_mutex);
+        
         return ret;
 }
 
+// Must be called outside of the read-side section.
+static void datahub_handle_failures(datahub_t *hub, datahub_failures_t *failures)
+{
+        if (failures->multicast) {
+                r_warn("datahub_broadcast: multicast failed, "
+                       "falling back to unicast");
+                datahub_clear_group(hub);
+        }
+        for (list_t *l = failures->links; l != NULL; l = list_next(l)) {
+                addr_t *addr = list_get(l, addr_t);
+                // FIXME: is this the proper way to handle errors?
+                datahub_remove_link(hub, addr);
+                delete_addr(addr);
+        }
+        delete_list(failures->links);
+}
+
 /**************************************************************/
 
+static int datahub_send_output(datahub_t *hub, addr_t *link, data_t *data, int stamp)
+{
+        datahub_failures_t failures = { NULL, 0 };
+        int epoch;
+        int err;
+        
+        datahub_links_t *links = datahub_read_begin(hub, &epoch);
+        err = datahub_send_data(hub, links, link, data, stamp, &failures);
+        datahub_read_end(hub, epoch);
+        
+        datahub_handle_failures(hub, &failures);
+        return err;
+}
+
 int datahub_send_num(datahub_t *hub, addr_t *link, double value)
 {
-        int r;
-        datahub_lock(hub);
-        r = data_printf(hub->output, "%f", value);
+        data_t *output = &datahub_buffers()->output;
+        int r = data_printf(output, "%f", value);
         if (r == 0)
-                r = datahub_send_locked(hub, link, hub->output, 1);
-        datahub_unlock(hub);
+                r = datahub_send_output(hub, link, output, 1);
         return r;
 }
 
 int datahub_send_str(datahub_t *hub, addr_t *link, const char *value)
 {
-        int r;
+        data_t *output = &datahub_buffers()->output;
         membuf_t *t = escape_string(value);
-        
-        datahub_lock(hub);
-        r = data_printf(hub->output, "\"%s\"", membuf_data(t)); 
+        int r = data_printf(output, "\"%s\"", membuf_data(t)); 
         if (r == 0)
-                r = datahub_send_locked(hub, link, hub->output, 1);
-        datahub_unlock(hub);
-
+                r = datahub_send_output(hub, link, output, 1);
         delete_membuf(t);
         return r;
 }
 
+static int32_t datahub_serialise(membuf_t *m, const char *s, int32_t len)
+{
+        return membuf_append(m, s, len);
+}
+
+// Serialises the value in the message buffer of the calling thread.
+static membuf_t *datahub_serialise_message(json_object_t value)
+{
+        membuf_t *message = datahub_buffers()->message;
+        membuf_clear(message);
+        if (json_serialise(value, 0, (json_writer_t) datahub_serialise,
+                           message) != 0)
+                return NULL;
+        return message;
+}
+
 int datahub_send_obj(datahub_t *hub, addr_t *link, json_object_t value)
 {
-        int r;
-        datahub_lock(hub);
-        r = data_serialise(hub->output, value);
-        if (r != 0) {
-                r_err("datahub_send: json_tostring failed");
-        } else {
-                r = datahub_send_locked(hub, link, hub->output, 1);
+        data_t *output = &datahub_buffers()->output;
+        membuf_t *message;
+        
+        if (hub->binary && data_serialise_bin(output, value) == 0)
+                return datahub_send_output(hub, link, output, 1);
+        
+        message = datahub_serialise_message(value);
+        if (message == NULL) {
+                r_err("datahub_send: json_serialise failed");
+                return -1;
         }
-        datahub_unlock(hub);
-        return r;
+        return datahub_send_message_data(hub, link, membuf_data(message),
+                                         membuf_len(message), 0);
 }
 
 int datahub_send_f(datahub_t *hub, addr_t *link, const char *format, ...)
 {
-        int r;
+        data_t *output = &datahub_buffers()->output;
         va_list ap;
 
-        datahub_lock(hub);
-        
         va_start(ap, format);
-        data_vprintf(hub->output, format, ap);
+        data_vprintf(output, format, ap);
         va_end(ap);
 
-        r = datahub_send_locked(hub, link, hub->output, 1);
-
-        datahub_unlock(hub);
-        return r;
+        return datahub_send_output(hub, link, output, 1);
 }
 
 int datahub_send_v(datahub_t *hub, addr_t *link, const char *format, va_list ap)
 {
-        int r;
-        datahub_lock(hub);
-        data_vprintf(hub->output, format, ap);
-        r = datahub_send_locked(hub, link, hub->output, 1);
-        datahub_unlock(hub);
-        return r;
+        data_t *output = &datahub_buffers()->output;
+        data_vprintf(output, format, ap);
+        return datahub_send_output(hub, link, output, 1);
 }
 
 int datahub_send_bin(datahub_t *hub, addr_t *link, const char *data, int len)
 {
-        int r;
-        datahub_lock(hub);
-        data_set_data(hub->output, data, len);
-        r = datahub_send_locked(hub, link, hub->output, 1);
-        datahub_unlock(hub);
-        return r;
+        data_t *output = &datahub_buffers()->output;
+        if (data_is_reserved(data, len)) {
+                r_err("datahub_send_bin: the first byte 0xff is reserved");
+                return -1;
+        }
+        data_set_data(output, data, len);
+        return datahub_send_output(hub, link, output, 1);
+}
+
+int datahub_send_array(datahub_t *hub, addr_t *link, const double *values, int n)
+{
+        data_t *output = &datahub_buffers()->output;
+        if (data_serialise_array(output, values, n) != 0) {
+                r_err("datahub_send_array: too many values");
+                return -1;
+        }
+        return datahub_send_output(hub, link, output, 1);
 }
 
 int datahub_send(datahub_t *hub, addr_t *link, data_t *m)
 {
-        int r;
-        datahub_lock(hub);
-        r = datahub_send_locked(hub, link, m, 0);
-        datahub_unlock(hub);
-        return r;
+        return datahub_send_output(hub, link, m, 0);
+}
+
+static inline void datahub_stamp(datahub_t *hub, data_t *data, int stamp)
+{
+        if (stamp)
+                data_set_timestamp(data);
+        data_set_seqnum(data, __atomic_fetch_add(&hub->seqnum, 1, __ATOMIC_RELAXED));
+}
+
+// A full ring drops the data, like the network would. Fragments always
+// go over UDP.
+static void datahub_write_ring(datahub_link_t *link, data_t *data)
+{
+        while (__atomic_test_and_set(&link->ring_lock, __ATOMIC_ACQUIRE))
+                sched_yield();
+        shm_ring_write(link->ring, data);
+        __atomic_clear(&link->ring_lock, __ATOMIC_RELEASE);
+}
+
+static inline int datahub_use_ring(datahub_link_t *link, data_t *data)
+{
+        return link != NULL && link->ring != NULL && !data_is_fragment(data);
 }
 
-static int datahub_send_locked(datahub_t *hub, addr_t *link, data_t *data, int stamp)
+static int datahub_send_data(datahub_t *hub, datahub_links_t *links,
+                             addr_t *addr, data_t *data, int stamp,
+                             datahub_failures_t *failures)
 {
-        if (link == NULL || data == NULL) {
-                r_err("datahub_send_locked: invalid arguments");
+        if (addr == NULL || data == NULL) {
+                r_err("datahub_send_data: invalid arguments");
                 return -1;
         }
         
-        if (stamp)
-                data_set_timestamp(data);
+        datahub_stamp(hub, data, stamp);
 
-        int err = udp_socket_send(hub->socket, link, data);
+        datahub_link_t *link = datahub_links_find(links, addr);
+        if (datahub_use_ring(link, data)) {
+                datahub_write_ring(link, data);
+                return 0;
+        }
+        
+        int err = udp_socket_send(hub->socket, addr, data);
         if (err) {
                 char b[64];
-                r_err("datahub_send_locked: failed to send to %s",
-                        addr_string(link, b, 64));
-                // FIXME: is this the proper way to handle errors?
-                hub->links = list_remove(hub->links, link);
+                r_err("datahub_send_data: failed to send to %s",
+                        addr_string(addr, b, 64));
+                if (link != NULL)
+                        failures->links = list_prepend(failures->links,
+                                                       addr_clone(addr));
                 return -1;
         }
         
         return 0;
 }
 
+int datahub_send_message(datahub_t *hub, addr_t *link, const char *data, int len)
+{
+        return datahub_send_message_data(hub, link, data, len, 0);
+}
+
+typedef struct _datahub_fragment_t {
+        datahub_t *hub;
+        datahub_links_t *links;
+        addr_t *addr;
+        int broadcast;
+        datahub_failures_t failures;
+} datahub_fragment_t;
+
+static int datahub_send_fragment(datahub_fragment_t *f, data_t *fragment)
+{
+        if (f->broadcast)
+                return datahub_broadcast_data(f->hub, f->links, f->addr,
+                                              fragment, 0, &f->failures);
+        else
+                return datahub_send_data(f->hub, f->links, f->addr,
+                                         fragment, 0, &f->failures);
+}
+
+// The addr is the destination link, or the link that is excluded in
+// case of a broadcast.
+static int datahub_send_message_data(datahub_t *hub, addr_t *addr,
+                                     const char *data, int len,
+                                     int broadcast)
+{
+        data_t *output = &datahub_buffers()->output;
+        int err;
+        int epoch;
+
+        // Small messages that start with the reserved byte are also
+        // sent as a fragment.
+        if (len <= DATA_MAXLEN && !data_is_reserved(data, len)) {
+                data_set_data(output, data, len);
+                if (broadcast)
+                        return datahub_broadcast_output(hub, addr, output, 1);
+                else
+                        return datahub_send_output(hub, addr, output, 1);
+        }
+
+        datahub_fragment_t f = { hub, NULL, addr, broadcast, { NULL, 0 } };
+        uint32_t msgid = __atomic_fetch_add(&hub->msgid, 1, __ATOMIC_RELAXED);
+        data_set_timestamp(output);
+        f.links = datahub_read_begin(hub, &epoch);
+        err = fragment_split(data, len, msgid, output,
+                             (fragment_send_t) datahub_send_fragment, &f);
+        datahub_read_end(hub, epoch);
+        
+        datahub_handle_failures(hub, &f.failures);
+        return err;
+}
+
 /**************************************************************/
 
 int datahub_broadcast_num(datahub_t *hub, addr_t *exclude, double value)
 {
-        int r;
-        datahub_lock(hub);
-        r = data_printf(hub->output, "%f", value);
-        if (r == 0) r = datahub_broadcast_locked(hub, exclude, hub->output, 1);
-        datahub_unlock(hub);
+        data_t *output = &datahub_buffers()->output;
+        int r = data_printf(output, "%f", value);
+        if (r == 0)
+                r = datahub_broadcast_output(hub, exclude, output, 1);
         return r;
 }
 
 int datahub_broadcast_str(datahub_t *hub, addr_t *exclude, const char *value)
 {
-        int r;
+        data_t *output = &datahub_buffers()->output;
         membuf_t *t = escape_string(value);
-        
-        datahub_lock(hub);
-        r = data_printf(hub->output, "\"%s\"", membuf_data(t)); 
+        int r = data_printf(output, "\"%s\"", membuf_data(t)); 
         if (r == 0)
-                r = datahub_broadcast_locked(hub, exclude, hub->output, 1);
-        datahub_unlock(hub);
-        
+                r = datahub_broadcast_output(hub, exclude, output, 1);
         delete_membuf(t);
         return r;
 }
 
 int datahub_broadcast_obj(datahub_t *hub, addr_t *exclude, json_object_t value)
 {
-        int r;
-        datahub_lock(hub);
-        r = data_serialise(hub->output, value);
-        if (r != 0) {
-                r_err("datahub_broadcast: json_tostring failed");
-        } else {
-                r = datahub_broadcast_locked(hub, exclude, hub->output, 1);
+        data_t *output = &datahub_buffers()->output;
+        membuf_t *message;
+        
+        if (hub->binary && data_serialise_bin(output, value) == 0)
+                return datahub_broadcast_output(hub, exclude, output, 1);
+        
+        message = datahub_serialise_message(value);
+        if (message == NULL) {
+                r_err("datahub_broadcast: json_serialise failed");
+                return -1;
         }
-        datahub_unlock(hub);
-        return r;
+        return datahub_send_message_data(hub, exclude, membuf_data(message),
+                                         membuf_len(message), 1);
 }
 
 int datahub_broadcast_f(datahub_t *hub, addr_t *exclude, const char *format, ...)
 {
-        int r;
+        data_t *output = &datahub_buffers()->output;
         va_list ap;
 
-        datahub_lock(hub);
-        
         va_start(ap, format);
-        data_vprintf(hub->output, format, ap);
+        data_vprintf(output, format, ap);
         va_end(ap);
 
-        r = datahub_broadcast_locked(hub, exclude, hub->output, 1);
-
-        datahub_unlock(hub);
-        return r;
+        return datahub_broadcast_output(hub, exclude, output, 1);
 }
 
 int datahub_broadcast_v(datahub_t *hub, addr_t *exclude, const char *format, va_list ap)
 {
-        int r;
-        datahub_lock(hub);
-        data_vprintf(hub->output, format, ap);
-        r = datahub_broadcast_locked(hub, exclude, hub->output, 1);
-        datahub_unlock(hub);
-        return r;
+        data_t *output = &datahub_buffers()->output;
+        data_vprintf(output, format, ap);
+        return datahub_broadcast_output(hub, exclude, output, 1);
 }
 
 int datahub_broadcast_bin(datahub_t *hub, addr_t *exclude, const char *data, int len)
 {
-        int r;
-        datahub_lock(hub);
-        data_set_data(hub->output, data, len);
-        r = datahub_broadcast_locked(hub, exclude, hub->output, 1);
-        datahub_unlock(hub);
-        return r;
+        data_t *output = &datahub_buffers()->output;
+        if (data_is_reserved(data, len)) {
+                r_err("datahub_broadcast_bin: the first byte 0xff is reserved");
+                return -1;
+        }
+        data_set_data(output, data, len);
+        return datahub_broadcast_output(hub, exclude, output, 1);
+}
+
+int datahub_broadcast_array(datahub_t *hub, addr_t *exclude,
+                            const double *values, int n)
+{
+        data_t *output = &datahub_buffers()->output;
+        if (data_serialise_array(output, values, n) != 0) {
+                r_err("datahub_broadcast_array: too many values");
+                return -1;
+        }
+        return datahub_broadcast_output(hub, exclude, output, 1);
 }
 
 int datahub_broadcast(datahub_t *hub, addr_t *exclude, data_t *m)
 {
-        int r;
-        datahub_lock(hub);
-        r = datahub_broadcast_locked(hub, exclude, m, 0);
-        datahub_unlock(hub);
-        return r;
+        return datahub_broadcast_output(hub, exclude, m, 0);
 }
 
-static int datahub_broadcast_locked(datahub_t *hub, addr_t *exclude, data_t *data, int stamp)
+int datahub_broadcast_message(datahub_t *hub, addr_t *exclude, const char *data, int len)
 {
-        list_t *l = hub->links;
-        list_t *rm = NULL;
-        
-        if (stamp)
-                data_set_timestamp(data);
+        return datahub_send_message_data(hub, exclude, data, len, 1);
+}
 
-        while (l) {
-                int err = 0;
-                addr_t *addr = list_get(l, addr_t);
-                if (addr != exclude)
-                        err = udp_socket_send(hub->socket, addr, data);
-                if (err) {
-                        char b[64];
-                        r_err("datahub_broadcast_locked: failed to send to %s",
-                                addr_string(addr, b, 64));
-                        rm = list_prepend(rm, addr);
+// Sends the data to a batch of links and collects the links for which
+// the send failed.
+static void datahub_broadcast_batch(datahub_t *hub, addr_t **batch, int count,
+                                    data_t *data, datahub_failures_t *failures)
+{
+        int failed[UDP_BATCH_SIZE];
+
+        if (udp_socket_send_many(hub->socket, batch, count, data, failed) != 0) {
+                for (int i = 0; i < count; i++) {
+                        if (failed[i])
+                                failures->links = list_prepend(failures->links,
+                                                               addr_clone(batch[i]));
                 }
-                l = list_next(l);
         }
+}
 
-        // FIXME: is this the proper way to handle errors?
-        l = rm;
-        while (l) {
-                addr_t *addr = list_get(l, addr_t);
-                hub->links = list_remove(hub->links, addr);
-                l = list_next(l);
+static int datahub_broadcast_output(datahub_t *hub, addr_t *exclude,
+                                    data_t *data, int stamp)
+{
+        datahub_failures_t failures = { NULL, 0 };
+        int epoch;
+        int err;
+        
+        datahub_links_t *links = datahub_read_begin(hub, &epoch);
+        err = datahub_broadcast_data(hub, links, exclude, data, stamp, &failures);
+        datahub_read_end(hub, epoch);
+
+        if (hub->dump)
+                dump_write_data(hub->dump, data);
+        
+        datahub_handle_failures(hub, &failures);
+        return err;
+}
+
+static int datahub_broadcast_data(datahub_t *hub, datahub_links_t *links,
+                                  addr_t *exclude, data_t *data, int stamp,
+                                  datahub_failures_t *failures)
+{
+        addr_t *batch[UDP_BATCH_SIZE];
+        int count = 0;
+        int multicast = 0;
+        
+        datahub_stamp(hub, data, stamp);
+
+        // In multicast mode, the network does the fan-out to the links
+        // on other hosts that joined the group. Broadcasts that
+        // exclude a link can't use the group.
+        if (links->has_group && exclude == NULL && links->count > 0) {
+                if (udp_socket_send(hub->socket, &links->group, data) == 0)
+                        multicast = 1;
+                else
+                        failures->multicast = 1;
         }
-        if (rm) delete_list(rm);
+        
+        for (int i = 0; i < links->count; i++) {
+                datahub_link_t *link = links->links[i];
+                if (exclude != NULL && datahub_addr_eq(&link->addr, exclude))
+                        continue;
+                if (datahub_use_ring(link, data)) {
+                        datahub_write_ring(link, data);
+                        continue;
+                }
+                if (multicast
+                    && __atomic_load_n(&link->member, __ATOMIC_RELAXED)
+                    && !datahub_same_host(hub, &link->addr))
+                        continue;
+                batch[count++] = &link->addr;
+                if (count == UDP_BATCH_SIZE) {
+                        datahub_broadcast_batch(hub, batch, count, data, failures);
+                        count = 0;
+                }
+        }
+        if (count > 0)
+                datahub_broadcast_batch(hub, batch, count, data, failures);
         
         return 0;
 }
 
 /**************************************************************/
 
-static void datahub_read(datahub_t *hub)
+void datahub_set_drop_stale(datahub_t* hub, int enable)
 {
-        list_t *list;
-        addr_t *link;
+        hub->drop_stale = enable;
+}
+
+void datahub_set_binary(datahub_t* hub, int enable)
+{
+        hub->binary = enable;
+}
+
+void datahub_set_dump(datahub_t* hub, dump_t *dump)
+{
+        hub->dump = dump;
+}
+
+int datahub_get_stats(datahub_t* hub, addr_t *link, datahub_stats_t *stats)
+{
+        int err = -1;
+        unsigned char key[DATAHUB_KEYLEN];
+        datahub_key(link, key);
+        mutex_lock(hub->stats_mutex);
+        seq_window_t *seq = hashtable_get(hub->stats, key, DATAHUB_KEYLEN);
+        if (seq != NULL) {
+                *stats = seq->stats;
+                err = 0;
+        }
+        mutex_unlock(hub->stats_mutex);
+        return err;
+}
+
+// Updates the statistics of the link. Returns 1 if the packet is
+// stale, i.e. it is a duplicate or it is older than a packet that was
+// received before, and 0 otherwise.
+static int datahub_update_stats(datahub_t *hub, addr_t *link, data_t *data)
+{
+        int stale = 0;
+        unsigned char key[DATAHUB_KEYLEN];
         
-        datahub_lock(hub);
+        datahub_key(link, key);
+        mutex_lock(hub->stats_mutex);
         
-        list = hub->links;
-        
-        while (list != NULL) {
-                link = list_get(list, addr_t);
-                int err = udp_socket_read(hub->socket, hub->input, link);
-                if (err == 0) {
-                        datahub_unlock(hub);
-                        if (hub->ondata)
-                                hub->ondata(hub->userdata, hub, link, hub->input);
-                        datahub_lock(hub);
-                        list = list_next(list);
-                } else {
-                        // TODO: are you sure this is the right way to
-                        // handle connection errors?
-                        list = list_next(list);
-                        hub->links = list_remove(hub->links, link);
-                        delete_addr(link);
+        seq_window_t *seq = hashtable_get(hub->stats, key, DATAHUB_KEYLEN);
+        if (seq == NULL) {
+                if (hashtable_size(hub->stats) >= DATAHUB_MAX_STATS)
+                        goto unlock;
+                seq = r_new(seq_window_t);
+                if (seq == NULL)
+                        goto unlock;
+                memset(seq, 0, sizeof(seq_window_t));
+                if (hashtable_set(hub->stats, key, DATAHUB_KEYLEN, seq) != 0) {
+                        r_delete(seq);
+                        goto unlock;
                 }
         }
+
+        stale = seq_window_update(seq, data);
         
-        datahub_unlock(hub);
+unlock:
+        mutex_unlock(hub->stats_mutex);
+        return stale;
+}
+
+static void datahub_handle_fragment(datahub_t *hub, addr_t *link, data_t *data)
+{
+        const char *message;
+        int len;
+
+        if (hub->onmessage == NULL || hub->reassembler == NULL) {
+                r_debug("datahub_handle_fragment: no onmessage callback, "
+                        "dropping the fragment");
+                return;
+        }
+        
+        if (reassembler_push(hub->reassembler, link, data, &message, &len) == 1)
+                hub->onmessage(hub->userdata, hub, link, message, len);
+}
+
+json_object_t datahub_parse(datahub_t *hub, data_t *data)
+{
+        json_object_t value;
+        
+        if (hub->num_parsed == DATAHUB_MAX_PARSED) {
+                r_warn("datahub_parse: too many values parsed in one callback");
+                return json_null();
+        }
+        
+        if (hub->parser == NULL) {
+                hub->parser = json_parser_create();
+                if (hub->parser == NULL)
+                        return json_null();
+        }
+        
+        value = data_parse(data, hub->parser);
+        hub->parsed[hub->num_parsed++] = value;
+        return value;
+}
+
+static void datahub_release_parsed(datahub_t *hub)
+{
+        for (int i = 0; i < hub->num_parsed; i++)
+                json_unref(hub->parsed[i]);
+        hub->num_parsed = 0;
+}
+
+static void datahub_handle_sync(datahub_t *hub, addr_t *sender, data_t *data)
+{
+        uint64_t t1 = data_clock_now();
+        char *reply = (char *) data_packet(hub->sync_reply)->data;
+        int len = clock_sync_make_reply(data_data(data), data_len(data), reply, t1);
+        if (len > 0) {
+                data_set_len(hub->sync_reply, len);
+                data_set_timestamp(hub->sync_reply);
+                udp_socket_send(hub->socket, sender, hub->sync_reply);
+        }
+}
+
+// A link tells that it receives the data sent to the group.
+static void datahub_handle_joined(datahub_t *hub, addr_t *sender, addr_t *group)
+{
+        int epoch;
+        datahub_links_t *links = datahub_read_begin(hub, &epoch);
+        datahub_link_t *link = datahub_links_find(links, sender);
+        if (link != NULL && links->has_group
+            && datahub_addr_eq(&links->group, group))
+                __atomic_store_n(&link->member, 1, __ATOMIC_RELAXED);
+        datahub_read_end(hub, epoch);
+}
+
+// Reads all the datagrams that are available, in batches, and passes
+// them on to the ondata callback together with the link they came
+// from.
+static void datahub_read(datahub_t *hub)
+{
+        int n;
+        
+        do {
+                n = udp_socket_read_many(hub->socket, hub->input, hub->senders,
+                                         DATAHUB_READ_BATCH);
+                if (n < 0)
+                        break;
+                
+                for (int i = 0; i < n; i++) {
+                        addr_t group;
+                        
+                        if (datalink_parse_joined(data_data(hub->input[i]),
+                                                  data_len(hub->input[i]),
+                                                  &group) == 0) {
+                                datahub_handle_joined(hub, &hub->senders[i], &group);
+                                continue;
+                        }
+                        if (clock_sync_is_request(data_data(hub->input[i]),
+                                                  data_len(hub->input[i]))) {
+                                datahub_handle_sync(hub, &hub->senders[i], hub->input[i]);
+                                continue;
+                        }
+                        
+                        // The sender may not be listed (yet). Broadcasts
+                        // compare the excluded link by address.
+                        addr_t *link = &hub->senders[i];
+
+                        int stale = datahub_update_stats(hub, link, hub->input[i]);
+                        
+                        // Fragments are reordered by the reassembler
+                        if (data_is_fragment(hub->input[i]))
+                                datahub_handle_fragment(hub, link, hub->input[i]);
+                        else if (hub->ondata != NULL
+                                 && (!stale || !hub->drop_stale)) {
+                                hub->ondata(hub->userdata, hub, link, hub->input[i]);
+                                datahub_release_parsed(hub);
+                        }
+                }
+                
+        } while (n == DATAHUB_READ_BATCH);
 }
 
 static void datahub_run_data(datahub_t *hub)
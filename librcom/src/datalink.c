@@ -29,17 +29,63 @@
 #include "util.h"
 
 #include "net.h"
+#include "fragment.h"
+#include "clocksync_priv.h"
+#include "shmring.h"
+#include "seqwindow.h"
 #include "datalink_priv.h"
 
+// The number of datagrams read per system call by the link's thread
+#define DATALINK_READ_BATCH 8
+
+// The interval, in seconds, between two attempts to join the
+// multicast group
+#define DATALINK_GROUP_RETRY 5.0
+
+#define DATALINK_JOINED_MAGIC "\xff" "GRP"
+
 struct _datalink_t {
         udp_socket_t socket;
         addr_t *addr;
         addr_t *remote_addr;
+        // The multicast group requested by the proxy, and the group
+        // that group_socket joined or tries to join. The hub is told
+        // regularly that the link receives the group's data. The
+        // socket is only touched by the thread that reads the data.
+        addr_t *group;
+        addr_t *joined;
+        udp_socket_t group_socket;
+        double group_retry;
+        double group_notified;
+        data_t *joined_notice;
+        // The ring through which a datahub on the same host sends its
+        // data. It is read by a second thread.
+        shm_ring_t *ring;
+        data_t *ring_in;
+        thread_t *ring_thread;
+        mutex_t *input_mutex;
         data_t* in;
         data_t* out;
+        data_t* batch[DATALINK_READ_BATCH];
+        addr_t senders[DATALINK_READ_BATCH];
         void* userdata;
         datalink_ondata_t ondata;
+        datalink_onmessage_t onmessage;
+        reassembler_t *reassembler;
+        data_t *fragment;
+        uint32_t msgid;
+        // The estimate of the clock offset of the remote datahub
+        clock_sync_t *sync;
+        data_t *sync_request;
         json_parser_t* parser;
+        // The sequence number of the next packet sent to the hub, and
+        // the window on the packets received from it. The window is
+        // updated by the UDP thread and by the ring thread.
+        uint32_t seqnum;
+        seq_window_t received;
+        mutex_t *stats_mutex;
+        int drop_stale;
+        int binary;
         int thread_quit;
         thread_t *thread;
         mutex_t *mutex;
@@ -47,6 +93,7 @@ struct _datalink_t {
 
 int datalink_start_thread(datalink_t *datalink);
 void datalink_stop_thread(datalink_t *datalink);
+static void datalink_open_ring(datalink_t *link);
 
 datalink_t* new_datalink(datalink_ondata_t callback, void* userdata)
 {
@@ -54,10 +101,21 @@ datalink_t* new_datalink(datalink_ondata_t callback, void* userdata)
         datalink_t* link;
                 
         link = r_new(datalink_t);
+        link->group_socket = INVALID_UDP_SOCKET;
         link->in = new_data();
         link->out = new_data();
+        for (int i = 0; i < DATALINK_READ_BATCH; i++)
+                link->batch[i] = new_data();
+        link->fragment = new_data();
+        link->sync = new_clock_sync();
+        link->sync_request = new_data();
+        link->joined_notice = new_data();
+        link->reassembler = new_reassembler(FRAGMENT_TIMEOUT);
         link->parser = json_parser_create();
         link->mutex = new_mutex();
+        link->input_mutex = new_mutex();
+        link->stats_mutex = new_mutex();
+        r_random(&link->seqnum, sizeof(link->seqnum));
         
         // create a UDP socket
         link->socket = open_udp_socket(0);
@@ -86,6 +144,8 @@ datalink_t* new_datalink(datalink_ondata_t callback, void* userdata)
                         delete_datalink(link);
                         return NULL;
                 }
+                // Not fatal: the data then arrives over UDP.
+                datalink_open_ring(link);
         }
         
         return link;
@@ -95,18 +155,181 @@ void delete_datalink(datalink_t* link)
 {
         if (link) {
                 datalink_stop_thread(link);
+                delete_shm_ring(link->ring);
+                delete_data(link->ring_in);
                 if (link->socket != INVALID_UDP_SOCKET)
                         close_udp_socket(link->socket);
+                if (link->group_socket != INVALID_UDP_SOCKET)
+                        close_udp_socket(link->group_socket);
+                delete_addr(link->group);
+                delete_addr(link->joined);
                 delete_data(link->in);
                 delete_data(link->out);
+                for (int i = 0; i < DATALINK_READ_BATCH; i++)
+                        delete_data(link->batch[i]);
+                delete_data(link->fragment);
+                delete_clock_sync(link->sync);
+                delete_data(link->sync_request);
+                delete_data(link->joined_notice);
+                delete_reassembler(link->reassembler);
                 json_parser_destroy(link->parser);
                 delete_addr(link->addr);
                 delete_addr(link->remote_addr);
                 delete_mutex(link->mutex);
+                delete_mutex(link->input_mutex);
+                delete_mutex(link->stats_mutex);
                 r_delete(link);
         }
 }
 
+static void datalink_handle_fragment(datalink_t* link, int i)
+{
+        const char *message;
+        int len;
+        
+        if (link->onmessage != NULL
+            && reassembler_push(link->reassembler, &link->senders[i],
+                                link->batch[i], &message, &len) == 1)
+                link->onmessage(link->userdata, link, message, len);
+}
+
+// Opens or closes the group socket when the proxy changed the group,
+// and retries a failed join. Once the socket joined the group, the
+// link tells the hub every DATALINK_JOINED_INTERVAL seconds. Until
+// then, the hub keeps sending the data to the link directly.
+static void datalink_update_group(datalink_t* link)
+{
+        double now = clock_time();
+        
+        mutex_lock(link->mutex);
+        
+        if (!((link->group == NULL && link->joined == NULL)
+              || (link->group != NULL && link->joined != NULL
+                  && addr_eq(link->group, link->joined)))) {
+                if (link->group_socket != INVALID_UDP_SOCKET) {
+                        close_udp_socket(link->group_socket);
+                        link->group_socket = INVALID_UDP_SOCKET;
+                }
+                delete_addr(link->joined);
+                link->joined = (link->group != NULL)? addr_clone(link->group) : NULL;
+                link->group_retry = 0.0;
+                link->group_notified = 0.0;
+        }
+
+        if (link->joined != NULL
+            && link->group_socket == INVALID_UDP_SOCKET
+            && now >= link->group_retry) {
+                link->group_socket = open_udp_multicast_socket(link->joined);
+                if (link->group_socket == INVALID_UDP_SOCKET) {
+                        if (link->group_retry == 0.0)
+                                r_warn("datalink_update_group: failed to join "
+                                       "the group, using unicast");
+                        link->group_retry = now + DATALINK_GROUP_RETRY;
+                }
+        }
+
+        if (link->group_socket != INVALID_UDP_SOCKET
+            && link->remote_addr != NULL
+            && now >= link->group_notified + DATALINK_JOINED_INTERVAL) {
+                char *notice = (char *) data_packet(link->joined_notice)->data;
+                data_set_len(link->joined_notice,
+                             datalink_make_joined(notice, link->joined));
+                data_set_timestamp(link->joined_notice);
+                udp_socket_send(link->socket, link->remote_addr,
+                                link->joined_notice);
+                link->group_notified = now;
+        }
+        
+        mutex_unlock(link->mutex);
+}
+
+int datalink_make_joined(char *buf, addr_t *group)
+{
+        memcpy(buf, DATALINK_JOINED_MAGIC, 4);
+        memcpy(buf + 4, &group->sin_addr.s_addr, 4);
+        memcpy(buf + 8, &group->sin_port, 2);
+        return DATALINK_JOINED_LEN;
+}
+
+int datalink_parse_joined(const char *data, int len, addr_t *group)
+{
+        if (len != DATALINK_JOINED_LEN
+            || memcmp(data, DATALINK_JOINED_MAGIC, 4) != 0)
+                return -1;
+        memset(group, 0, sizeof(addr_t));
+        group->sin_family = AF_INET;
+        memcpy(&group->sin_addr.s_addr, data + 4, 4);
+        memcpy(&group->sin_port, data + 8, 2);
+        return 0;
+}
+
+// Returns 1 if the data was a reply to a clock sync request.
+static int datalink_handle_sync(datalink_t* link, data_t *data)
+{
+        uint64_t t0, t1, t2;
+        uint64_t t3 = data_clock_now();
+        
+        if (clock_sync_parse_reply(data_data(data), data_len(data),
+                                   &t0, &t1, &t2) != 0)
+                return 0;
+        clock_sync_add(link->sync, t0, t1, t2, t3);
+        return 1;
+}
+
+// Updates the statistics. Returns 1 if the packet is stale and must
+// be dropped.
+static int datalink_drop_stale(datalink_t* link, data_t *data)
+{
+        mutex_lock(link->stats_mutex);
+        int stale = seq_window_update(&link->received, data);
+        mutex_unlock(link->stats_mutex);
+        return stale && link->drop_stale;
+}
+
+// Called by the UDP thread and by the ring thread.
+static void datalink_dispatch(datalink_t* link, data_t *data)
+{
+        mutex_lock(link->input_mutex);
+        
+        // Initilize the timestamp and reset the length of the reply
+        // data. The client can improve the accuracy of the timestamp
+        // if needed.
+        data_set_timestamp(link->out);
+        data_set_len(link->out, 0);
+        
+        link->ondata(link->userdata, link, data, link->out);
+        
+        if (data_len(link->out) > 0)
+                datalink_send(link, link->out);
+        
+        mutex_unlock(link->input_mutex);
+}
+
+// Handle all the datagrams that are available on the socket.
+static void datalink_drain(datalink_t* link, udp_socket_t socket)
+{
+        int n;
+        
+        do {
+                n = udp_socket_read_many(socket, link->batch, link->senders,
+                                         DATALINK_READ_BATCH);
+                for (int i = 0; i < n; i++) {
+                        // The replies to the clock sync requests are
+                        // not numbered.
+                        if (datalink_handle_sync(link, link->batch[i]))
+                                continue;
+                        
+                        int stale = datalink_drop_stale(link, link->batch[i]);
+                        
+                        // Fragments are reordered by the reassembler
+                        if (data_is_fragment(link->batch[i]))
+                                datalink_handle_fragment(link, i);
+                        else if (!stale)
+                                datalink_dispatch(link, link->batch[i]);
+                }
+        } while (n == DATALINK_READ_BATCH);
+}
+
 static void datalink_handle_input(datalink_t* link)
 {
         if (link->remote_addr == NULL) {
@@ -116,22 +339,17 @@ static void datalink_handle_input(datalink_t* link)
                 return;
         }
 
-        int wait_status;
-        data_t *data = datalink_read(link, 1, &wait_status);
-        if (wait_status == RCOM_WAIT_OK
-            && data != NULL
-            && link->ondata != NULL) {
-                // Initilize the timestamp and reset the length of the
-                // reply data. The client can improve the accuracy of
-                // the timestamp if needed.
-                data_set_timestamp(link->out);
-                data_set_len(link->out, 0);
-                
-                link->ondata(link->userdata, link, link->in, link->out);
-                
-                if (data_len(link->out) > 0)
-                        datalink_send(link, link->out);
-                
+        datalink_update_group(link);
+        
+        udp_socket_t sockets[2] = { link->socket, link->group_socket };
+        int ready[2];
+        int wait_status = udp_socket_wait_any(sockets, 2, 1, ready);
+        
+        if (wait_status == RCOM_WAIT_OK && link->ondata != NULL) {
+                for (int i = 0; i < 2; i++) {
+                        if (ready[i])
+                                datalink_drain(link, sockets[i]);
+                }
         } else if (wait_status == RCOM_WAIT_ERROR) {
                 r_debug("datalink_handle_input: datalink_read returned an error");
         } else if (wait_status == RCOM_WAIT_TIMEOUT) {
@@ -147,6 +365,53 @@ static void datalink_run(void* d)
                 datalink_handle_input(link);
 }
 
+static void datalink_run_ring(void* d)
+{
+        datalink_t* link = (datalink_t*) d;
+        int r;
+
+        while (!link->thread_quit && !app_quit()) {
+                if (shm_ring_wait(link->ring, 1.0) != RCOM_WAIT_OK)
+                        continue;
+                while ((r = shm_ring_read(link->ring, link->ring_in)) != 0) {
+                        // An invalid slot was skipped: ring_in still
+                        // holds the previous packet.
+                        if (r < 0)
+                                continue;
+                        if (data_is_fragment(link->ring_in))
+                                continue; // Large messages go over UDP
+                        if (!datalink_drop_stale(link, link->ring_in))
+                                datalink_dispatch(link, link->ring_in);
+                }
+        }
+}
+
+static void datalink_open_ring(datalink_t *link)
+{
+        char name[SHM_RING_NAMELEN];
+        
+        // The port makes the name unique on this host.
+        snprintf(name, sizeof(name), "/rcom-datalink-%d", addr_port(link->addr));
+        
+        link->ring = new_shm_ring(name, SHM_RING_SLOTS);
+        if (link->ring == NULL) {
+                r_warn("datalink_open_ring: failed to create the ring");
+                return;
+        }
+        
+        link->ring_in = new_data();
+        link->ring_thread = new_thread(datalink_run_ring, (void*) link);
+        if (link->ring_thread == NULL) {
+                delete_shm_ring(link->ring);
+                link->ring = NULL;
+        }
+}
+
+const char *datalink_ring_name(datalink_t* link)
+{
+        return (link->ring != NULL)? shm_ring_name(link->ring) : NULL;
+}
+
 data_t *datalink_get_output(datalink_t* link)
 {
         return link->out;
@@ -182,6 +447,12 @@ void datalink_stop_thread(datalink_t* link)
                 link->thread = NULL;
                 mutex_unlock(link->mutex);
         }
+        
+        if (link->ring_thread) {
+                thread_join(link->ring_thread);
+                delete_thread(link->ring_thread);
+                link->ring_thread = NULL;
+        }
 }
 
 addr_t *datalink_addr(datalink_t* link)
@@ -223,6 +494,19 @@ void datalink_set_remote_addr(datalink_t *link, addr_t *addr)
                 delete_addr(link->remote_addr);
         link->remote_addr = clone;
 
+        // The new hub has its own sequence numbers
+        mutex_lock(link->stats_mutex);
+        memset(&link->received, 0, sizeof(seq_window_t));
+        mutex_unlock(link->stats_mutex);
+        
+        mutex_unlock(link->mutex);
+}
+
+void datalink_set_group(datalink_t *link, addr_t *group)
+{
+        mutex_lock(link->mutex);
+        delete_addr(link->group);
+        link->group = (group != NULL)? addr_clone(group) : NULL;
         mutex_unlock(link->mutex);
 }
 
@@ -232,17 +516,53 @@ void datalink_set_remote_addr(datalink_t *link, addr_t *addr)
 data_t *datalink_read(datalink_t* link, int timeout, int *wait_status)
 {
         data_t *data = NULL;
+        udp_socket_t sockets[2];
+        int ready[2];
         
-        *wait_status = udp_socket_wait_data(link->socket, timeout);
+        datalink_update_group(link);
+        sockets[0] = link->socket;
+        sockets[1] = link->group_socket;
+        
+        *wait_status = udp_socket_wait_any(sockets, 2, timeout, ready);
         if (*wait_status == RCOM_WAIT_OK) {
                 addr_t addr; // FIXME
-                if (udp_socket_read(link->socket, link->in, &addr) == 0)
+                udp_socket_t socket = ready[0]? sockets[0] : sockets[1];
+                if (udp_socket_read(socket, link->in, &addr) == 0
+                    && !datalink_handle_sync(link, link->in)
+                    && !datalink_drop_stale(link, link->in))
                         data = link->in;
         }
         
         return data;
 }
 
+int datalink_sync_clock(datalink_t *link)
+{
+        char *request = (char *) data_packet(link->sync_request)->data;
+        int err = 0;
+        
+        mutex_lock(link->mutex);
+        if (link->remote_addr != NULL) {
+                data_set_len(link->sync_request,
+                             clock_sync_make_request(request, data_clock_now()));
+                data_set_timestamp(link->sync_request);
+                err = udp_socket_send(link->socket, link->remote_addr,
+                                      link->sync_request);
+        }
+        mutex_unlock(link->mutex);
+        return err;
+}
+
+int datalink_get_clock_offset(datalink_t *link, clock_offset_t *offset)
+{
+        return clock_sync_get(link->sync, offset);
+}
+
+uint64_t datalink_to_local_time(datalink_t *link, uint64_t timestamp)
+{
+        return clock_sync_to_local(link->sync, timestamp);
+}
+
 int datalink_sendto(datalink_t *link, addr_t *addr, data_t *data)
 {
         return udp_socket_send(link->socket, addr, data);
@@ -252,8 +572,10 @@ int datalink_send(datalink_t* link, data_t *data)
 {
         int err = 0;
         mutex_lock(link->mutex);
-        if (link->remote_addr != NULL)
+        if (link->remote_addr != NULL) {
+                data_set_seqnum(data, link->seqnum++);
                 err = udp_socket_send(link->socket, link->remote_addr, data);
+        }
         mutex_unlock(link->mutex);
         return err;
 }
@@ -277,7 +599,11 @@ int datalink_send_f(datalink_t* link, const char *format, ...)
 
 int datalink_send_obj(datalink_t *link, json_object_t obj)
 {
-        int err = data_serialise(link->out, obj);
+        int err = -1;
+        if (link->binary)
+                err = data_serialise_bin(link->out, obj);
+        if (err != 0)
+                err = data_serialise(link->out, obj);
         if (err == 0) {
                 data_set_timestamp(link->out);
                 err = datalink_send(link, link->out);
@@ -285,6 +611,75 @@ int datalink_send_obj(datalink_t *link, json_object_t obj)
         return err;
 }
 
+int datalink_send_array(datalink_t *link, const double *values, int n)
+{
+        int err = data_serialise_array(link->out, values, n);
+        if (err != 0) {
+                r_err("datalink_send_array: too many values");
+        } else {
+                data_set_timestamp(link->out);
+                err = datalink_send(link, link->out);
+        }
+        return err;
+}
+
+int datalink_get_stats(datalink_t *link, data_stats_t *stats)
+{
+        int err = -1;
+        mutex_lock(link->stats_mutex);
+        if (link->received.initialized) {
+                *stats = link->received.stats;
+                err = 0;
+        }
+        mutex_unlock(link->stats_mutex);
+        return err;
+}
+
+void datalink_set_drop_stale(datalink_t *link, int enable)
+{
+        link->drop_stale = enable;
+}
+
+void datalink_set_binary(datalink_t *link, int enable)
+{
+        link->binary = enable;
+}
+
+void datalink_set_onmessage(datalink_t *link, datalink_onmessage_t onmessage)
+{
+        link->onmessage = onmessage;
+}
+
+static int datalink_send_fragment(datalink_t *link, data_t *fragment)
+{
+        data_set_seqnum(fragment, link->seqnum++);
+        return udp_socket_send(link->socket, link->remote_addr, fragment);
+}
+
+int datalink_send_message(datalink_t *link, const char *data, int len)
+{
+        int err = 0;
+        
+        mutex_lock(link->mutex);
+        if (link->remote_addr != NULL) {
+                data_set_timestamp(link->fragment);
+                // Small messages that start with the reserved byte
+                // are also sent as a fragment.
+                if (len <= DATA_MAXLEN && !data_is_reserved(data, len)) {
+                        data_set_data(link->fragment, data, len);
+                        data_set_seqnum(link->fragment, link->seqnum++);
+                        err = udp_socket_send(link->socket, link->remote_addr,
+                                              link->fragment);
+                } else {
+                        err = fragment_split(data, len, link->msgid++, link->fragment,
+                                             (fragment_send_t) datalink_send_fragment,
+                                             link);
+                }
+        }
+        mutex_unlock(link->mutex);
+        return err;
+}
+
 json_object_t datalink_read_obj(datalink_t *link, int timeout)
 {
         json_object_t r = json_null();
@@ -21,19 +21,43 @@
   <http://www.gnu.org/licenses/>.
 
  */
+#define _GNU_SOURCE
 #include <errno.h>
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include <r.h>
 
 #include "dump.h"
 
 #include "registry_priv.h"
+#include "compress.h"
+
+#define DUMP_MAX_ATTEMPTS 100
 
 static int _dumping = 0;
+static char _session[64];
+static pthread_once_t _session_once = PTHREAD_ONCE_INIT;
 static char *_dumping_dir = NULL;
+static int _dumping_codec = COMPRESS_NONE;
+static int _dumping_level = 0;
 static char *_replay_id = NULL;
 
+static void dump_init_session()
+{
+        clock_datetime(_session, sizeof(_session), '-', '_', '-');
+}
+
 void set_dumping(int value)
 {
         _dumping = value;
@@ -61,6 +85,17 @@ const char *get_dumping_dir()
         return _dumping_dir;
 }
 
+int set_dumping_compression(int codec, int level)
+{
+        if (!compress_available(codec)) {
+                r_err("set_dumping_compression: codec %d is not available", codec);
+                return -1;
+        }
+        _dumping_codec = codec;
+        _dumping_level = level;
+        return 0;
+}
+
 void set_replay_id(const char *id)
 {
         if (_replay_id != NULL) {
@@ -85,15 +120,154 @@ int do_replay()
 
 /***********************************************************/
 
+/*
+ * Version 2 of the dump format. The file starts with the text header:
+ *
+ *   #rcom-dump 2\n
+ *   name\n type\n topic\n mimetype\n
+ *
+ * followed by the records, of at most DUMP_RECORD_MAXLEN bytes. Each
+ * record has a 16-byte header:
+ *
+ *   uint32 length of the payload
+ *   uint8  type (see dump_record_type_t)
+ *   uint8  flags, uint16 reserved
+ *   uint64 timestamp in microseconds
+ *
+ * When the dump is closed, the time index is appended as a record of
+ * type DUMP_RECORD_INDEX, followed by a fixed-size trailer that points
+ * to it. An entry is added to the index every DUMP_INDEX_RECORDS
+ * records, or when DUMP_INDEX_PERIOD microseconds passed since the
+ * previous entry. A dump that wasn't closed properly has no index; it
+ * is rebuilt by scanning the record headers when the dump is opened.
+ *
+ * A compressed dump groups the records in blocks of DUMP_BLOCK_SIZE
+ * bytes. Each block is written as a record of type DUMP_RECORD_BLOCK
+ * whose flags hold the codec and whose timestamp is that of its first
+ * record. The payload is a 24-byte prefix followed by the compressed
+ * records, which use the same 16-byte headers as above:
+ *
+ *   uint32 uncompressed length
+ *   uint32 number of records
+ *   uint64 timestamp of the last record
+ *   uint64 largest timestamp so far
+ *
+ * The index then points to the blocks. Each block gets an entry, so a
+ * seek only decompresses the block that holds the requested record.
+ *
+ * All integers are big-endian. Version 1 files have no magic line and
+ * their records are a 32-bit length followed by a data packet. They
+ * can still be read.
+ */
+#define DUMP_MAGIC "#rcom-dump 2"
+#define DUMP_RECORD_HEADER 16
+#define DUMP_INDEX_RECORDS 256
+#define DUMP_INDEX_PERIOD 1000000
+#define DUMP_INDEX_ENTRY 24
+#define DUMP_TRAILER_MAGIC "RCDINDEX"
+#define DUMP_TRAILER 48
+#define DUMP_RECORD_BLOCK 254
+#define DUMP_BLOCK_SIZE (256 * 1024)
+#define DUMP_BLOCK_PREFIX 24
+#define DUMP_RECORD_MAXLEN (64 * 1024 * 1024)
+// A block is flushed as soon as it holds DUMP_BLOCK_SIZE bytes, so it
+// is shorter than this.
+#define DUMP_BLOCK_MAXLEN (DUMP_BLOCK_SIZE + DUMP_RECORD_HEADER + DUMP_RECORD_MAXLEN)
+
+typedef struct _dump_index_entry_t {
+        // The largest timestamp of the records that precede the entry,
+        // so that the entries are sorted even when the records are not.
+        uint64_t timestamp;
+        uint64_t record;
+        uint64_t offset;
+} dump_index_entry_t;
+
+typedef struct _dump_writer_t dump_writer_t;
+
 struct _dump_t {
         FILE *fp;
         char *name;
         int type;
         char *topic;
         char *mimetype;
-        uint32_t offset;
+        int version;
+        int writing;
+        // The file offset and the number of the next record
+        uint64_t offset;
+        uint64_t record;
+        // The offset of the first record, and the offset where the
+        // records end
+        uint64_t start;
+        uint64_t end;
+        uint64_t count;
+        uint64_t first_timestamp;
+        uint64_t last_timestamp;
+        uint64_t max_timestamp;
+        uint64_t indexed_timestamp;
+        dump_index_entry_t *index;
+        int index_length;
+        int index_size;
+        dump_writer_t *writer;
+
+        // Compression. The records are collected in raw until a block
+        // is full.
+        int codec;
+        int level;
+        unsigned char *raw;
+        uint32_t raw_len;
+        uint32_t raw_size;
+        uint32_t raw_count;
+        uint64_t raw_record;
+        uint64_t raw_timestamp;
+        uint64_t raw_max_timestamp;
+        unsigned char *packed;
+        uint32_t packed_size;
+
+        // The decompressed block that is being read
+        unsigned char *block;
+        uint32_t block_size;
+        uint32_t block_len;
+        uint32_t block_pos;
+        uint32_t block_end;
+        uint64_t block_offset;
+        int block_valid;
+        int in_block;
 };
 
+static int dump_write_index(dump_t *dump);
+static int dump_stop_writer(dump_t *dump);
+static int dump_writer_push(dump_writer_t *writer, int type, uint64_t timestamp,
+                            const void *data, uint32_t len);
+static void dump_writer_copy(dump_writer_t *writer, const unsigned char *p,
+                             size_t len);
+static int dump_load_index(dump_t *dump);
+static int dump_scan(dump_t *dump);
+
+static inline void dump_put32(unsigned char *p, uint32_t v)
+{
+        p[0] = (unsigned char) (v >> 24);
+        p[1] = (unsigned char) (v >> 16);
+        p[2] = (unsigned char) (v >> 8);
+        p[3] = (unsigned char) v;
+}
+
+static inline void dump_put64(unsigned char *p, uint64_t v)
+{
+        dump_put32(p, (uint32_t) (v >> 32));
+        dump_put32(p + 4, (uint32_t) v);
+}
+
+static inline uint32_t dump_get32(const unsigned char *p)
+{
+        return (((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+                | ((uint32_t)p[2] << 8) | (uint32_t)p[3]);
+}
+
+static inline uint64_t dump_get64(const unsigned char *p)
+{
+        return ((uint64_t) dump_get32(p) << 32) | dump_get32(p + 4);
+}
+
 dump_t *new_dump()
 {
         dump_t *dump = r_new(dump_t);
@@ -103,15 +277,33 @@ dump_t *new_dump()
 
 void delete_dump(dump_t *dump)
 {
+        int failed = 0;
+        
         if (dump) {
-                if (dump->fp)
+                if (dump->writer)
+                        failed = (dump_stop_writer(dump) != 0);
+                if (dump->fp) {
+                        // Without the index, the readers scan the
+                        // records that made it to the file.
+                        if (dump->writing && !failed)
+                                dump_write_index(dump);
                         fclose(dump->fp);
+                }
                 if (dump->name)
                         r_free(dump->name);
                 if (dump->topic)
                         r_free(dump->topic);
                 if (dump->mimetype)
                         r_free(dump->mimetype);
+                if (dump->index)
+                        r_free(dump->index);
+                if (dump->raw)
+                        r_free(dump->raw);
+                if (dump->packed)
+                        r_free(dump->packed);
+                if (dump->block)
+                        r_free(dump->block);
+                r_delete(dump);
         }
 }
 
@@ -120,15 +312,26 @@ int dump_type(dump_t *dump)
         return dump->type;
 }
 
-dump_t *dump_create(const char *name,
-                    int type,
-                    const char *topic,
-                    const char *mimetype)
+const char *dump_name(dump_t *dump)
+{
+        return dump->name;
+}
+
+const char *dump_topic(dump_t *dump)
+{
+        return dump->topic;
+}
+
+const char *dump_mimetype(dump_t *dump)
+{
+        return dump->mimetype;
+}
+
+static dump_t *dump_new_writable(const char *name,
+                                 int type,
+                                 const char *topic,
+                                 const char *mimetype)
 {
-        char path[1024];
-        char timestamp[128];
-        const char *stype = registry_type_to_str(type); 
-        
         dump_t *dump = new_dump();
         if (dump == NULL) return NULL;
 
@@ -142,17 +345,54 @@ dump_t *dump_create(const char *name,
                 delete_dump(dump);
                 return NULL;
         }
+        return dump;
+}
+
+static void dump_begin(dump_t *dump, const char *path)
+{
+        r_info("Dumping to file '%s'", path);
+        fprintf(dump->fp, "%s\n%s\n%s\n%s\n%s\n", DUMP_MAGIC,
+                dump->name, registry_type_to_str(dump->type),
+                dump->topic, dump->mimetype);
         
-        clock_datetime(timestamp, 128, '-', '_', '-');
+        dump->version = 2;
+        dump->writing = 1;
+        dump->start = (uint64_t) ftello(dump->fp);
+        dump->offset = dump->start;
+}
 
-        if (_dumping_dir == NULL) {
-                snprintf(path, 1024, "%s-%s-%s-%s.dump",
-                         name, stype, topic, timestamp);
-        } else {
-                snprintf(path, 1024, "%s/%s-%s-%s-%s.dump",
-                         _dumping_dir, name, stype, topic, timestamp);
+dump_t *dump_create(const char *name,
+                    int type,
+                    const char *topic,
+                    const char *mimetype)
+{
+        char path[1024];
+        char timestamp[128];
+        const char *stype = registry_type_to_str(type); 
+        
+        dump_t *dump = dump_new_writable(name, type, topic, mimetype);
+        if (dump == NULL) return NULL;
+        
+        // All the dumps of a session carry the same date, so that a
+        // recording can be found and replayed as a set.
+        pthread_once(&_session_once, dump_init_session);
+
+        for (int i = 0; i < DUMP_MAX_ATTEMPTS; i++) {
+                if (i == 0)
+                        snprintf(timestamp, 128, "%s", _session);
+                else
+                        snprintf(timestamp, 128, "%s-%d", _session, i);
+                if (_dumping_dir == NULL) {
+                        snprintf(path, 1024, "%s-%s-%s-%s.dump",
+                                 name, stype, topic, timestamp);
+                } else {
+                        snprintf(path, 1024, "%s/%s-%s-%s-%s.dump",
+                                 _dumping_dir, name, stype, topic, timestamp);
+                }
+                dump->fp = fopen(path, "w+xb");
+                if (dump->fp != NULL || errno != EEXIST)
+                        break;
         }
-        dump->fp = fopen(path, "wb");
         if (dump->fp == NULL) {
                 char reason[200];
                 strerror_r(errno, reason, 200);
@@ -160,19 +400,75 @@ dump_t *dump_create(const char *name,
                 delete_dump(dump);
                 return NULL;
         }
-        r_info("Dumping to file '%s'", path);
-        fprintf(dump->fp, "%s\n%s\n%s\n%s\n", name, stype, topic, mimetype);
+        dump_begin(dump, path);
+        return dump;
+}
+
+dump_t *dump_create_file(const char *path,
+                         const char *name,
+                         int type,
+                         const char *topic,
+                         const char *mimetype)
+{
+        dump_t *dump = dump_new_writable(name, type, topic, mimetype);
+        if (dump == NULL) return NULL;
+        
+        dump->fp = fopen(path, "w+b");
+        if (dump->fp == NULL) {
+                char reason[200];
+                strerror_r(errno, reason, 200);
+                r_err("Failed to open dump '%s': %s", path, reason);
+                delete_dump(dump);
+                return NULL;
+        }
+        dump_begin(dump, path);
+        return dump;
+}
+
+dump_t *dump_start_recording(const char *name,
+                             int type,
+                             const char *topic,
+                             const char *mimetype)
+{
+        dump_t *dump;
         
+        if (!_dumping)
+                return NULL;
+        dump = dump_create(name, type, topic, mimetype);
+        if (dump == NULL)
+                return NULL;
+        if (_dumping_codec != COMPRESS_NONE
+            && dump_set_compression(dump, _dumping_codec, _dumping_level) != 0) {
+                r_warn("dump_start_recording: recording without compression");
+        }
+        // The hubs write from several threads, which only the
+        // background writer allows.
+        if (dump_start_writer(dump, NULL) != 0) {
+                r_warn("dump_start_recording: failed to start the writer, "
+                       "not recording '%s'", name);
+                delete_dump(dump);
+                return NULL;
+        }
         return dump;
 }
 
+static int dump_read_line(FILE *fp, char *line, int len)
+{
+        char *p;
+        if (fgets(line, len, fp) == NULL)
+                return -1;
+        if ((p = strchr(line, '\n')) != NULL) *p = '\0';
+        return 0;
+}
+
 dump_t *dump_open(const char *path)
 {
+        char magic[128];
         char name[128];
         char stype[128];
         char topic[128];
         char mimetype[128];
-        char *p;
+        int version = 1;
         
         FILE *fp = fopen(path, "rb");
         if (fp == NULL) {
@@ -182,38 +478,39 @@ dump_t *dump_open(const char *path)
                 return NULL;
         }
 
-        if (fgets(name, 128, fp) == NULL) {
+        if (dump_read_line(fp, magic, 128) != 0) {
                 r_err("Failed to read the dump header in '%s'", path);
                 fclose(fp);
                 return NULL;
         }
-        if ((p = strchr(name, '\n')) != NULL) *p = '\0';
-
-        if (fgets(stype, 128, fp) == NULL) {
-                r_err("Failed to read the dump header in '%s'", path);
-                fclose(fp);
-                return NULL;
+        
+        if (rstreq(magic, DUMP_MAGIC)) {
+                version = 2;
+                if (dump_read_line(fp, name, 128) != 0) {
+                        r_err("Failed to read the dump header in '%s'", path);
+                        fclose(fp);
+                        return NULL;
+                }
+        } else {
+                memcpy(name, magic, 128);
         }
-        if ((p = strchr(stype, '\n')) != NULL) *p = '\0';
 
-        if (fgets(topic, 128, fp) == NULL) {
+        if (dump_read_line(fp, stype, 128) != 0
+            || dump_read_line(fp, topic, 128) != 0
+            || dump_read_line(fp, mimetype, 128) != 0) {
                 r_err("Failed to read the dump header in '%s'", path);
                 fclose(fp);
                 return NULL;
         }
-        if ((p = strchr(topic, '\n')) != NULL) *p = '\0';
-
-        if (fgets(mimetype, 128, fp) == NULL) {
-                r_err("Failed to read the dump header in '%s'", path);
+        
+        dump_t *dump = new_dump();
+        if (dump == NULL) {
                 fclose(fp);
                 return NULL;
         }
-        if ((p = strchr(mimetype, '\n')) != NULL) *p = '\0';
-
-        
-        dump_t *dump = new_dump();
-        if (dump == NULL) return NULL;
 
+        dump->fp = fp;
+        dump->version = version;
         dump->name = r_strdup(name);
         dump->type = registry_str_to_type(stype);
         dump->topic = r_strdup(topic);
@@ -224,11 +521,21 @@ dump_t *dump_open(const char *path)
                 delete_dump(dump);
                 return NULL;
         }
+
+        dump->start = (uint64_t) ftello(fp);
+        if ((version == 2 && dump_load_index(dump) == 0)
+            || dump_scan(dump) == 0) {
+                dump_seek_record(dump, 0);
+                return dump;
+        }
         
-        return dump;
+        delete_dump(dump);
+        return NULL;
 }
 
-static inline int dump_write(dump_t *dump, void *ptr, uint32_t size)
+/***********************************************************/
+
+static inline int dump_write(dump_t *dump, const void *ptr, uint32_t size)
 {
         uint32_t s = fwrite(ptr, 1, size, dump->fp);
         if (s != size) {
@@ -238,7 +545,7 @@ static inline int dump_write(dump_t *dump, void *ptr, uint32_t size)
         return 0;
 }
 
-static inline int dump_read(dump_t *dump, char *ptr, uint32_t size)
+static inline int dump_read(dump_t *dump, void *ptr, uint32_t size)
 {
         uint32_t s = fread(ptr, 1, size, dump->fp);
         if (s != size) {
@@ -255,53 +562,1456 @@ static inline int dump_read(dump_t *dump, char *ptr, uint32_t size)
         return 0;
 }
 
+static int dump_reserve(unsigned char **buffer, uint32_t *size, uint32_t needed)
+{
+        if (needed > *size) {
+                unsigned char *p = r_realloc(*buffer, needed);
+                if (p == NULL)
+                        return -1;
+                *buffer = p;
+                *size = needed;
+        }
+        return 0;
+}
+
+static int dump_add_index_entry(dump_t *dump, uint64_t timestamp,
+                                uint64_t record, uint64_t offset)
+{
+        if (dump->index_length == dump->index_size) {
+                int size = (dump->index_size == 0)? 256 : 2 * dump->index_size;
+                dump_index_entry_t *index = r_realloc(dump->index,
+                                                      size * sizeof(dump_index_entry_t));
+                if (index == NULL)
+                        return -1;
+                dump->index = index;
+                dump->index_size = size;
+        }
+        dump_index_entry_t *e = &dump->index[dump->index_length++];
+        e->timestamp = timestamp;
+        e->record = record;
+        e->offset = offset;
+        return 0;
+}
+
+// Called before a record is added at the current offset.
+static void dump_update_index(dump_t *dump, uint64_t timestamp)
+{
+        if (dump->record % DUMP_INDEX_RECORDS == 0
+            || timestamp >= dump->indexed_timestamp + DUMP_INDEX_PERIOD) {
+                if (dump_add_index_entry(dump, dump->max_timestamp,
+                                         dump->record, dump->offset) == 0)
+                        dump->indexed_timestamp = timestamp;
+        }
+}
+
+// Updates the record count and the time range after a record was added.
+static void dump_count_record(dump_t *dump, uint64_t timestamp)
+{
+        if (dump->record == 0)
+                dump->first_timestamp = timestamp;
+        dump->last_timestamp = timestamp;
+        if (timestamp > dump->max_timestamp)
+                dump->max_timestamp = timestamp;
+        dump->record++;
+        dump->count = dump->record;
+}
+
+static void dump_make_header(unsigned char *h, int type, int flags,
+                             uint64_t timestamp, uint32_t len)
+{
+        dump_put32(h, len);
+        h[4] = (unsigned char) type;
+        h[5] = (unsigned char) flags;
+        h[6] = 0;
+        h[7] = 0;
+        dump_put64(h + 8, timestamp);
+}
+
+// Writes to the file, or to the buffer of the background writer when
+// called from its thread.
+static int dump_emit(dump_t *dump, const void *data, uint32_t len)
+{
+        if (dump->writer) {
+                dump_writer_copy(dump->writer, data, len);
+                return 0;
+        }
+        return dump_write(dump, data, len);
+}
+
+int dump_set_compression(dump_t *dump, int codec, int level)
+{
+        if (!dump->writing || dump->writer != NULL || dump->count > 0) {
+                r_err("dump_set_compression: must be called before writing");
+                return -1;
+        }
+        if (!compress_available(codec)) {
+                r_err("dump_set_compression: codec %d is not available", codec);
+                return -1;
+        }
+        dump->codec = codec;
+        dump->level = level;
+        return 0;
+}
+
+// Compresses the collected records and writes them as a block record.
+// Each block gets an index entry, so a seek only decompresses the
+// block that holds the requested record.
+static int dump_flush_block(dump_t *dump)
+{
+        unsigned char h[DUMP_RECORD_HEADER];
+        uint32_t bound;
+        long len;
+        int codec = dump->codec;
+        
+        if (dump->raw_len == 0)
+                return 0;
+
+        bound = (uint32_t) compress_bound(codec, dump->raw_len);
+        if (dump_reserve(&dump->packed, &dump->packed_size,
+                         DUMP_BLOCK_PREFIX + bound) != 0)
+                return -1;
+
+        len = compress_block(codec, dump->level, dump->raw, dump->raw_len,
+                             dump->packed + DUMP_BLOCK_PREFIX, bound);
+        if (len < 0 || (uint32_t) len >= dump->raw_len) {
+                // Incompressible: store the records as they are
+                codec = COMPRESS_NONE;
+                memcpy(dump->packed + DUMP_BLOCK_PREFIX, dump->raw, dump->raw_len);
+                len = dump->raw_len;
+        }
+
+        dump_put32(dump->packed, dump->raw_len);
+        dump_put32(dump->packed + 4, dump->raw_count);
+        dump_put64(dump->packed + 8, dump->last_timestamp);
+        dump_put64(dump->packed + 16, dump->max_timestamp);
+        
+        dump_add_index_entry(dump, dump->raw_max_timestamp,
+                             dump->raw_record, dump->offset);
+        dump_make_header(h, DUMP_RECORD_BLOCK, codec, dump->raw_timestamp,
+                         DUMP_BLOCK_PREFIX + (uint32_t) len);
+        
+        dump->raw_len = 0;
+        dump->raw_count = 0;
+        dump->offset += DUMP_RECORD_HEADER + DUMP_BLOCK_PREFIX + (uint64_t) len;
+        
+        if (dump_emit(dump, h, DUMP_RECORD_HEADER) != 0
+            || dump_emit(dump, dump->packed, DUMP_BLOCK_PREFIX + (uint32_t) len) != 0)
+                return -1;
+        return 0;
+}
+
+static int dump_append_block(dump_t *dump, int type, uint64_t timestamp,
+                             const void *data, uint32_t len)
+{
+        if (dump->raw_len == 0) {
+                dump->raw_record = dump->record;
+                dump->raw_timestamp = timestamp;
+                dump->raw_max_timestamp = dump->max_timestamp;
+        }
+        if (dump_reserve(&dump->raw, &dump->raw_size,
+                         dump->raw_len + DUMP_RECORD_HEADER + len) != 0)
+                return -1;
+        
+        dump_make_header(dump->raw + dump->raw_len, type, 0, timestamp, len);
+        memcpy(dump->raw + dump->raw_len + DUMP_RECORD_HEADER, data, len);
+        dump->raw_len += DUMP_RECORD_HEADER + len;
+        dump->raw_count++;
+        dump_count_record(dump, timestamp);
+
+        if (dump->raw_len >= DUMP_BLOCK_SIZE
+            || timestamp >= dump->raw_timestamp + DUMP_INDEX_PERIOD)
+                return dump_flush_block(dump);
+        return 0;
+}
+
+// Adds a record at the end of the dump. Called by the thread that
+// writes the file: the caller of dump_write_record(), or the
+// background writer.
+static int dump_append(dump_t *dump, int type, uint64_t timestamp,
+                       const void *data, uint32_t len)
+{
+        unsigned char h[DUMP_RECORD_HEADER];
+
+        if (dump->codec != COMPRESS_NONE)
+                return dump_append_block(dump, type, timestamp, data, len);
+        
+        dump_update_index(dump, timestamp);
+        dump_make_header(h, type, 0, timestamp, len);
+        dump_count_record(dump, timestamp);
+        dump->offset += DUMP_RECORD_HEADER + len;
+        if (dump_emit(dump, h, DUMP_RECORD_HEADER) != 0
+            || dump_emit(dump, data, len) != 0)
+                return -1;
+        return 0;
+}
+
+int dump_write_record(dump_t *dump, int type, uint64_t timestamp,
+                      const void *data, uint32_t len)
+{
+        if (!dump->writing) {
+                r_err("dump_write_record: the dump is not writable");
+                return -1;
+        }
+        if (len > DUMP_RECORD_MAXLEN) {
+                r_err("dump_write_record: the record is too large");
+                return -1;
+        }
+        if (dump->writer)
+                return dump_writer_push(dump->writer, type, timestamp, data, len);
+        return dump_append(dump, type, timestamp, data, len);
+}
+
 int dump_write_data(dump_t *dump, data_t *data)
 {
-        int err;
-        uint32_t n = PACKET_HEADER + data_len(data);
-        unsigned char b[4];
-        b[0] = (unsigned char) ((n & 0xff000000) >> 24);
-        b[1] = (unsigned char) ((n & 0x00ff0000) >> 16);
-        b[2] = (unsigned char) ((n & 0x0000ff00) >> 8);
-        b[3] = (unsigned char) (n & 0x000000ff);
-        err = dump_write(dump, b, 4);
-        if (err != 0) return err;
-        return dump_write(dump, data_packet(data), n);        
+        uint64_t timestamp = data_timestamp(data);
+        if (timestamp == 0)
+                timestamp = data_clock_now();
+        return dump_write_record(dump, DUMP_RECORD_DATA, timestamp,
+                                 data_packet(data), PACKET_HEADER + data_len(data));
 }
 
 int dump_write_buffer(dump_t *dump, char* buffer, uint32_t len)
 {
-        return dump_write(dump, buffer, len);        
+        return dump_write_record(dump, DUMP_RECORD_BUFFER, data_clock_now(),
+                                 buffer, len);
 }
 
-int dump_read_data(dump_t *dump, data_t *data)
+int dump_write_message(dump_t *dump, const char *data, int len)
+{
+        if (len < 0)
+                return -1;
+        return dump_write_record(dump, DUMP_RECORD_MESSAGE, data_clock_now(),
+                                 data, (uint32_t) len);
+}
+
+int dump_write_frame(dump_t *dump, const char *data, int len,
+                     const char *mimetype, double time)
 {
-        unsigned char b[4];
+        uint32_t mimetype_len = (uint32_t) strlen(mimetype) + 1;
+        uint32_t size = 8 + mimetype_len + (uint32_t) len;
+        uint64_t bits;
+        unsigned char *payload;
         int err;
-        uint32_t n;
+
+        if (len < 0)
+                return -1;
+        payload = r_alloc(size);
+        if (payload == NULL)
+                return -1;
+        
+        memcpy(&bits, &time, 8);
+        dump_put64(payload, bits);
+        memcpy(payload + 8, mimetype, mimetype_len);
+        memcpy(payload + 8 + mimetype_len, data, (size_t) len);
+        
+        err = dump_write_record(dump, DUMP_RECORD_FRAME, data_clock_now(),
+                                payload, size);
+        r_free(payload);
+        return err;
+}
+
+int dump_parse_frame(const void *payload, uint32_t len,
+                     const char **mimetype, double *time,
+                     const char **data, uint32_t *data_len)
+{
+        const unsigned char *p = (const unsigned char *) payload;
+        const unsigned char *end;
+        uint64_t bits;
+        
+        if (len < 9)
+                return -1;
+        end = memchr(p + 8, 0, len - 8);
+        if (end == NULL)
+                return -1;
         
-        err = dump_read(dump, (char*)b, 4);
-        if (err != 0)
-                return err;
+        bits = dump_get64(p);
+        memcpy(time, &bits, 8);
+        *mimetype = (const char *) p + 8;
+        *data = (const char *) end + 1;
+        *data_len = len - (uint32_t) (end + 1 - p);
+        return 0;
+}
+
+static int dump_write_index(dump_t *dump)
+{
+        unsigned char e[DUMP_INDEX_ENTRY];
+        unsigned char t[DUMP_TRAILER];
+        unsigned char h[DUMP_RECORD_HEADER];
+        uint64_t index_offset;
+        uint32_t len;
+
+        if (dump_flush_block(dump) != 0)
+                return -1;
         
-        n = (((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16)
-             | ((uint32_t)b[2] << 8) | (uint32_t)b[3]);
-        if (n > DATA_MAXLEN) {
-                r_err("Invalid data length: %d", n);
+        index_offset = dump->offset;
+        len = (uint32_t) dump->index_length * DUMP_INDEX_ENTRY;
+        
+        dump_make_header(h, DUMP_RECORD_INDEX, 0, dump->last_timestamp, len);
+        if (dump_write(dump, h, DUMP_RECORD_HEADER) != 0)
                 return -1;
+        for (int i = 0; i < dump->index_length; i++) {
+                dump_put64(e, dump->index[i].timestamp);
+                dump_put64(e + 8, dump->index[i].record);
+                dump_put64(e + 16, dump->index[i].offset);
+                if (dump_write(dump, e, DUMP_INDEX_ENTRY) != 0)
+                        return -1;
         }
+
+        memcpy(t, DUMP_TRAILER_MAGIC, 8);
+        dump_put64(t + 8, index_offset);
+        dump_put64(t + 16, (uint64_t) dump->index_length);
+        dump_put64(t + 24, dump->count);
+        dump_put64(t + 32, dump->first_timestamp);
+        dump_put64(t + 40, dump->last_timestamp);
+        return dump_write(dump, t, DUMP_TRAILER);
+}
+
+/***********************************************************/
+
+// Reads the index at the end of a dump that was closed properly.
+static int dump_load_index(dump_t *dump)
+{
+        unsigned char t[DUMP_TRAILER];
+        unsigned char h[DUMP_RECORD_HEADER];
+        unsigned char e[DUMP_INDEX_ENTRY];
+        uint64_t index_offset, length;
         
-        err = dump_read_buffer(dump, (void*) data_packet(data), n);
-        if (err != 0)
-                return err;
+        if (fseeko(dump->fp, -DUMP_TRAILER, SEEK_END) != 0
+            || dump_read(dump, t, DUMP_TRAILER) != 0
+            || memcmp(t, DUMP_TRAILER_MAGIC, 8) != 0)
+                return -1;
+
+        index_offset = dump_get64(t + 8);
+        length = dump_get64(t + 16);
+        if (index_offset < dump->start
+            || fseeko(dump->fp, (off_t) index_offset, SEEK_SET) != 0
+            || dump_read(dump, h, DUMP_RECORD_HEADER) != 0
+            || h[4] != DUMP_RECORD_INDEX
+            || dump_get32(h) != length * DUMP_INDEX_ENTRY)
+                return -1;
 
-        data_set_len(data, n - PACKET_HEADER);
+        dump->index_length = 0;
+        for (uint64_t i = 0; i < length; i++) {
+                if (dump_read(dump, e, DUMP_INDEX_ENTRY) != 0
+                    || dump_add_index_entry(dump, dump_get64(e), dump_get64(e + 8),
+                                            dump_get64(e + 16)) != 0)
+                        return -1;
+        }
+        
+        dump->end = index_offset;
+        dump->count = dump_get64(t + 24);
+        dump->first_timestamp = dump_get64(t + 32);
+        dump->last_timestamp = dump_get64(t + 40);
+        return 0;
+}
 
+// Reads the header of the next record in the file, if any. Returns -1
+// at the end of the records.
+static int dump_read_file_header(dump_t *dump, dump_record_t *record, int *flags)
+{
+        unsigned char h[DUMP_RECORD_HEADER];
+        
+        if (dump->end != 0 && dump->offset >= dump->end)
+                return -1;
+        
+        if (dump->version == 1) {
+                if (dump_read(dump, h, 4) != 0)
+                        return -1;
+                record->type = DUMP_RECORD_DATA;
+                record->len = dump_get32(h);
+                record->timestamp = 0;
+                *flags = 0;
+                if (record->len < PACKET_HEADER || record->len > PACKET_MAXLEN)
+                        return -1;
+                // The timestamp is in the packet header
+                if (dump_read(dump, h + 4, PACKET_HEADER) != 0)
+                        return -1;
+                record->timestamp = dump_get64(h + 8);
+                if (fseeko(dump->fp, -PACKET_HEADER, SEEK_CUR) != 0)
+                        return -1;
+                dump->offset += 4;
+                return 0;
+        }
+        
+        if (dump_read(dump, h, DUMP_RECORD_HEADER) != 0)
+                return -1;
+        record->len = dump_get32(h);
+        record->type = h[4];
+        record->timestamp = dump_get64(h + 8);
+        *flags = h[5];
+        if (record->type == DUMP_RECORD_INDEX)
+                return -1;
+        dump->offset += DUMP_RECORD_HEADER;
         return 0;
 }
 
-int dump_read_buffer(dump_t *dump, char *ptr, uint32_t size)
+// Decompresses the block record whose header was just read. The last
+// block is kept, so that moving back to it doesn't decompress it again.
+static int dump_load_block(dump_t *dump, dump_record_t *record, int codec,
+                           uint64_t offset)
 {
-        return dump_read(dump, ptr, size);
+        uint32_t raw_len;
+
+        if (dump->block_valid && dump->block_offset == offset) {
+                if (fseeko(dump->fp, (off_t) record->len, SEEK_CUR) != 0)
+                        return -1;
+        } else {
+                dump->block_valid = 0;
+                if (record->len < DUMP_BLOCK_PREFIX
+                    || dump->offset + record->len > dump->end) {
+                        r_err("dump_load_block: invalid block length");
+                        return -1;
+                }
+                if (dump_reserve(&dump->packed, &dump->packed_size, record->len) != 0
+                    || dump_read(dump, dump->packed, record->len) != 0)
+                        return -1;
+                raw_len = dump_get32(dump->packed);
+                if (raw_len > DUMP_BLOCK_MAXLEN
+                    || dump_reserve(&dump->block, &dump->block_size, raw_len) != 0
+                    || decompress_block(codec, dump->packed + DUMP_BLOCK_PREFIX,
+                                        record->len - DUMP_BLOCK_PREFIX,
+                                        dump->block, raw_len) != 0) {
+                        r_err("dump_load_block: invalid block");
+                        return -1;
+                }
+                dump->block_len = raw_len;
+                dump->block_offset = offset;
+                dump->block_valid = 1;
+        }
+        dump->offset += record->len;
+        dump->block_pos = 0;
+        dump->block_end = dump->block_len;
+        return 0;
 }
 
+// Reads the header of the next record, from the current block or
+// from the file.
+static int dump_read_record_header(dump_t *dump, dump_record_t *record)
+{
+        const unsigned char *h;
+        uint64_t offset;
+        int flags;
+        
+        while (1) {
+                if (dump->block_pos < dump->block_end) {
+                        if (dump->block_end - dump->block_pos < DUMP_RECORD_HEADER)
+                                return -1;
+                        h = dump->block + dump->block_pos;
+                        record->len = dump_get32(h);
+                        record->type = h[4];
+                        record->timestamp = dump_get64(h + 8);
+                        dump->block_pos += DUMP_RECORD_HEADER;
+                        if (record->len > dump->block_end - dump->block_pos)
+                                return -1;
+                        dump->in_block = 1;
+                        return 0;
+                }
+
+                dump->in_block = 0;
+                dump->block_end = 0;
+                offset = dump->offset;
+                if (dump_read_file_header(dump, record, &flags) != 0)
+                        return -1;
+                if (record->type != DUMP_RECORD_BLOCK)
+                        return 0;
+                if (dump_load_block(dump, record, flags, offset) != 0)
+                        return -1;
+        }
+}
+
+static int dump_read_payload(dump_t *dump, dump_record_t *record, void *buffer)
+{
+        if (dump->in_block) {
+                memcpy(buffer, dump->block + dump->block_pos, record->len);
+                dump->block_pos += record->len;
+        } else {
+                if (dump_read(dump, buffer, record->len) != 0)
+                        return -1;
+                dump->offset += record->len;
+        }
+        dump->record++;
+        return 0;
+}
+
+static int dump_skip_payload(dump_t *dump, dump_record_t *record)
+{
+        if (dump->in_block) {
+                dump->block_pos += record->len;
+        } else {
+                if (fseeko(dump->fp, (off_t) record->len, SEEK_CUR) != 0)
+                        return -1;
+                dump->offset += record->len;
+        }
+        dump->record++;
+        return 0;
+}
+
+// A position in the dump, to come back to after reading a header.
+typedef struct _dump_mark_t {
+        uint64_t offset;
+        uint64_t record;
+        uint32_t block_pos;
+        int in_block;
+} dump_mark_t;
+
+static void dump_mark(dump_t *dump, dump_mark_t *mark)
+{
+        mark->offset = dump->offset;
+        mark->record = dump->record;
+        mark->block_pos = dump->block_pos;
+        mark->in_block = (dump->block_pos < dump->block_end);
+}
+
+// A mark inside a block is only restored while that block is still
+// the current one.
+static int dump_restore(dump_t *dump, dump_mark_t *mark)
+{
+        if (mark->in_block) {
+                dump->block_pos = mark->block_pos;
+        } else {
+                dump->block_end = 0;
+                if (dump->offset != mark->offset
+                    && fseeko(dump->fp, (off_t) mark->offset, SEEK_SET) != 0)
+                        return -1;
+                dump->offset = mark->offset;
+        }
+        dump->record = mark->record;
+        return 0;
+}
+
+// Rebuilds the index of a dump that has none by reading the headers
+// of all the records. A truncated record at the end is ignored. The
+// blocks of a compressed dump are not decompressed: their prefix
+// holds the number of records and the timestamps.
+static int dump_scan(dump_t *dump)
+{
+        unsigned char prefix[DUMP_BLOCK_PREFIX];
+        dump_record_t record;
+        uint64_t offset = dump->start;
+        off_t size;
+        int flags;
+
+        if (fseeko(dump->fp, 0, SEEK_END) != 0)
+                return -1;
+        size = ftello(dump->fp);
+        if (size < 0 || fseeko(dump->fp, (off_t) dump->start, SEEK_SET) != 0)
+                return -1;
+        
+        dump->offset = dump->start;
+        dump->record = 0;
+        dump->end = 0;
+        dump->max_timestamp = 0;
+        dump->indexed_timestamp = 0;
+        dump->index_length = 0;
+        
+        while (1) {
+                offset = dump->offset;
+                if (dump_read_file_header(dump, &record, &flags) != 0
+                    || dump->offset + record.len > (uint64_t) size)
+                        break;
+                
+                if (record.type == DUMP_RECORD_BLOCK) {
+                        uint64_t last, max;
+                        if (record.len < DUMP_BLOCK_PREFIX
+                            || dump_read(dump, prefix, DUMP_BLOCK_PREFIX) != 0
+                            || fseeko(dump->fp, (off_t) (record.len - DUMP_BLOCK_PREFIX),
+                                      SEEK_CUR) != 0)
+                                break;
+                        dump_add_index_entry(dump, dump->max_timestamp,
+                                             dump->record, offset);
+                        if (dump->record == 0)
+                                dump->first_timestamp = record.timestamp;
+                        last = dump_get64(prefix + 8);
+                        max = dump_get64(prefix + 16);
+                        dump->record += dump_get32(prefix + 4);
+                        dump->last_timestamp = last;
+                        if (max > dump->max_timestamp)
+                                dump->max_timestamp = max;
+                } else {
+                        if (fseeko(dump->fp, (off_t) record.len, SEEK_CUR) != 0)
+                                break;
+                        dump->offset = offset;
+                        dump_update_index(dump, record.timestamp);
+                        dump_count_record(dump, record.timestamp);
+                }
+                dump->offset = offset + (uint64_t) (dump->version == 1? 4 : DUMP_RECORD_HEADER)
+                        + record.len;
+        }
+
+        dump->offset = offset;
+        dump->end = offset;
+        dump->count = dump->record;
+        return 0;
+}
+
+/***********************************************************/
+
+uint64_t dump_count(dump_t *dump)
+{
+        return dump->count;
+}
+
+int dump_time_range(dump_t *dump, uint64_t *first, uint64_t *last)
+{
+        if (dump->count == 0)
+                return -1;
+        *first = dump->first_timestamp;
+        *last = dump->last_timestamp;
+        return 0;
+}
+
+static int dump_goto(dump_t *dump, uint64_t record, uint64_t offset)
+{
+        if (fseeko(dump->fp, (off_t) offset, SEEK_SET) != 0) {
+                r_err("dump_seek: fseeko failed");
+                return -1;
+        }
+        dump->record = record;
+        dump->offset = offset;
+        dump->block_end = 0;
+        dump->in_block = 0;
+        return 0;
+}
+
+int dump_seek_record(dump_t *dump, uint64_t n)
+{
+        dump_record_t record;
+        int lo = 0, hi = dump->index_length - 1;
+        
+        if (dump->writing) {
+                r_err("dump_seek_record: the dump is opened for writing");
+                return -1;
+        }
+        if (n > dump->count)
+                return -1;
+
+        // The last index entry at or before the record
+        while (lo < hi) {
+                int mid = (lo + hi + 1) / 2;
+                if (dump->index[mid].record <= n)
+                        lo = mid;
+                else hi = mid - 1;
+        }
+        
+        if (dump->index_length == 0 || dump->index[lo].record > n) {
+                if (dump_goto(dump, 0, dump->start) != 0)
+                        return -1;
+        } else if (dump_goto(dump, dump->index[lo].record,
+                             dump->index[lo].offset) != 0) {
+                return -1;
+        }
+
+        while (dump->record < n) {
+                if (dump_read_record_header(dump, &record) != 0
+                    || dump_skip_payload(dump, &record) != 0)
+                        return -1;
+        }
+        return 0;
+}
+
+int dump_seek_time(dump_t *dump, uint64_t timestamp)
+{
+        dump_record_t record;
+        dump_mark_t mark;
+        int lo = 0, hi = dump->index_length - 1;
+        
+        if (dump->writing) {
+                r_err("dump_seek_time: the dump is opened for writing");
+                return -1;
+        }
+
+        // The entry timestamps are the largest timestamps of the
+        // records before them. Find the last entry before which all
+        // the records are older than the requested time.
+        while (lo < hi) {
+                int mid = (lo + hi + 1) / 2;
+                if (dump->index[mid].timestamp < timestamp)
+                        lo = mid;
+                else hi = mid - 1;
+        }
+
+        if (dump->index_length == 0 || dump->index[lo].timestamp >= timestamp) {
+                if (dump_goto(dump, 0, dump->start) != 0)
+                        return -1;
+        } else if (dump_goto(dump, dump->index[lo].record,
+                             dump->index[lo].offset) != 0) {
+                return -1;
+        }
+        
+        while (1) {
+                dump_mark(dump, &mark);
+                if (dump_read_record_header(dump, &record) != 0)
+                        return -1;
+                if (record.timestamp >= timestamp)
+                        return dump_restore(dump, &mark);
+                if (dump_skip_payload(dump, &record) != 0)
+                        return -1;
+        }
+}
+
+int dump_peek_record(dump_t *dump, dump_record_t *record)
+{
+        dump_mark_t mark;
+        
+        if (dump->writing)
+                return -1;
+        dump_mark(dump, &mark);
+        if (dump_read_record_header(dump, record) != 0)
+                return -1;
+        return dump_restore(dump, &mark);
+}
+
+int dump_read_record(dump_t *dump, dump_record_t *record,
+                     void *buffer, uint32_t len)
+{
+        dump_mark_t mark;
+        
+        if (dump->writing) {
+                r_err("dump_read_record: the dump is opened for writing");
+                return -1;
+        }
+        dump_mark(dump, &mark);
+        if (dump_read_record_header(dump, record) != 0)
+                return -1;
+        if (record->len > len) {
+                r_err("dump_read_record: the buffer is too small: %u > %u",
+                      record->len, len);
+                dump_restore(dump, &mark);
+                return -1;
+        }
+        return dump_read_payload(dump, record, buffer);
+}
+
+// Returns 0 when a data record was read, and -1 at the end of the
+// dump or in case of an error. Other records are skipped.
+int dump_read_data(dump_t *dump, data_t *data)
+{
+        dump_record_t record;
+        while (1) {
+                if (dump_read_record_header(dump, &record) != 0)
+                        return -1;
+                if (record.type != DUMP_RECORD_DATA) {
+                        if (dump_skip_payload(dump, &record) != 0)
+                                return -1;
+                        continue;
+                }
+                if (record.len < PACKET_HEADER || record.len > PACKET_MAXLEN) {
+                        r_err("Invalid data length: %u", record.len);
+                        return -1;
+                }
+                if (dump_read_payload(dump, &record, data_packet(data)) != 0)
+                        return -1;
+                data_set_len(data, record.len - PACKET_HEADER);
+                return 0;
+        }
+}
+
+// Returns the length of the buffer, or -1 at the end of the dump or
+// in case of an error. Other records are skipped.
+int dump_read_buffer(dump_t *dump, char* buffer, uint32_t len)
+{
+        dump_record_t record;
+        while (1) {
+                if (dump_read_record_header(dump, &record) != 0)
+                        return -1;
+                if (record.type != DUMP_RECORD_BUFFER) {
+                        if (dump_skip_payload(dump, &record) != 0)
+                                return -1;
+                        continue;
+                }
+                if (record.len > len) {
+                        r_err("The buffer is too small: %u > %u", record.len, len);
+                        return -1;
+                }
+                if (dump_read_payload(dump, &record, buffer) != 0)
+                        return -1;
+                return (int) record.len;
+        }
+}
+
+/***********************************************************/
+
+struct _dump_map_t {
+        // The dump provides the header and the index
+        dump_t *dump;
+        const unsigned char *base;
+        size_t size;
+};
+
+dump_map_t *dump_mmap_open(const char *path)
+{
+        struct stat st;
+        void *p;
+        
+        dump_map_t *map = r_new(dump_map_t);
+        if (map == NULL)
+                return NULL;
+
+        map->dump = dump_open(path);
+        if (map->dump == NULL)
+                goto error;
+        
+        if (fstat(fileno(map->dump->fp), &st) != 0) {
+                r_err("dump_mmap_open: fstat failed: %s", strerror(errno));
+                goto error;
+        }
+        if (st.st_size == 0 || (uint64_t) st.st_size < map->dump->end) {
+                r_err("dump_mmap_open: invalid size");
+                goto error;
+        }
+        
+        map->size = (size_t) st.st_size;
+        p = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE,
+                 fileno(map->dump->fp), 0);
+        if (p == MAP_FAILED) {
+                r_err("dump_mmap_open: mmap failed: %s", strerror(errno));
+                goto error;
+        }
+        map->base = p;
+        madvise(p, map->size, MADV_SEQUENTIAL);
+        return map;
+        
+error:
+        delete_dump(map->dump);
+        r_delete(map);
+        return NULL;
+}
+
+void dump_mmap_close(dump_map_t *map)
+{
+        if (map) {
+                if (map->base)
+                        munmap((void *) map->base, map->size);
+                delete_dump(map->dump);
+                r_delete(map);
+        }
+}
+
+dump_t *dump_mmap_dump(dump_map_t *map)
+{
+        return map->dump;
+}
+
+static void dump_cursor_set(dump_cursor_t *cursor, dump_map_t *map,
+                            uint64_t record, uint64_t offset, uint64_t end)
+{
+        cursor->map = map;
+        cursor->record = record;
+        cursor->offset = offset;
+        cursor->end = end;
+        cursor->block = NULL;
+        cursor->block_size = 0;
+        cursor->block_len = 0;
+        cursor->block_pos = 0;
+        cursor->block_offset = 0;
+}
+
+void dump_mmap_cursor(dump_map_t *map, dump_cursor_t *cursor)
+{
+        dump_cursor_set(cursor, map, 0, map->dump->start, map->dump->end);
+}
+
+void dump_mmap_cursor_release(dump_cursor_t *cursor)
+{
+        if (cursor->block)
+                r_free(cursor->block);
+        cursor->block = NULL;
+        cursor->block_size = 0;
+        cursor->block_len = 0;
+        cursor->block_pos = 0;
+        cursor->block_offset = 0;
+}
+
+int dump_mmap_partition(dump_map_t *map, int part, int parts,
+                        dump_cursor_t *cursor)
+{
+        dump_t *dump = map->dump;
+        int n = dump->index_length;
+        
+        if (parts <= 0 || part < 0 || part >= parts)
+                return -1;
+
+        // The ranges start at index entries so that each thread can
+        // start reading without scanning the preceding records.
+        int first = (int) ((int64_t) part * n / parts);
+        int last = (int) ((int64_t) (part + 1) * n / parts);
+        
+        if (first == last) {
+                dump_cursor_set(cursor, map, dump->count, dump->end, dump->end);
+        } else {
+                dump_cursor_set(cursor, map, dump->index[first].record,
+                                dump->index[first].offset,
+                                (last < n)? dump->index[last].offset : dump->end);
+        }
+        return 0;
+}
+
+// Decompresses the block record at the cursor into the buffer of the
+// cursor.
+static int dump_cursor_load_block(dump_cursor_t *cursor, const unsigned char *p,
+                                  uint32_t len)
+{
+        uint32_t raw_len;
+
+        if (len < DUMP_BLOCK_PREFIX)
+                return -1;
+        raw_len = dump_get32(p + DUMP_RECORD_HEADER);
+        
+        if (cursor->block_offset != cursor->offset) {
+                if (raw_len > DUMP_BLOCK_MAXLEN
+                    || dump_reserve(&cursor->block, &cursor->block_size, raw_len) != 0
+                    || decompress_block(p[5], p + DUMP_RECORD_HEADER + DUMP_BLOCK_PREFIX,
+                                        len - DUMP_BLOCK_PREFIX,
+                                        cursor->block, raw_len) != 0) {
+                        r_err("dump_mmap_next: invalid block");
+                        cursor->block_offset = 0;
+                        return -1;
+                }
+                cursor->block_offset = cursor->offset;
+        }
+        cursor->block_len = raw_len;
+        cursor->block_pos = 0;
+        cursor->offset += DUMP_RECORD_HEADER + len;
+        return 0;
+}
+
+int dump_mmap_next(dump_cursor_t *cursor, dump_view_t *view)
+{
+        dump_t *dump = cursor->map->dump;
+        const unsigned char *p;
+        uint32_t header = (dump->version == 1)? 4 : DUMP_RECORD_HEADER;
+        uint64_t available;
+
+        while (cursor->block_pos >= cursor->block_len) {
+                p = cursor->map->base + cursor->offset;
+                available = cursor->end - cursor->offset;
+                if (cursor->offset >= cursor->end || available < header)
+                        return -1;
+
+                view->len = dump_get32(p);
+                if (view->len > available - header)
+                        return -1;
+
+                if (dump->version == 1) {
+                        if (view->len < PACKET_HEADER)
+                                return -1;
+                        view->type = DUMP_RECORD_DATA;
+                        view->timestamp = dump_get64(p + 8);
+                } else if (p[4] == DUMP_RECORD_BLOCK) {
+                        if (dump_cursor_load_block(cursor, p, view->len) != 0)
+                                return -1;
+                        continue;
+                } else {
+                        view->type = p[4];
+                        view->timestamp = dump_get64(p + 8);
+                }
+                view->data = p + header;
+                view->record = cursor->record;
+
+                cursor->offset += header + view->len;
+                cursor->record++;
+                return 0;
+        }
+
+        p = cursor->block + cursor->block_pos;
+        if (cursor->block_len - cursor->block_pos < DUMP_RECORD_HEADER)
+                return -1;
+        view->len = dump_get32(p);
+        if (view->len > cursor->block_len - cursor->block_pos - DUMP_RECORD_HEADER)
+                return -1;
+        view->type = p[4];
+        view->timestamp = dump_get64(p + 8);
+        view->data = p + DUMP_RECORD_HEADER;
+        view->record = cursor->record;
+        
+        cursor->block_pos += DUMP_RECORD_HEADER + view->len;
+        cursor->record++;
+        return 0;
+}
+
+int dump_mmap_seek_time(dump_map_t *map, uint64_t timestamp,
+                        dump_cursor_t *cursor)
+{
+        dump_t *dump = map->dump;
+        dump_view_t view;
+        uint64_t offset, record;
+        uint32_t block_pos;
+        int in_block;
+        int lo = 0, hi = dump->index_length - 1;
+
+        while (lo < hi) {
+                int mid = (lo + hi + 1) / 2;
+                if (dump->index[mid].timestamp < timestamp)
+                        lo = mid;
+                else hi = mid - 1;
+        }
+        
+        if (dump->index_length == 0 || dump->index[lo].timestamp >= timestamp)
+                dump_cursor_set(cursor, map, 0, dump->start, dump->end);
+        else
+                dump_cursor_set(cursor, map, dump->index[lo].record,
+                                dump->index[lo].offset, dump->end);
+
+        while (1) {
+                offset = cursor->offset;
+                record = cursor->record;
+                block_pos = cursor->block_pos;
+                in_block = (cursor->block_pos < cursor->block_len);
+                if (dump_mmap_next(cursor, &view) != 0)
+                        return -1;
+                if (view.timestamp >= timestamp)
+                        break;
+        }
+
+        // Move back to the start of the record. The decompressed block
+        // is kept.
+        if (in_block) {
+                cursor->block_pos = block_pos;
+        } else {
+                cursor->offset = offset;
+                cursor->block_len = 0;
+                cursor->block_pos = 0;
+        }
+        cursor->record = record;
+        return 0;
+}
+
+int dump_view_payload(dump_view_t *view, const char **data, uint32_t *len)
+{
+        if (view->type != DUMP_RECORD_DATA || view->len < PACKET_HEADER)
+                return -1;
+        *data = (const char *) view->data + PACKET_HEADER;
+        *len = view->len - PACKET_HEADER;
+        return 0;
+}
+
+/***********************************************************/
+
+/*
+ * The asynchronous writer. The producers copy the records into nodes
+ * that are pushed on a lock-free, multiple-producer, single-consumer
+ * queue. The writer thread takes them off the queue, updates the index
+ * and copies them into a large, aligned buffer that is written out
+ * when it is full or when the queue is empty. The memory used by the
+ * queued records is bounded: when the budget is exhausted, the records
+ * are dropped and counted instead of blocking the producer.
+ */
+#define DUMP_BLOCK 4096
+#define DUMP_WRITER_TIMEOUT 0.1
+
+typedef struct _dump_node_t {
+        struct _dump_node_t *next;
+        int type;
+        uint64_t timestamp;
+        uint32_t len;
+        // Points to the bytes that follow the node
+        unsigned char *data;
+} dump_node_t;
+
+struct _dump_writer_t {
+        dump_t *dump;
+        thread_t *thread;
+        dump_writer_options_t options;
+        int fd;
+        int direct;
+        int quit;
+        
+        // Producers push at the head, the writer pops at the tail
+        dump_node_t *head;
+        dump_node_t *tail;
+        dump_node_t stub;
+        uint32_t sleeping;
+        uint32_t wakeup;
+        
+        // The buffer holds the file contents starting at file_offset,
+        // which is a multiple of DUMP_BLOCK when O_DIRECT is used.
+        unsigned char *buffer;
+        size_t fill;
+        uint64_t file_offset;
+        double last_sync;
+        int failed;
+
+        uint64_t pending;
+        dump_writer_stats_t stats;
+};
+
+void dump_writer_options_init(dump_writer_options_t *options)
+{
+        options->buffer_size = 1024 * 1024;
+        options->memory_budget = 16 * 1024 * 1024;
+        options->direct = 0;
+        options->sync = DUMP_SYNC_NONE;
+        options->sync_period = 1.0;
+}
+
+static void dump_queue_push(dump_writer_t *writer, dump_node_t *node)
+{
+        dump_node_t *prev;
+        __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+        prev = __atomic_exchange_n(&writer->head, node, __ATOMIC_ACQ_REL);
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+// Returns NULL when the queue is empty, or when a producer is half-way
+// through a push. In the latter case, the node will be available on
+// the next call.
+static dump_node_t *dump_queue_pop(dump_writer_t *writer)
+{
+        dump_node_t *tail = writer->tail;
+        dump_node_t *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+        
+        if (tail == &writer->stub) {
+                if (next == NULL)
+                        return NULL;
+                writer->tail = next;
+                tail = next;
+                next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+        }
+        if (next != NULL) {
+                writer->tail = next;
+                return tail;
+        }
+        if (tail != __atomic_load_n(&writer->head, __ATOMIC_ACQUIRE))
+                return NULL;
+        dump_queue_push(writer, &writer->stub);
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+        if (next != NULL) {
+                writer->tail = next;
+                return tail;
+        }
+        return NULL;
+}
+
+static void dump_writer_wake(dump_writer_t *writer)
+{
+        if (__atomic_load_n(&writer->sleeping, __ATOMIC_SEQ_CST)) {
+                __atomic_add_fetch(&writer->wakeup, 1, __ATOMIC_SEQ_CST);
+                syscall(SYS_futex, &writer->wakeup, FUTEX_WAKE, 1, NULL, NULL, 0);
+        }
+}
+
+static int dump_writer_push(dump_writer_t *writer, int type, uint64_t timestamp,
+                            const void *data, uint32_t len)
+{
+        uint64_t size = sizeof(dump_node_t) + len;
+        dump_node_t *node;
+
+        if (__atomic_load_n(&writer->failed, __ATOMIC_RELAXED)) {
+                __atomic_add_fetch(&writer->stats.dropped, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&writer->stats.dropped_bytes, len, __ATOMIC_RELAXED);
+                return -1;
+        }
+        if (__atomic_add_fetch(&writer->pending, size, __ATOMIC_RELAXED)
+            > writer->options.memory_budget) {
+                __atomic_sub_fetch(&writer->pending, size, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&writer->stats.dropped, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&writer->stats.dropped_bytes, len, __ATOMIC_RELAXED);
+                return -1;
+        }
+        
+        node = (dump_node_t *) r_alloc(size);
+        if (node == NULL) {
+                __atomic_sub_fetch(&writer->pending, size, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&writer->stats.dropped, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&writer->stats.dropped_bytes, len, __ATOMIC_RELAXED);
+                return -1;
+        }
+        node->data = (unsigned char *) (node + 1);
+        node->type = type;
+        node->timestamp = timestamp;
+        node->len = len;
+        memcpy(node->data, data, len);
+
+        dump_queue_push(writer, node);
+        dump_writer_wake(writer);
+        return 0;
+}
+
+static int dump_writer_pwrite(dump_writer_t *writer, size_t len)
+{
+        size_t written = 0;
+        while (written < len) {
+                ssize_t n = pwrite(writer->fd, writer->buffer + written,
+                                   len - written,
+                                   (off_t) (writer->file_offset + written));
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        r_err("dump_writer: write failed, stopping: %s",
+                              strerror(errno));
+                        __atomic_store_n(&writer->failed, 1, __ATOMIC_RELAXED);
+                        return -1;
+                }
+                written += (size_t) n;
+        }
+        __atomic_add_fetch(&writer->stats.writes, 1, __ATOMIC_RELAXED);
+        return 0;
+}
+
+static void dump_writer_sync(dump_writer_t *writer, int force)
+{
+        double now;
+        
+        switch (writer->options.sync) {
+        case DUMP_SYNC_NONE:
+                return;
+        case DUMP_SYNC_PERIODIC:
+                now = clock_time();
+                if (!force && now - writer->last_sync < writer->options.sync_period)
+                        return;
+                writer->last_sync = now;
+                break;
+        default:
+                break;
+        }
+        if (fdatasync(writer->fd) != 0 && !writer->failed)
+                r_warn("dump_writer: fdatasync failed: %s", strerror(errno));
+}
+
+// Writes out the buffer. With O_DIRECT, only whole blocks can be
+// written, so the incomplete last block is kept in the buffer, unless
+// all is set, in which case O_DIRECT is turned off first. Once a write
+// failed, nothing is written anymore.
+static void dump_writer_flush(dump_writer_t *writer, int all)
+{
+        size_t len = writer->fill;
+
+        if (writer->failed)
+                return;
+
+        if (writer->direct) {
+                if (all) {
+                        int flags = fcntl(writer->fd, F_GETFL);
+                        fcntl(writer->fd, F_SETFL, flags & ~O_DIRECT);
+                        writer->direct = 0;
+                } else {
+                        len -= len % DUMP_BLOCK;
+                }
+        }
+        if (len == 0)
+                return;
+
+        if (dump_writer_pwrite(writer, len) != 0)
+                return;
+        writer->file_offset += len;
+        writer->fill -= len;
+        if (writer->fill > 0)
+                memmove(writer->buffer, writer->buffer + len, writer->fill);
+        dump_writer_sync(writer, all);
+}
+
+static void dump_writer_copy(dump_writer_t *writer, const unsigned char *p,
+                             size_t len)
+{
+        size_t capacity = writer->options.buffer_size;
+        while (len > 0 && !writer->failed) {
+                size_t n = capacity - writer->fill;
+                if (n > len)
+                        n = len;
+                memcpy(writer->buffer + writer->fill, p, n);
+                writer->fill += n;
+                p += n;
+                len -= n;
+                if (writer->fill == capacity)
+                        dump_writer_flush(writer, 0);
+        }
+}
+
+static void dump_writer_append(dump_writer_t *writer, dump_node_t *node)
+{
+        if (writer->failed) {
+                __atomic_add_fetch(&writer->stats.dropped, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&writer->stats.dropped_bytes, node->len,
+                                   __ATOMIC_RELAXED);
+                return;
+        }
+        dump_append(writer->dump, node->type, node->timestamp,
+                    node->data, node->len);
+
+        __atomic_add_fetch(&writer->stats.records, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&writer->stats.bytes, DUMP_RECORD_HEADER + node->len,
+                           __ATOMIC_RELAXED);
+}
+
+static int dump_writer_drain(dump_writer_t *writer)
+{
+        dump_node_t *node;
+        uint64_t pending = __atomic_load_n(&writer->pending, __ATOMIC_RELAXED);
+        int count = 0;
+
+        if (pending > writer->stats.max_pending)
+                __atomic_store_n(&writer->stats.max_pending, pending, __ATOMIC_RELAXED);
+
+        while ((node = dump_queue_pop(writer)) != NULL) {
+                dump_writer_append(writer, node);
+                __atomic_sub_fetch(&writer->pending, sizeof(dump_node_t) + node->len,
+                                   __ATOMIC_RELAXED);
+                r_free(node);
+                count++;
+        }
+        return count;
+}
+
+static int dump_writer_queue_empty(dump_writer_t *writer)
+{
+        return (__atomic_load_n(&writer->pending, __ATOMIC_SEQ_CST) == 0);
+}
+
+static void dump_writer_wait(dump_writer_t *writer)
+{
+        struct timespec ts;
+        uint32_t wakeup = __atomic_load_n(&writer->wakeup, __ATOMIC_SEQ_CST);
+        
+        __atomic_store_n(&writer->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (dump_writer_queue_empty(writer)
+            && !__atomic_load_n(&writer->quit, __ATOMIC_SEQ_CST)) {
+                ts.tv_sec = 0;
+                ts.tv_nsec = (long) (DUMP_WRITER_TIMEOUT * 1000000000.0);
+                syscall(SYS_futex, &writer->wakeup, FUTEX_WAIT, wakeup, &ts, NULL, 0);
+        }
+        __atomic_store_n(&writer->sleeping, 0, __ATOMIC_SEQ_CST);
+}
+
+static void dump_writer_run(dump_writer_t *writer)
+{
+        while (1) {
+                int quit = __atomic_load_n(&writer->quit, __ATOMIC_SEQ_CST);
+                if (dump_writer_drain(writer) > 0)
+                        continue;
+                if (quit && dump_writer_queue_empty(writer))
+                        break;
+                // Idle: write out what was collected so far
+                dump_writer_flush(writer, 0);
+                dump_writer_wait(writer);
+        }
+        dump_flush_block(writer->dump);
+        dump_writer_flush(writer, 1);
+}
+
+int dump_start_writer(dump_t *dump, const dump_writer_options_t *options)
+{
+        dump_writer_t *writer;
+        void *buffer = NULL;
+        uint64_t start;
+        
+        if (!dump->writing || dump->writer != NULL) {
+                r_err("dump_start_writer: the dump is not writable "
+                      "or already has a writer");
+                return -1;
+        }
+        
+        writer = r_new(dump_writer_t);
+        if (writer == NULL)
+                return -1;
+        
+        if (options)
+                writer->options = *options;
+        else
+                dump_writer_options_init(&writer->options);
+
+        // Whole blocks only, so that the buffer can be used with O_DIRECT
+        writer->options.buffer_size -= writer->options.buffer_size % DUMP_BLOCK;
+        if (writer->options.buffer_size == 0)
+                writer->options.buffer_size = DUMP_BLOCK;
+        
+        if (posix_memalign(&buffer, DUMP_BLOCK, writer->options.buffer_size) != 0) {
+                r_err("dump_start_writer: out of memory");
+                r_delete(writer);
+                return -1;
+        }
+        
+        writer->dump = dump;
+        writer->buffer = buffer;
+        writer->head = &writer->stub;
+        writer->tail = &writer->stub;
+        writer->fd = fileno(dump->fp);
+        writer->last_sync = clock_time();
+
+        // From now on, the file is written through the descriptor. The
+        // start of the block that holds the end of the header is
+        // loaded in the buffer so that all the writes are aligned.
+        fflush(dump->fp);
+        start = dump->offset - dump->offset % DUMP_BLOCK;
+        writer->file_offset = start;
+        writer->fill = (size_t) (dump->offset - start);
+        if (writer->fill > 0
+            && pread(writer->fd, writer->buffer, writer->fill, (off_t) start)
+            != (ssize_t) writer->fill) {
+                r_err("dump_start_writer: failed to read the header");
+                free(buffer);
+                r_delete(writer);
+                return -1;
+        }
+
+        if (writer->options.direct) {
+                int flags = fcntl(writer->fd, F_GETFL);
+                if (flags == -1 || fcntl(writer->fd, F_SETFL, flags | O_DIRECT) != 0)
+                        r_warn("dump_start_writer: O_DIRECT is not supported, "
+                               "using buffered writes");
+                else
+                        writer->direct = 1;
+        }
+
+        dump->writer = writer;
+        writer->thread = new_thread((thread_run_t) dump_writer_run, writer);
+        if (writer->thread == NULL) {
+                r_err("dump_start_writer: failed to start the thread");
+                dump->writer = NULL;
+                if (writer->direct) {
+                        int flags = fcntl(writer->fd, F_GETFL);
+                        fcntl(writer->fd, F_SETFL, flags & ~O_DIRECT);
+                }
+                free(buffer);
+                r_delete(writer);
+                return -1;
+        }
+        return 0;
+}
+
+// Writes the queued records and stops the thread. The file position
+// of the stream is moved to the end of the records, so that the index
+// can be appended. Returns -1 if a write failed.
+static int dump_stop_writer(dump_t *dump)
+{
+        dump_writer_t *writer = dump->writer;
+        int err = 0;
+        
+        __atomic_store_n(&writer->quit, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&writer->wakeup, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &writer->wakeup, FUTEX_WAKE, 1, NULL, NULL, 0);
+        thread_join(writer->thread);
+        delete_thread(writer->thread);
+        
+        dump->writer = NULL;
+        fseeko(dump->fp, (off_t) dump->offset, SEEK_SET);
+        
+        if (writer->failed) {
+                r_err("Dump '%s': the recording is incomplete because a write "
+                      "failed", dump->name);
+                err = -1;
+        }
+        if (writer->stats.dropped > 0)
+                r_warn("Dump '%s': %llu records were dropped", dump->name,
+                       (unsigned long long) writer->stats.dropped);
+        free(writer->buffer);
+        r_delete(writer);
+        return err;
+}
+
+int dump_get_writer_stats(dump_t *dump, dump_writer_stats_t *stats)
+{
+        dump_writer_t *writer = dump->writer;
+        if (writer == NULL)
+                return -1;
+        stats->records = __atomic_load_n(&writer->stats.records, __ATOMIC_RELAXED);
+        stats->bytes = __atomic_load_n(&writer->stats.bytes, __ATOMIC_RELAXED);
+        stats->writes = __atomic_load_n(&writer->stats.writes, __ATOMIC_RELAXED);
+        stats->dropped = __atomic_load_n(&writer->stats.dropped, __ATOMIC_RELAXED);
+        stats->dropped_bytes = __atomic_load_n(&writer->stats.dropped_bytes,
+                                               __ATOMIC_RELAXED);
+        stats->pending = __atomic_load_n(&writer->pending, __ATOMIC_RELAXED);
+        stats->max_pending = __atomic_load_n(&writer->stats.max_pending,
+                                             __ATOMIC_RELAXED);
+        stats->failed = __atomic_load_n(&writer->failed, __ATOMIC_RELAXED);
+        return 0;
+}
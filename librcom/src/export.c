@@ -24,6 +24,7 @@
 
 #include <r.h>
 #include "util.h"
+#include "hashtable.h"
 #include "export.h"
 
 typedef struct _export_t
@@ -82,15 +83,6 @@ void delete_export(export_t* e)
         }
 }
 
-// FIXME: needed by service::request_handle only
-export_t *export_clone(export_t* e)
-{
-        export_t *n = new_export(e->name, e->mimetype_in, e->mimetype_out);
-        n->userdata = e->userdata;
-        n->onrequest = e->onrequest;
-        return n;
-}
-
 void export_set_onrequest(export_t* e,
                           void *userdata,
                           service_onrequest_t onrequest)
@@ -162,3 +154,57 @@ int export_matches(export_t* e, const char *name)
         return rstreq(name, e->name)
                 || (name[0] == '/' && rstreq(name+1, e->name));
 }
+
+/******************************************************************************/
+
+struct _export_table_t {
+        hashtable_t *index;
+        export_t *wildcard;
+};
+
+export_table_t *new_export_table(list_t *exports)
+{
+        export_table_t *table = r_new(export_table_t);
+        if (table == NULL)
+                return NULL;
+
+        table->index = new_hashtable(list_size(exports));
+        if (table->index == NULL) {
+                delete_export_table(table);
+                return NULL;
+        }
+
+        // The list is ordered newest first. Walk it in full but keep
+        // the first entry for a given name so that lookups return the
+        // same export as a linear search would.
+        for (list_t *l = exports; l != NULL; l = list_next(l)) {
+                export_t *e = list_get(l, export_t);
+                if (rstreq(e->name, "*")) {
+                        if (table->wildcard == NULL)
+                                table->wildcard = e;
+                } else if (hashtable_get_str(table->index, e->name) == NULL
+                           && hashtable_set_str(table->index, e->name, e) != 0) {
+                        delete_export_table(table);
+                        return NULL;
+                }
+        }
+        return table;
+}
+
+void delete_export_table(export_table_t *table)
+{
+        if (table) {
+                delete_hashtable(table->index);
+                r_delete(table);
+        }
+}
+
+export_t *export_table_get(export_table_t *table, const char *name)
+{
+        export_t *e = hashtable_get_str(table->index, name);
+        if (e == NULL && name[0] == '/')
+                e = hashtable_get_str(table->index, name + 1);
+        if (e == NULL)
+                e = table->wildcard;
+        return e;
+}
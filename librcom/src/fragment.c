@@ -0,0 +1,287 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#include <string.h>
+#include <r.h>
+#include "hashtable.h"
+#include "fragment.h"
+
+static const unsigned char fragment_magic[4] = { 0xff, 'F', 'R', 'G' };
+
+// The maximum number of incomplete messages kept by a reassembler
+#define FRAGMENT_MAX_PENDING 16
+
+// Key: IPv4 address, port, and message ID
+#define FRAGMENT_KEYLEN 10
+
+static inline void put_u16(unsigned char *p, uint16_t v)
+{
+        p[0] = (unsigned char) (v >> 8);
+        p[1] = (unsigned char) v;
+}
+
+static inline void put_u32(unsigned char *p, uint32_t v)
+{
+        p[0] = (unsigned char) (v >> 24);
+        p[1] = (unsigned char) (v >> 16);
+        p[2] = (unsigned char) (v >> 8);
+        p[3] = (unsigned char) v;
+}
+
+static inline uint16_t get_u16(const unsigned char *p)
+{
+        return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t get_u32(const unsigned char *p)
+{
+        return (((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+                | ((uint32_t) p[2] << 8) | (uint32_t) p[3]);
+}
+
+int data_is_fragment(data_t *data)
+{
+        return (data_len(data) >= FRAGMENT_HEADER
+                && memcmp(data_data(data), fragment_magic, 4) == 0);
+}
+
+int data_is_reserved(const char *data, int len)
+{
+        return len > 0 && (unsigned char) data[0] == fragment_magic[0];
+}
+
+int fragment_split(const char *message, int len, uint32_t msgid,
+                   data_t *out, fragment_send_t send, void *userdata)
+{
+        int count = (len + FRAGMENT_DATA_MAXLEN - 1) / FRAGMENT_DATA_MAXLEN;
+        unsigned char *p = (unsigned char *) data_packet(out)->data;
+        
+        if (count > FRAGMENT_MAX_COUNT) {
+                r_err("fragment_split: message too long (%d > %d)",
+                      len, FRAGMENT_MESSAGE_MAXLEN);
+                return -1;
+        }
+        
+        memcpy(p, fragment_magic, 4);
+        put_u32(p + 4, msgid);
+        put_u16(p + 10, (uint16_t) count);
+        put_u32(p + 12, (uint32_t) len);
+        
+        for (int i = 0; i < count; i++) {
+                int offset = i * FRAGMENT_DATA_MAXLEN;
+                int n = len - offset;
+                if (n > FRAGMENT_DATA_MAXLEN)
+                        n = FRAGMENT_DATA_MAXLEN;
+                
+                put_u16(p + 8, (uint16_t) i);
+                memcpy(p + FRAGMENT_HEADER, message + offset, n);
+                data_set_len(out, FRAGMENT_HEADER + n);
+                
+                if (send(userdata, out) != 0)
+                        return -1;
+        }
+        return 0;
+}
+
+/******************************************************************************/
+
+typedef struct _partial_t {
+        unsigned char key[FRAGMENT_KEYLEN];
+        int count;
+        int received;
+        int total;
+        unsigned char *have;
+        char *buffer;
+        double start;
+} partial_t;
+
+struct _reassembler_t {
+        hashtable_t *partials;
+        double timeout;
+        double last_sweep;
+        char *complete;
+        uint32_t dropped;
+};
+
+static void delete_partial(partial_t *p)
+{
+        if (p) {
+                r_free(p->have);
+                r_free(p->buffer);
+                r_delete(p);
+        }
+}
+
+static partial_t *new_partial(const unsigned char *key, int count, int total)
+{
+        partial_t *p = r_new(partial_t);
+        if (p == NULL)
+                return NULL;
+        memcpy(p->key, key, FRAGMENT_KEYLEN);
+        p->count = count;
+        p->total = total;
+        p->start = clock_time();
+        p->have = r_array(unsigned char, count);
+        p->buffer = r_array(char, total);
+        if (p->have == NULL || p->buffer == NULL) {
+                delete_partial(p);
+                return NULL;
+        }
+        memset(p->have, 0, count);
+        return p;
+}
+
+reassembler_t *new_reassembler(double timeout)
+{
+        reassembler_t *r = r_new(reassembler_t);
+        if (r == NULL)
+                return NULL;
+        r->timeout = timeout;
+        r->last_sweep = clock_time();
+        r->partials = new_hashtable(FRAGMENT_MAX_PENDING);
+        if (r->partials == NULL) {
+                r_delete(r);
+                return NULL;
+        }
+        return r;
+}
+
+static void reassembler_collect(void *userdata,
+                                const void *key __attribute__((unused)),
+                                int keylen __attribute__((unused)),
+                                void *value)
+{
+        list_t **list = (list_t **) userdata;
+        *list = list_prepend(*list, value);
+}
+
+// Removes all the partial messages that started before the given
+// time. Pass a negative time to remove them all.
+static void reassembler_drop(reassembler_t *r, double before)
+{
+        list_t *partials = NULL;
+        
+        hashtable_foreach(r->partials, reassembler_collect, &partials);
+        
+        for (list_t *l = partials; l != NULL; l = list_next(l)) {
+                partial_t *p = list_get(l, partial_t);
+                if (before < 0 || p->start < before) {
+                        hashtable_remove(r->partials, p->key, FRAGMENT_KEYLEN);
+                        delete_partial(p);
+                        if (before >= 0)
+                                r->dropped++;
+                }
+        }
+        delete_list(partials);
+}
+
+void delete_reassembler(reassembler_t *r)
+{
+        if (r) {
+                reassembler_drop(r, -1.0);
+                delete_hashtable(r->partials);
+                r_free(r->complete);
+                r_delete(r);
+        }
+}
+
+uint32_t reassembler_dropped(reassembler_t *r)
+{
+        return r->dropped;
+}
+
+int reassembler_push(reassembler_t *r, addr_t *from, data_t *fragment,
+                     const char **message, int *len)
+{
+        const unsigned char *p = (const unsigned char *) data_data(fragment);
+        unsigned char key[FRAGMENT_KEYLEN];
+        double now = clock_time();
+        
+        if (!data_is_fragment(fragment))
+                return -1;
+
+        int index = get_u16(p + 8);
+        int count = get_u16(p + 10);
+        int total = (int) get_u32(p + 12);
+        int n = data_len(fragment) - FRAGMENT_HEADER;
+        int expected = (index < count - 1)
+                ? FRAGMENT_DATA_MAXLEN
+                : total - (count - 1) * FRAGMENT_DATA_MAXLEN;
+
+        if (count == 0 || count > FRAGMENT_MAX_COUNT || index >= count
+            || total <= (count - 1) * FRAGMENT_DATA_MAXLEN
+            || total > count * FRAGMENT_DATA_MAXLEN
+            || n != expected) {
+                r_warn("reassembler_push: invalid fragment");
+                return -1;
+        }
+
+        if (now - r->last_sweep > r->timeout / 2) {
+                reassembler_drop(r, now - r->timeout);
+                r->last_sweep = now;
+        }
+        
+        memcpy(key, &from->sin_addr, 4);
+        memcpy(key + 4, &from->sin_port, 2);
+        memcpy(key + 6, p + 4, 4);
+        
+        partial_t *partial = hashtable_get(r->partials, key, FRAGMENT_KEYLEN);
+        if (partial == NULL) {
+                if (hashtable_size(r->partials) >= FRAGMENT_MAX_PENDING) {
+                        r->dropped++;
+                        return 0;
+                }
+                partial = new_partial(key, count, total);
+                if (partial == NULL
+                    || hashtable_set(r->partials, key, FRAGMENT_KEYLEN, partial) != 0) {
+                        r_err("reassembler_push: out of memory");
+                        delete_partial(partial);
+                        return -1;
+                }
+        } else if (partial->count != count || partial->total != total) {
+                r_warn("reassembler_push: inconsistent fragment");
+                return -1;
+        }
+
+        // Duplicate
+        if (partial->have[index])
+                return 0;
+        
+        memcpy(partial->buffer + index * FRAGMENT_DATA_MAXLEN,
+               p + FRAGMENT_HEADER, n);
+        partial->have[index] = 1;
+        partial->received++;
+        
+        if (partial->received < partial->count)
+                return 0;
+
+        hashtable_remove(r->partials, key, FRAGMENT_KEYLEN);
+        r_free(r->complete);
+        r->complete = partial->buffer;
+        partial->buffer = NULL;
+        delete_partial(partial);
+        
+        *message = r->complete;
+        *len = total;
+        return 1;
+}
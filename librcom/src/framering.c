@@ -0,0 +1,339 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <r.h>
+#include "framering.h"
+
+#define FRAMERING_MAGIC 0x52434d46 // "RCMF"
+#define FRAMERING_VERSION 2
+#define FRAMERING_PAGE 4096
+
+// A reader that hasn't called framering_read() for this long, in
+// milliseconds, is taken to be gone.
+#define FRAMERING_READER_TIMEOUT 3000
+
+typedef struct _framering_header_t {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slots;
+        uint32_t reserved;
+        uint64_t frame_maxlen;
+        uint64_t slot_size;
+        // Cleared by the writer when it deletes the ring
+        uint32_t alive;
+        uint32_t readers;
+        // The last time a reader called framering_read(). A reader
+        // that crashed never decrements the readers count.
+        uint64_t heartbeat;
+        // The number of frames written. Readers sleep on it.
+        uint32_t counter __attribute__((aligned(64)));
+} framering_header_t;
+
+// Each slot is protected by a sequence lock: seq is odd while the
+// writer updates the slot.
+typedef struct _framering_slot_t {
+        uint32_t seq;
+        uint32_t length;
+        double timestamp;
+        char mimetype[FRAMERING_MIMETYPE_MAXLEN];
+} framering_slot_t;
+
+struct _framering_t {
+        char name[FRAMERING_NAMELEN];
+        int owner;
+        size_t size;
+        framering_header_t *header;
+        unsigned char *base;
+        uint32_t last;
+        uint32_t overruns;
+};
+
+// Milliseconds on the monotonic clock, which all the processes share
+static uint64_t framering_now()
+{
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (uint64_t) t.tv_sec * 1000 + (uint64_t) t.tv_nsec / 1000000;
+}
+
+static size_t framering_align(size_t n)
+{
+        return (n + FRAMERING_PAGE - 1) & ~((size_t) FRAMERING_PAGE - 1);
+}
+
+static framering_slot_t *framering_slot(framering_t *ring, uint32_t n)
+{
+        framering_header_t *h = ring->header;
+        return (framering_slot_t *) (ring->base + (n % h->slots) * h->slot_size);
+}
+
+static framering_t *framering_map(const char *name, int fd, size_t size, int owner)
+{
+        framering_t *ring;
+        void *p;
+
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+                r_err("framering_map: mmap failed: %s", strerror(errno));
+                return NULL;
+        }
+        
+        ring = r_new(framering_t);
+        if (ring == NULL) {
+                munmap(p, size);
+                return NULL;
+        }
+        
+        strncpy(ring->name, name, FRAMERING_NAMELEN - 1);
+        ring->owner = owner;
+        ring->size = size;
+        ring->header = (framering_header_t *) p;
+        ring->base = (unsigned char *) p + FRAMERING_PAGE;
+        return ring;
+}
+
+framering_t *new_framering(const char *name, int slots, size_t frame_maxlen)
+{
+        framering_t *ring;
+        size_t slot_size;
+        size_t size;
+        int fd;
+
+        if (name == NULL || name[0] != '/' || strlen(name) >= FRAMERING_NAMELEN
+            || slots < 2 || frame_maxlen == 0 || frame_maxlen > UINT32_MAX) {
+                r_err("new_framering: invalid arguments");
+                return NULL;
+        }
+
+        slot_size = framering_align(sizeof(framering_slot_t) + frame_maxlen);
+        size = FRAMERING_PAGE + (size_t) slots * slot_size;
+        
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd == -1) {
+                r_err("new_framering: shm_open failed: %s", strerror(errno));
+                return NULL;
+        }
+        
+        if (ftruncate(fd, (off_t) size) != 0) {
+                r_err("new_framering: ftruncate failed: %s", strerror(errno));
+                close(fd);
+                shm_unlink(name);
+                return NULL;
+        }
+
+        ring = framering_map(name, fd, size, 1);
+        close(fd);
+        if (ring == NULL) {
+                shm_unlink(name);
+                return NULL;
+        }
+
+        ring->header->version = FRAMERING_VERSION;
+        ring->header->slots = (uint32_t) slots;
+        ring->header->frame_maxlen = frame_maxlen;
+        ring->header->slot_size = slot_size;
+        ring->header->alive = 1;
+        __atomic_store_n(&ring->header->magic, FRAMERING_MAGIC, __ATOMIC_RELEASE);
+        
+        return ring;
+}
+
+framering_t *open_framering(const char *name)
+{
+        framering_t *ring;
+        framering_header_t *h;
+        struct stat st;
+        int fd;
+        
+        if (name == NULL || strlen(name) >= FRAMERING_NAMELEN) {
+                r_err("open_framering: invalid name");
+                return NULL;
+        }
+        
+        fd = shm_open(name, O_RDWR, 0);
+        if (fd == -1) {
+                r_err("open_framering: shm_open failed: %s", strerror(errno));
+                return NULL;
+        }
+        
+        if (fstat(fd, &st) != 0 || (size_t) st.st_size < FRAMERING_PAGE) {
+                r_err("open_framering: invalid shared memory size");
+                close(fd);
+                return NULL;
+        }
+        
+        ring = framering_map(name, fd, (size_t) st.st_size, 0);
+        close(fd);
+        if (ring == NULL)
+                return NULL;
+
+        h = ring->header;
+        if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != FRAMERING_MAGIC
+            || h->version != FRAMERING_VERSION
+            || h->slots < 2
+            || h->slot_size < sizeof(framering_slot_t) + h->frame_maxlen
+            || FRAMERING_PAGE + h->slots * h->slot_size > ring->size) {
+                r_err("open_framering: invalid ring '%s'", name);
+                munmap(ring->header, ring->size);
+                r_delete(ring);
+                return NULL;
+        }
+
+        // Wait for the next frame, not the one already in the ring.
+        ring->last = __atomic_load_n(&h->counter, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&h->heartbeat, framering_now(), __ATOMIC_RELAXED);
+        __atomic_add_fetch(&h->readers, 1, __ATOMIC_SEQ_CST);
+        return ring;
+}
+
+void delete_framering(framering_t *ring)
+{
+        if (ring) {
+                if (ring->owner) {
+                        // Wake up the readers so that they see that
+                        // the ring is closed.
+                        __atomic_store_n(&ring->header->alive, 0, __ATOMIC_SEQ_CST);
+                        syscall(SYS_futex, &ring->header->counter, FUTEX_WAKE,
+                                INT_MAX, NULL, NULL, 0);
+                        shm_unlink(ring->name);
+                } else
+                        __atomic_sub_fetch(&ring->header->readers, 1, __ATOMIC_SEQ_CST);
+                munmap(ring->header, ring->size);
+                r_delete(ring);
+        }
+}
+
+const char *framering_name(framering_t *ring)
+{
+        return ring->name;
+}
+
+int framering_has_readers(framering_t *ring)
+{
+        framering_header_t *h = ring->header;
+        return (__atomic_load_n(&h->readers, __ATOMIC_RELAXED) > 0
+                && (framering_now() - __atomic_load_n(&h->heartbeat, __ATOMIC_RELAXED)
+                    < FRAMERING_READER_TIMEOUT));
+}
+
+uint32_t framering_overruns(framering_t *ring)
+{
+        return ring->overruns;
+}
+
+int framering_write(framering_t *ring, const char *data, size_t length,
+                    const char *mimetype, double timestamp)
+{
+        framering_header_t *h = ring->header;
+        uint32_t n = __atomic_load_n(&h->counter, __ATOMIC_RELAXED);
+        framering_slot_t *slot = framering_slot(ring, n);
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+
+        if (length > h->frame_maxlen) {
+                r_err("framering_write: frame too large (%zu > %zu)",
+                      length, (size_t) h->frame_maxlen);
+                return -1;
+        }
+        
+        __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        slot->length = (uint32_t) length;
+        slot->timestamp = timestamp;
+        strncpy(slot->mimetype, mimetype? mimetype : "", FRAMERING_MIMETYPE_MAXLEN - 1);
+        slot->mimetype[FRAMERING_MIMETYPE_MAXLEN - 1] = 0;
+        memcpy((char *) (slot + 1), data, length);
+        
+        __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+        __atomic_store_n(&h->counter, n + 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &h->counter, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+        
+        return 0;
+}
+
+int framering_read(framering_t *ring, double timeout,
+                   framering_onframe_t onframe, void *userdata)
+{
+        framering_header_t *h = ring->header;
+        char mimetype[FRAMERING_MIMETYPE_MAXLEN];
+        framering_slot_t *slot;
+        struct timespec ts;
+        uint32_t counter;
+        uint32_t seq;
+        uint32_t length;
+        double timestamp;
+        
+        if (timeout < 0 || !__atomic_load_n(&h->alive, __ATOMIC_SEQ_CST))
+                return RCOM_WAIT_ERROR;
+
+        __atomic_store_n(&h->heartbeat, framering_now(), __ATOMIC_RELAXED);
+
+        counter = __atomic_load_n(&h->counter, __ATOMIC_ACQUIRE);
+        if (counter == ring->last) {
+                ts.tv_sec = (time_t) timeout;
+                ts.tv_nsec = (long) ((timeout - (double) ts.tv_sec) * 1000000000.0);
+                syscall(SYS_futex, &h->counter, FUTEX_WAIT, ring->last, &ts, NULL, 0);
+                if (!__atomic_load_n(&h->alive, __ATOMIC_SEQ_CST))
+                        return RCOM_WAIT_ERROR;
+                counter = __atomic_load_n(&h->counter, __ATOMIC_ACQUIRE);
+                if (counter == ring->last)
+                        return RCOM_WAIT_TIMEOUT;
+        }
+
+        // Only the most recent frame is of interest.
+        ring->overruns += counter - ring->last - 1;
+        ring->last = counter;
+        slot = framering_slot(ring, counter - 1);
+
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        length = slot->length;
+        timestamp = slot->timestamp;
+        memcpy(mimetype, slot->mimetype, FRAMERING_MIMETYPE_MAXLEN);
+        mimetype[FRAMERING_MIMETYPE_MAXLEN - 1] = 0;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        
+        if ((seq & 1) != 0 || length > h->frame_maxlen
+            || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+                ring->overruns++;
+                return RCOM_WAIT_OK;
+        }
+
+        onframe(userdata, mimetype, (const char *) (slot + 1), (int) length, timestamp);
+
+        // The writer may have wrapped around while the callback ran.
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+                ring->overruns++;
+        
+        return RCOM_WAIT_OK;
+}
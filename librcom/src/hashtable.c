@@ -0,0 +1,231 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#include <string.h>
+#include <r.h>
+
+#include "hashtable.h"
+
+typedef struct _hashtable_entry_t {
+        uint32_t hash;
+        int keylen;
+        char *key;
+        void *value;
+} hashtable_entry_t;
+
+struct _hashtable_t {
+        hashtable_entry_t *entries;
+        uint32_t capacity;
+        int size;
+};
+
+// FNV-1a
+uint32_t hash_bytes(const void *key, int keylen)
+{
+        const unsigned char *p = (const unsigned char *) key;
+        uint32_t h = 2166136261u;
+        for (int i = 0; i < keylen; i++) {
+                h ^= p[i];
+                h *= 16777619u;
+        }
+        return h;
+}
+
+static uint32_t hashtable_capacity_for(int size)
+{
+        // Keep the load factor at or below 1/2.
+        uint32_t capacity = 8;
+        while (capacity < 2 * (uint32_t) size)
+                capacity <<= 1;
+        return capacity;
+}
+
+hashtable_t *new_hashtable(int size_hint)
+{
+        hashtable_t *table = r_new(hashtable_t);
+        if (table == NULL)
+                return NULL;
+        
+        table->capacity = hashtable_capacity_for(size_hint);
+        table->entries = r_array(hashtable_entry_t, table->capacity);
+        if (table->entries == NULL) {
+                r_delete(table);
+                return NULL;
+        }
+        memset(table->entries, 0, table->capacity * sizeof(hashtable_entry_t));
+        return table;
+}
+
+void delete_hashtable(hashtable_t *table)
+{
+        if (table) {
+                if (table->entries) {
+                        for (uint32_t i = 0; i < table->capacity; i++)
+                                if (table->entries[i].key)
+                                        r_free(table->entries[i].key);
+                        r_delete(table->entries);
+                }
+                r_delete(table);
+        }
+}
+
+int hashtable_size(hashtable_t *table)
+{
+        return table->size;
+}
+
+static hashtable_entry_t *hashtable_find(hashtable_t *table, uint32_t hash,
+                                         const void *key, int keylen)
+{
+        uint32_t mask = table->capacity - 1;
+        uint32_t i = hash & mask;
+        
+        while (table->entries[i].key != NULL) {
+                hashtable_entry_t *e = &table->entries[i];
+                if (e->hash == hash
+                    && e->keylen == keylen
+                    && memcmp(e->key, key, keylen) == 0)
+                        return e;
+                i = (i + 1) & mask;
+        }
+        return NULL;
+}
+
+static void hashtable_insert_entry(hashtable_entry_t *entries, uint32_t capacity,
+                                   hashtable_entry_t *entry)
+{
+        uint32_t mask = capacity - 1;
+        uint32_t i = entry->hash & mask;
+        while (entries[i].key != NULL)
+                i = (i + 1) & mask;
+        entries[i] = *entry;
+}
+
+static int hashtable_grow(hashtable_t *table)
+{
+        uint32_t capacity = table->capacity << 1;
+        hashtable_entry_t *entries = r_array(hashtable_entry_t, capacity);
+        if (entries == NULL)
+                return -1;
+        memset(entries, 0, capacity * sizeof(hashtable_entry_t));
+        
+        for (uint32_t i = 0; i < table->capacity; i++)
+                if (table->entries[i].key != NULL)
+                        hashtable_insert_entry(entries, capacity, &table->entries[i]);
+        
+        r_delete(table->entries);
+        table->entries = entries;
+        table->capacity = capacity;
+        return 0;
+}
+
+int hashtable_set(hashtable_t *table, const void *key, int keylen, void *value)
+{
+        uint32_t hash = hash_bytes(key, keylen);
+        hashtable_entry_t *e = hashtable_find(table, hash, key, keylen);
+        if (e != NULL) {
+                e->value = value;
+                return 0;
+        }
+
+        if (2 * (uint32_t) (table->size + 1) > table->capacity
+            && hashtable_grow(table) != 0)
+                return -1;
+
+        hashtable_entry_t entry;
+        entry.hash = hash;
+        entry.keylen = keylen;
+        // Allocate one extra byte so that the key is never a NULL
+        // pointer, even for zero-length keys.
+        entry.key = r_alloc(keylen + 1);
+        if (entry.key == NULL)
+                return -1;
+        memcpy(entry.key, key, keylen);
+        entry.key[keylen] = 0;
+        entry.value = value;
+        
+        hashtable_insert_entry(table->entries, table->capacity, &entry);
+        table->size++;
+        return 0;
+}
+
+void *hashtable_get(hashtable_t *table, const void *key, int keylen)
+{
+        hashtable_entry_t *e = hashtable_find(table, hash_bytes(key, keylen), key, keylen);
+        return (e == NULL)? NULL : e->value;
+}
+
+void *hashtable_remove(hashtable_t *table, const void *key, int keylen)
+{
+        hashtable_entry_t *e = hashtable_find(table, hash_bytes(key, keylen), key, keylen);
+        if (e == NULL)
+                return NULL;
+
+        void *value = e->value;
+        r_free(e->key);
+        
+        // Backward-shift the entries that follow in the probe
+        // sequence so that no tombstones are needed.
+        uint32_t mask = table->capacity - 1;
+        uint32_t i = (uint32_t) (e - table->entries);
+        uint32_t j = i;
+        while (1) {
+                j = (j + 1) & mask;
+                if (table->entries[j].key == NULL)
+                        break;
+                uint32_t k = table->entries[j].hash & mask;
+                int stays = (i <= j)? (i < k && k <= j) : (i < k || k <= j);
+                if (!stays) {
+                        table->entries[i] = table->entries[j];
+                        i = j;
+                }
+        }
+        memset(&table->entries[i], 0, sizeof(hashtable_entry_t));
+        table->size--;
+        
+        return value;
+}
+
+void hashtable_foreach(hashtable_t *table, hashtable_foreach_t callback, void *userdata)
+{
+        for (uint32_t i = 0; i < table->capacity; i++) {
+                hashtable_entry_t *e = &table->entries[i];
+                if (e->key != NULL)
+                        callback(userdata, e->key, e->keylen, e->value);
+        }
+}
+
+int hashtable_set_str(hashtable_t *table, const char *key, void *value)
+{
+        return hashtable_set(table, key, strlen(key), value);
+}
+
+void *hashtable_get_str(hashtable_t *table, const char *key)
+{
+        return hashtable_get(table, key, strlen(key));
+}
+
+void *hashtable_remove_str(hashtable_t *table, const char *key)
+{
+        return hashtable_remove(table, key, strlen(key));
+}
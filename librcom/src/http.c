@@ -119,138 +119,304 @@ int http_header_set_value(http_header_t *h, const char *value)
         return h->value == NULL? -1 : 0;
 }
 
+#define HTTP_STATUS_LIST(X)                                             \
+        X(100, "Continue")                                              \
+        X(101, "Switching Protocols")                                   \
+        X(200, "OK")                                                    \
+        X(201, "Created")                                               \
+        X(202, "Accepted")                                              \
+        X(203, "Non-Authoritative Information")                         \
+        X(204, "No Content")                                            \
+        X(205, "Reset Content")                                         \
+        X(206, "Partial Content")                                       \
+        X(300, "Multiple Choices")                                      \
+        X(301, "Moved Permanently")                                     \
+        X(302, "Found")                                                 \
+        X(303, "See Other")                                             \
+        X(304, "Not Modified")                                          \
+        X(307, "Temporary Redirect")                                    \
+        X(308, "Permanent Redirect")                                    \
+        X(400, "Bad Request")                                           \
+        X(401, "Unauthorized")                                          \
+        X(403, "Forbidden")                                             \
+        X(404, "Not Found")                                             \
+        X(405, "Method Not Allowed")                                    \
+        X(406, "Not Acceptable")                                        \
+        X(407, "Proxy Authentication Required")                         \
+        X(408, "Request Timeout")                                       \
+        X(409, "Conflict")                                              \
+        X(410, "Gone")                                                  \
+        X(411, "Length Required")                                       \
+        X(412, "Precondition Failed")                                   \
+        X(413, "Payload Too Large")                                     \
+        X(414, "URI Too Long")                                          \
+        X(415, "Unsupported Media Type")                                \
+        X(416, "Range Not Satisfiable")                                 \
+        X(417, "Expectation Failed")                                    \
+        X(418, "I'm a teapot")                                          \
+        X(422, "Unprocessable Entity")                                  \
+        X(425, "Too Early")                                             \
+        X(426, "Upgrade Required")                                      \
+        X(428, "Precondition Required")                                 \
+        X(429, "Too Many Requests")                                     \
+        X(431, "Request Header Fields Too Large")                       \
+        X(451, "Unavailable For Legal Reasons")                         \
+        X(500, "Internal Server Error")                                 \
+        X(501, "Not Implemented")                                       \
+        X(502, "Bad Gateway")                                           \
+        X(503, "Service Unavailable")                                   \
+        X(504, "Gateway Timeout")                                       \
+        X(505, "HTTP Version Not Supported")                            \
+        X(511, "Network Authentication Required")
+
 const char *http_status_string(int status)
 {
+#define X(_code, _text) case _code: return _text;
         switch (status) {
-        case 100: return "Continue";
-        case 101: return "Switching Protocols";
-        case 200: return "OK";
-        case 201: return "Created";
-        case 202: return "Accepted";
-        case 203: return "Non-Authoritative Information";
-        case 204: return "No Content";
-        case 205: return "Reset Content";
-        case 206: return "Partial Content";
-        case 300: return "Multiple Choices";
-        case 301: return "Moved Permanently";
-        case 302: return "Found";
-        case 303: return "See Other";
-        case 304: return "Not Modified";
-        case 307: return "Temporary Redirect";
-        case 308: return "Permanent Redirect";
-        case 400: return "Bad Request";
-        case 401: return "Unauthorized";
-        case 403: return "Forbidden";
-        case 404: return "Not Found";
-        case 405: return "Method Not Allowed";
-        case 406: return "Not Acceptable";
-        case 407: return "Proxy Authentication Required";
-        case 408: return "Request Timeout";
-        case 409: return "Conflict";
-        case 410: return "Gone";
-        case 411: return "Length Required";
-        case 412: return "Precondition Failed";
-        case 413: return "Payload Too Large";
-        case 414: return "URI Too Long";
-        case 415: return "Unsupported Media Type";
-        case 416: return "Range Not Satisfiable";
-        case 417: return "Expectation Failed";
-        case 418: return "I'm a teapot";
-        case 422: return "Unprocessable Entity";
-        case 425: return "Too Early";
-        case 426: return "Upgrade Required";
-        case 428: return "Precondition Required";
-        case 429: return "Too Many Requests";
-        case 431: return "Request Header Fields Too Large";
-        case 451: return "Unavailable For Legal Reasons";
-        case 500: return "Internal Server Error";
-        case 501: return "Not Implemented";
-        case 502: return "Bad Gateway";
-        case 503: return "Service Unavailable";
-        case 504: return "Gateway Timeout";
-        case 505: return "HTTP Version Not Supported";
-        case 511: return "Network Authentication Required";
+        HTTP_STATUS_LIST(X)
         default: return "--"; break;
         }
+#undef X
 }
 
-int http_send_response(tcp_socket_t socket, response_t* r)
+// Returns the complete status line, e.g. "HTTP/1.1 200 OK\r\n", or
+// NULL for an unknown status. The strings are assembled at compile
+// time.
+static const char *http_status_line(int status, int *len)
 {
-        int status = response_status(r);
-        membuf_t *headers = new_membuf();
-        membuf_t *body = response_body(r);
+#define X(_code, _text)                                                 \
+        case _code:                                                     \
+                *len = sizeof("HTTP/1.1 " #_code " " _text "\r\n") - 1; \
+                return "HTTP/1.1 " #_code " " _text "\r\n";
+        switch (status) {
+        HTTP_STATUS_LIST(X)
+        default:
+                *len = 0;
+                return NULL;
+        }
+#undef X
+}
+
+/*
+ * The headers are written into a fixed buffer, allocated on the stack
+ * by the caller. The lengths are computed first so that the writers
+ * below can simply copy the strings without checking for overflow.
+ */
+#define HTTP_HEADERS_BUFLEN 2048
+
+typedef struct _http_headers_t {
+        char *data;
+        int len;
+} http_headers_t;
+
+#define HTTP_LITERAL(_s) _s, (int) (sizeof(_s) - 1)
+
+static inline void http_headers_append(http_headers_t *h, const char *s, int len)
+{
+        memcpy(h->data + h->len, s, len);
+        h->len += len;
+}
+
+static inline void http_headers_append_str(http_headers_t *h, const char *s)
+{
+        http_headers_append(h, s, strlen(s));
+}
+
+// Writes the decimal representation of the value, without a
+// terminating zero, and returns its length. The buffer must be at
+// least 20 bytes.
+static int http_format_uint(char *s, unsigned long value)
+{
+        char tmp[20];
+        int n = 0;
+        do {
+                tmp[n++] = (char) ('0' + value % 10);
+                value /= 10;
+        } while (value > 0);
+        for (int i = 0; i < n; i++)
+                s[i] = tmp[n - 1 - i];
+        return n;
+}
+
+static inline void http_headers_append_uint(http_headers_t *h, unsigned long value)
+{
+        h->len += http_format_uint(h->data + h->len, value);
+}
+
+// The status line takes at most HTTP_STATUS_MAXLEN bytes.
+#define HTTP_STATUS_MAXLEN 64
+
+static void http_headers_append_status(http_headers_t *h, int status)
+{
+        int len;
+        const char *line = http_status_line(status, &len);
+        if (line) {
+                http_headers_append(h, line, len);
+        } else {
+                http_headers_append(h, HTTP_LITERAL("HTTP/1.1 "));
+                http_headers_append_uint(h, (unsigned int) status);
+                http_headers_append(h, HTTP_LITERAL(" --\r\n"));
+        }
+}
+
+// Pass content_length < 0 for a chunked response. The headers are
+// written into the buffer if they fit, otherwise into a newly
+// allocated buffer that must be freed by the caller.
+static void http_format_response_headers(http_headers_t *headers,
+                                         char *buffer, response_t* r,
+                                         long content_length)
+{
+        int size = HTTP_STATUS_MAXLEN
+                + sizeof("Content-Length: \r\n") + 20
+                + sizeof("Transfer-Encoding: chunked\r\n")
+                + sizeof("Connection: close\r\n")
+                + 2;
         
-        membuf_printf(headers, "HTTP/1.1 %d %s\r\n",
-                      status, http_status_string(status));
+        for (list_t *l = response_headers(r); l != NULL; l = list_next(l)) {
+                http_header_t *h = list_get(l, http_header_t);
+                size += strlen(h->name) + (h->value? strlen(h->value) : 0) + 4;
+        }
+
+        headers->data = (size <= HTTP_HEADERS_BUFLEN)? buffer : r_alloc(size);
+        headers->len = 0;
+        if (headers->data == NULL)
+                return;
         
-        membuf_printf(headers, "Content-Length: %d\r\n", membuf_len(body));
-        membuf_printf(headers, "Connection: close\r\n");
+        http_headers_append_status(headers, response_status(r));
+        if (content_length >= 0) {
+                http_headers_append(headers, HTTP_LITERAL("Content-Length: "));
+                http_headers_append_uint(headers, (unsigned long) content_length);
+                http_headers_append(headers, HTTP_LITERAL("\r\n"));
+        } else {
+                http_headers_append(headers, HTTP_LITERAL("Transfer-Encoding: chunked\r\n"));
+        }
+        http_headers_append(headers, HTTP_LITERAL("Connection: close\r\n"));
         
         for (list_t *l = response_headers(r); l != NULL; l = list_next(l)) {
                 http_header_t *h = list_get(l, http_header_t);
-                membuf_printf(headers, "%s: %s\r\n", h->name, h->value);
+                http_headers_append_str(headers, h->name);
+                http_headers_append(headers, HTTP_LITERAL(": "));
+                if (h->value)
+                        http_headers_append_str(headers, h->value);
+                http_headers_append(headers, HTTP_LITERAL("\r\n"));
         }
+        
+        http_headers_append(headers, HTTP_LITERAL("\r\n"));
+}
 
-        membuf_printf(headers, "\r\n");
+static void http_release_headers(http_headers_t *headers, char *buffer)
+{
+        if (headers->data != buffer)
+                r_free(headers->data);
+}
 
-        if (tcp_socket_send(socket, membuf_data(headers), membuf_len(headers)) != 0)
+int http_send_response(tcp_socket_t socket, response_t* r)
+{
+        int err;
+        char buffer[HTTP_HEADERS_BUFLEN];
+        http_headers_t headers;
+        const char *body;
+        size_t length;
+        off_t offset;
+        int fd;
+
+        fd = response_body_fd(r, &offset, &length);
+        body = (fd >= 0)? NULL : response_body_data(r, &length);
+        
+        http_format_response_headers(&headers, buffer, r, (long) length);
+        if (headers.data == NULL) {
+                r_err("http_send_response: out of memory");
                 return -1;
+        }
 
-        delete_membuf(headers);
-        return tcp_socket_send(socket, membuf_data(body), membuf_len(body));
+        if (fd >= 0) {
+                err = tcp_socket_send(socket, headers.data, headers.len);
+                if (err == 0)
+                        err = tcp_socket_sendfile(socket, fd, offset, length);
+        } else {
+                // Headers and body in one system call
+                struct iovec iov[2];
+                iov[0].iov_base = headers.data;
+                iov[0].iov_len = headers.len;
+                iov[1].iov_base = (void *) body;
+                iov[1].iov_len = length;
+                err = tcp_socket_sendv(socket, iov, length > 0? 2 : 1);
+        }
+
+        http_release_headers(&headers, buffer);
+        return err;
+}
+
+int http_send_chunked_response_headers(tcp_socket_t socket, response_t* r)
+{
+        char buffer[HTTP_HEADERS_BUFLEN];
+        http_headers_t headers;
+        
+        http_format_response_headers(&headers, buffer, r, -1);
+        if (headers.data == NULL) {
+                r_err("http_send_chunked_response_headers: out of memory");
+                return -1;
+        }
+        int err = tcp_socket_send(socket, headers.data, headers.len);
+        http_release_headers(&headers, buffer);
+        return err;
 }
 
 int http_send_headers(tcp_socket_t socket, int status,
                       const char *mimetype, int content_length)
 {
-        char header[2048];
-        // FIXME: write directly in socket, instead of intermediate buffer
-        // FIXME: or use a membuf!
-        int len = snprintf(NULL, 0,
-                           "HTTP/1.1 %d %s\r\n"
-                           "Content-Type: %s\r\n"
-                           "Content-Length: %d\r\n"
-                           "Access-Control-Allow-Origin: *\r\n"
-                           "Connection: close\r\n\r\n",
-                           status, http_status_string(status), mimetype, content_length);
-        if ((unsigned)len > (sizeof(header) - 1)) {
+        char buffer[HTTP_HEADERS_BUFLEN];
+        http_headers_t headers = { buffer, 0 };
+        int mimetype_len = strlen(mimetype);
+        
+        if (mimetype_len > HTTP_HEADERS_BUFLEN - 256) {
                 r_err("http_send_headers: header fields too long");
                 return -1;
         }
-        
-        len = snprintf(header, sizeof(header),
-                       "HTTP/1.1 %d %s\r\n"
-                       "Content-Type: %s\r\n"
-                       "Content-Length: %d\r\n"
-                       "Access-Control-Allow-Origin: *\r\n"
-                       "Connection: close\r\n\r\n",
-                       status, http_status_string(status), mimetype, content_length);
 
-        return tcp_socket_send(socket, header, len);
+        http_headers_append_status(&headers, status);
+        http_headers_append(&headers, HTTP_LITERAL("Content-Type: "));
+        http_headers_append(&headers, mimetype, mimetype_len);
+        http_headers_append(&headers, HTTP_LITERAL("\r\n"));
+        // Without a length, the body ends when the connection closes.
+        if (content_length >= 0) {
+                http_headers_append(&headers, HTTP_LITERAL("Content-Length: "));
+                http_headers_append_uint(&headers, (unsigned long) content_length);
+                http_headers_append(&headers, HTTP_LITERAL("\r\n"));
+        }
+        http_headers_append(&headers, HTTP_LITERAL("Access-Control-Allow-Origin: *\r\n"
+                                                   "Connection: close\r\n\r\n"));
+        return tcp_socket_send(socket, headers.data, headers.len);
 }
 
 int http_send_error_headers(tcp_socket_t socket, int status)
 {
-        char header[2048];
-        //r_debug("streamer_client_send_error_headers");
-        int len = snprintf(header, 2048,
-                           "HTTP/1.1 %d %s\r\n"
-                           "Connection: close\r\n\r\n",
-                           status, http_status_string(status));
-        return tcp_socket_send(socket, header, len);
+        char buffer[128];
+        http_headers_t headers = { buffer, 0 };
+
+        http_headers_append_status(&headers, status);
+        http_headers_append(&headers, HTTP_LITERAL("Connection: close\r\n\r\n"));
+        return tcp_socket_send(socket, headers.data, headers.len);
 }
 
 int http_send_streaming_headers(tcp_socket_t socket, const char *mimetype)
 {
-        char header[2048];
-        //r_debug("request_send_headers");
-        int len = snprintf(header, 2048,
-                           "HTTP/1.1 %d %s\r\n"
-                           "Content-Type: %s\r\n"
-                           "Transfer-Encoding: chunked\r\n"
-                           "\r\n",
-                           200, http_status_string(200), mimetype);
-        return tcp_socket_send(socket, header, len);
+        char buffer[HTTP_HEADERS_BUFLEN];
+        http_headers_t headers = { buffer, 0 };
+        int mimetype_len = strlen(mimetype);
+        
+        if (mimetype_len > HTTP_HEADERS_BUFLEN - 256) {
+                r_err("http_send_streaming_headers: header fields too long");
+                return -1;
+        }
+        
+        http_headers_append(&headers, HTTP_LITERAL("HTTP/1.1 200 OK\r\n"
+                                                   "Content-Type: "));
+        http_headers_append(&headers, mimetype, mimetype_len);
+        http_headers_append(&headers, HTTP_LITERAL("\r\n"
+                                                   "Transfer-Encoding: chunked\r\n"
+                                                   "\r\n"));
+        return tcp_socket_send(socket, headers.data, headers.len);
 }
 
 int http_get(addr_t *addr, const char *resource, response_t **response_handle)
@@ -361,14 +527,21 @@ static int http_send_request_headers(tcp_socket_t socket,
 int http_send_chunk(tcp_socket_t socket, const char *data, int datalen)
 {
         char buf[64];
+        struct iovec iov[3];
+        
         int len = snprintf(buf, 64, "%x\r\n", datalen);
-        if (tcp_socket_send(socket, buf, len) == -1)
-                return -1;
-        if (tcp_socket_send(socket, data, datalen) == -1)
-                return -1;
-        if (tcp_socket_send(socket, "\r\n", 2) == -1)
-                return -1;
-        return 0;
+        iov[0].iov_base = buf;
+        iov[0].iov_len = len;
+        iov[1].iov_base = (void *) data;
+        iov[1].iov_len = datalen;
+        iov[2].iov_base = (void *) "\r\n";
+        iov[2].iov_len = 2;
+        return tcp_socket_sendv(socket, iov, 3);
+}
+
+int http_send_last_chunk(tcp_socket_t socket)
+{
+        return tcp_socket_send(socket, "0\r\n\r\n", 5);
 }
 
 typedef struct {
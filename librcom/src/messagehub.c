@@ -25,6 +25,8 @@
 #include <r.h>
 #include "app.h"
 #include "messagelink.h"
+#include "dump.h"
+#include "registry_priv.h"
 
 #include "util_priv.h"
 #include "net.h"
@@ -46,6 +48,9 @@ struct _messagehub_t {
 
         membuf_t *mem;
         int quit;
+
+        // Records the broadcast messages when dumping is on
+        dump_t *dump;
         
         messagehub_onconnect_t onconnect;
         messagehub_onrequest_t onrequest;
@@ -97,6 +102,9 @@ messagehub_t* new_messagehub(const char *name,
                 return NULL;
         }
 
+        hub->dump = dump_start_recording(name, TYPE_MESSAGEHUB, topic,
+                                         "application/json");
+
         char b[64];
         r_info("Messagehub listening at http://%s:%d",
                  addr_ip(hub->addr, b, 64), addr_port(hub->addr));
@@ -116,6 +124,7 @@ void delete_messagehub(messagehub_t*hub)
                 }
                 
                 delete_membuf(hub->mem);
+                delete_dump(hub->dump);
                 
                 if (hub->socket != INVALID_TCP_SOCKET) {
                         r_debug("delete_messagehub: close_tcp_socket");
@@ -522,6 +531,9 @@ int messagehub_broadcast_text(messagehub_t *hub, messagelink_t *exclude,
         
         if (messagehub_membuf(hub) != 0)
                 return -1;
+
+        if (hub->dump)
+                dump_write_message(hub->dump, data, len);
         
         messagehub_lock_links(hub);
         
@@ -28,6 +28,8 @@
 
 #include "app.h"
 #include "addr.h"
+#include "data.h"
+#include "dump.h"
 
 #include "util_priv.h"
 #include "http.h"
@@ -35,6 +37,8 @@
 #include "net.h"
 #include "messagehub_priv.h"
 #include "messagelink_priv.h"
+#include "clocksync_priv.h"
+#include "registry_priv.h"
 
 /** Messagelinks are created on the server-side by a messagehub to
  *  handle an incoming connection. Let's call it a server-side
@@ -245,6 +249,13 @@ typedef struct _messagelink_t {
         messagelink_onclose_t onclose;
         void *userdata;
 
+        // The estimate of the clock offset of the remote node
+        clock_sync_t *sync;
+
+        // Records the received messages of client-side links when
+        // dumping is on
+        dump_t *dump;
+
         /* The background thread that handles incoming
          * messages. Server-side messagelinks always use a
          * thread. Client-side messagelinks that have an 'onmessage'
@@ -264,7 +275,7 @@ static void owner_messagelink_close(messagelink_t *link, int code);
 static int messagelink_read_message(messagelink_t *link, ws_frame_t *frame);
 
 static int messagelink_send_close(messagelink_t *link, int code);
-static int messagelink_send_pong(messagelink_t *link, membuf_t *payload);
+static int messagelink_send_pong(messagelink_t *link, const char *data, int len);
 
 // Receive messages If an error occurs, the function returns
 // json_null(). In that case, the connection will have been closed and
@@ -307,6 +318,7 @@ messagelink_t *new_messagelink(const char *name,
         link->in = new_membuf();
         link->header_name = new_membuf();
         link->header_value = new_membuf();
+        link->sync = new_clock_sync();
         
         return link;
 }
@@ -331,6 +343,8 @@ void delete_messagelink(messagelink_t *link)
                 delete_membuf(link->out);
                 delete_membuf(link->header_name);
                 delete_membuf(link->header_value);
+                delete_clock_sync(link->sync);
+                delete_dump(link->dump);
                 delete_addr(link->addr);
                 delete_addr(link->remote_addr);
                 delete_mutex(link->send_mutex);
@@ -882,6 +896,32 @@ json_object_t messagelink_read(messagelink_t *link)
         return _messagelink_read(link);
 }
 
+// Answers a ping. The clock sync requests get a reply with the
+// timestamps, other pings are echoed.
+static int messagelink_handle_ping(messagelink_t *link)
+{
+        char reply[CLOCK_SYNC_REPLY_LEN];
+        int len = clock_sync_make_reply(membuf_data(link->in), membuf_len(link->in),
+                                        reply, data_clock_now());
+        if (len > 0)
+                return messagelink_send_pong(link, reply, len);
+        return messagelink_send_pong(link, membuf_data(link->in),
+                                     membuf_len(link->in));
+}
+
+// Returns 1 if the pong was a reply to a clock sync request.
+static int messagelink_handle_sync(messagelink_t *link)
+{
+        uint64_t t0, t1, t2;
+        uint64_t t3 = data_clock_now();
+        
+        if (clock_sync_parse_reply(membuf_data(link->in), membuf_len(link->in),
+                                   &t0, &t1, &t2) != 0)
+                return 0;
+        clock_sync_add(link->sync, t0, t1, t2, t3);
+        return 1;
+}
+
 static json_object_t _messagelink_read(messagelink_t *link)
 {
         if (link->state != WS_OPEN) {
@@ -929,6 +969,11 @@ static json_object_t _messagelink_read(messagelink_t *link)
                 switch (frame.opcode) {
                 case WS_TEXT:
                         //r_debug("messagelink_read: received text event.");
+
+                        if (link->dump)
+                                dump_write_message(link->dump,
+                                                   membuf_data(link->in),
+                                                   membuf_len(link->in));
                         
                         membuf_append_zero(link->in);
                         //r_debug("messagelink_read: %s", membuf_data(link->in));
@@ -958,15 +1003,20 @@ static json_object_t _messagelink_read(messagelink_t *link)
                         break;
                         
                 case WS_PING:
-                        r_info("messagelink_read: ping message: %.*s",
-                                 membuf_len(link->in), membuf_data(link->in));
                         r_info("messagelink_read: sending pong");
-                        if (messagelink_send_pong(link, link->in) != 0)
+                        if (messagelink_handle_ping(link) != 0)
                                 r_err("messagelink_read: Failed to send pong message");
                         break;
                         
                 case WS_PONG:
                         r_info("messagelink_read: got pong message");
+                        if (messagelink_handle_sync(link))
+                                break;
+                        // A peer that doesn't answer clock sync
+                        // requests echoes them back
+                        if (clock_sync_is_request(membuf_data(link->in),
+                                                  membuf_len(link->in)))
+                                break;
                         if (link->onpong)
                                 link->onpong(link, link->userdata,
                                                  membuf_data(link->in),
@@ -1194,7 +1244,24 @@ int messagelink_send_ping(messagelink_t *link, const char *data, int len)
         return err;
 }
 
-static int messagelink_send_pong(messagelink_t *link, membuf_t *payload)
+int messagelink_sync_clock(messagelink_t *link)
+{
+        char request[CLOCK_SYNC_REQUEST_LEN];
+        int len = clock_sync_make_request(request, data_clock_now());
+        return messagelink_send_ping(link, request, len);
+}
+
+int messagelink_get_clock_offset(messagelink_t *link, clock_offset_t *offset)
+{
+        return clock_sync_get(link->sync, offset);
+}
+
+uint64_t messagelink_to_local_time(messagelink_t *link, uint64_t timestamp)
+{
+        return clock_sync_to_local(link->sync, timestamp);
+}
+
+static int messagelink_send_pong(messagelink_t *link, const char *data, int len)
 {
         int err;
         int masked = link->is_client;
@@ -1203,7 +1270,7 @@ static int messagelink_send_pong(messagelink_t *link, membuf_t *payload)
         
         membuf_lock(link->out);
         membuf_clear(link->out);
-        err = frame_make(link->out, WS_PONG, masked, membuf_data(payload), membuf_len(payload));
+        err = frame_make(link->out, WS_PONG, masked, data, len);
 
         if (err == 0) {        
                 mutex_lock(link->send_mutex);
@@ -1612,6 +1679,11 @@ int client_messagelink_connect(messagelink_t *link, addr_t *addr)
         
         r_debug("client_messagelink_connect (%s:%s)", link->name, link->topic);
 
+        // Kept across reconnections
+        if (link->dump == NULL)
+                link->dump = dump_start_recording(link->name, TYPE_MESSAGELINK,
+                                                  link->topic, "application/json");
+
         mutex_lock(link->state_mutex);
         
         if (link->remote_addr != NULL
@@ -21,10 +21,12 @@
   <http://www.gnu.org/licenses/>.
 
  */
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <string.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <netinet/in.h>
 #include <errno.h>
 
@@ -67,6 +69,81 @@ udp_socket_t open_udp_socket()
         return s;
 }
 
+int addr_is_multicast(addr_t *addr)
+{
+        return addr != NULL && IN_MULTICAST(ntohl(addr->sin_addr.s_addr));
+}
+
+int udp_socket_set_multicast(udp_socket_t socket, int ttl)
+{
+        struct in_addr iface;
+        unsigned char loop = 1;
+        unsigned char hops = (unsigned char) ttl;
+        
+        inet_aton(app_ip(), &iface);
+        
+        if (setsockopt(socket, IPPROTO_IP, IP_MULTICAST_IF,
+                       &iface, sizeof(iface)) != 0
+            || setsockopt(socket, IPPROTO_IP, IP_MULTICAST_TTL,
+                          &hops, sizeof(hops)) != 0
+            || setsockopt(socket, IPPROTO_IP, IP_MULTICAST_LOOP,
+                          &loop, sizeof(loop)) != 0) {
+                r_warn("udp_socket_set_multicast: setsockopt failed: %s",
+                       strerror(errno));
+                return -1;
+        }
+        return 0;
+}
+
+udp_socket_t open_udp_multicast_socket(addr_t *group)
+{
+        struct sockaddr_in local_addr;
+        struct ip_mreq mreq;
+        int reuse = 1;
+        
+        if (!addr_is_multicast(group)) {
+                r_err("open_udp_multicast_socket: not a multicast address");
+                return INVALID_UDP_SOCKET;
+        }
+        
+        int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (s == -1) {
+                r_err("open_udp_multicast_socket: failed to create the socket");
+                return INVALID_UDP_SOCKET;
+        }
+
+        if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0) {
+                r_err("open_udp_multicast_socket: failed to set SO_REUSEADDR");
+                close(s);
+                return INVALID_UDP_SOCKET;
+        }
+        
+        // Bind to the group address so that the socket only receives
+        // the datagrams sent to this group.
+        memset((char *) &local_addr, 0, sizeof(local_addr));
+        local_addr.sin_family = AF_INET;
+        local_addr.sin_port = group->sin_port;
+        local_addr.sin_addr = group->sin_addr;
+        
+        if (bind(s, (struct sockaddr*) &local_addr, sizeof(local_addr)) == -1) {
+                r_err("open_udp_multicast_socket: failed to bind the socket");
+                close(s);
+                return INVALID_UDP_SOCKET;
+        }
+
+        mreq.imr_multiaddr = group->sin_addr;
+        inet_aton(app_ip(), &mreq.imr_interface);
+        
+        if (setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0) {
+                r_err("open_udp_multicast_socket: failed to join the group: %s",
+                      strerror(errno));
+                close(s);
+                return INVALID_UDP_SOCKET;
+        }
+
+        return s;
+}
+
 void close_udp_socket(udp_socket_t s)
 {
         close(s);
@@ -101,6 +178,47 @@ int udp_socket_wait_data(udp_socket_t socket, int timeout)
         return posix_wait_data(socket, timeout);
 }
 
+int udp_socket_wait_any(udp_socket_t *sockets, int count,
+                        int timeout, int *ready)
+{
+        struct timeval timev;
+        fd_set readset;
+        int maxfd = -1;
+        
+        if (timeout < 0)
+                return RCOM_WAIT_ERROR;
+        
+        FD_ZERO(&readset);
+        for (int i = 0; i < count; i++) {
+                ready[i] = 0;
+                if (sockets[i] == INVALID_UDP_SOCKET)
+                        continue;
+                FD_SET(sockets[i], &readset);
+                if (sockets[i] > maxfd)
+                        maxfd = sockets[i];
+        }
+        if (maxfd < 0)
+                return RCOM_WAIT_ERROR;
+        
+        timev.tv_sec = timeout;
+        timev.tv_usec = 0;
+        
+        int n = select(maxfd + 1, &readset, NULL, NULL, &timev);
+        if (n < 0) {
+                r_err("udp_socket_wait_any: error: %s", strerror(errno));
+                return RCOM_WAIT_ERROR;
+        } else if (n == 0) {
+                return RCOM_WAIT_TIMEOUT;
+        }
+        
+        for (int i = 0; i < count; i++) {
+                if (sockets[i] != INVALID_UDP_SOCKET
+                    && FD_ISSET(sockets[i], &readset))
+                        ready[i] = 1;
+        }
+        return RCOM_WAIT_OK;
+}
+
 int udp_socket_read(udp_socket_t socket, data_t *data, addr_t *addr)
 {
         u_int32_t addrlen = sizeof(addr_t);
@@ -119,6 +237,93 @@ int udp_socket_read(udp_socket_t socket, data_t *data, addr_t *addr)
         return 0; 
 }
 
+int udp_socket_send_many(udp_socket_t socket, addr_t **addrs, int count,
+                         data_t *data, int *failed)
+{
+        struct mmsghdr msgs[UDP_BATCH_SIZE];
+        struct iovec iov;
+        int err = 0;
+        int sent = 0;
+
+        iov.iov_base = data_packet(data);
+        iov.iov_len = PACKET_HEADER + data_len(data);
+
+        if (failed)
+                memset(failed, 0, count * sizeof(int));
+
+        while (sent < count) {
+                int n = count - sent;
+                if (n > UDP_BATCH_SIZE)
+                        n = UDP_BATCH_SIZE;
+
+                memset(msgs, 0, n * sizeof(struct mmsghdr));
+                for (int i = 0; i < n; i++) {
+                        msgs[i].msg_hdr.msg_name = addrs[sent + i];
+                        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+                        msgs[i].msg_hdr.msg_iov = &iov;
+                        msgs[i].msg_hdr.msg_iovlen = 1;
+                }
+
+                int ret = sendmmsg(socket, msgs, n, 0);
+                if (ret < 0 && errno == EINTR)
+                        continue;
+                
+                if (ret <= 0) {
+                        // The first message of the batch failed. Skip
+                        // it and continue with the next one.
+                        char b[64];
+                        r_err("udp_socket_send_many: sendmmsg() to %s failed: %s",
+                              addr_string(addrs[sent], b, 64),
+                              strerror(errno));
+                        if (failed)
+                                failed[sent] = 1;
+                        err = -1;
+                        sent++;
+                } else {
+                        sent += ret;
+                }
+        }
+        
+        return err;
+}
+
+int udp_socket_read_many(udp_socket_t socket, data_t **data,
+                         addr_t *addrs, int count)
+{
+        struct mmsghdr msgs[UDP_BATCH_SIZE];
+        struct iovec iov[UDP_BATCH_SIZE];
+        int ret;
+
+        if (count > UDP_BATCH_SIZE)
+                count = UDP_BATCH_SIZE;
+        
+        memset(msgs, 0, count * sizeof(struct mmsghdr));
+        for (int i = 0; i < count; i++) {
+                iov[i].iov_base = data_packet(data[i]);
+                iov[i].iov_len = PACKET_MAXLEN;
+                msgs[i].msg_hdr.msg_name = &addrs[i];
+                msgs[i].msg_hdr.msg_namelen = sizeof(addr_t);
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        do {
+                ret = recvmmsg(socket, msgs, count, MSG_DONTWAIT, NULL);
+        } while (ret < 0 && errno == EINTR);
+        
+        if (ret < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        return 0;
+                r_err("udp_socket_read_many: recvmmsg failed: %s", strerror(errno));
+                return -1;
+        }
+        
+        for (int i = 0; i < ret; i++)
+                data_set_len(data[i], (int) msgs[i].msg_len - PACKET_HEADER);
+        
+        return ret;
+}
+
 //*********************************************************
 // tcp socket 
 
@@ -194,6 +399,70 @@ int tcp_socket_send(tcp_socket_t socket, const char *data, int len)
         return 0;
 }
 
+int tcp_socket_sendv(tcp_socket_t socket, struct iovec *iov, int iovcnt)
+{
+        struct msghdr msg;
+        ssize_t ret;
+
+        if (socket < 0) {
+                r_err("tcp_socket_sendv: invalid socket");
+                return -1;
+        }
+
+        while (iovcnt > 0) {
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = iov;
+                msg.msg_iovlen = iovcnt;
+                
+                ret = sendmsg(socket, &msg, MSG_NOSIGNAL);
+                if (ret < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        r_err("tcp_socket_sendv: sendmsg failed: %s", strerror(errno));
+                        return -1;
+                }
+
+                // Skip the buffers that were sent completely and
+                // adjust the first one that was sent partially.
+                while (iovcnt > 0 && (size_t) ret >= iov->iov_len) {
+                        ret -= iov->iov_len;
+                        iov++;
+                        iovcnt--;
+                }
+                if (iovcnt > 0) {
+                        iov->iov_base = (char *) iov->iov_base + ret;
+                        iov->iov_len -= ret;
+                }
+        }
+        return 0;
+}
+
+int tcp_socket_sendfile(tcp_socket_t socket, int fd, off_t offset, size_t len)
+{
+        ssize_t ret;
+        
+        if (socket < 0) {
+                r_err("tcp_socket_sendfile: invalid socket");
+                return -1;
+        }
+
+        while (len > 0) {
+                ret = sendfile(socket, fd, &offset, len);
+                if (ret < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        r_err("tcp_socket_sendfile: sendfile failed: %s", strerror(errno));
+                        return -1;
+                }
+                if (ret == 0) {
+                        r_err("tcp_socket_sendfile: unexpected end of file");
+                        return -1;
+                }
+                len -= ret;
+        }
+        return 0;
+}
+
 int tcp_socket_wait_data(tcp_socket_t socket, int timeout)
 {
         return posix_wait_data(socket, timeout);
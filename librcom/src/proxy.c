@@ -22,6 +22,8 @@
 
  */
 
+#include <pthread.h>
+#include <time.h>
 #include <r.h>
 #include "app.h"
 #include "util.h"
@@ -34,6 +36,7 @@
 #include "streamer_priv.h"
 #include "streamerlink_priv.h"
 #include "registry_priv.h"
+#include "hashtable.h"
 #include "proxy.h"
 
 enum {
@@ -42,12 +45,33 @@ enum {
         PROXY_ERROR
 };
 
+// How long the first queued request waits for others to join its
+// batch, in seconds, and the largest batch.
+#define PROXY_BATCH_DELAY 0.02
+#define PROXY_BATCH_MAX 256
+
 struct _proxy_t
 {
         registry_t *registry;
         messagelink_t *link;
         mutex_t *mutex;
         int status;
+        // The instance of the remote registry and its revision that
+        // is reflected by the local registry. They are updated by the
+        // events and the sync responses, in the thread of the link.
+        char *registry_id;
+        uint64_t revision;
+        int syncing;
+        // The register, unregister, and update-address requests are
+        // queued in 'pending' and sent by the sender thread, so that
+        // the requests of a burst, such as those of a node that opens
+        // its end-points at start-up, go out in one batch.
+        json_object_t pending;
+        double pending_since;
+        pthread_mutex_t pending_mutex;
+        pthread_cond_t pending_cond;
+        thread_t *sender;
+        int quit;
 };
 
 static proxy_t* new_proxy(addr_t *addr);
@@ -68,13 +92,14 @@ static void proxy_onclose(proxy_t* proxy, messagelink_t *link);
 // requests
 static int proxy_send_register_request(proxy_t* proxy, registry_entry_t *entry);
 static int proxy_send_unregister_request(proxy_t* proxy, registry_entry_t *entry);
-static int proxy_send_list_request(proxy_t* proxy);
+static int proxy_send_sync_request(proxy_t* proxy);
+static void proxy_sender_run(proxy_t* proxy);
 static int proxy_send_update_address_request(proxy_t* proxy, const char *id, const char *addr);
 
 // response handlers
 static void proxy_handle_register_add(proxy_t* proxy, json_object_t message);
 static void proxy_handle_register_remove(proxy_t* proxy, json_object_t message);
-static void proxy_handle_update_list(proxy_t* proxy,  json_object_t message);
+static void proxy_handle_sync(proxy_t* proxy,  json_object_t message);
 static void proxy_handle_update_address(proxy_t* proxy, json_object_t message);
 
 // update the connections
@@ -193,8 +218,12 @@ static proxy_t* new_proxy(addr_t *addr)
         if (proxy == NULL)
                 return NULL;
 
+        pthread_mutex_init(&proxy->pending_mutex, NULL);
+        pthread_cond_init(&proxy->pending_cond, NULL);
+        
+        proxy->pending = json_array_create();
         proxy->registry = new_registry();
-        if (proxy->registry == NULL) {
+        if (proxy->pending == NULL || proxy->registry == NULL) {
                 delete_proxy(proxy);
                 return NULL;
         }
@@ -221,9 +250,16 @@ static proxy_t* new_proxy(addr_t *addr)
                         return NULL;
                 }
 
-                err = proxy_send_list_request(proxy);
+                proxy->sender = new_thread((thread_run_t) proxy_sender_run, proxy);
+                if (proxy->sender == NULL) {
+                        r_err("new_proxy: failed to start the sender thread");
+                        delete_proxy(proxy);
+                        return NULL;
+                }
+
+                err = proxy_send_sync_request(proxy);
                 if (err != 0) {
-                        r_err("new_proxy: failed to send the list request");
+                        r_err("new_proxy: failed to send the sync request");
                         delete_proxy(proxy);
                         return NULL;
                 }
@@ -247,12 +283,27 @@ static proxy_t* new_proxy(addr_t *addr)
 static void delete_proxy(proxy_t* proxy)
 {
         if (proxy) {
+                // The sender sends the pending requests before it quits
+                if (proxy->sender) {
+                        pthread_mutex_lock(&proxy->pending_mutex);
+                        proxy->quit = 1;
+                        pthread_cond_signal(&proxy->pending_cond);
+                        pthread_mutex_unlock(&proxy->pending_mutex);
+                        thread_join(proxy->sender);
+                        delete_thread(proxy->sender);
+                }
                 if (proxy->registry)
                         delete_registry(proxy->registry);
                 if (proxy->link)
                         delete_messagelink(proxy->link);
                 if (proxy->mutex) 
                         delete_mutex(proxy->mutex);
+                if (proxy->registry_id)
+                        r_free(proxy->registry_id);
+                if (proxy->pending)
+                        json_unref(proxy->pending);
+                pthread_cond_destroy(&proxy->pending_cond);
+                pthread_mutex_destroy(&proxy->pending_mutex);
                 r_delete(proxy);
         }
 }
@@ -262,11 +313,59 @@ static int proxy_is_local(registry_entry_t *entry)
         return entry->endpoint != NULL;
 }
 
+// Whether the end-point runs on this host, possibly in another
+// process.
+static int proxy_same_host(registry_entry_t *entry)
+{
+        struct in_addr ip;
+        return (inet_aton(app_ip(), &ip) != 0
+                && ip.s_addr == entry->addr->sin_addr.s_addr);
+}
+
+// The datalinks on the same host as the hub receive the data directly
+// and don't join the multicast group.
+static void proxy_set_datalink_hub(datalink_t *link, registry_entry_t *hub)
+{
+        datalink_set_remote_addr(link, hub->addr);
+        datalink_set_group(link, proxy_same_host(hub)? NULL : hub->group);
+}
+
+static void proxy_add_datahub_link(datahub_t *hub, registry_entry_t *link)
+{
+        if (link->shm != NULL && proxy_same_host(link))
+                datahub_add_local_link(hub, link->addr, link->shm);
+        else
+                datahub_add_link(hub, link->addr);
+}
+
+// Events carry the revision of the registry after the change. When
+// some revisions were skipped, ask the registry for what was missed.
+static void proxy_update_revision(proxy_t *proxy, json_object_t message)
+{
+        uint64_t revision;
+        
+        if (!json_object_has(message, "revision"))
+                return;
+        
+        revision = (uint64_t) json_object_getnum(message, "revision");
+        if (revision == proxy->revision + 1) {
+                proxy->revision = revision;
+        } else if (revision > proxy->revision + 1 && !proxy->syncing) {
+                r_warn("proxy_update_revision: missed revisions %llu to %llu",
+                       (unsigned long long) proxy->revision + 1,
+                       (unsigned long long) revision - 1);
+                if (proxy_send_sync_request(proxy) != 0)
+                        r_err("proxy_update_revision: failed to send the sync request");
+        }
+}
+
 static void proxy_onevent(proxy_t *proxy,
                           const char *event,
                           json_object_t message)
 {
         r_debug("proxy_onevent: %s", event);
+        proxy_update_revision(proxy, message);
+        
         if (rstreq(event, "proxy-add")) {
                 proxy_handle_register_add(proxy, message);
                 
@@ -276,6 +375,15 @@ static void proxy_onevent(proxy_t *proxy,
         } else if (rstreq(event, "proxy-update-address")) {
                 proxy_handle_update_address(proxy, message);
                 
+        } else if (rstreq(event, "proxy-batch")) {
+                json_object_t events = json_object_get(message, "events");
+                for (int i = 0; i < json_array_length(events); i++) {
+                        json_object_t e = json_array_get(events, i);
+                        const char *name = json_object_getstr(e, "event");
+                        if (name != NULL)
+                                proxy_onevent(proxy, name, e);
+                }
+                
         } else {
                 r_warn("proxy_onevent: unknown event: %s", event);
         }
@@ -305,12 +413,28 @@ static void proxy_onresponse(proxy_t *proxy,
                         r_err("updating of address failed: %s",
                                 json_object_getstr(message, "message"));
                 
-        } else if (rstreq(response, "list")) {
+        } else if (rstreq(response, "batch")) {
+                json_object_t responses = json_object_get(message, "responses");
                 if (!success)
-                        r_err("updating of list failed: %s",
+                        r_err("batch failed: %s",
                                 json_object_getstr(message, "message"));
+                for (int i = 0; i < json_array_length(responses); i++) {
+                        json_object_t r = json_array_get(responses, i);
+                        const char *name = json_object_getstr(r, "response");
+                        if (name != NULL)
+                                proxy_onresponse(proxy, name, r);
+                }
                 
-                proxy_handle_update_list(proxy, message);
+        } else if (rstreq(response, "sync")) {
+                if (!success) {
+                        r_err("sync failed: %s",
+                                json_object_getstr(message, "message"));
+                        proxy->syncing = 0;
+                        if (proxy->status == PROXY_INITIALIZING)
+                                proxy->status = PROXY_ERROR;
+                        return;
+                }
+                proxy_handle_sync(proxy, message);
                 
         } else {
                 r_warn("proxy_onresponse: unknown response: %s", response);
@@ -359,9 +483,42 @@ static void _proxy_onclose(void *userdata, messagelink_t *link)
         proxy_onclose(proxy, link);
 }
 
-static void proxy_handle_register_add(proxy_t* proxy, json_object_t message)
+// Inserts an entry received from the registry, unless it is already
+// known, and makes the local connections. Called with the mutex
+// locked.
+static void proxy_add_entry(proxy_t* proxy, registry_entry_t *entry)
 {
         int count;
+        int err = 0;
+        
+        count = registry_count(proxy->registry, entry->id, NULL,
+                               NULL, TYPE_ANY, NULL, NULL);
+        if (count == 0)
+                count = registry_count(proxy->registry, 0, entry->name,
+                                       entry->topic, entry->type, entry->addr, NULL);
+        if (count == 0)
+                err = registry_insert_entry(proxy->registry, entry);
+        
+        if (err == 0)
+                // Update connections
+                proxy_add_connection(proxy, entry);
+}
+
+// Called with the mutex locked.
+static void proxy_remove_entry(proxy_t* proxy, const char *id)
+{
+        registry_entry_t *entry = registry_get(proxy->registry, id);
+        if (entry) {
+                // This return code will always be 0  (from registry_remove_entry_locked)
+                registry_delete(proxy->registry, id);
+                // Update connections
+                proxy_remove_connection(proxy, entry);
+                delete_registry_entry(entry);
+        }
+}
+
+static void proxy_handle_register_add(proxy_t* proxy, json_object_t message)
+{
         registry_entry_t *entry;
         int err = 0;
 
@@ -381,16 +538,7 @@ static void proxy_handle_register_add(proxy_t* proxy, json_object_t message)
         }
 
         mutex_lock(proxy->mutex);
-        
-        count = registry_count(proxy->registry, 0, entry->name,
-                               entry->topic, entry->type, entry->addr, NULL);
-        if (count == 0)
-                err = registry_insert_entry(proxy->registry, entry);
-        
-        if (err == 0)
-                // Update connections
-                proxy_add_connection(proxy, entry);
-        
+        proxy_add_entry(proxy, entry);
         mutex_unlock(proxy->mutex);
         
         delete_registry_entry(entry);        
@@ -398,7 +546,6 @@ static void proxy_handle_register_add(proxy_t* proxy, json_object_t message)
 
 static void proxy_handle_register_remove(proxy_t* proxy, json_object_t message)
 {
-        registry_entry_t *entry = NULL;
         const char *id;
         
         id = json_object_getstr(message, "id");
@@ -408,18 +555,8 @@ static void proxy_handle_register_remove(proxy_t* proxy, json_object_t message)
         }
         
         mutex_lock(proxy->mutex);
-        
-        entry = registry_get(proxy->registry, id);
-        if (entry) {
-                // This return code will always be 0  (from registry_remove_entry_locked)
-                registry_delete(proxy->registry, id);
-                // Update connections
-                proxy_remove_connection(proxy, entry);
-        }
-        
+        proxy_remove_entry(proxy, id);
         mutex_unlock(proxy->mutex);
-        
-        if (entry) delete_registry_entry(entry);
 }
 
 static void proxy_handle_update_address(proxy_t* proxy, json_object_t message)
@@ -445,69 +582,33 @@ static void proxy_handle_update_address(proxy_t* proxy, json_object_t message)
             r_err("proxy_handle_update_address - registry_update_addr: failed");
 }
 
-static int _entry_equals(registry_entry_t* entry, registry_entry_t* e) 
+// Replaces the remote entries with those of the snapshot. Called with
+// the mutex locked.
+static int proxy_apply_snapshot(proxy_t* proxy, list_t *remote_entries)
 {
-        return (e->type == entry->type
-                && rstreq(e->name, entry->name)
-                && rstreq(e->topic, entry->topic)
-                && addr_eq(e->addr, entry->addr));
-}
-
-static registry_entry_t *_list_contains(list_t* list, registry_entry_t *e)
-{
-        for (list_t *l = list; l != NULL; l = list_next(l)) {
-                registry_entry_t *f = list_get(l, registry_entry_t);
-                if (_entry_equals(e, f))
-                        return f;
-        }
-        return NULL;
-}
-
-static void proxy_handle_update_list(proxy_t* proxy, json_object_t message)
-{
-        json_object_t obj = json_object_get(message, "list");
-        if (json_isnull(obj) || !json_isarray(obj)) {
-                r_err("proxy_handle_update_list: 'list' value is not an array");
-                proxy->status = PROXY_ERROR;
-                return;
-        }
-        if (json_array_length(obj) == 0) {
-                r_err("proxy_handle_update_list: empty 'list' value");
-                proxy->status = PROXY_READY;
-                return;
-        }
-
-        list_t *remote_entries = registry_entry_parse_list(obj);
-        if (remote_entries == NULL) {
-                r_err("proxy_handle_update_list: failed to parse the 'list' value");
-                proxy->status = PROXY_ERROR;
-                return;
-        }
+        hashtable_t *remote_ids = new_hashtable(0);
+        if (remote_ids == NULL)
+                return -1;
         
-        mutex_lock(proxy->mutex);
-
         // add the missing endpoints
         for (list_t *l = remote_entries; l != NULL; l = list_next(l)) {
                 registry_entry_t *e = list_get(l, registry_entry_t);
-                int count = registry_count(proxy->registry, 0, e->name, e->topic,
-                                           e->type, e->addr, NULL);
-                if (count == 0) {
+                hashtable_set_str(remote_ids, e->id, e);
+                if (registry_count(proxy->registry, e->id, NULL, NULL,
+                                   TYPE_ANY, NULL, NULL) == 0) {
                     // ToDo: what happens here if it fails? log? break? Exit?
                     registry_insert_entry(proxy->registry, e);
-                    //err = registry_insert_entry(proxy->registry, e);
                 }
         }
 
         // remove the endpoints that have vanished
         list_t *local_entries = registry_select_all(proxy->registry);
         for (list_t *l = local_entries; l != NULL; l = list_next(l)) {
-
                 registry_entry_t *local_entry = list_get(l, registry_entry_t);
-                registry_entry_t *remote_entry = _list_contains(remote_entries, local_entry);
-                if (remote_entry == NULL) {
+                if (hashtable_get_str(remote_ids, local_entry->id) == NULL) {
                         // a locally registered entry is unknown to the remote registry. 
                         if (local_entry->endpoint != NULL) {
-                                r_warn("proxy_handle_update_list: central registry doesn't "
+                                r_warn("proxy_apply_snapshot: central registry doesn't "
                                          "list active local node '%s:%s'.",
                                          local_entry->name, local_entry->topic);
                         } else {
@@ -515,9 +616,8 @@ static void proxy_handle_update_list(proxy_t* proxy, json_object_t message)
                         }
                 }
         }
-
         delete_registry_entry_list(local_entries);
-        delete_registry_entry_list(remote_entries);
+        delete_hashtable(remote_ids);
         
         list_t *entries = registry_select_all(proxy->registry);
         for (list_t *l = entries; l != NULL; l = list_next(l)) {
@@ -525,10 +625,96 @@ static void proxy_handle_update_list(proxy_t* proxy, json_object_t message)
                 proxy_add_connection(proxy, entry);
         }
         delete_registry_entry_list(entries);
+        return 0;
+}
+
+// Applies the entries that were added or updated, and those that were
+// removed, since the previous revision. Called with the mutex locked.
+static int proxy_apply_delta(proxy_t* proxy, list_t *remote_entries,
+                             json_object_t removed)
+{
+        char b[64];
+        
+        for (list_t *l = remote_entries; l != NULL; l = list_next(l)) {
+                registry_entry_t *e = list_get(l, registry_entry_t);
+                registry_entry_t *known = registry_get(proxy->registry, e->id);
+                if (known == NULL) {
+                        proxy_add_entry(proxy, e);
+                } else {
+                        if (!addr_eq(known->addr, e->addr)) {
+                                addr_string(e->addr, b, sizeof(b));
+                                registry_update_addr(proxy->registry, e->id, b);
+                        }
+                        delete_registry_entry(known);
+                }
+        }
+        
+        for (int i = 0; i < json_array_length(removed); i++) {
+                const char *id = json_array_getstr(removed, i);
+                if (id != NULL)
+                        proxy_remove_entry(proxy, id);
+        }
+        return 0;
+}
+
+static void proxy_handle_sync(proxy_t* proxy, json_object_t message)
+{
+        list_t *remote_entries = NULL;
+        int err;
+        
+        const char *registry_id = json_object_getstr(message, "registry");
+        json_object_t entries = json_object_get(message, "entries");
+        json_object_t removed = json_object_get(message, "removed");
+        int snapshot = json_object_getbool(message, "snapshot");
+        uint64_t revision = (uint64_t) json_object_getnum(message, "revision");
+        
+        proxy->syncing = 0;
+        
+        if (registry_id == NULL || !json_isarray(entries)
+            || (!snapshot && !json_isarray(removed))) {
+                r_err("proxy_handle_sync: invalid response");
+                if (proxy->status == PROXY_INITIALIZING)
+                        proxy->status = PROXY_ERROR;
+                return;
+        }
 
-        proxy->status = PROXY_READY;
+        if (json_array_length(entries) > 0) {
+                remote_entries = registry_entry_parse_list(entries);
+                if (remote_entries == NULL) {
+                        r_err("proxy_handle_sync: failed to parse the entries");
+                        if (proxy->status == PROXY_INITIALIZING)
+                                proxy->status = PROXY_ERROR;
+                        return;
+                }
+        }
+        
+        mutex_lock(proxy->mutex);
+
+        if (snapshot)
+                err = proxy_apply_snapshot(proxy, remote_entries);
+        else
+                err = proxy_apply_delta(proxy, remote_entries, removed);
+        
+        if (err == 0) {
+                if (proxy->registry_id == NULL
+                    || !rstreq(proxy->registry_id, registry_id)) {
+                        if (proxy->registry_id)
+                                r_free(proxy->registry_id);
+                        proxy->registry_id = r_strdup(registry_id);
+                        proxy->revision = revision;
+                } else if (revision > proxy->revision) {
+                        proxy->revision = revision;
+                }
+                proxy->status = PROXY_READY;
+        } else {
+                r_err("proxy_handle_sync: failed to apply the changes");
+                if (proxy->status == PROXY_INITIALIZING)
+                        proxy->status = PROXY_ERROR;
+        }
 
         mutex_unlock(proxy->mutex);
+
+        delete_registry_entry_list(remote_entries);
 }
 
 // A datahub registered. Check whether there are any local datalinks
@@ -542,7 +728,7 @@ static void proxy_connect_datahub(proxy_t* proxy, registry_entry_t *entry)
                 registry_entry_t *e = list_get(l, registry_entry_t);
                 if (proxy_is_local(e)) {
                         datalink_t *link = (datalink_t *) e->endpoint;
-                        datalink_set_remote_addr(link, entry->addr);
+                        proxy_set_datalink_hub(link, entry);
                 }
         }
 
@@ -559,11 +745,12 @@ static void proxy_connect_datalink(proxy_t* proxy, registry_entry_t *entry)
         list = registry_select(proxy->registry, 0, NULL, entry->topic,
                                TYPE_DATAHUB, NULL, NULL);
         if (list == NULL) return;
-        
+
+        // The most recently registered hub
         e = list_get(list, registry_entry_t);
         if (proxy_is_local(e)) {
                 datahub_t *hub = (datahub_t *) e->endpoint;
-                datahub_add_link(hub, entry->addr);
+                proxy_add_datahub_link(hub, entry);
         }
 
         delete_registry_entry_list(list);
@@ -613,7 +800,9 @@ static void proxy_connect_streamer(proxy_t* proxy, registry_entry_t *entry)
                 registry_entry_t *e = list_get(l, registry_entry_t);
                 if (proxy_is_local(e)) {
                         streamerlink_t *link = (streamerlink_t *) e->endpoint;
-                        int err = streamerlink_set_remote(link, entry->addr);
+                        int err = streamerlink_set_remote(link, entry->addr,
+                                                          proxy_same_host(entry)?
+                                                          entry->shm : NULL);
                         if (err != 0) {
                                 r_err("proxy_connect_streamer: failed to make the connection.");
                         }
@@ -654,6 +843,7 @@ static void proxy_remove_datahub(proxy_t* proxy, registry_entry_t *entry)
                 if (proxy_is_local(e)) {
                         datalink_t *link = (datalink_t *) e->endpoint;
                         datalink_set_remote_addr(link, NULL);
+                        datalink_set_group(link, NULL);
                 }
         }
 
@@ -684,7 +874,6 @@ static void proxy_remove_datalink(proxy_t* proxy, registry_entry_t *entry)
 static void proxy_remove_messagehub(proxy_t* proxy, registry_entry_t *entry)
 {
         list_t *list;
-        
         list = registry_select(proxy->registry, 0, NULL, entry->topic,
                                TYPE_MESSAGELINK, NULL, NULL);
         if (list == NULL) return;
@@ -716,53 +905,154 @@ static void proxy_remove_connection(proxy_t* proxy, registry_entry_t *entry)
         }
 }
 
-static int proxy_send_register_request(proxy_t* proxy, registry_entry_t *entry)
+static void proxy_send_batch(proxy_t* proxy, json_object_t requests)
 {
-        // TODO: register to remote registry
         int r;
-        char b[64];
         
-        if (app_standalone())
-                return 0;
+        if (json_array_length(requests) == 1) {
+                r = messagelink_send_obj(proxy->link, json_array_get(requests, 0));
+        } else {
+                json_object_t batch = json_object_create();
+                json_object_setstr(batch, "request", "batch");
+                json_object_set(batch, "requests", requests);
+                r = messagelink_send_obj(proxy->link, batch);
+                json_unref(batch);
+        }
+        if (r != 0)
+                r_err("proxy_send_batch: failed to send %d request(s)",
+                      json_array_length(requests));
+}
+
+// Called with the pending mutex locked.
+static void proxy_sender_wait(proxy_t* proxy, double delay)
+{
+        struct timespec ts;
+        long ns;
+        
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ns = ts.tv_nsec + (long) (delay * 1000000000.0);
+        ts.tv_sec += ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        pthread_cond_timedwait(&proxy->pending_cond, &proxy->pending_mutex, &ts);
+}
+
+static void proxy_sender_run(proxy_t* proxy)
+{
+        json_object_t batch;
+        double delay;
+        int n;
         
-        r = messagelink_send_f(proxy->link,
-                               "{\"request\": \"register\","
-                               "\"entry\": {"
-                               "\"id\": \"%s\", "
-                               "\"name\": \"%s\", "
-                               "\"topic\": \"%s\", "
-                               "\"type\": \"%s\", "
-                               "\"addr\": \"%s\"}}",
-                               entry->id, entry->name, entry->topic, 
-                               registry_type_to_str(entry->type),
-                               addr_string(entry->addr, b, 64));
+        pthread_mutex_lock(&proxy->pending_mutex);
+        while (1) {
+                n = json_array_length(proxy->pending);
+                if (n == 0) {
+                        if (proxy->quit)
+                                break;
+                        pthread_cond_wait(&proxy->pending_cond, &proxy->pending_mutex);
+                        continue;
+                }
+                
+                delay = proxy->pending_since + PROXY_BATCH_DELAY - clock_time();
+                if (!proxy->quit && n < PROXY_BATCH_MAX && delay > 0) {
+                        proxy_sender_wait(proxy, delay);
+                        continue;
+                }
+                
+                batch = proxy->pending;
+                proxy->pending = json_array_create();
+                pthread_mutex_unlock(&proxy->pending_mutex);
+
+                proxy_send_batch(proxy, batch);
+                json_unref(batch);
+                
+                pthread_mutex_lock(&proxy->pending_mutex);
+        }
+        pthread_mutex_unlock(&proxy->pending_mutex);
+}
+
+// Queues the request for the sender thread, which takes over the
+// reference.
+static int proxy_queue_request(proxy_t* proxy, json_object_t request)
+{
+        int n, r;
+        
+        pthread_mutex_lock(&proxy->pending_mutex);
+        n = json_array_length(proxy->pending);
+        if (n == 0)
+                proxy->pending_since = clock_time();
+        r = json_array_push(proxy->pending, request);
+        if (r == 0 && (n == 0 || n + 1 >= PROXY_BATCH_MAX))
+                pthread_cond_signal(&proxy->pending_cond);
+        pthread_mutex_unlock(&proxy->pending_mutex);
+        
+        json_unref(request);
         return r;
 }
 
+static int proxy_send_register_request(proxy_t* proxy, registry_entry_t *entry)
+{
+        json_object_t request;
+        json_object_t encoded;
+        
+        if (app_standalone())
+                return 0;
+
+        request = json_object_create();
+        encoded = registry_entry_encode(entry);
+        json_object_setstr(request, "request", "register");
+        json_object_set(request, "entry", encoded);
+        json_unref(encoded);
+        return proxy_queue_request(proxy, request);
+}
+
 static int proxy_send_unregister_request(proxy_t* proxy, registry_entry_t *entry)
 {
+        json_object_t request;
+        
         if (app_standalone())
                 return 0;
-        return messagelink_send_f(proxy->link,
-                                  "{\"request\": \"unregister\", \"id\": \"%s\"}",
-                                  entry->id);
+        
+        request = json_object_create();
+        json_object_setstr(request, "request", "unregister");
+        json_object_setstr(request, "id", entry->id);
+        return proxy_queue_request(proxy, request);
 }
 
 static int proxy_send_update_address_request(proxy_t* proxy, const char *id,
                                              const char *addr)
 {
+        json_object_t request;
+        
         if (app_standalone())
                 return 0;
-        return messagelink_send_f(proxy->link,
-                                  "{\"request\": \"update-address\", "
-                                  "\"id\": \"%s\", \"addr\": \"%s\"}", id, addr);
+        
+        request = json_object_create();
+        json_object_setstr(request, "request", "update-address");
+        json_object_setstr(request, "id", id);
+        json_object_setstr(request, "addr", addr);
+        return proxy_queue_request(proxy, request);
 }
 
-static int proxy_send_list_request(proxy_t* proxy)
+// Asks for the changes since the known revision. The registry sends
+// all the entries on the first request.
+static int proxy_send_sync_request(proxy_t* proxy)
 {
+        int r;
+        
         if (app_standalone())
                 return 0;
-        return messagelink_send_f(proxy->link, "{\"request\": \"list\"}");
+        
+        proxy->syncing = 1;
+        if (proxy->registry_id == NULL)
+                r = messagelink_send_f(proxy->link, "{\"request\": \"sync\"}");
+        else
+                r = messagelink_send_f(proxy->link,
+                                       "{\"request\": \"sync\", \"registry\": \"%s\", "
+                                       "\"revision\": %llu}", proxy->registry_id,
+                                       (unsigned long long) proxy->revision);
+        if (r != 0)
+                proxy->syncing = 0;
+        return r;
 }
 
 static registry_entry_t *proxy_new_entry(proxy_t *proxy,
@@ -770,6 +1060,8 @@ static registry_entry_t *proxy_new_entry(proxy_t *proxy,
                                          const char *topic,
                                          int type,
                                          addr_t *addr,
+                                         addr_t *group,
+                                         const char *shm,
                                          void *endpoint)
 {
         registry_entry_t *entry;
@@ -787,6 +1079,12 @@ static registry_entry_t *proxy_new_entry(proxy_t *proxy,
         entry = new_registry_entry(0, name, topic, type, addr, endpoint);
         if (entry == NULL)
                 return NULL;
+
+        if (registry_entry_set_group(entry, group) != 0
+            || registry_entry_set_shm(entry, shm) != 0) {
+                delete_registry_entry(entry);
+                return NULL;
+        }
         
         mutex_lock(proxy->mutex);
         
@@ -845,7 +1143,8 @@ static datalink_t *proxy_open_datalink(proxy_t *proxy,
                 return NULL;
 
         entry = proxy_new_entry(proxy, name, topic, TYPE_DATALINK,
-                                datalink_addr(link), link);
+                                datalink_addr(link), NULL,
+                                datalink_ring_name(link), link);
         if (entry == NULL) {
                 delete_datalink(link);
                 return NULL;
@@ -858,13 +1157,13 @@ static datalink_t *proxy_open_datalink(proxy_t *proxy,
                                           TYPE_DATAHUB, NULL, NULL);
         if (entries != NULL) {
                 registry_entry_t *e = list_get(entries, registry_entry_t);
-                datalink_set_remote_addr(link, e->addr);
+                proxy_set_datalink_hub(link, e);
         } else
                 r_debug("proxy_open_datalink: didn't find hub for topic %s", topic);
+        delete_registry_entry_list(entries);
 
         mutex_unlock(proxy->mutex);
 
-        delete_registry_entry_list(entries);
         delete_registry_entry(entry);
 
         return link;
@@ -881,7 +1180,8 @@ static datahub_t *proxy_open_datahub(proxy_t *proxy,
                                      const char *topic,
                                      datahub_onbroadcast_t onbroadcast,
                                      datahub_ondata_t ondata,
-                                     void* userdata)
+                                     void* userdata,
+                                     addr_t *group)
 {
         datahub_t *hub;
         registry_entry_t *entry;
@@ -890,8 +1190,19 @@ static datahub_t *proxy_open_datahub(proxy_t *proxy,
         if (hub == NULL)
                 return NULL;
 
+        datahub_set_dump(hub, dump_start_recording(name, TYPE_DATAHUB, topic,
+                                                   "application/json"));
+
+        // Only advertise the group if the hub can send to it. The
+        // links then keep receiving the data by unicast.
+        if (group != NULL && datahub_set_group(hub, group) != 0) {
+                r_warn("proxy_open_datahub: multicast is not available, "
+                       "using unicast");
+        }
+
         entry = proxy_new_entry(proxy, name, topic, TYPE_DATAHUB,
-                                datahub_addr(hub), hub);
+                                datahub_addr(hub), datahub_group(hub),
+                                NULL, hub);
         if (entry == NULL) {
                 delete_datahub(hub);
                 return NULL;
@@ -902,14 +1213,12 @@ static datahub_t *proxy_open_datahub(proxy_t *proxy,
         // Connect to the available datalinks
         list_t *entries = registry_select(proxy->registry, 0, NULL, entry->topic,
                                           TYPE_DATALINK, NULL, NULL);
-        for (list_t *l = entries; l != NULL; l = list_next(l)) {
-                registry_entry_t *e = list_get(l, registry_entry_t);
-                datahub_add_link(hub, e->addr);
-        }
+        for (list_t *l = entries; l != NULL; l = list_next(l))
+                proxy_add_datahub_link(hub, list_get(l, registry_entry_t));
+        delete_registry_entry_list(entries);
 
         mutex_unlock(proxy->mutex);
 
-        delete_registry_entry_list(entries);
         delete_registry_entry(entry);
         
         return hub;
@@ -935,7 +1244,7 @@ static messagelink_t *proxy_open_messagelink(proxy_t *proxy,
                 return NULL;
 
         entry = proxy_new_entry(proxy, name, topic, TYPE_MESSAGELINK,
-                                messagelink_addr(link), link);
+                                messagelink_addr(link), NULL, NULL, link);
         if (entry == NULL) {
                 delete_messagelink(link);
                 return NULL;
@@ -952,10 +1261,10 @@ static messagelink_t *proxy_open_messagelink(proxy_t *proxy,
                 if (err)
                         r_err("proxy_open_messagelink: failed to make the connection.");
         }
+        delete_registry_entry_list(entries);
 
         mutex_unlock(proxy->mutex);
 
-        delete_registry_entry_list(entries);
         delete_registry_entry(entry);
 
         return link;
@@ -982,7 +1291,7 @@ static messagehub_t *proxy_open_messagehub(proxy_t *proxy,
                 return NULL;
 
         entry = proxy_new_entry(proxy, name, topic, TYPE_MESSAGEHUB,
-                                messagehub_addr(hub), hub); 
+                                messagehub_addr(hub), NULL, NULL, hub); 
         if (entry == NULL) {
                 delete_messagehub(hub);
                 return NULL;
@@ -1000,23 +1309,21 @@ static void proxy_close_messagehub(proxy_t *proxy, messagehub_t *hub)
 
 addr_t *proxy_get_messagehub(proxy_t *proxy, const char *topic)
 {
-        list_t *list;
+        registry_view_t view;
         registry_entry_t *e;
         addr_t *addr = NULL;
         
         mutex_lock(proxy->mutex);
         
-        list = registry_select(proxy->registry, 0, NULL, topic,
-                               TYPE_MESSAGEHUB, NULL, NULL);
-
-        if (list) {
-                e = list_get(list, registry_entry_t);
+        if (registry_select_view(proxy->registry, &view, 0, NULL, topic,
+                                 TYPE_MESSAGEHUB, NULL, NULL) > 0) {
+                e = view.entries[view.length - 1];
                 addr = addr_clone(e->addr);
         }
+        registry_release_view(proxy->registry, &view);
         
         mutex_unlock(proxy->mutex);
         
-        delete_registry_entry_list(list);
         return addr;
 }
 
@@ -1032,7 +1339,7 @@ static service_t *proxy_open_service(proxy_t *proxy, const char *name,
                 return NULL;
 
         entry = proxy_new_entry(proxy, name, topic, TYPE_SERVICE,
-                                service_addr(service), service); 
+                                service_addr(service), NULL, NULL, service); 
         if (entry == NULL) {
                 delete_service(service);
                 return NULL;
@@ -1050,22 +1357,21 @@ static void proxy_close_service(proxy_t *proxy, service_t *service)
 
 static addr_t *proxy_get_service(proxy_t *proxy, const char *topic)
 {
-        list_t *list;
+        registry_view_t view;
         registry_entry_t *e;
         addr_t *addr = NULL;
         
         mutex_lock(proxy->mutex);
         
-        list = registry_select(proxy->registry, 0, NULL, topic, TYPE_SERVICE, NULL, NULL);
-
-        if (list) {
-                e = list_get(list, registry_entry_t);
+        if (registry_select_view(proxy->registry, &view, 0, NULL, topic,
+                                 TYPE_SERVICE, NULL, NULL) > 0) {
+                e = view.entries[view.length - 1];
                 addr = addr_clone(e->addr);
         }
+        registry_release_view(proxy->registry, &view);
         
         mutex_unlock(proxy->mutex);
         
-        delete_registry_entry_list(list);
         return addr;
 }
 
@@ -1087,7 +1393,8 @@ static streamer_t *proxy_open_streamer(proxy_t *proxy,
                 return NULL;
 
         entry = proxy_new_entry(proxy, name, topic, TYPE_STREAMER,
-                                streamer_addr(streamer), streamer); 
+                                streamer_addr(streamer), NULL,
+                                streamer_ring_name(streamer), streamer); 
         if (entry == NULL) {
                 delete_streamer(streamer);
                 return NULL;
@@ -1105,22 +1412,21 @@ static void proxy_close_streamer(proxy_t *proxy, streamer_t *streamer)
 
 static addr_t *proxy_get_streamer(proxy_t *proxy, const char *topic)
 {
-        list_t *list;
+        registry_view_t view;
         registry_entry_t *e;
         addr_t *addr = NULL;
         
         mutex_lock(proxy->mutex);
         
-        list = registry_select(proxy->registry, 0, NULL, topic, TYPE_STREAMER, NULL, NULL);
-
-        if (list) {
-                e = list_get(list, registry_entry_t);
+        if (registry_select_view(proxy->registry, &view, 0, NULL, topic,
+                                 TYPE_STREAMER, NULL, NULL) > 0) {
+                e = view.entries[view.length - 1];
                 addr = addr_clone(e->addr);
         }
+        registry_release_view(proxy->registry, &view);
         
         mutex_unlock(proxy->mutex);
         
-        delete_registry_entry_list(list);
         return addr;
 }
 
@@ -1141,7 +1447,7 @@ static streamerlink_t *proxy_open_streamerlink(proxy_t *proxy,
                 return NULL;
 
         entry = proxy_new_entry(proxy, name, topic, TYPE_STREAMERLINK,
-                                streamerlink_addr(link), link); 
+                                streamerlink_addr(link), NULL, NULL, link); 
         if (entry == NULL) {
                 delete_streamerlink(link);
                 return NULL;
@@ -1154,14 +1460,15 @@ static streamerlink_t *proxy_open_streamerlink(proxy_t *proxy,
                                           TYPE_STREAMER, NULL, NULL);
         if (entries != NULL) {
                 registry_entry_t *e = list_get(entries, registry_entry_t);
-                int err = streamerlink_set_remote(link, e->addr);
+                int err = streamerlink_set_remote(link, e->addr,
+                                                  proxy_same_host(e)? e->shm : NULL);
                 if (err)
                         r_err("proxy_open_streamerlink: failed to make the connection.");
         }
+        delete_registry_entry_list(entries);
 
         mutex_unlock(proxy->mutex);
 
-        delete_registry_entry_list(entries);
         delete_registry_entry(entry);
         
         return link;
@@ -1203,7 +1510,21 @@ datahub_t *registry_open_datahub(const char *name,
 {
         proxy_t *proxy = proxy_get();
         if (proxy == NULL) return NULL;
-        return proxy_open_datahub(proxy, name, topic, onbroadcast, ondata, userdata);
+        return proxy_open_datahub(proxy, name, topic, onbroadcast, ondata,
+                                  userdata, NULL);
+}
+
+datahub_t *registry_open_datahub_multicast(const char *name,
+                                           const char *topic,
+                                           addr_t *group,
+                                           datahub_onbroadcast_t onbroadcast,
+                                           datahub_ondata_t ondata,
+                                           void* userdata)
+{
+        proxy_t *proxy = proxy_get();
+        if (proxy == NULL) return NULL;
+        return proxy_open_datahub(proxy, name, topic, onbroadcast, ondata,
+                                  userdata, group);
 }
 
 void registry_close_datahub(datahub_t *hub)
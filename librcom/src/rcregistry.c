@@ -31,6 +31,14 @@
 typedef struct _rcregistry_t {
         registry_t *registry;
         messagehub_t *hub;
+        // The id of the registry's own entry. It identifies this
+        // instance of the registry, and therefore the sequence of its
+        // revisions, in sync requests.
+        char *id;
+        // Each link has its own thread. The requests are handled one
+        // at a time so that the events go out in the order of the
+        // revisions.
+        mutex_t *mutex;
 } rcregistry_t;
 
 static void _onmessage(void *userdata, messagelink_t *link, json_object_t message);
@@ -60,6 +68,12 @@ rcregistry_t* new_rcregistry()
         if (rcregistry == NULL)
                 return NULL;
 
+        rcregistry->mutex = new_mutex();
+        if (rcregistry->mutex == NULL) {
+                delete_rcregistry(rcregistry);
+                return NULL;
+        }
+
         rcregistry->registry = new_registry();
         if (rcregistry->registry == NULL) {
                 r_err("Failed to create the registry. Quiting.");
@@ -77,10 +91,9 @@ rcregistry_t* new_rcregistry()
         }
         
         addr_t *addr = messagehub_addr(rcregistry->hub);
-        char *id = r_uuid();
-        err = registry_insert(rcregistry->registry, id, "registry",
+        rcregistry->id = r_uuid();
+        err = registry_insert(rcregistry->registry, rcregistry->id, "registry",
                               "registry", TYPE_MESSAGEHUB, addr, rcregistry->hub);
-        r_free(id);
         if (err != 0) {
                 r_err("Failed to insert the hub into the registry. Quiting.");
                 delete_rcregistry(rcregistry);
@@ -97,6 +110,10 @@ void delete_rcregistry(rcregistry_t* rcregistry)
                         delete_registry(rcregistry->registry);
                 if (rcregistry->hub)
                         delete_messagehub(rcregistry->hub);
+                if (rcregistry->id)
+                        r_free(rcregistry->id);
+                if (rcregistry->mutex)
+                        delete_mutex(rcregistry->mutex);
                 r_delete(rcregistry);
         }
 }
@@ -116,96 +133,105 @@ static int rcregistry_fail(messagelink_t *link, const char *req, const char *mes
                            req, message);
 }
 
-static int rcregistry_success(messagelink_t *link, const char *req)
+static json_object_t rcregistry_response(const char *req, int success, const char *message)
 {
-        return messagelink_send_f(link, "{\"response\":\"%s\", \"success\":true}", req);
+        json_object_t response = json_object_create();
+        if (!success)
+                r_warn("rcregistry_response: %s: %s", req, message);
+        json_object_setstr(response, "response", req);
+        json_object_set(response, "success", success? json_true() : json_false());
+        if (message)
+                json_object_setstr(response, "message", message);
+        return response;
 }
 
-static void rcregistry_register(rcregistry_t* rcregistry,
-                                messagelink_t *link,
-                                json_object_t message)
+static double rcregistry_revision(rcregistry_t* rcregistry)
+{
+        return (double) registry_revision(rcregistry->registry);
+}
+
+/*
+ * The handlers of the register, unregister, and update-address
+ * requests return the response. When the registry changed, they add
+ * the event that announces the change to the 'events' array. The
+ * caller sends the response and broadcasts the events, so that the
+ * requests of a batch produce one response and one event message.
+ */
+typedef json_object_t (*rcregistry_handler_t)(rcregistry_t* rcregistry,
+                                              json_object_t message,
+                                              json_object_t events);
+
+static json_object_t rcregistry_register(rcregistry_t* rcregistry,
+                                         json_object_t message,
+                                         json_object_t events)
 {
         registry_entry_t *entry;
         int err;
         json_object_t obj = json_object_get(message, "entry");
-        if (json_isnull(obj)) {
-                rcregistry_fail(link, "register", "Invalid entry value");
-                return; 
-        }
+        if (json_isnull(obj))
+                return rcregistry_response("register", 0, "Invalid entry value");
         
         entry = registry_entry_parse(obj, &err);
         switch (err) {
         case 0: break; 
-        case -1: rcregistry_fail(link, "register", "Invalid name"); return; 
-        case -2: rcregistry_fail(link, "register", "Invalid topic"); return; 
-        case -3: rcregistry_fail(link, "register", "Invalid type"); return; 
-        case -4: rcregistry_fail(link, "register", "Invalid address"); return; 
-        case -5: rcregistry_fail(link, "register", "Invalid ID"); return; 
-        default: rcregistry_fail(link, "register", "Unknown error"); return; 
+        case -1: return rcregistry_response("register", 0, "Invalid name");
+        case -2: return rcregistry_response("register", 0, "Invalid topic");
+        case -3: return rcregistry_response("register", 0, "Invalid type");
+        case -4: return rcregistry_response("register", 0, "Invalid address");
+        case -5: return rcregistry_response("register", 0, "Invalid ID");
+        default: return rcregistry_response("register", 0, "Unknown error");
         }
 
-        err = registry_insert(rcregistry->registry, entry->id, entry->name,
-                              entry->topic, entry->type, entry->addr, NULL);
+        err = registry_insert_entry(rcregistry->registry, entry);
         
         if (err != 0) {
-                rcregistry_fail(link, "register", "Internal error");
                 delete_registry_entry(entry);
-                return;
+                return rcregistry_response("register", 0, "Internal error");
         }
         
-        err = rcregistry_success(link, "register");
-        if (err != 0) {
-                r_err("rcregistry_success returned an error");
-        }
-
         r_info("successful registration %s %s:%s id=%s",
                  registry_type_to_str(entry->type), entry->name, entry->topic, entry->id);
 
-        // Broadcast new node
-        char b[64];
-        messagehub_broadcast_f(rcregistry->hub, NULL, 
-                               "{\"event\": \"proxy-add\","
-                               "\"entry\": {" 
-                               "\"id\": \"%s\","
-                               "\"name\": \"%s\","
-                               "\"topic\": \"%s\","
-                               "\"type\": \"%s\","
-                               "\"addr\": \"%s\"}}",
-                               entry->id, entry->name, entry->topic,
-                               registry_type_to_str(entry->type),
-                               addr_string(entry->addr, b, 64));
+        // Announce the new node
+        json_object_t event = json_object_create();
+        json_object_t encoded = registry_entry_encode(entry);
+        json_object_setstr(event, "event", "proxy-add");
+        json_object_set(event, "entry", encoded);
+        json_object_setnum(event, "revision", rcregistry_revision(rcregistry));
+        json_array_push(events, event);
+        json_unref(encoded);
+        json_unref(event);
 
         delete_registry_entry(entry);
+        
+        return rcregistry_response("register", 1, NULL);
 }
 
-static void rcregistry_unregister(rcregistry_t* rcregistry,
-                                  messagelink_t *link,
-                                  json_object_t message)
+static json_object_t rcregistry_unregister(rcregistry_t* rcregistry,
+                                           json_object_t message,
+                                           json_object_t events)
 {
         int err;
         const char *id;
         
         id = json_object_getstr(message, "id");
-        if (id == NULL) {
-                r_err("rcregistry_unregister: Invalid ID"); 
-                return;
-        }
+        if (id == NULL)
+                return rcregistry_response("unregister", 0, "Invalid ID");
         
         err = registry_delete(rcregistry->registry, id);
-        if (err != 0) {
-                rcregistry_fail(link, "unregister", "Internal error");
-                return;
-        }
-        
-        err = rcregistry_success(link, "unregister");
         if (err != 0)
-                r_err("rcregistry_success returned an error");
-
+                return rcregistry_response("unregister", 0, "Internal error");
+        
         r_info("successful unregistration: id=%s", id); 
 
-        // Broadcast 
-        messagehub_broadcast_f(rcregistry->hub, NULL, 
-                               "{\"event\": \"proxy-remove\", \"id\": \"%s\"}", id);
+        json_object_t event = json_object_create();
+        json_object_setstr(event, "event", "proxy-remove");
+        json_object_setstr(event, "id", id);
+        json_object_setnum(event, "revision", rcregistry_revision(rcregistry));
+        json_array_push(events, event);
+        json_unref(event);
+        
+        return rcregistry_response("unregister", 1, NULL);
 }
 
 static void rcregistry_send_list(rcregistry_t* rcregistry, messagelink_t *link)
@@ -225,40 +251,187 @@ static void rcregistry_send_list(rcregistry_t* rcregistry, messagelink_t *link)
         delete_registry_entry_list(entries);
 }
 
-static void rcregistry_update_address(rcregistry_t* rcregistry,
-                                      messagelink_t *link,
-                                      json_object_t message)
+static json_object_t rcregistry_encode_ids(list_t *ids)
+{
+        json_object_t array = json_array_create();
+        for (list_t *l = ids; l != NULL; l = list_next(l)) {
+                json_object_t s = json_string_create(list_get(l, char));
+                json_array_push(array, s);
+                json_unref(s);
+        }
+        return array;
+}
+
+// Sends the changes since the revision that the proxy already knows,
+// or all the entries when the proxy has no revision of this registry
+// yet, or when the changes it missed are no longer available.
+static void rcregistry_sync(rcregistry_t* rcregistry,
+                            messagelink_t *link,
+                            json_object_t message)
+{
+        uint64_t revision;
+        list_t *entries = NULL;
+        list_t *removed = NULL;
+        int snapshot = 1;
+        json_object_t value;
+        
+        const char *registry_id = json_object_getstr(message, "registry");
+        if (registry_id != NULL
+            && rstreq(registry_id, rcregistry->id)
+            && json_object_has(message, "revision")) {
+                uint64_t since = (uint64_t) json_object_getnum(message, "revision");
+                if (registry_changes(rcregistry->registry, since, &revision,
+                                     &entries, &removed) == 0)
+                        snapshot = 0;
+        }
+        if (snapshot)
+                entries = registry_snapshot(rcregistry->registry, &revision);
+        
+        json_object_t response = json_object_create();
+        json_object_setstr(response, "response", "sync");
+        json_object_set(response, "success", json_true());
+        json_object_setstr(response, "message", "OK");
+        json_object_setstr(response, "registry", rcregistry->id);
+        json_object_setnum(response, "revision", (double) revision);
+        json_object_set(response, "snapshot", snapshot? json_true() : json_false());
+        
+        value = registry_entry_encode_list(entries);
+        json_object_set(response, "entries", value);
+        json_unref(value);
+        
+        if (!snapshot) {
+                value = rcregistry_encode_ids(removed);
+                json_object_set(response, "removed", value);
+                json_unref(value);
+        }
+
+        messagelink_send_obj(link, response);
+        
+        json_unref(response);
+        delete_registry_entry_list(entries);
+        registry_delete_id_list(removed);
+}
+
+static json_object_t rcregistry_update_address(rcregistry_t* rcregistry,
+                                               json_object_t message,
+                                               json_object_t events)
 {
         int err;
         const char *id;
         const char *addr;
         
         id = json_object_getstr(message, "id");
-        if (id == NULL) {
-                r_err("rcregistry_update_address: Invalid ID"); 
-                return;
-        }
+        if (id == NULL)
+                return rcregistry_response("update-address", 0, "Invalid ID");
 
         addr = json_object_getstr(message, "addr");
-        if (addr == NULL) {
-                r_err("rcregistry_update_address: Invalid address"); 
-                return;
-        }
+        if (addr == NULL)
+                return rcregistry_response("update-address", 0, "Invalid address");
         
         err = registry_update_addr(rcregistry->registry, id, addr);
-        if (err != 0) {
-                rcregistry_fail(link, "update-address", "Internal error");
+        if (err != 0)
+                return rcregistry_response("update-address", 0, "Internal error");
+        
+        // Announce the update. The sender receives it too, so that it
+        // sees every revision.
+        json_object_t event = json_object_create();
+        json_object_setstr(event, "event", "proxy-update-address");
+        json_object_setstr(event, "id", id);
+        json_object_setstr(event, "addr", addr);
+        json_object_setnum(event, "revision", rcregistry_revision(rcregistry));
+        json_array_push(events, event);
+        json_unref(event);
+        
+        return rcregistry_response("update-address", 1, NULL);
+}
+
+static rcregistry_handler_t rcregistry_get_handler(const char *request)
+{
+        if (rstreq(request, "register"))
+                return rcregistry_register;
+        else if (rstreq(request, "unregister"))
+                return rcregistry_unregister;
+        else if (rstreq(request, "update-address"))
+                return rcregistry_update_address;
+        return NULL;
+}
+
+// A single event is sent as is, several as one proxy-batch event.
+static void rcregistry_broadcast(rcregistry_t* rcregistry, json_object_t events)
+{
+        int n = json_array_length(events);
+        if (n == 1) {
+                messagehub_broadcast_obj(rcregistry->hub, NULL, json_array_get(events, 0));
+        } else if (n > 1) {
+                json_object_t batch = json_object_create();
+                json_object_setstr(batch, "event", "proxy-batch");
+                json_object_set(batch, "events", events);
+                messagehub_broadcast_obj(rcregistry->hub, NULL, batch);
+                json_unref(batch);
+        }
+}
+
+static void rcregistry_handle(rcregistry_t* rcregistry,
+                              messagelink_t *link,
+                              rcregistry_handler_t handler,
+                              json_object_t message)
+{
+        json_object_t events = json_array_create();
+        json_object_t response = handler(rcregistry, message, events);
+        
+        if (messagelink_send_obj(link, response) != 0)
+                r_err("rcregistry_handle: failed to send the response");
+        rcregistry_broadcast(rcregistry, events);
+        
+        json_unref(response);
+        json_unref(events);
+}
+
+// Handles the requests in the 'requests' array in order. The response
+// lists the response of each request, and the changes are announced
+// in one event.
+static void rcregistry_batch(rcregistry_t* rcregistry,
+                             messagelink_t *link,
+                             json_object_t message)
+{
+        json_object_t requests = json_object_get(message, "requests");
+        if (!json_isarray(requests)) {
+                rcregistry_fail(link, "batch", "Invalid requests value");
                 return;
         }
         
-        err = rcregistry_success(link, "update-address");
-        if (err != 0)
-                r_err("rcregistry_success returned an error");
+        json_object_t events = json_array_create();
+        json_object_t responses = json_array_create();
+        
+        for (int i = 0; i < json_array_length(requests); i++) {
+                json_object_t sub = json_array_get(requests, i);
+                const char *request = NULL;
+                rcregistry_handler_t handler = NULL;
+                json_object_t response;
+                
+                if (json_isobject(sub))
+                        request = json_object_getstr(sub, "request");
+                if (request != NULL)
+                        handler = rcregistry_get_handler(request);
+                
+                if (handler != NULL)
+                        response = handler(rcregistry, sub, events);
+                else
+                        response = rcregistry_response(request? request : "?", 0,
+                                                       "Unknown request");
+                json_array_push(responses, response);
+                json_unref(response);
+        }
+
+        json_object_t response = rcregistry_response("batch", 1, "OK");
+        json_object_set(response, "responses", responses);
+        if (messagelink_send_obj(link, response) != 0)
+                r_err("rcregistry_batch: failed to send the response");
+        rcregistry_broadcast(rcregistry, events);
         
-        // Broadcast update
-        messagehub_broadcast_f(rcregistry->hub, link, 
-                               "{\"event\": \"proxy-update-address\","
-                               "\"id\": \"%s\", \"addr\": \"%s\"}", id, addr);
+        json_unref(response);
+        json_unref(responses);
+        json_unref(events);
 }
 
 static void rcregistry_onmessage(rcregistry_t* rcregistry,
@@ -283,22 +456,29 @@ static void rcregistry_onmessage(rcregistry_t* rcregistry,
         
         //r_debug("rcregistry_onmessage: request=%s", request);
 
-        if (rstreq(request, "register")) {
-                rcregistry_register(rcregistry, link, message);
+        mutex_lock(rcregistry->mutex);
+        
+        rcregistry_handler_t handler = rcregistry_get_handler(request);
+        
+        if (handler != NULL) {
+                rcregistry_handle(rcregistry, link, handler, message);
+                
+        } else if (rstreq(request, "batch")) {
+                rcregistry_batch(rcregistry, link, message);
                 
-        } else if (rstreq(request, "unregister")) {
-                rcregistry_unregister(rcregistry, link, message);
+        } else if (rstreq(request, "sync")) {
+                rcregistry_sync(rcregistry, link, message);
                 
         } else if (rstreq(request, "list")) {
+                // Deprecated: replaced by "sync"
                 rcregistry_send_list(rcregistry, link);                
                 
-        } else if (rstreq(request, "update-address")) {
-                rcregistry_update_address(rcregistry, link, message);                
-                
         } else {
                 r_warn("Unknown request: %s", request);
                 rcregistry_fail(link, request, "Unknown request");
         }
+        
+        mutex_unlock(rcregistry->mutex);
 }
 
 __attribute__((unused))
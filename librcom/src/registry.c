@@ -22,9 +22,12 @@
 
  */
 
+#include <string.h>
+#include <pthread.h>
 #include <r.h>
 
 #include "addr.h"
+#include "hashtable.h"
 #include "registry_priv.h"
 
 int registry_str_to_type(const char* str)
@@ -105,6 +108,10 @@ void delete_registry_entry(registry_entry_t *entry)
                         r_free(entry->topic);
                 if (entry->addr)
                         delete_addr(entry->addr);
+                if (entry->group)
+                        delete_addr(entry->group);
+                if (entry->shm)
+                        r_free(entry->shm);
                 // ToDo: This isn't created by the new fubction so we can't delete it can we?
 //                if (entry->endpoint)
 //                        ; // FIXME!
@@ -112,6 +119,51 @@ void delete_registry_entry(registry_entry_t *entry)
         }
 }
 
+registry_entry_t *registry_entry_clone(registry_entry_t *e)
+{
+        registry_entry_t *clone;
+        
+        clone = new_registry_entry(e->id, e->name, e->topic, e->type,
+                                   e->addr, e->endpoint);
+        if (clone != NULL
+            && (registry_entry_set_group(clone, e->group) != 0
+                || registry_entry_set_shm(clone, e->shm) != 0)) {
+                delete_registry_entry(clone);
+                clone = NULL;
+        }
+        return clone;
+}
+
+int registry_entry_set_group(registry_entry_t *entry, addr_t *group)
+{
+        addr_t *clone = NULL;
+        
+        if (group != NULL) {
+                clone = addr_clone(group);
+                if (clone == NULL)
+                        return -1;
+        }
+        if (entry->group)
+                delete_addr(entry->group);
+        entry->group = clone;
+        return 0;
+}
+
+int registry_entry_set_shm(registry_entry_t *entry, const char *shm)
+{
+        char *clone = NULL;
+        
+        if (shm != NULL) {
+                clone = r_strdup(shm);
+                if (clone == NULL)
+                        return -1;
+        }
+        if (entry->shm)
+                r_free(entry->shm);
+        entry->shm = clone;
+        return 0;
+}
+
 registry_entry_t *registry_entry_parse(json_object_t obj, int *error)
 {
         const char *id;
@@ -119,7 +171,10 @@ registry_entry_t *registry_entry_parse(json_object_t obj, int *error)
         const char *topic;
         const char *type_str;
         const char *addr_str;
+        const char *group_str;
+        const char *shm;
         addr_t *addr;
+        addr_t *group = NULL;
         int type;
         
         id = json_object_getstr(obj, "id");
@@ -127,6 +182,8 @@ registry_entry_t *registry_entry_parse(json_object_t obj, int *error)
         topic = json_object_getstr(obj, "topic");
         type_str = json_object_getstr(obj, "type");
         addr_str = json_object_getstr(obj, "addr");
+        group_str = json_object_getstr(obj, "group");
+        shm = json_object_getstr(obj, "shm");
 
         if (!registry_valid_id(id)) {
                 *error = -5;
@@ -162,14 +219,28 @@ registry_entry_t *registry_entry_parse(json_object_t obj, int *error)
                 return NULL;
         }
         
+        if (group_str != NULL) {
+                group = addr_parse(group_str);
+                if (group == NULL) {
+                        delete_addr(addr);
+                        *error = -4;
+                        return NULL;
+                }
+        }
+        
         registry_entry_t *entry = new_registry_entry(id, name, topic, type, addr, NULL);
-        if (entry == NULL) {
+        if (entry == NULL
+            || registry_entry_set_group(entry, group) != 0
+            || registry_entry_set_shm(entry, shm) != 0) {
+                delete_registry_entry(entry);
                 delete_addr(addr);
+                delete_addr(group);
                 *error = -6;
                 return NULL;
         }
         
         delete_addr(addr);
+        delete_addr(group);
         
         *error = 0;
         return entry;
@@ -184,6 +255,10 @@ json_object_t registry_entry_encode(registry_entry_t *e)
         json_object_setstr(obj, "topic", e->topic);
         json_object_setstr(obj, "type", registry_type_to_str(e->type));
         json_object_setstr(obj, "addr", addr_string(e->addr, b, 64));
+        if (e->group)
+                json_object_setstr(obj, "group", addr_string(e->group, b, 64));
+        if (e->shm)
+                json_object_setstr(obj, "shm", e->shm);
         return obj;
 }
 
@@ -315,15 +390,59 @@ int registry_valid_name(const char *name)
 
 /********************************************************/
 
+// The longest topic, followed by a zero and the type
+#define REGISTRY_KEY_MAX 260
+
+// The number of changes that are remembered for registry_changes()
+#define REGISTRY_HISTORY 1024
+
+/*
+ * The entries are kept in an array, in the order in which they were
+ * inserted, and are indexed by id and by (topic, type). The key of
+ * the second index is the topic followed by a zero and the type, and
+ * its values are buckets that list the entries of that topic and type.
+ *
+ * Readers take the lock in shared mode. The views returned by
+ * registry_select_view() borrow the entries, and even the arrays of
+ * the buckets, and keep the lock until they are released.
+ *
+ * Each insert, delete, or address update increments the revision.
+ * The ids of the last REGISTRY_HISTORY changed entries are kept in a
+ * ring, indexed by revision, from which registry_changes() computes
+ * the delta since an earlier revision.
+ */
+typedef struct _registry_bucket_t {
+        registry_entry_t **entries;
+        int length;
+        int size;
+} registry_bucket_t;
+
 typedef struct _registry_t
 {
-        list_t *entries;
-        messagelink_t *link;
-        mutex_t *mutex;
+        registry_entry_t **entries;
+        int length;
+        int size;
+        hashtable_t *ids;
+        hashtable_t *topics;
+        uint64_t revision;
+        char **changes;
+        pthread_rwlock_t lock;
 } registry_t;
 
-static void registry_lock(registry_t* registry);
-static void registry_unlock(registry_t* registry);
+static void registry_read_lock(registry_t* registry)
+{
+        pthread_rwlock_rdlock(&registry->lock);
+}
+
+static void registry_write_lock(registry_t* registry)
+{
+        pthread_rwlock_wrlock(&registry->lock);
+}
+
+static void registry_unlock(registry_t* registry)
+{
+        pthread_rwlock_unlock(&registry->lock);
+}
 
 registry_t* new_registry()
 {
@@ -333,32 +452,168 @@ registry_t* new_registry()
         if (registry == NULL)
                 return NULL;
 
-        registry->mutex = new_mutex();        
+        registry->ids = new_hashtable(0);
+        registry->topics = new_hashtable(0);
+        registry->changes = r_array(char *, REGISTRY_HISTORY);
+        if (registry->ids == NULL || registry->topics == NULL
+            || registry->changes == NULL
+            || pthread_rwlock_init(&registry->lock, NULL) != 0) {
+                delete_hashtable(registry->ids);
+                delete_hashtable(registry->topics);
+                if (registry->changes)
+                        r_free(registry->changes);
+                r_delete(registry);
+                return NULL;
+        }
         return registry;
 }
 
+static void registry_delete_bucket(void *userdata __attribute__((unused)),
+                                   const void *key __attribute__((unused)),
+                                   int keylen __attribute__((unused)),
+                                   void *value)
+{
+        registry_bucket_t *bucket = (registry_bucket_t *) value;
+        if (bucket->entries)
+                r_free(bucket->entries);
+        r_delete(bucket);
+}
+
 void delete_registry(registry_t* registry)
 {
         if (registry) {
-                if (registry->mutex) {
-                        mutex_lock(registry->mutex);
-                        delete_registry_entry_list(registry->entries);
-                        registry->entries = NULL;
-                        mutex_unlock(registry->mutex);
-                        delete_mutex(registry->mutex);
-                }
+                for (int i = 0; i < registry->length; i++)
+                        delete_registry_entry(registry->entries[i]);
+                if (registry->entries)
+                        r_free(registry->entries);
+                hashtable_foreach(registry->topics, registry_delete_bucket, NULL);
+                delete_hashtable(registry->topics);
+                delete_hashtable(registry->ids);
+                for (int i = 0; i < REGISTRY_HISTORY; i++)
+                        if (registry->changes[i])
+                                r_free(registry->changes[i]);
+                r_free(registry->changes);
+                pthread_rwlock_destroy(&registry->lock);
                 r_delete(registry);
         }
 }
 
-static void registry_lock(registry_t* registry)
+static int registry_topic_key(char *key, int len, const char *topic, int type)
 {
-        mutex_lock(registry->mutex);
+        int n = (int) strlen(topic);
+        if (n + 2 > len)
+                return -1;
+        memcpy(key, topic, n);
+        key[n] = 0;
+        key[n + 1] = (char) type;
+        return n + 2;
 }
 
-static void registry_unlock(registry_t* registry)
+static registry_bucket_t *registry_get_bucket(registry_t* registry,
+                                              const char *topic, int type)
 {
-        mutex_unlock(registry->mutex);
+        char key[REGISTRY_KEY_MAX];
+        int len = registry_topic_key(key, sizeof(key), topic, type);
+        if (len < 0)
+                return NULL;
+        return (registry_bucket_t *) hashtable_get(registry->topics, key, len);
+}
+
+// Called with the write lock held, after the entry was changed.
+static void registry_log_change(registry_t* registry, const char *id)
+{
+        char **slot;
+        
+        registry->revision++;
+        slot = &registry->changes[registry->revision % REGISTRY_HISTORY];
+        if (*slot)
+                r_free(*slot);
+        *slot = r_strdup(id);
+}
+
+static int registry_entry_matches(registry_entry_t *e, const char *id, const char *name,
+                                  const char *topic, int type, addr_t *addr,
+                                  void *endpoint)
+{
+        return ((id == NULL || rstreq(e->id, id))
+                && (type == TYPE_ANY || e->type == type)
+                && (name == NULL || rstreq(e->name, name))
+                && (topic == NULL || rstreq(e->topic, topic))
+                && (addr == NULL || addr_eq(e->addr, addr))
+                && (endpoint == NULL || endpoint == e->endpoint));
+}
+
+static int registry_append(registry_entry_t ***entries, int *length, int *size,
+                           registry_entry_t *entry)
+{
+        if (*length == *size) {
+                int n = (*size == 0)? 8 : 2 * *size;
+                registry_entry_t **p = r_realloc(*entries, n * sizeof(registry_entry_t *));
+                if (p == NULL)
+                        return -1;
+                *entries = p;
+                *size = n;
+        }
+        (*entries)[(*length)++] = entry;
+        return 0;
+}
+
+// Removes the entry and keeps the order of the others.
+static void registry_remove(registry_entry_t **entries, int *length,
+                            registry_entry_t *entry)
+{
+        for (int i = 0; i < *length; i++) {
+                if (entries[i] == entry) {
+                        memmove(&entries[i], &entries[i + 1],
+                                (*length - i - 1) * sizeof(registry_entry_t *));
+                        (*length)--;
+                        return;
+                }
+        }
+}
+
+// Calls the function for each entry that matches. The indexes are
+// used when an id or a topic is given. Stops when the function returns
+// a non-zero value.
+typedef int (*registry_match_t)(void *userdata, registry_entry_t *e);
+
+static void registry_foreach_locked(registry_t* registry, const char *id,
+                                    const char *name, const char *topic, int type,
+                                    addr_t *addr, void *endpoint,
+                                    registry_match_t callback, void *userdata)
+{
+        registry_entry_t *e;
+        
+        if (id != NULL) {
+                e = (registry_entry_t *) hashtable_get_str(registry->ids, id);
+                if (e && registry_entry_matches(e, NULL, name, topic, type, addr, endpoint))
+                        callback(userdata, e);
+                
+        } else if (topic != NULL) {
+                int first = (type == TYPE_ANY)? TYPE_DATALINK : type;
+                int last = (type == TYPE_ANY)? TYPE_STREAMERLINK : type;
+                for (int t = first; t <= last; t++) {
+                        registry_bucket_t *bucket = registry_get_bucket(registry, topic, t);
+                        if (bucket == NULL)
+                                continue;
+                        for (int i = 0; i < bucket->length; i++) {
+                                e = bucket->entries[i];
+                                if (registry_entry_matches(e, NULL, name, NULL, TYPE_ANY,
+                                                           addr, endpoint)
+                                    && callback(userdata, e) != 0)
+                                        return;
+                        }
+                }
+                
+        } else {
+                for (int i = 0; i < registry->length; i++) {
+                        e = registry->entries[i];
+                        if (registry_entry_matches(e, NULL, name, NULL, type,
+                                                   addr, endpoint)
+                            && callback(userdata, e) != 0)
+                                return;
+                }
+        }
 }
 
 registry_entry_t *registry_get(registry_t* registry, const char *id)
@@ -366,40 +621,31 @@ registry_entry_t *registry_get(registry_t* registry, const char *id)
         registry_entry_t *clone = NULL;
         registry_entry_t *e;
 
-        registry_lock(registry);
-        for (list_t *l = registry->entries; l != NULL; l = list_next(l)) {
-                e = list_get(l, registry_entry_t);
-                if (rstreq(e->id, id)) {
-                        clone = new_registry_entry(e->id, e->name, e->topic, e->type,
-                                                   e->addr, e->endpoint);
-                        break;
-                }
-        }
+        registry_read_lock(registry);
+        e = (registry_entry_t *) hashtable_get_str(registry->ids, id);
+        if (e != NULL)
+                clone = registry_entry_clone(e);
         registry_unlock(registry);
         return clone;
 }
 
+static int registry_select_clone(void *userdata, registry_entry_t *e)
+{
+        list_t **results = (list_t **) userdata;
+        registry_entry_t *clone = registry_entry_clone(e);
+        if (clone != NULL)
+                *results = list_prepend(*results, clone);
+        return 0;
+}
+
 list_t *registry_select(registry_t* registry, const char *id, const char *name,
                         const char *topic, int type, addr_t *addr, void *endpoint)
 {
         list_t *results = NULL;
-        registry_entry_t *e;
 
-        registry_lock(registry);
-        for (list_t *l = registry->entries; l != NULL; l = list_next(l)) {
-                e = list_get(l, registry_entry_t);
-                if ((id == NULL || rstreq(e->id, id))
-                    && (type == TYPE_ANY || e->type == type)
-                    && (name == NULL || rstreq(e->name, name))
-                    && (topic == NULL || rstreq(e->topic, topic))
-                    && (addr == NULL || addr_eq(e->addr, addr))
-                    && (endpoint == NULL || endpoint == e->endpoint)) {
-                        registry_entry_t *clone;
-                        clone = new_registry_entry(e->id, e->name, e->topic, e->type,
-                                                   e->addr, e->endpoint);
-                        results = list_prepend(results, clone);
-                }
-        }
+        registry_read_lock(registry);
+        registry_foreach_locked(registry, id, name, topic, type, addr, endpoint,
+                                registry_select_clone, &results);
         registry_unlock(registry);
         return results;
 }
@@ -409,40 +655,91 @@ list_t *registry_select_all(registry_t* registry)
         return registry_select(registry, 0, NULL, NULL, TYPE_ANY, NULL, NULL);
 }
 
+static int registry_count_match(void *userdata, registry_entry_t *e __attribute__((unused)))
+{
+        (*(int *) userdata)++;
+        return 0;
+}
+
 int registry_count(registry_t* registry, const char *id, const char *name,
                    const char *topic, int type, addr_t *addr, void *endpoint)
 {
         int count = 0;
-        registry_entry_t *e;
+        
+        registry_read_lock(registry);
+        if (id == NULL && name == NULL && topic == NULL && type == TYPE_ANY
+            && addr == NULL && endpoint == NULL)
+                count = registry->length;
+        else
+                registry_foreach_locked(registry, id, name, topic, type, addr, endpoint,
+                                        registry_count_match, &count);
+        registry_unlock(registry);
+        return count;
+}
+
+static int registry_view_add(void *userdata, registry_entry_t *e)
+{
+        registry_view_t *view = (registry_view_t *) userdata;
+        if (view->length < REGISTRY_VIEW_INLINE) {
+                view->inline_entries[view->length++] = e;
+                return 0;
+        }
+        if (view->length == REGISTRY_VIEW_INLINE) {
+                view->allocated = r_array(registry_entry_t *, 2 * REGISTRY_VIEW_INLINE);
+                if (view->allocated == NULL)
+                        return -1;
+                memcpy(view->allocated, view->inline_entries,
+                       sizeof(view->inline_entries));
+                view->size = 2 * REGISTRY_VIEW_INLINE;
+                view->entries = view->allocated;
+        }
+        if (registry_append(&view->allocated, &view->length, &view->size, e) != 0)
+                return -1;
+        view->entries = view->allocated;
+        return 0;
+}
 
-        registry_lock(registry);
-        for (list_t *l = registry->entries; l != NULL; l = list_next(l)) {
-                e = list_get(l, registry_entry_t);
-                if ((id == NULL || rstreq(e->id, id))
-                    && (type == TYPE_ANY || e->type == type)
-                    && (name == NULL || rstreq(e->name, name))
-                    && (topic == NULL || rstreq(e->topic, topic))
-                    && (addr == NULL || addr_eq(e->addr, addr))
-                    && (endpoint == NULL || endpoint == e->endpoint)) {
-                        count++;
+int registry_select_view(registry_t* registry, registry_view_t *view,
+                         const char *id, const char *name, const char *topic,
+                         int type, addr_t *addr, void *endpoint)
+{
+        memset(view, 0, sizeof(registry_view_t));
+        view->entries = view->inline_entries;
+
+        registry_read_lock(registry);
+        
+        if (id == NULL && name == NULL && topic != NULL && type != TYPE_ANY
+            && addr == NULL && endpoint == NULL) {
+                // The bucket holds exactly the requested entries
+                registry_bucket_t *bucket = registry_get_bucket(registry, topic, type);
+                if (bucket != NULL) {
+                        view->entries = bucket->entries;
+                        view->length = bucket->length;
                 }
+        } else {
+                registry_foreach_locked(registry, id, name, topic, type, addr, endpoint,
+                                        registry_view_add, view);
         }
-        registry_unlock(registry);
-        return count;
+        return view->length;
 }
 
+void registry_release_view(registry_t* registry, registry_view_t *view)
+{
+        registry_unlock(registry);
+        if (view->allocated)
+                r_free(view->allocated);
+        memset(view, 0, sizeof(registry_view_t));
+}
 
 int registry_geti(registry_t* registry, int n,
                   membuf_t *name, membuf_t *topic,
                   int *type, addr_t *addr)
 {
-        list_t* l;
         registry_entry_t *e;
         
-        registry_lock(registry);
-        l = list_nth(registry->entries, n);
-        if (l) {
-                e = list_get(l, registry_entry_t);
+        registry_read_lock(registry);
+        if (n >= 0 && n < registry->length) {
+                e = registry->entries[n];
                 
                 membuf_clear(name);
                 membuf_append(name, e->name, strlen(e->name));
@@ -464,16 +761,51 @@ int registry_geti(registry_t* registry, int n,
 
 static int registry_add_entry_locked(registry_t* registry, registry_entry_t *entry)
 {
-        registry->entries = list_append(registry->entries, entry);
-        return (registry->entries == NULL)? -1 : 0;
+        char key[REGISTRY_KEY_MAX];
+        registry_bucket_t *bucket;
+        int len;
+
+        if (hashtable_get_str(registry->ids, entry->id) != NULL) {
+                r_err("registry_add_entry: duplicate id %s", entry->id);
+                return -1;
+        }
+        len = registry_topic_key(key, sizeof(key), entry->topic, entry->type);
+        if (len < 0)
+                return -1;
+        
+        bucket = (registry_bucket_t *) hashtable_get(registry->topics, key, len);
+        if (bucket == NULL) {
+                bucket = r_new(registry_bucket_t);
+                if (bucket == NULL)
+                        return -1;
+                if (hashtable_set(registry->topics, key, len, bucket) != 0) {
+                        r_delete(bucket);
+                        return -1;
+                }
+        }
+        
+        if (registry_append(&bucket->entries, &bucket->length, &bucket->size, entry) != 0)
+                return -1;
+        if (registry_append(&registry->entries, &registry->length,
+                            &registry->size, entry) != 0) {
+                bucket->length--;
+                return -1;
+        }
+        if (hashtable_set_str(registry->ids, entry->id, entry) != 0) {
+                bucket->length--;
+                registry->length--;
+                return -1;
+        }
+        registry_log_change(registry, entry->id);
+        return 0;
 }
 
 static int registry_add_entry(registry_t* registry, registry_entry_t *entry)
 {
         int r;
-        mutex_lock(registry->mutex);
+        registry_write_lock(registry);
         r = registry_add_entry_locked(registry, entry);
-        mutex_unlock(registry->mutex);
+        registry_unlock(registry);
         return r;
 }
 
@@ -499,47 +831,46 @@ int registry_insert(registry_t* registry, const char *id, const char *name,
 
 int registry_insert_entry(registry_t* registry, registry_entry_t *entry)
 {
-        return registry_insert(registry, entry->id, entry->name, entry->topic,
-                               entry->type, entry->addr, entry->endpoint);
-}
-
-// ToDo: This seems wrong having two functions. We could use a recursive mutex.
-// ToDo: Just one lock function needed as anything calling it already has access to the lock.
-static int registry_remove_entry_locked(registry_t* registry, registry_entry_t *entry)
-{
-        registry->entries = list_remove(registry->entries, entry);
+        registry_entry_t *clone = registry_entry_clone(entry);
+        if (clone == NULL)
+                return -1;
+        
+        int r = registry_add_entry(registry, clone);
+        if (r != 0) {
+                delete_registry_entry(clone);
+                return -1;
+        }
         return 0;
 }
 
-// ToDo: See above. Remove this function and rename the above.
-__attribute__((unused))
-static int registry_remove_entry(registry_t* registry, registry_entry_t *entry)
+static void registry_remove_entry_locked(registry_t* registry, registry_entry_t *entry)
 {
-        int r;
-        mutex_lock(registry->mutex);
-        r = registry_remove_entry_locked(registry, entry);
-        mutex_unlock(registry->mutex);
-        return r;
+        registry_bucket_t *bucket;
+        
+        hashtable_remove_str(registry->ids, entry->id);
+        registry_remove(registry->entries, &registry->length, entry);
+        
+        bucket = registry_get_bucket(registry, entry->topic, entry->type);
+        if (bucket != NULL)
+                registry_remove(bucket->entries, &bucket->length, entry);
 }
 
 int registry_delete(registry_t* registry, const char *id)
 {
+        registry_entry_t *e;
         int ret = -1;
         
         //r_debug("registry_delete id=%s", id);
 
-        mutex_lock(registry->mutex);
-        list_t *l = registry->entries;
-        while (l) {
-                registry_entry_t *e = list_get(l, registry_entry_t);
-                if (rstreq(e->id, id)) {
-                        ret = registry_remove_entry_locked(registry, e);
-                        delete_registry_entry(e);
-                        break;
-                }
-                l = list_next(l);
+        registry_write_lock(registry);
+        e = (registry_entry_t *) hashtable_get_str(registry->ids, id);
+        if (e != NULL) {
+                registry_log_change(registry, e->id);
+                registry_remove_entry_locked(registry, e);
+                delete_registry_entry(e);
+                ret = 0;
         }
-        mutex_unlock(registry->mutex);
+        registry_unlock(registry);
         return ret;
 }
 
@@ -548,22 +879,109 @@ int registry_update_addr(registry_t* registry, const char *id, const char *addr)
         int err = 0;
         registry_entry_t *e;
 
-        registry_lock(registry);
-        for (list_t *l = registry->entries; l != NULL; l = list_next(l)) {
-                e = list_get(l, registry_entry_t);
-                if (rstreq(id, e->id)) {
-                        if (e->addr != NULL)
-                                delete_addr(e->addr);
-                        e->addr = addr_parse(addr);
-                        if (e->addr == NULL) {
+        registry_write_lock(registry);
+        e = (registry_entry_t *) hashtable_get_str(registry->ids, id);
+        if (e != NULL) {
+                if (e->addr != NULL)
+                        delete_addr(e->addr);
+                e->addr = addr_parse(addr);
+                if (e->addr == NULL) {
+                        err = -1;
+                        r_err("fixme_registry_update_addr: invalid addr");
+                }
+                registry_log_change(registry, e->id);
+        }
+        registry_unlock(registry);
+        return err;        
+}
+
+uint64_t registry_revision(registry_t* registry)
+{
+        uint64_t revision;
+        registry_read_lock(registry);
+        revision = registry->revision;
+        registry_unlock(registry);
+        return revision;
+}
+
+list_t *registry_snapshot(registry_t* registry, uint64_t *revision)
+{
+        list_t *results = NULL;
+
+        registry_read_lock(registry);
+        for (int i = registry->length - 1; i >= 0; i--) {
+                registry_entry_t *clone = registry_entry_clone(registry->entries[i]);
+                if (clone != NULL)
+                        results = list_prepend(results, clone);
+        }
+        *revision = registry->revision;
+        registry_unlock(registry);
+        return results;
+}
+
+int registry_changes(registry_t* registry, uint64_t since, uint64_t *revision,
+                     list_t **entries, list_t **removed)
+{
+        hashtable_t *seen;
+        int err = 0;
+
+        *entries = NULL;
+        *removed = NULL;
+        
+        seen = new_hashtable(0);
+        if (seen == NULL)
+                return -1;
+        
+        registry_read_lock(registry);
+        
+        *revision = registry->revision;
+        if (since > registry->revision
+            || registry->revision - since > REGISTRY_HISTORY) {
+                err = -1;
+                goto cleanup;
+        }
+        
+        // From the newest change to the oldest, so that each entry is
+        // only listed once, in its latest state.
+        for (uint64_t r = registry->revision; r > since; r--) {
+                const char *id = registry->changes[r % REGISTRY_HISTORY];
+                if (hashtable_get_str(seen, id) != NULL)
+                        continue;
+                if (hashtable_set_str(seen, id, (void *) id) != 0) {
+                        err = -1;
+                        goto cleanup;
+                }
+                
+                registry_entry_t *e = (registry_entry_t *) hashtable_get_str(registry->ids, id);
+                if (e != NULL) {
+                        registry_entry_t *clone = registry_entry_clone(e);
+                        if (clone == NULL) {
                                 err = -1;
-                                r_err("fixme_registry_update_addr: invalid addr");
+                                goto cleanup;
                         }
-                        break;
+                        *entries = list_prepend(*entries, clone);
+                } else {
+                        *removed = list_prepend(*removed, r_strdup(id));
                 }
         }
+
+cleanup:
         registry_unlock(registry);
-        return err;        
+        delete_hashtable(seen);
+        if (err != 0) {
+                delete_registry_entry_list(*entries);
+                registry_delete_id_list(*removed);
+                *entries = NULL;
+                *removed = NULL;
+        }
+        return err;
+}
+
+void registry_delete_id_list(list_t *list)
+{
+        for (list_t *l = list; l != NULL; l = list_next(l))
+                r_free(list_get(l, char));
+        delete_list(list);
 }
 
 /* int registry_update_id(registry_t* registry, int old_id, int new_id) */
@@ -584,5 +1002,3 @@ int registry_update_addr(registry_t* registry, const char *id, const char *addr)
 /*         registry_unlock(registry); */
 /*         return err;         */
 /* } */
-
-
@@ -0,0 +1,305 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#include <string.h>
+#include <r.h>
+#include "replay.h"
+
+// Sleeps are cut in slices so that replay_stop() is noticed quickly
+#define REPLAY_SLEEP 0.1
+
+typedef struct _replay_source_t {
+        dump_t *dump;
+        replay_onrecord_t onrecord;
+        void *userdata;
+        dump_record_t next;
+        int done;
+} replay_source_t;
+
+struct _replay_t {
+        replay_source_t *sources;
+        int num_sources;
+        double speed;
+        uint64_t start;
+        uint64_t end;
+        int quit;
+        unsigned char *buffer;
+        uint32_t buffer_size;
+        replay_stats_t stats;
+};
+
+replay_t *new_replay()
+{
+        replay_t *replay = r_new(replay_t);
+        if (replay == NULL)
+                return NULL;
+        replay->speed = 1.0;
+        return replay;
+}
+
+void delete_replay(replay_t *replay)
+{
+        if (replay) {
+                for (int i = 0; i < replay->num_sources; i++)
+                        delete_dump(replay->sources[i].dump);
+                if (replay->sources)
+                        r_free(replay->sources);
+                if (replay->buffer)
+                        r_free(replay->buffer);
+                r_delete(replay);
+        }
+}
+
+void replay_set_speed(replay_t *replay, double speed)
+{
+        replay->speed = (speed > 0.0)? speed : 0.0;
+}
+
+void replay_set_range(replay_t *replay, uint64_t start, uint64_t end)
+{
+        replay->start = start;
+        replay->end = end;
+}
+
+int replay_add(replay_t *replay, const char *path,
+               replay_onrecord_t onrecord, void *userdata)
+{
+        replay_source_t *sources;
+        dump_t *dump;
+        
+        dump = dump_open(path);
+        if (dump == NULL)
+                return -1;
+
+        sources = r_realloc(replay->sources,
+                            (replay->num_sources + 1) * sizeof(replay_source_t));
+        if (sources == NULL) {
+                delete_dump(dump);
+                return -1;
+        }
+        
+        replay->sources = sources;
+        memset(&sources[replay->num_sources], 0, sizeof(replay_source_t));
+        sources[replay->num_sources].dump = dump;
+        sources[replay->num_sources].onrecord = onrecord;
+        sources[replay->num_sources].userdata = userdata;
+        replay->num_sources++;
+        return 0;
+}
+
+static int replay_datahub(void *userdata, dump_t *dump,
+                          dump_record_t *record, const void *payload)
+{
+        datahub_t *hub = (datahub_t *) userdata;
+        data_t *data;
+        (void) dump;
+
+        if (record->type != DUMP_RECORD_DATA
+            || record->len < PACKET_HEADER
+            || record->len > PACKET_MAXLEN)
+                return 0;
+        
+        data = new_data();
+        if (data == NULL)
+                return -1;
+        memcpy(data_packet(data), payload, record->len);
+        data_set_len(data, record->len - PACKET_HEADER);
+        datahub_broadcast(hub, NULL, data);
+        delete_data(data);
+        return 0;
+}
+
+static int replay_messagehub(void *userdata, dump_t *dump,
+                             dump_record_t *record, const void *payload)
+{
+        messagehub_t *hub = (messagehub_t *) userdata;
+        (void) dump;
+
+        if (record->type != DUMP_RECORD_MESSAGE)
+                return 0;
+        return messagehub_broadcast_text(hub, NULL, (const char *) payload,
+                                         (int) record->len);
+}
+
+static int replay_streamer(void *userdata, dump_t *dump,
+                           dump_record_t *record, const void *payload)
+{
+        streamer_t *streamer = (streamer_t *) userdata;
+        const char *mimetype;
+        const char *data;
+        uint32_t len;
+        double time;
+        (void) dump;
+
+        if (record->type != DUMP_RECORD_FRAME
+            || dump_parse_frame(payload, record->len, &mimetype,
+                                &time, &data, &len) != 0)
+                return 0;
+        return streamer_send_multipart(streamer, data, (int) len, mimetype, time);
+}
+
+int replay_add_datahub(replay_t *replay, const char *path, datahub_t *hub)
+{
+        return replay_add(replay, path, replay_datahub, hub);
+}
+
+int replay_add_messagehub(replay_t *replay, const char *path, messagehub_t *hub)
+{
+        return replay_add(replay, path, replay_messagehub, hub);
+}
+
+int replay_add_streamer(replay_t *replay, const char *path, streamer_t *streamer)
+{
+        return replay_add(replay, path, replay_streamer, streamer);
+}
+
+static void replay_peek(replay_t *replay, replay_source_t *source)
+{
+        if (dump_peek_record(source->dump, &source->next) != 0
+            || (replay->end != 0 && source->next.timestamp >= replay->end))
+                source->done = 1;
+}
+
+// There are only a handful of dumps, so the next record is found
+// with a linear search rather than a heap.
+static replay_source_t *replay_next(replay_t *replay)
+{
+        replay_source_t *next = NULL;
+        for (int i = 0; i < replay->num_sources; i++) {
+                replay_source_t *source = &replay->sources[i];
+                if (!source->done
+                    && (next == NULL
+                        || source->next.timestamp < next->next.timestamp))
+                        next = source;
+        }
+        return next;
+}
+
+static int replay_read(replay_t *replay, replay_source_t *source)
+{
+        if (source->next.len > replay->buffer_size) {
+                uint32_t size = source->next.len;
+                unsigned char *buffer = r_realloc(replay->buffer, size);
+                if (buffer == NULL)
+                        return -1;
+                replay->buffer = buffer;
+                replay->buffer_size = size;
+        }
+        return dump_read_record(source->dump, &source->next,
+                                replay->buffer, replay->buffer_size);
+}
+
+// Waits until the record is due. Returns -1 if the replay was stopped.
+static int replay_wait(replay_t *replay, uint64_t t0, uint64_t start,
+                       uint64_t timestamp)
+{
+        double due, now;
+        
+        if (replay->speed == 0.0)
+                return __atomic_load_n(&replay->quit, __ATOMIC_RELAXED)? -1 : 0;
+
+        due = (double) start + (double) (timestamp - t0) / replay->speed;
+        while (1) {
+                if (__atomic_load_n(&replay->quit, __ATOMIC_RELAXED))
+                        return -1;
+                now = (double) clock_timestamp();
+                if (now >= due)
+                        break;
+                if (due - now > REPLAY_SLEEP * 1000000.0)
+                        clock_sleep(REPLAY_SLEEP);
+                else
+                        clock_sleep((due - now) / 1000000.0);
+        }
+        
+        // More than a millisecond behind counts as late
+        if (now - due > 1000.0) {
+                replay->stats.late++;
+                if ((now - due) / 1000000.0 > replay->stats.max_lateness)
+                        replay->stats.max_lateness = (now - due) / 1000000.0;
+        }
+        return 0;
+}
+
+int replay_run(replay_t *replay)
+{
+        replay_source_t *source;
+        uint64_t t0 = 0;
+        uint64_t start;
+        int first = 1;
+
+        __atomic_store_n(&replay->quit, 0, __ATOMIC_RELAXED);
+        memset(&replay->stats, 0, sizeof(replay_stats_t));
+        
+        for (int i = 0; i < replay->num_sources; i++) {
+                replay_source_t *s = &replay->sources[i];
+                s->done = 0;
+                if (replay->start != 0) {
+                        if (dump_seek_time(s->dump, replay->start) != 0)
+                                s->done = 1;
+                } else if (dump_seek_record(s->dump, 0) != 0) {
+                        s->done = 1;
+                }
+                if (!s->done)
+                        replay_peek(replay, s);
+        }
+
+        start = clock_timestamp();
+        
+        while ((source = replay_next(replay)) != NULL) {
+                if (first) {
+                        t0 = source->next.timestamp;
+                        first = 0;
+                }
+                // Dumps are not strictly ordered when the records come
+                // from several threads.
+                if (source->next.timestamp < t0)
+                        source->next.timestamp = t0;
+                
+                if (replay_wait(replay, t0, start, source->next.timestamp) != 0)
+                        break;
+                
+                if (replay_read(replay, source) != 0) {
+                        r_warn("replay_run: failed to read a record, "
+                               "skipping the rest of the dump");
+                        source->done = 1;
+                        continue;
+                }
+                
+                source->onrecord(source->userdata, source->dump,
+                                 &source->next, replay->buffer);
+                replay->stats.records++;
+                replay_peek(replay, source);
+        }
+        
+        return 0;
+}
+
+void replay_stop(replay_t *replay)
+{
+        __atomic_store_n(&replay->quit, 1, __ATOMIC_RELAXED);
+}
+
+void replay_get_stats(replay_t *replay, replay_stats_t *stats)
+{
+        *stats = replay->stats;
+}
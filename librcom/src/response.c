@@ -21,6 +21,9 @@
   <http://www.gnu.org/licenses/>.
 
  */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <r.h>
 #include <rcom.h>
 #include "net.h"
@@ -32,6 +35,18 @@ struct _response_t {
         list_t *headers;
         membuf_t *body;
 
+        // File or memory region sent instead of the body buffer
+        int body_fd;
+        off_t body_offset;
+        size_t body_length;
+        const char *body_data;
+
+        // Streaming, chunked responses
+        tcp_socket_t socket;
+        int streaming;
+        int headers_sent;
+        int stream_error;
+
         int continue_parsing;
         int parse_what;
         int parser_header_state;
@@ -54,6 +69,8 @@ response_t *new_response(int status)
         r->status = status;
         r->headers = 0;
         r->body = new_membuf();
+        r->body_fd = -1;
+        r->socket = INVALID_TCP_SOCKET;
         r->parser_header_state = k_header_new;
         r->header_name = new_membuf();
         r->header_value = new_membuf();
@@ -65,6 +82,8 @@ void delete_response(response_t *r)
 {
         if (r) {
                 delete_membuf(r->body);                
+                if (r->body_fd >= 0)
+                        close(r->body_fd);
                 for (list_t *l = r->headers; l != NULL; l = list_next(l)) {
                         http_header_t *h = list_get(l, http_header_t);
                         delete_http_header(h);
@@ -359,17 +378,23 @@ int response_parse_html(response_t *response, tcp_socket_t socket, int what)
         return 0;
 }
 
+static int response_check_flush(response_t *r)
+{
+        if (r->streaming && membuf_len(r->body) >= RESPONSE_CHUNK_SIZE)
+                return response_flush(r);
+        return 0;
+}
+
 int response_append(response_t *r, const char *data, int len)
 {
         membuf_append(r->body, data, len);
-        return 0;
+        return response_check_flush(r);
 }
 
 // ToDo: Remove return type.
 static int32_t response_serialise(response_t *r, const char *s, int32_t len)
 {
-        membuf_append(r->body, s, len);
-        return 0;
+        return response_append(r, s, len);
 }
 
 int response_json(response_t *r, json_object_t obj)
@@ -388,12 +413,125 @@ int response_printf(response_t *r, const char *format, ...)
 
     if (ret < 0) {
         r_err("response_printf: membuf_vprintf returned an error");
+    } else if (response_check_flush(r) != 0) {
+        ret = -1;
     }
     return ret;
 }
 
+void response_set_socket(response_t *r, tcp_socket_t socket)
+{
+        r->socket = socket;
+}
+
+int response_set_streaming(response_t *r)
+{
+        if (r->socket == INVALID_TCP_SOCKET) {
+                r_err("response_set_streaming: the response has no connection");
+                return -1;
+        }
+        r->streaming = 1;
+        return 0;
+}
+
+int response_flush(response_t *r)
+{
+        if (!r->streaming)
+                return 0;
+        if (r->stream_error)
+                return -1;
+        
+        if (!r->headers_sent) {
+                if (http_send_chunked_response_headers(r->socket, r) != 0)
+                        goto error;
+                r->headers_sent = 1;
+        }
+        
+        // A chunk of length zero marks the end of the response.
+        if (membuf_len(r->body) > 0) {
+                if (http_send_chunk(r->socket, membuf_data(r->body),
+                                    membuf_len(r->body)) != 0)
+                        goto error;
+                membuf_clear(r->body);
+        }
+        return 0;
+        
+error:
+        r_err("response_flush: failed to send the data");
+        r->stream_error = 1;
+        return -1;
+}
+
+int response_set_fd(response_t *r, int fd, off_t offset, size_t length)
+{
+        if (r->body_fd >= 0)
+                close(r->body_fd);
+        r->body_fd = fd;
+        r->body_offset = offset;
+        r->body_length = length;
+        r->body_data = NULL;
+        return 0;
+}
+
+int response_set_file(response_t *r, const char *path)
+{
+        struct stat st;
+        
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+                r_err("response_set_file: failed to open %s", path);
+                return -1;
+        }
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+                r_err("response_set_file: %s is not a regular file", path);
+                close(fd);
+                return -1;
+        }
+        
+        if (response_get_header_value(r, "Content-Type") == NULL)
+                response_set_mimetype(r, filename_to_mimetype(path));
+        
+        return response_set_fd(r, fd, 0, (size_t) st.st_size);
+}
+
+int response_set_data(response_t *r, const void *data, size_t length)
+{
+        if (r->body_fd >= 0) {
+                close(r->body_fd);
+                r->body_fd = -1;
+        }
+        r->body_data = (const char *) data;
+        r->body_length = length;
+        return 0;
+}
+
+int response_body_fd(response_t *r, off_t *offset, size_t *length)
+{
+        if (r->body_fd >= 0) {
+                *offset = r->body_offset;
+                *length = r->body_length;
+        }
+        return r->body_fd;
+}
+
+const char *response_body_data(response_t *r, size_t *length)
+{
+        if (r->body_data) {
+                *length = r->body_length;
+                return r->body_data;
+        } else {
+                *length = (size_t) membuf_len(r->body);
+                return membuf_data(r->body);
+        }
+}
+
 int response_send(response_t *response, tcp_socket_t client_socket)
 {
+        if (response->streaming) {
+                if (response_flush(response) != 0)
+                        return -1;
+                return http_send_last_chunk(response->socket);
+        }
         return http_send_response(client_socket, response);
 }
 
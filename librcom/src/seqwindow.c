@@ -0,0 +1,84 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#include "seqwindow.h"
+
+static void seq_window_update_latency(data_stats_t *stats, data_t *data)
+{
+        double latency = ((double) data_clock_now()
+                          - (double) data_timestamp(data)) / 1000000.0;
+        if (stats->received == 1) {
+                stats->latency = latency;
+                stats->latency_min = latency;
+                stats->latency_max = latency;
+        } else {
+                stats->latency += (latency - stats->latency) / 16.0;
+                if (latency < stats->latency_min)
+                        stats->latency_min = latency;
+                if (latency > stats->latency_max)
+                        stats->latency_max = latency;
+        }
+}
+
+int seq_window_update(seq_window_t *seq, data_t *data)
+{
+        int stale = 0;
+        uint32_t seqnum = data_seqnum(data);
+        int32_t delta = (int32_t) (seqnum - seq->last);
+        
+        if (!seq->initialized
+            || delta <= -SEQ_WINDOW_RESTART
+            || delta >= SEQ_WINDOW_RESTART) {
+                // First packet, or the sender was restarted
+                seq->initialized = 1;
+                seq->last = seqnum;
+                seq->window = 1;
+                
+        } else if (delta > 0) {
+                // The packets in between are counted as lost until
+                // they arrive.
+                seq->stats.lost += (uint32_t) (delta - 1);
+                seq->window = (delta < 64)? (seq->window << delta) | 1 : 1;
+                seq->last = seqnum;
+                
+        } else if (delta == 0) {
+                seq->stats.duplicates++;
+                return 1;
+                
+        } else {
+                uint64_t bit = (-delta < 64)? ((uint64_t) 1 << -delta) : 0;
+                if (bit && (seq->window & bit)) {
+                        seq->stats.duplicates++;
+                        return 1;
+                }
+                seq->window |= bit;
+                seq->stats.reordered++;
+                if (seq->stats.lost > 0)
+                        seq->stats.lost--;
+                stale = 1;
+        }
+
+        seq->stats.received++;
+        seq_window_update_latency(&seq->stats, data);
+        return stale;
+}
@@ -34,6 +34,8 @@ typedef struct _service_client_t service_client_t;
 static void service_add_client(service_t *service, service_client_t *client);
 static void service_remove_client(service_t *service, service_client_t *client);
 static void service_delete_clients(service_t *service);
+static int service_read_begin(service_t *service);
+static void service_read_end(service_t *service, int epoch);
 
 /*
  * service_client_t
@@ -79,6 +81,7 @@ void service_client_handle(service_client_t *client)
         request_t* request = NULL;
         export_t *export = NULL;
         response_t *response = NULL;
+        int epoch;
 
         request = new_request();
 
@@ -96,22 +99,26 @@ void service_client_handle(service_client_t *client)
                 goto cleanup;
         }
 
+        response = new_response(HTTP_Status_OK);
+        if (response == NULL) {
+                http_send_error_headers(client->socket, HTTP_Status_Internal_Server_Error);
+                goto cleanup;
+        }
+        
+        epoch = service_read_begin(client->service);
         export = service_get_export(client->service, request_uri(request));
         if (export == NULL) {
+                service_read_end(client->service, epoch);
                 r_err("request_handle: export == NULL: resource '%s'",
                       request_uri(request));
                 http_send_error_headers(client->socket, HTTP_Status_Bad_Request);
                 goto cleanup;
         }
 
-        response = new_response(HTTP_Status_OK);
-        if (response == NULL) {
-                http_send_error_headers(client->socket, HTTP_Status_Internal_Server_Error);
-                goto cleanup;
-        }
-        
+        response_set_socket(response, client->socket);
         response_set_mimetype(response, export_mimetype_out(export));
         export_callback(export, request, response);
+        service_read_end(client->service, epoch);
 
         err = response_send(response, client->socket);
         
@@ -127,7 +134,6 @@ cleanup:
         
         delete_request(request);
         delete_response(response);
-        delete_export(export);
 }
 
 
@@ -139,6 +145,27 @@ struct _service_t {
         tcp_socket_t socket;
         list_t* exports;
         mutex_t *exports_mutex;
+
+        // The lookup table used by the client threads. It is rebuilt
+        // by service_export() and swapped in atomically so that
+        // service_get_export() does not have to take the lock. The
+        // exports and tables that are replaced may still be in use by
+        // a client thread. A client thread announces itself in the
+        // reader counter of the current epoch. The replaced entries
+        // first go to the retired lists. service_reclaim() flips the
+        // epoch when no reader is left in the previous one, and moves
+        // them to the expired lists. The expired entries are freed at
+        // the next flip, when no reader can hold them anymore. The
+        // writer doesn't wait for the readers because a request
+        // handler may stream for a long time, or export a resource
+        // itself.
+        export_table_t *table;
+        int epoch;
+        int readers[2];
+        list_t *retired_exports;
+        list_t *retired_tables;
+        list_t *expired_exports;
+        list_t *expired_tables;
         thread_t *thread;
         int cont;
 
@@ -150,6 +177,9 @@ struct _service_t {
 static void service_run(service_t *service);
 static void service_lock_exports(service_t* s);
 static void service_unlock_exports(service_t* s);
+static int service_update_table(service_t* s);
+static void service_reclaim(service_t* s);
+static void service_free_retired(list_t *exports, list_t *tables);
 static void service_lock_clients(service_t* s);
 static void service_unlock_clients(service_t* s);
 static void service_index_html(service_t* service, request_t *request, response_t *response);
@@ -224,6 +254,17 @@ void delete_service(service_t* service)
                 }
                 delete_list(service->exports);
                 service->exports = NULL;
+
+                service_free_retired(service->retired_exports,
+                                     service->retired_tables);
+                service->retired_exports = NULL;
+                service->retired_tables = NULL;
+                service_free_retired(service->expired_exports,
+                                     service->expired_tables);
+                service->expired_exports = NULL;
+                service->expired_tables = NULL;
+                delete_export_table(service->table);
+                service->table = NULL;
                 service_unlock_exports(service);
                 delete_mutex(service->exports_mutex);
 
@@ -395,37 +436,106 @@ int service_export(service_t* service,
                    service_onrequest_t onrequest)
 {
         export_t *e;
-        int found = 0;
         int err = 0;
-        
-        service_lock_exports(service);
-        for (list_t *l = service->exports; l != NULL; l = list_next(l)) {
-                e = list_get(l, export_t);
-                if (export_matches(e, name)) {
-                        if (export_set_mimetypes(e, mimetype_in, mimetype_out) == 0)
-                                export_set_onrequest(e, data, onrequest);
-                        else err = -1;
-                        found = 1;
-                        break;
-                }
-        }
-        service_unlock_exports(service);
 
-        if (found)
-                return err;
-        
+        // Exports are never modified once they are visible to the
+        // client threads. A new export replaces the old one.
         e = new_export(name, mimetype_in, mimetype_out);
         if (e == NULL) 
                 return -1;
         export_set_onrequest(e, data, onrequest);
         
         service_lock_exports(service);
+        for (list_t *l = service->exports; l != NULL; l = list_next(l)) {
+                export_t *old = list_get(l, export_t);
+                if (export_matches(old, name)) {
+                        service->exports = list_remove(service->exports, old);
+                        service->retired_exports = list_prepend(service->retired_exports, old);
+                        break;
+                }
+        }
         service->exports = list_prepend(service->exports, e);
+        err = service_update_table(service);
+        service_reclaim(service);
         service_unlock_exports(service);
 
+        return err;
+}
+
+// Must be called with the exports lock held.
+static int service_update_table(service_t* service)
+{
+        export_table_t *table = new_export_table(service->exports);
+        if (table == NULL) {
+                r_err("service_update_table: out of memory");
+                return -1;
+        }
+        export_table_t *old = __atomic_exchange_n(&service->table, table,
+                                                  __ATOMIC_SEQ_CST);
+        if (old)
+                service->retired_tables = list_prepend(service->retired_tables, old);
         return 0;
 }
 
+static void service_free_retired(list_t *exports, list_t *tables)
+{
+        for (list_t *l = exports; l != NULL; l = list_next(l))
+                delete_export(list_get(l, export_t));
+        delete_list(exports);
+        for (list_t *l = tables; l != NULL; l = list_next(l))
+                delete_export_table(list_get(l, export_table_t));
+        delete_list(tables);
+}
+
+// Frees the expired entries and flips the epoch, unless a reader of
+// the previous epoch is still busy. In that case, the entries are
+// kept until the next call. Must be called with the exports lock
+// held.
+static void service_reclaim(service_t* service)
+{
+        int e = __atomic_load_n(&service->epoch, __ATOMIC_SEQ_CST);
+
+        if (service->retired_exports == NULL
+            && service->retired_tables == NULL
+            && service->expired_exports == NULL
+            && service->expired_tables == NULL)
+                return;
+        if (__atomic_load_n(&service->readers[1 - e], __ATOMIC_SEQ_CST) != 0)
+                return;
+
+        // The expired entries were replaced before the epoch was
+        // last flipped to e. Their readers all counted themselves in
+        // the previous epoch, and they are gone.
+        service_free_retired(service->expired_exports,
+                             service->expired_tables);
+        service->expired_exports = service->retired_exports;
+        service->expired_tables = service->retired_tables;
+        service->retired_exports = NULL;
+        service->retired_tables = NULL;
+        __atomic_store_n(&service->epoch, 1 - e, __ATOMIC_SEQ_CST);
+}
+
+// Enters a read-side section. The exports returned by
+// service_get_export() remain valid until service_read_end() is
+// called.
+static int service_read_begin(service_t *service)
+{
+        while (1) {
+                int e = __atomic_load_n(&service->epoch, __ATOMIC_SEQ_CST);
+                __atomic_fetch_add(&service->readers[e], 1, __ATOMIC_SEQ_CST);
+                if (__atomic_load_n(&service->epoch, __ATOMIC_SEQ_CST) == e)
+                        return e;
+                // The epoch was flipped in between. Try again so that
+                // the reclaim doesn't miss this reader.
+                __atomic_fetch_sub(&service->readers[e], 1, __ATOMIC_SEQ_CST);
+        }
+}
+
+static void service_read_end(service_t *service, int epoch)
+{
+        __atomic_fetch_sub(&service->readers[epoch], 1, __ATOMIC_RELEASE);
+}
+
 void service_run(service_t* service)
 {
         tcp_socket_t client_socket;
@@ -450,6 +560,9 @@ void service_run(service_t* service)
 
                 // Do some cleanup
                 service_delete_clients(service);
+                service_lock_exports(service);
+                service_reclaim(service);
+                service_unlock_exports(service);
                 
                 client->thread = new_thread((thread_run_t) service_client_handle, client);
         }
@@ -457,33 +570,11 @@ void service_run(service_t* service)
 
 export_t *service_get_export(service_t *service, const char *name)
 {
-        list_t *l;
-        export_t *n = NULL;
-        
-        service_lock_exports(service);
-        l = service->exports;
-        while (l) {
-                export_t* r = list_get(l, export_t);
-                //r_debug("export '%s', name '%s'", export_name(r), name);
-                if (export_matches(r, name)) {
-                        //r_debug("found export matching '%s'", name);
-                        n = export_clone(r);
-                        break;
-                }
-                l = list_next(l);
-        }
-        if (n == NULL) {
-                // If no match was found, seek the wildcard service
-                l = service->exports;
-                while (l) {
-                        export_t* r = list_get(l, export_t);
-                        if (rstreq("*", export_name(r))) {
-                                n = export_clone(r);
-                                break;
-                        }
-                        l = list_next(l);
-                }
-        }
-        service_unlock_exports(service);
-        return n;
+        // The returned export is owned by the service. The client
+        // threads call this function in a read-side section, and the
+        // export remains valid until the end of the section.
+        export_table_t *table = __atomic_load_n(&service->table, __ATOMIC_SEQ_CST);
+        if (table == NULL)
+                return NULL;
+        return export_table_get(table, name);
 }
@@ -0,0 +1,306 @@
+/*
+  rcutil
+
+  Copyright (C) 2019 Sony Computer Science Laboratories
+  Author(s) Peter Hanappe
+
+  rcutil is light-weight libary for inter-node communication.
+
+  rcutil is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see
+  <http://www.gnu.org/licenses/>.
+
+ */
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <r.h>
+#include "shmring.h"
+
+#define SHM_RING_MAGIC 0x52434d52 // "RCMR"
+#define SHM_RING_VERSION 1
+
+// The number of times the reader checks the ring before sleeping
+#define SHM_RING_SPIN 2000
+
+#if defined(__x86_64__) || defined(__i386__)
+#define shm_ring_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define shm_ring_relax() __asm__ __volatile__("yield")
+#else
+#define shm_ring_relax()
+#endif
+
+// Each slot holds the length of the packet followed by the packet.
+#define SHM_RING_SLOT_SIZE (4 + PACKET_MAXLEN)
+
+typedef struct _shm_ring_header_t {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slots;
+        uint32_t slot_size;
+        // The writer and the reader each have their own cache line.
+        uint64_t head __attribute__((aligned(64)));
+        uint32_t dropped;
+        uint64_t tail __attribute__((aligned(64)));
+        uint32_t sleeping;
+        uint32_t wakeup __attribute__((aligned(64)));
+} shm_ring_header_t;
+
+struct _shm_ring_t {
+        char name[SHM_RING_NAMELEN];
+        int owner;
+        size_t size;
+        shm_ring_header_t *header;
+        unsigned char *slots;
+};
+
+static size_t shm_ring_size(uint32_t slots)
+{
+        return sizeof(shm_ring_header_t) + (size_t) slots * SHM_RING_SLOT_SIZE;
+}
+
+static shm_ring_t *shm_ring_map(const char *name, int fd, size_t size, int owner)
+{
+        shm_ring_t *ring;
+        void *p;
+
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+                r_err("shm_ring_map: mmap failed: %s", strerror(errno));
+                return NULL;
+        }
+        
+        ring = r_new(shm_ring_t);
+        if (ring == NULL) {
+                munmap(p, size);
+                return NULL;
+        }
+        
+        strncpy(ring->name, name, SHM_RING_NAMELEN - 1);
+        ring->owner = owner;
+        ring->size = size;
+        ring->header = (shm_ring_header_t *) p;
+        ring->slots = (unsigned char *) p + sizeof(shm_ring_header_t);
+        return ring;
+}
+
+shm_ring_t *new_shm_ring(const char *name, int slots)
+{
+        shm_ring_t *ring;
+        size_t size;
+        int fd;
+
+        if (name == NULL || name[0] != '/' || strlen(name) >= SHM_RING_NAMELEN) {
+                r_err("new_shm_ring: invalid name");
+                return NULL;
+        }
+        if (slots <= 0 || (slots & (slots - 1)) != 0) {
+                r_err("new_shm_ring: the number of slots must be a power of two");
+                return NULL;
+        }
+        
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd == -1) {
+                r_err("new_shm_ring: shm_open failed: %s", strerror(errno));
+                return NULL;
+        }
+        
+        size = shm_ring_size((uint32_t) slots);
+        if (ftruncate(fd, (off_t) size) != 0) {
+                r_err("new_shm_ring: ftruncate failed: %s", strerror(errno));
+                close(fd);
+                shm_unlink(name);
+                return NULL;
+        }
+
+        ring = shm_ring_map(name, fd, size, 1);
+        close(fd);
+        if (ring == NULL) {
+                shm_unlink(name);
+                return NULL;
+        }
+
+        // ftruncate zeroed the memory. The magic is written last so
+        // that a writer never attaches to a half-initialised ring.
+        ring->header->version = SHM_RING_VERSION;
+        ring->header->slots = (uint32_t) slots;
+        ring->header->slot_size = SHM_RING_SLOT_SIZE;
+        __atomic_store_n(&ring->header->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+        
+        return ring;
+}
+
+shm_ring_t *open_shm_ring(const char *name)
+{
+        shm_ring_t *ring;
+        struct stat st;
+        shm_ring_header_t *h;
+        int fd;
+        
+        if (name == NULL || strlen(name) >= SHM_RING_NAMELEN) {
+                r_err("open_shm_ring: invalid name");
+                return NULL;
+        }
+        
+        fd = shm_open(name, O_RDWR, 0);
+        if (fd == -1) {
+                r_err("open_shm_ring: shm_open failed: %s", strerror(errno));
+                return NULL;
+        }
+        
+        if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(shm_ring_header_t)) {
+                r_err("open_shm_ring: invalid shared memory size");
+                close(fd);
+                return NULL;
+        }
+        
+        ring = shm_ring_map(name, fd, (size_t) st.st_size, 0);
+        close(fd);
+        if (ring == NULL)
+                return NULL;
+        
+        h = ring->header;
+        if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC
+            || h->version != SHM_RING_VERSION
+            || h->slot_size != SHM_RING_SLOT_SIZE
+            || h->slots == 0 || (h->slots & (h->slots - 1)) != 0
+            || shm_ring_size(h->slots) > ring->size) {
+                r_err("open_shm_ring: invalid ring '%s'", name);
+                delete_shm_ring(ring);
+                return NULL;
+        }
+        
+        return ring;
+}
+
+void delete_shm_ring(shm_ring_t *ring)
+{
+        if (ring) {
+                munmap(ring->header, ring->size);
+                if (ring->owner)
+                        shm_unlink(ring->name);
+                r_delete(ring);
+        }
+}
+
+const char *shm_ring_name(shm_ring_t *ring)
+{
+        return ring->name;
+}
+
+uint32_t shm_ring_dropped(shm_ring_t *ring)
+{
+        return __atomic_load_n(&ring->header->dropped, __ATOMIC_RELAXED);
+}
+
+static unsigned char *shm_ring_slot(shm_ring_t *ring, uint64_t index)
+{
+        return ring->slots + (index & (ring->header->slots - 1)) * SHM_RING_SLOT_SIZE;
+}
+
+int shm_ring_write(shm_ring_t *ring, data_t *data)
+{
+        shm_ring_header_t *h = ring->header;
+        uint64_t head = __atomic_load_n(&h->head, __ATOMIC_RELAXED);
+        uint64_t tail = __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+        uint32_t len = (uint32_t) (data_len(data) + PACKET_HEADER);
+        unsigned char *slot;
+        
+        if (head - tail >= h->slots) {
+                __atomic_add_fetch(&h->dropped, 1, __ATOMIC_RELAXED);
+                return -1;
+        }
+
+        slot = shm_ring_slot(ring, head);
+        memcpy(slot, &len, 4);
+        memcpy(slot + 4, data_packet(data), len);
+        
+        // The head is published before checking whether the reader
+        // sleeps, and the reader announces that it sleeps before
+        // checking the head, so the wakeup can't be missed.
+        __atomic_store_n(&h->head, head + 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&h->sleeping, __ATOMIC_SEQ_CST)) {
+                __atomic_add_fetch(&h->wakeup, 1, __ATOMIC_SEQ_CST);
+                syscall(SYS_futex, &h->wakeup, FUTEX_WAKE, 1, NULL, NULL, 0);
+        }
+        return 0;
+}
+
+static inline int shm_ring_empty(shm_ring_header_t *h)
+{
+        return (__atomic_load_n(&h->head, __ATOMIC_SEQ_CST)
+                == __atomic_load_n(&h->tail, __ATOMIC_RELAXED));
+}
+
+int shm_ring_wait(shm_ring_t *ring, double timeout)
+{
+        shm_ring_header_t *h = ring->header;
+        struct timespec ts;
+        uint32_t wakeup;
+        
+        if (timeout < 0)
+                return RCOM_WAIT_ERROR;
+        
+        for (int i = 0; i < SHM_RING_SPIN; i++) {
+                if (!shm_ring_empty(h))
+                        return RCOM_WAIT_OK;
+                shm_ring_relax();
+        }
+
+        wakeup = __atomic_load_n(&h->wakeup, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&h->sleeping, 1, __ATOMIC_SEQ_CST);
+        
+        if (shm_ring_empty(h)) {
+                ts.tv_sec = (time_t) timeout;
+                ts.tv_nsec = (long) ((timeout - (double) ts.tv_sec) * 1000000000.0);
+                syscall(SYS_futex, &h->wakeup, FUTEX_WAIT, wakeup, &ts, NULL, 0);
+        }
+        
+        __atomic_store_n(&h->sleeping, 0, __ATOMIC_SEQ_CST);
+        
+        return shm_ring_empty(h)? RCOM_WAIT_TIMEOUT : RCOM_WAIT_OK;
+}
+
+int shm_ring_read(shm_ring_t *ring, data_t *data)
+{
+        shm_ring_header_t *h = ring->header;
+        uint64_t tail = __atomic_load_n(&h->tail, __ATOMIC_RELAXED);
+        uint64_t head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+        unsigned char *slot;
+        uint32_t len;
+        int ret = 1;
+        
+        if (head == tail)
+                return 0;
+
+        slot = shm_ring_slot(ring, tail);
+        memcpy(&len, slot, 4);
+        
+        // The memory is shared with another process: don't trust it.
+        if (len < PACKET_HEADER || len > PACKET_MAXLEN) {
+                ret = -1;
+        } else {
+                memcpy(data_packet(data), slot + 4, len);
+                data_set_len(data, (int) (len - PACKET_HEADER));
+        }
+        
+        __atomic_store_n(&h->tail, tail + 1, __ATOMIC_RELEASE);
+        return ret;
+}
@@ -21,6 +21,7 @@
   <http://www.gnu.org/licenses/>.
 
  */
+#include <unistd.h>
 #include <r.h>
 
 #include "app.h"
@@ -30,8 +31,10 @@
 #include "http_parser.h"
 #include "http.h"
 #include "export.h"
+#include "framering.h"
 #include "request_priv.h"
 #include "streamer_priv.h"
+#include "registry_priv.h"
 
 static void streamer_send_index_html(streamer_t *streamer, tcp_socket_t s);
 static void streamer_send_index_json(streamer_t *streamer, tcp_socket_t s);
@@ -213,6 +216,12 @@ struct _streamer_t
         thread_t* server_thread;
         thread_t* data_thread;
 
+        // The frames for the streamerlinks on the same host
+        framering_t *ring;
+
+        // Records the frames when dumping is on
+        dump_t *dump;
+
         int cont;
         streamer_onclient_t onclient;
         streamer_onbroadcast_t onbroadcast;
@@ -224,6 +233,26 @@ struct _streamer_t
 static void streamer_run_server(streamer_t *streamer);
 static void streamer_run_data(streamer_t *streamer);
 
+static void streamer_open_ring(streamer_t *streamer)
+{
+        static int count = 0;
+        char name[FRAMERING_NAMELEN];
+        
+        // The port may be zero, so use the process ID and a counter.
+        snprintf(name, sizeof(name), "/rcom-streamer-%d-%d", (int) getpid(),
+                 __atomic_fetch_add(&count, 1, __ATOMIC_RELAXED));
+        
+        streamer->ring = new_framering(name, FRAMERING_SLOTS,
+                                       FRAMERING_FRAME_MAXLEN);
+        if (streamer->ring == NULL)
+                r_warn("streamer_open_ring: failed to create the frame ring");
+}
+
+const char *streamer_ring_name(streamer_t *streamer)
+{
+        return (streamer->ring != NULL)? framering_name(streamer->ring) : NULL;
+}
+
 streamer_t *new_streamer(const char *name,
                          const char *topic,
                          int port,
@@ -260,6 +289,11 @@ streamer_t *new_streamer(const char *name,
         r_info("Streamer listening at http://%s",
                  addr_string(streamer->addr, b, sizeof(b)));
 
+        // Not fatal: local clients then use HTTP.
+        streamer_open_ring(streamer);
+
+        streamer->dump = dump_start_recording(name, TYPE_STREAMER, topic, mimetype);
+
         streamer->cont = 1;        
 
         streamer->server_thread = new_thread((thread_run_t) streamer_run_server,
@@ -326,6 +360,8 @@ void delete_streamer(streamer_t *streamer)
                 r_free(streamer->name);
                 r_free(streamer->mimetype);
                 delete_addr(streamer->addr);
+                delete_framering(streamer->ring);
+                delete_dump(streamer->dump);
                 if (streamer->socket != INVALID_TCP_SOCKET) {
                     r_debug("delete_streamer: close_tcp_socket");
                     close_tcp_socket(streamer->socket);
@@ -516,6 +552,12 @@ int streamer_send_multipart(streamer_t* s,
                               time);
 
         total_len = header_len + length;
+
+        if (s->dump)
+                dump_write_frame(s->dump, data, length, mimetype, time);
+
+        if (s->ring != NULL && framering_has_readers(s->ring))
+                framering_write(s->ring, data, (size_t) length, mimetype, time);
         
         streamer_lock_clients(s);
         l = streamer_get_clients(s);
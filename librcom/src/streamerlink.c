@@ -24,10 +24,12 @@
 
 #include <r.h>
 
+#include "app.h"
 #include "registry.h"
 #include "util.h"
 
 #include "http.h"
+#include "framering.h"
 #include "streamerlink_priv.h"
 
 typedef struct _streamerlink_t {
@@ -35,6 +37,9 @@ typedef struct _streamerlink_t {
         void* userdata;
         streamerlink_ondata_t ondata;
         streamerlink_onresponse_t onresponse;
+        streamerlink_onframe_t onframe;
+        char *remote_ring;
+        framering_t *ring;
         tcp_socket_t socket;
         addr_t *addr;
         addr_t *remote_addr;
@@ -44,6 +49,10 @@ typedef struct _streamerlink_t {
         int autoconnect;
 } streamerlink_t;
 
+// The number of seconds without frames after which a link that reads
+// the streamer's ring falls back to HTTP
+#define STREAMERLINK_RING_TIMEOUT 5.0
+
 static int streamerlink_stop_thread(streamerlink_t *link);
 static int streamerlink_close_connection(streamerlink_t *link);
 static void streamerlink_lock(streamerlink_t *link);
@@ -94,6 +103,10 @@ void delete_streamerlink(streamerlink_t *link)
                                 delete_addr(link->remote_addr);
                                 link->remote_addr = NULL;
                         }                        
+                        if (link->remote_ring) {
+                                r_free(link->remote_ring);
+                                link->remote_ring = NULL;
+                        }
                         streamerlink_unlock(link);
                         delete_mutex(link->mutex);
                 }
@@ -143,6 +156,10 @@ static int streamerlink_close_connection(streamerlink_t *link)
                 close_tcp_socket(link->socket);
                 link->socket = INVALID_TCP_SOCKET;
         }
+        if (link->ring) {
+                delete_framering(link->ring);
+                link->ring = NULL;
+        }
         if (link->addr) {
                 delete_addr(link->addr);
                 link->addr = new_addr0();
@@ -256,6 +273,88 @@ cleanup:
         streamerlink_unlock(link);
 }
 
+static int streamerlink_onframe(void *userdata, const char *mimetype,
+                                const char *data, int len, double timestamp)
+{
+        streamerlink_t *link = (streamerlink_t *) userdata;
+        return link->onframe(link->userdata, mimetype, data, len, timestamp);
+}
+
+static void streamerlink_run_ring(streamerlink_t *link)
+{
+        double last_frame = clock_time();
+        int err;
+        
+        link->cont = 1;
+        
+        while (link->cont && !app_quit()) {
+                err = framering_read(link->ring, 1.0, streamerlink_onframe, link);
+                if (err == RCOM_WAIT_ERROR)
+                        break;
+                if (err == RCOM_WAIT_OK)
+                        last_frame = clock_time();
+                else if (clock_time() - last_frame > STREAMERLINK_RING_TIMEOUT)
+                        break;
+        }
+
+        // The streamer closed the ring, or it crashed or stalled. Try
+        // HTTP, which fails if the streamer is gone.
+        if (link->cont && !app_quit()) {
+                r_warn("streamerlink_run_ring: no frames from the ring, using HTTP");
+                streamerlink_lock(link);
+                delete_framering(link->ring);
+                link->ring = NULL;
+                err = streamerlink_open(link);
+                streamerlink_unlock(link);
+                if (err == 0) {
+                        streamerlink_run(link);
+                        return;
+                }
+        }
+        
+        streamerlink_lock(link);        
+        streamerlink_close_connection(link);
+        delete_thread(link->thread);
+        link->thread = NULL;
+        streamerlink_unlock(link);
+}
+
+// Returns 0 if the link reads the frames from the streamer's ring.
+static int streamerlink_open_ring(streamerlink_t *link)
+{
+        if (link->onframe == NULL || link->remote_ring == NULL)
+                return -1;
+        
+        link->ring = open_framering(link->remote_ring);
+        if (link->ring == NULL) {
+                r_warn("streamerlink_open_ring: failed to open the ring, using HTTP");
+                return -1;
+        }
+        
+        link->thread = new_thread((thread_run_t) streamerlink_run_ring, link);
+        if (link->thread == NULL) {
+                delete_framering(link->ring);
+                link->ring = NULL;
+                return -1;
+        }
+        return 0;
+}
+
+void streamerlink_set_onframe(streamerlink_t *link, streamerlink_onframe_t onframe)
+{
+        int reconnect;
+        
+        streamerlink_lock(link);
+        link->onframe = onframe;
+        reconnect = (link->autoconnect
+                     && link->remote_addr != NULL
+                     && link->remote_ring != NULL);
+        streamerlink_unlock(link);
+
+        if (reconnect)
+                streamerlink_connect(link);
+}
+
 int streamerlink_connect(streamerlink_t *link)
 {
         int ret = 0;
@@ -278,6 +377,9 @@ int streamerlink_connect(streamerlink_t *link)
 
         //r_debug("streamerlink_connect @2: %s", addr_string(link->remote_addr, b, 64));
 
+        if (streamerlink_open_ring(link) == 0)
+                goto unlock_and_return;
+        
         ret = streamerlink_open(link);
         if (ret != 0) {
                 streamerlink_close_connection(link);
@@ -301,7 +403,7 @@ unlock_and_return:
         return ret;
 }
 
-int streamerlink_set_remote(streamerlink_t *link, addr_t *addr)
+int streamerlink_set_remote(streamerlink_t *link, addr_t *addr, const char *ring)
 {
         int ret = -1;
 
@@ -322,12 +424,18 @@ int streamerlink_set_remote(streamerlink_t *link, addr_t *addr)
                 delete_addr(link->remote_addr);
                 link->remote_addr = NULL;
         }
+        if (link->remote_ring) {
+                r_free(link->remote_ring);
+                link->remote_ring = NULL;
+        }
         if (addr != NULL) {
                 link->remote_addr = addr_clone(addr);
                 if (link->remote_addr == NULL) {
                         ret = -1;
                         goto unlock_and_return;
                 }
+                if (ring != NULL)
+                        link->remote_ring = r_strdup(ring);
         }
         
         streamerlink_unlock(link);
@@ -11,6 +11,7 @@ Invalid_Id = "Invalid ID"
 Invalid_Topic = "Invalid topic"
 Invalid_Type = "Invalid type"
 Invalid_Address = "Invalid address"
+Invalid_Requests = "Invalid requests value"
 
 test_array = []
 
@@ -25,6 +26,10 @@ def add_tests():
     test_array = [
         (registry_tests.registry_send_test, "{'request':'xxxx'}", False, Unknown_Request),
         (registry_tests.registry_send_test, "{'request':'list'}", True, OK),
+        (registry_tests.registry_send_test, "{'request':'sync'}", True, OK),
+        (registry_tests.registry_send_test, "{'request':'sync','registry':'unknown','revision':1}", True, OK),
+        (registry_tests.registry_send_test, "{'request':'batch'}", False, Invalid_Requests),
+        (registry_tests.registry_send_test, "{'request':'batch','requests':[]}", True, OK),
         (registry_tests.registry_send_test, "{'request':'register'}", False, Invalid_Id),
         (registry_tests.registry_send_test, "{'request':'register','entry':{'id':'mock'}}", False, Invalid_Id),
         (registry_tests.registry_send_test, "{'request':'register','entry':{'id':'1b4e28ba-2fa1-11d2-883f-0016d3cca427', 'name':'mocker'}}", False, Invalid_Topic),
@@ -0,0 +1,305 @@
+#include <string>
+#include <climits>
+#include <vector>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "mem.mock.h"
+#include "log.mock.h"
+}
+
+#include "cbor.h"
+
+
+class cbor_tests : public ::testing::Test
+{
+protected:
+    unsigned char buffer[4096];
+
+    cbor_tests() : buffer() {}
+
+	~cbor_tests() override = default;
+
+	void SetUp() override
+    {
+	    RESET_FAKE(safe_malloc);
+        RESET_FAKE(safe_free);
+        safe_malloc_fake.custom_fake = safe_malloc_custom_fake;
+        safe_free_fake.custom_fake = safe_free_custom_fake;
+	}
+
+	void TearDown() override
+    {
+	}
+
+    // Nests an empty array in depth arrays
+    json_object_t nested_arrays(int depth)
+    {
+        json_object_t value = json_array_create();
+        for (int i = 0; i < depth; i++) {
+            json_object_t outer = json_array_create();
+            json_array_push(outer, value);
+            json_unref(value);
+            value = outer;
+        }
+        return value;
+    }
+};
+
+TEST_F(cbor_tests, cbor_decode_roundtrips_object)
+{
+    // Arrange
+    json_object_t obj = json_object_create();
+    json_object_t flags = json_array_create();
+    json_object_t nested = json_object_create();
+    json_object_setstr(obj, "name", "sensor");
+    json_object_setnum(obj, "count", 42);
+    json_object_setnum(obj, "negative", -7);
+    json_object_setnum(obj, "half", 1.5);
+    json_object_setnum(obj, "tenth", 0.1);
+    json_array_push(flags, json_true());
+    json_array_push(flags, json_false());
+    json_array_push(flags, json_null());
+    json_object_set(obj, "flags", flags);
+    json_object_setnum(nested, "big", 1e300);
+    json_object_set(obj, "nested", nested);
+    int error = 0;
+
+    // Act
+    int len = cbor_encode(obj, buffer, sizeof(buffer));
+    json_object_t decoded = cbor_decode(buffer, len, &error);
+
+    // Assert
+    ASSERT_GT(len, 0);
+    ASSERT_EQ(error, 0);
+    ASSERT_TRUE(json_isobject(decoded));
+    ASSERT_STREQ(json_object_getstr(decoded, "name"), "sensor");
+    ASSERT_EQ(json_object_getnum(decoded, "count"), 42.0);
+    ASSERT_EQ(json_object_getnum(decoded, "negative"), -7.0);
+    ASSERT_EQ(json_object_getnum(decoded, "half"), 1.5);
+    ASSERT_EQ(json_object_getnum(decoded, "tenth"), 0.1);
+    json_object_t decoded_flags = json_object_get(decoded, "flags");
+    ASSERT_EQ(json_array_length(decoded_flags), 3);
+    ASSERT_TRUE(json_istrue(json_array_get(decoded_flags, 0)));
+    ASSERT_TRUE(json_isfalse(json_array_get(decoded_flags, 1)));
+    ASSERT_TRUE(json_isnull(json_array_get(decoded_flags, 2)));
+    ASSERT_EQ(json_object_getnum(json_object_get(decoded, "nested"), "big"), 1e300);
+
+    json_unref(decoded);
+    json_unref(nested);
+    json_unref(flags);
+    json_unref(obj);
+}
+
+TEST_F(cbor_tests, cbor_encode_uses_smallest_number_encoding)
+{
+    // Arrange
+    json_object_t small = json_number_create(23);
+    json_object_t negative = json_number_create(-1);
+    json_object_t large_negative = json_number_create(-4294967296.0);
+    json_object_t single = json_number_create(1.5);
+    json_object_t dbl = json_number_create(0.1);
+
+    // Act
+    int len1 = cbor_encode(small, buffer, sizeof(buffer));
+    unsigned char b1 = buffer[0];
+    int len2 = cbor_encode(negative, buffer, sizeof(buffer));
+    unsigned char b2 = buffer[0];
+    int len3 = cbor_encode(large_negative, buffer, sizeof(buffer));
+    unsigned char b3 = buffer[0];
+    int len4 = cbor_encode(single, buffer, sizeof(buffer));
+    unsigned char b4 = buffer[0];
+    int len5 = cbor_encode(dbl, buffer, sizeof(buffer));
+    unsigned char b5 = buffer[0];
+
+    // Assert
+    ASSERT_EQ(len1, 1);
+    ASSERT_EQ(b1, 0x17);
+    ASSERT_EQ(len2, 1);
+    ASSERT_EQ(b2, 0x20);
+    ASSERT_EQ(len3, 5);
+    ASSERT_EQ(b3, 0x3a);
+    ASSERT_EQ(len4, 5);
+    ASSERT_EQ(b4, 0xfa);
+    ASSERT_EQ(len5, 9);
+    ASSERT_EQ(b5, 0xfb);
+
+    json_unref(small);
+    json_unref(negative);
+    json_unref(large_negative);
+    json_unref(single);
+    json_unref(dbl);
+}
+
+TEST_F(cbor_tests, cbor_decode_roundtrips_long_string)
+{
+    // Arrange
+    std::string s(1000, 'x');
+    json_object_t value = json_string_create(s.c_str());
+    int error = 0;
+
+    // Act
+    int len = cbor_encode(value, buffer, sizeof(buffer));
+    json_object_t decoded = cbor_decode(buffer, len, &error);
+
+    // Assert
+    ASSERT_EQ(len, 3 + 1000);
+    ASSERT_EQ(error, 0);
+    ASSERT_TRUE(json_isstring(decoded));
+    ASSERT_EQ(std::string(json_string_value(decoded)), s);
+
+    json_unref(decoded);
+    json_unref(value);
+}
+
+TEST_F(cbor_tests, cbor_decode_reads_half_precision_floats)
+{
+    // Arrange
+    const unsigned char data[] = { 0xf9, 0xbc, 0x00 };
+    int error = 0;
+
+    // Act
+    json_object_t decoded = cbor_decode(data, sizeof(data), &error);
+
+    // Assert
+    ASSERT_EQ(error, 0);
+    ASSERT_EQ(json_number_value(decoded), -1.0);
+    json_unref(decoded);
+}
+
+TEST_F(cbor_tests, cbor_encode_fails_when_buffer_is_too_small)
+{
+    // Arrange
+    json_object_t value = json_string_create("hello");
+
+    // Act
+    int len = cbor_encode(value, buffer, 5);
+
+    // Assert
+    ASSERT_EQ(len, -1);
+    json_unref(value);
+}
+
+TEST_F(cbor_tests, cbor_encode_rejects_nesting_beyond_limit)
+{
+    // Arrange
+    json_object_t shallow = nested_arrays(10);
+    json_object_t deep = nested_arrays(40);
+
+    // Act
+    int len1 = cbor_encode(shallow, buffer, sizeof(buffer));
+    int len2 = cbor_encode(deep, buffer, sizeof(buffer));
+
+    // Assert
+    ASSERT_EQ(len1, 11);
+    ASSERT_EQ(len2, -1);
+    json_unref(shallow);
+    json_unref(deep);
+}
+
+TEST_F(cbor_tests, cbor_decode_rejects_nesting_beyond_limit)
+{
+    // Arrange
+    std::vector<unsigned char> data(40, 0x81); // Arrays of one element
+    data.push_back(0x01);
+    int error = 0;
+
+    // Act
+    json_object_t decoded = cbor_decode(data.data(), (int) data.size(), &error);
+
+    // Assert
+    ASSERT_EQ(error, -1);
+    ASSERT_TRUE(json_isnull(decoded));
+}
+
+TEST_F(cbor_tests, cbor_decode_rejects_truncated_input)
+{
+    // Arrange
+    json_object_t obj = json_object_create();
+    json_object_setstr(obj, "name", "sensor");
+    json_object_setnum(obj, "value", 0.1);
+    int len = cbor_encode(obj, buffer, sizeof(buffer));
+    int failures = 0;
+
+    // Act
+    for (int n = 0; n < len; n++) {
+        int error = 0;
+        json_object_t decoded = cbor_decode(buffer, n, &error);
+        if (error == -1 && json_isnull(decoded))
+            failures++;
+    }
+
+    // Assert
+    ASSERT_EQ(failures, len);
+    json_unref(obj);
+}
+
+TEST_F(cbor_tests, cbor_decode_rejects_malformed_input)
+{
+    // Arrange
+    const unsigned char integer_key[] = { 0xa1, 0x01, 0x02 };
+    const unsigned char reserved_info[] = { 0x1c };
+    const unsigned char indefinite_text[] = { 0x7f, 0x61, 0x61, 0xff };
+    const unsigned char unknown_tag[] = { 0xc1, 0x01 };
+    const unsigned char bad_typed_array[] = { 0xd8, 0x56, 0x43, 0x01, 0x02, 0x03 };
+    const unsigned char long_text[] = { 0x78, 0xff, 'a' };
+    int e1, e2, e3, e4, e5, e6;
+
+    // Act
+    cbor_decode(integer_key, sizeof(integer_key), &e1);
+    cbor_decode(reserved_info, sizeof(reserved_info), &e2);
+    cbor_decode(indefinite_text, sizeof(indefinite_text), &e3);
+    cbor_decode(unknown_tag, sizeof(unknown_tag), &e4);
+    cbor_decode(bad_typed_array, sizeof(bad_typed_array), &e5);
+    cbor_decode(long_text, sizeof(long_text), &e6);
+
+    // Assert
+    ASSERT_EQ(e1, -1);
+    ASSERT_EQ(e2, -1);
+    ASSERT_EQ(e3, -1);
+    ASSERT_EQ(e4, -1);
+    ASSERT_EQ(e5, -1);
+    ASSERT_EQ(e6, -1);
+}
+
+TEST_F(cbor_tests, cbor_decode_rejects_indefinite_length_on_other_items)
+{
+    // Arrange
+    const unsigned char uint_item[] = { 0x1f };
+    const unsigned char negint_item[] = { 0x3f };
+    const unsigned char tag_item[] = { 0xdf, 0x01 };
+    const unsigned char stray_break[] = { 0xff };
+    const unsigned char array_of_uint[] = { 0x81, 0x1f };
+    double values[4];
+    int e1, e2, e3, e4;
+
+    // Act
+    cbor_decode(uint_item, sizeof(uint_item), &e1);
+    cbor_decode(negint_item, sizeof(negint_item), &e2);
+    cbor_decode(tag_item, sizeof(tag_item), &e3);
+    cbor_decode(stray_break, sizeof(stray_break), &e4);
+    int count = cbor_decode_array(array_of_uint, sizeof(array_of_uint), values, 4);
+
+    // Assert
+    ASSERT_EQ(e1, -1);
+    ASSERT_EQ(e2, -1);
+    ASSERT_EQ(e3, -1);
+    ASSERT_EQ(e4, -1);
+    ASSERT_EQ(count, -1);
+}
+
+TEST_F(cbor_tests, cbor_encode_array_rejects_invalid_count)
+{
+    // Arrange
+    double values[2] = { 1.0, 2.0 };
+
+    // Act
+    int ret1 = cbor_encode_array(values, -1, buffer, sizeof(buffer));
+    int ret2 = cbor_encode_array(values, INT_MAX / 4, buffer, sizeof(buffer));
+    int ret3 = cbor_encode_array(values, 2, buffer, sizeof(buffer));
+
+    // Assert
+    ASSERT_EQ(ret1, -1);
+    ASSERT_EQ(ret2, -1);
+    ASSERT_EQ(ret3, 2 + 1 + 16);
+}
@@ -0,0 +1,121 @@
+#include <string>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "mem.mock.h"
+}
+
+#include "clocksync_priv.h"
+
+
+class clocksync_tests : public ::testing::Test
+{
+protected:
+    clocksync_tests() = default;
+
+	~clocksync_tests() override = default;
+
+	void SetUp() override
+    {
+	    RESET_FAKE(safe_malloc);
+        RESET_FAKE(safe_free);
+        safe_malloc_fake.custom_fake = safe_malloc_custom_fake;
+        safe_free_fake.custom_fake = safe_free_custom_fake;
+	}
+
+	void TearDown() override
+    {
+	}
+};
+
+TEST_F(clocksync_tests, clock_sync_get_fails_without_exchanges)
+{
+    // Arrange
+    clock_sync_t *sync = new_clock_sync();
+    clock_offset_t offset;
+
+    // Act
+    int ret = clock_sync_get(sync, &offset);
+
+    // Assert
+    ASSERT_EQ(ret, -1);
+    ASSERT_EQ(clock_sync_to_local(sync, 1234), 1234u);
+    delete_clock_sync(sync);
+}
+
+TEST_F(clocksync_tests, clock_sync_get_uses_exchange_with_smallest_delay)
+{
+    // Arrange
+    clock_sync_t *sync = new_clock_sync();
+    clock_offset_t offset;
+    uint64_t remote = 5000000; // The remote clock is 5 s ahead
+
+    // Symmetric exchange with a delay of 2 ms
+    clock_sync_add(sync, 1000000, 1001000 + remote, 1001000 + remote, 1002000);
+    // Asymmetric exchange with a delay of 20 ms
+    clock_sync_add(sync, 2000000, 2018000 + remote, 2018000 + remote, 2020000);
+
+    // Act
+    int ret = clock_sync_get(sync, &offset);
+
+    // Assert
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(offset.samples, 2);
+    ASSERT_DOUBLE_EQ(offset.offset, 5.0);
+    ASSERT_DOUBLE_EQ(offset.delay, 0.002);
+    ASSERT_EQ(clock_sync_to_local(sync, 3000000 + remote), 3000000u);
+    delete_clock_sync(sync);
+}
+
+TEST_F(clocksync_tests, clock_sync_get_estimates_skew)
+{
+    // Arrange
+    clock_sync_t *sync = new_clock_sync();
+    clock_offset_t offset;
+
+    // The remote clock runs 100 ppm fast
+    for (uint64_t t = 0; t <= 30000000; t += 1000000) {
+        uint64_t remote = t + 500 + (t + 500) / 10000;
+        clock_sync_add(sync, t, remote, remote, t + 1000);
+    }
+
+    // Act
+    int ret = clock_sync_get(sync, &offset);
+
+    // Assert
+    ASSERT_EQ(ret, 0);
+    ASSERT_NEAR(offset.skew, 0.0001, 0.000001);
+    delete_clock_sync(sync);
+}
+
+TEST_F(clocksync_tests, clock_sync_reply_carries_the_request_time)
+{
+    // Arrange
+    char request[CLOCK_SYNC_REQUEST_LEN];
+    char reply[CLOCK_SYNC_REPLY_LEN];
+    uint64_t t0, t1, t2;
+
+    // Act
+    int request_len = clock_sync_make_request(request, 0x0102030405060708);
+    int reply_len = clock_sync_make_reply(request, request_len, reply, 42);
+    int ret = clock_sync_parse_reply(reply, reply_len, &t0, &t1, &t2);
+
+    // Assert
+    ASSERT_TRUE(clock_sync_is_request(request, request_len));
+    ASSERT_FALSE(clock_sync_is_reply(request, request_len));
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(t0, 0x0102030405060708u);
+    ASSERT_EQ(t1, 42u);
+}
+
+TEST_F(clocksync_tests, clock_sync_make_reply_rejects_other_data)
+{
+    // Arrange
+    char reply[CLOCK_SYNC_REPLY_LEN];
+
+    // Act
+    int ret = clock_sync_make_reply("hello, world", 12, reply, 42);
+
+    // Assert
+    ASSERT_EQ(ret, -1);
+}
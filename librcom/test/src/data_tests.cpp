@@ -1,4 +1,5 @@
 #include <string>
+#include <thread>
 #include <gmock/gmock-matchers.h>
 #include "gtest/gtest.h"
 
@@ -441,19 +442,28 @@ TEST_F(data_tests, data_serialise_when_serialise_fails_logs_returns_error)
     json_unref(json_obj);
 }
 
-TEST_F(data_tests, data_parse_if_parser_NULL_parser_created_and_destroyed)
+TEST_F(data_tests, data_parse_if_parser_NULL_thread_parser_reused_and_destroyed_at_exit)
 {
     // Arrange
     safe_malloc_fake.custom_fake = safe_malloc_custom_fake;
     safe_free_fake.custom_fake = safe_free_custom_fake;
+    json_parser_t* parser = (json_parser_t*) 0x1234;
+    json_parser_create_fake.return_val = parser;
     data_t *data = new_data();
 
     // Act
-    data_parse(data, nullptr);
+    std::thread thread([data]() {
+        data_parse(data, nullptr);
+        data_parse(data, nullptr);
+    });
+    thread.join();
 
     // Assert
     ASSERT_EQ(json_parser_create_fake.call_count, 1);
+    ASSERT_EQ(json_parser_eval_fake.call_count, 2);
+    ASSERT_EQ(json_parser_eval_fake.arg0_val, parser);
     ASSERT_EQ(json_parser_destroy_fake.call_count, 1);
+    ASSERT_EQ(json_parser_destroy_fake.arg0_val, parser);
     delete_data(data);
 }
 
@@ -609,4 +619,112 @@ TEST_F(data_tests, data_get_seqnum_gets_seqnum)
     // Assert
     ASSERT_THAT(actual, expected);
     delete_data(data);
-}
\ No newline at end of file
+}
+
+TEST_F(data_tests, data_serialise_array_roundtrips_values)
+{
+    // Arrange
+    safe_malloc_fake.custom_fake = safe_malloc_custom_fake;
+    safe_free_fake.custom_fake = safe_free_custom_fake;
+    double values[] = { 0.0, -1.5, 3.14159, 1e-300 };
+    double actual[4];
+
+    data_t *data = new_data();
+
+    // Act
+    int ret = data_serialise_array(data, values, 4);
+    int n = data_parse_array(data, actual, 4);
+
+    // Assert
+    ASSERT_EQ(ret, 0);
+    ASSERT_TRUE(data_is_bin(data));
+    ASSERT_EQ(data_len(data), 3 + 2 + 1 + 4 * 8);
+    ASSERT_EQ(n, 4);
+    ASSERT_THAT(actual, ::testing::ElementsAre(0.0, -1.5, 3.14159, 1e-300));
+    delete_data(data);
+}
+
+TEST_F(data_tests, data_serialise_array_fails_when_too_many_values)
+{
+    // Arrange
+    safe_malloc_fake.custom_fake = safe_malloc_custom_fake;
+    safe_free_fake.custom_fake = safe_free_custom_fake;
+    std::vector<double> values(DATA_MAXLEN / 8, 1.0);
+
+    data_t *data = new_data();
+
+    // Act
+    int ret = data_serialise_array(data, values.data(), (int) values.size());
+
+    // Assert
+    ASSERT_EQ(ret, -1);
+    delete_data(data);
+}
+
+TEST_F(data_tests, data_parse_array_rejects_text_data)
+{
+    // Arrange
+    safe_malloc_fake.custom_fake = safe_malloc_custom_fake;
+    safe_free_fake.custom_fake = safe_free_custom_fake;
+    double actual[4];
+
+    data_t *data = new_data();
+    data_set_data(data, "[1,2,3]", 7);
+
+    // Act
+    int n = data_parse_array(data, actual, 4);
+
+    // Assert
+    ASSERT_FALSE(data_is_bin(data));
+    ASSERT_EQ(n, -1);
+    delete_data(data);
+}
+
+TEST_F(data_tests, data_parse_decodes_binary_data_without_parser)
+{
+    // Arrange
+    safe_malloc_fake.custom_fake = safe_malloc_custom_fake;
+    safe_free_fake.custom_fake = safe_free_custom_fake;
+    json_object_t obj = json_object_create();
+    json_object_setstr(obj, "name", "sensor");
+    json_object_setnum(obj, "value", -2.5);
+
+    data_t *data = new_data();
+
+    // Act
+    int ret = data_serialise_bin(data, obj);
+    json_object_t actual = data_parse(data, nullptr);
+
+    // Assert
+    ASSERT_EQ(ret, 0);
+    ASSERT_TRUE(data_is_bin(data));
+    ASSERT_EQ(json_parser_create_fake.call_count, 0);
+    ASSERT_EQ(json_parser_eval_fake.call_count, 0);
+    ASSERT_STREQ(json_object_getstr(actual, "name"), "sensor");
+    ASSERT_EQ(json_object_getnum(actual, "value"), -2.5);
+    json_unref(actual);
+    json_unref(obj);
+    delete_data(data);
+}
+
+TEST_F(data_tests, data_parse_returns_null_and_warns_on_invalid_binary_data)
+{
+    // Arrange
+    safe_malloc_fake.custom_fake = safe_malloc_custom_fake;
+    safe_free_fake.custom_fake = safe_free_custom_fake;
+    // The self-describe tag followed by a truncated map
+    const char invalid[] = { (char) 0xd9, (char) 0xd9, (char) 0xf7, (char) 0xa1, 0x01 };
+
+    data_t *data = new_data();
+    data_set_data(data, invalid, sizeof(invalid));
+
+    // Act
+    json_object_t actual = data_parse(data, nullptr);
+
+    // Assert
+    ASSERT_TRUE(data_is_bin(data));
+    ASSERT_TRUE(json_isnull(actual));
+    ASSERT_EQ(json_parser_eval_fake.call_count, 0);
+    ASSERT_EQ(r_warn_fake.call_count, 1);
+    delete_data(data);
+}
@@ -0,0 +1,439 @@
+#include <string>
+#include <glob.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "mem.mock.h"
+#include "log.mock.h"
+#include "clock_posix.mock.h"
+}
+
+#include "dump.h"
+#include "registry_priv.h"
+
+static char *clock_datetime_custom_fake(char *buf, int len, char, char, char)
+{
+    snprintf(buf, len, "2020-01-01_00-00-00");
+    return buf;
+}
+
+class dump_tests : public ::testing::Test
+{
+protected:
+    char dir[64];
+    
+    dump_tests() = default;
+
+	~dump_tests() override = default;
+
+	void SetUp() override
+    {
+	    RESET_FAKE(safe_malloc);
+        RESET_FAKE(safe_free);
+        RESET_FAKE(r_err);
+        RESET_FAKE(clock_datetime);
+        safe_malloc_fake.custom_fake = safe_malloc_custom_fake;
+        safe_free_fake.custom_fake = safe_free_custom_fake;
+        clock_datetime_fake.custom_fake = clock_datetime_custom_fake;
+        snprintf(dir, sizeof(dir), "/tmp/dump_tests_XXXXXX");
+        mkdtemp(dir);
+        set_dumping_dir(dir);
+	}
+
+	void TearDown() override
+    {
+        std::string cmd = std::string("rm -rf ") + dir;
+        system(cmd.c_str());
+        set_dumping_dir(nullptr);
+	}
+
+    std::string dump_path()
+    {
+        glob_t g;
+        std::string pattern = std::string(dir) + "/*.dump";
+        glob(pattern.c_str(), 0, nullptr, &g);
+        std::string path = (g.gl_pathc > 0)? g.gl_pathv[0] : "";
+        globfree(&g);
+        return path;
+    }
+
+    // Writes n data records, one every millisecond
+    void write_dump(int n)
+    {
+        dump_t *dump = dump_create("node", TYPE_DATAHUB, "topic", "application/json");
+        data_t *data = new_data();
+        for (int i = 0; i < n; i++) {
+            data_printf(data, "%d", i);
+            data_set_timestamp_value(data, 1000000 + 1000 * (uint64_t) i);
+            dump_write_data(dump, data);
+        }
+        delete_data(data);
+        delete_dump(dump);
+    }
+
+    int read_value(dump_t *dump)
+    {
+        data_t *data = new_data();
+        int value = -1;
+        if (dump_read_data(dump, data) == 0)
+            value = std::stoi(std::string(data_data(data), data_len(data)));
+        delete_data(data);
+        return value;
+    }
+};
+
+TEST_F(dump_tests, dump_open_reads_header_and_index)
+{
+    // Arrange
+    uint64_t first, last;
+    write_dump(1000);
+
+    // Act
+    dump_t *dump = dump_open(dump_path().c_str());
+
+    // Assert
+    ASSERT_NE(dump, nullptr);
+    ASSERT_STREQ(dump_name(dump), "node");
+    ASSERT_STREQ(dump_topic(dump), "topic");
+    ASSERT_EQ(dump_count(dump), 1000u);
+    ASSERT_EQ(dump_time_range(dump, &first, &last), 0);
+    ASSERT_EQ(first, 1000000u);
+    ASSERT_EQ(last, 1999000u);
+    ASSERT_EQ(read_value(dump), 0);
+    delete_dump(dump);
+}
+
+TEST_F(dump_tests, dump_seek_time_positions_on_first_record_at_or_after_time)
+{
+    // Arrange
+    write_dump(1000);
+    dump_t *dump = dump_open(dump_path().c_str());
+
+    // Act
+    int ret1 = dump_seek_time(dump, 1500500);
+    int value1 = read_value(dump);
+    int ret2 = dump_seek_time(dump, 0);
+    int value2 = read_value(dump);
+    int ret3 = dump_seek_time(dump, 2000000);
+
+    // Assert
+    ASSERT_EQ(ret1, 0);
+    ASSERT_EQ(value1, 501);
+    ASSERT_EQ(ret2, 0);
+    ASSERT_EQ(value2, 0);
+    ASSERT_EQ(ret3, -1);
+    delete_dump(dump);
+}
+
+TEST_F(dump_tests, dump_seek_record_positions_on_nth_record)
+{
+    // Arrange
+    write_dump(1000);
+    dump_t *dump = dump_open(dump_path().c_str());
+
+    // Act
+    int ret1 = dump_seek_record(dump, 777);
+    int value1 = read_value(dump);
+    int ret2 = dump_seek_record(dump, 1000);
+    int value2 = read_value(dump);
+    int ret3 = dump_seek_record(dump, 1001);
+
+    // Assert
+    ASSERT_EQ(ret1, 0);
+    ASSERT_EQ(value1, 777);
+    ASSERT_EQ(ret2, 0);
+    ASSERT_EQ(value2, -1);
+    ASSERT_EQ(ret3, -1);
+    delete_dump(dump);
+}
+
+TEST_F(dump_tests, dump_open_rebuilds_index_of_truncated_dump)
+{
+    // Arrange
+    write_dump(1000);
+    std::string path = dump_path();
+    // Cut off the index and the end of the last record
+    FILE *fp = fopen(path.c_str(), "rb");
+    fseeko(fp, 0, SEEK_END);
+    off_t size = ftello(fp);
+    fclose(fp);
+    // The index has 4 entries of 24 bytes, its record header and the
+    // trailer take 16 and 48 bytes.
+    truncate(path.c_str(), size - 4 * 24 - 16 - 48 - 2);
+
+    // Act
+    dump_t *dump = dump_open(path.c_str());
+
+    // Assert
+    ASSERT_NE(dump, nullptr);
+    ASSERT_EQ(dump_count(dump), 999u);
+    ASSERT_EQ(dump_seek_time(dump, 1998000), 0);
+    ASSERT_EQ(read_value(dump), 998);
+    ASSERT_EQ(read_value(dump), -1);
+    delete_dump(dump);
+}
+
+TEST_F(dump_tests, dump_start_writer_writes_records_in_background)
+{
+    // Arrange
+    dump_writer_options_t options;
+    dump_writer_stats_t stats;
+    dump_writer_options_init(&options);
+    options.buffer_size = 8192;
+    dump_t *dump = dump_create("node", TYPE_DATAHUB, "topic", "application/json");
+    data_t *data = new_data();
+
+    // Act
+    int ret = dump_start_writer(dump, &options);
+    for (int i = 0; i < 1000; i++) {
+        data_printf(data, "%d", i);
+        data_set_timestamp_value(data, 1000000 + 1000 * (uint64_t) i);
+        dump_write_data(dump, data);
+    }
+    dump_get_writer_stats(dump, &stats);
+    delete_dump(dump);
+    delete_data(data);
+
+    // Assert
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(stats.dropped, 0u);
+    dump = dump_open(dump_path().c_str());
+    ASSERT_EQ(dump_count(dump), 1000u);
+    ASSERT_EQ(dump_seek_record(dump, 999), 0);
+    ASSERT_EQ(read_value(dump), 999);
+    delete_dump(dump);
+}
+
+TEST_F(dump_tests, dump_writer_drops_records_beyond_memory_budget)
+{
+    // Arrange
+    dump_writer_options_t options;
+    dump_writer_stats_t stats;
+    char buffer[1000] = {0};
+    dump_writer_options_init(&options);
+    options.memory_budget = 0;
+    dump_t *dump = dump_create("node", TYPE_DATAHUB, "topic", "application/json");
+    dump_start_writer(dump, &options);
+
+    // Act
+    int ret = dump_write_buffer(dump, buffer, sizeof(buffer));
+    dump_get_writer_stats(dump, &stats);
+
+    // Assert
+    ASSERT_EQ(ret, -1);
+    ASSERT_EQ(stats.dropped, 1u);
+    ASSERT_EQ(stats.dropped_bytes, 1000u);
+    delete_dump(dump);
+}
+
+TEST_F(dump_tests, dump_writer_stops_when_a_write_fails)
+{
+    // Arrange
+    dump_writer_options_t options;
+    dump_writer_stats_t stats;
+    struct rlimit saved, limit;
+    char buffer[1000] = {0};
+    dump_writer_options_init(&options);
+    options.buffer_size = 8192;
+    dump_t *dump = dump_create("node", TYPE_DATAHUB, "topic", "application/json");
+    dump_start_writer(dump, &options);
+    getrlimit(RLIMIT_FSIZE, &saved);
+    limit = saved;
+    limit.rlim_cur = 65536;
+    void (*handler)(int) = signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &limit);
+
+    // Act
+    for (int i = 0; i < 1000; i++)
+        dump_write_buffer(dump, buffer, sizeof(buffer));
+    for (int i = 0; i < 500; i++) {
+        dump_get_writer_stats(dump, &stats);
+        if (stats.failed)
+            break;
+        usleep(10000);
+    }
+    delete_dump(dump);
+    setrlimit(RLIMIT_FSIZE, &saved);
+    signal(SIGXFSZ, handler);
+
+    // Assert
+    ASSERT_EQ(stats.failed, 1);
+    ASSERT_GT(stats.dropped, 0u);
+    ASSERT_GE(r_err_fake.call_count, 2u);
+    dump = dump_open(dump_path().c_str());
+    ASSERT_NE(dump, nullptr);
+    ASSERT_LT(dump_count(dump), 1000u);
+    delete_dump(dump);
+}
+
+TEST_F(dump_tests, dump_set_compression_writes_blocks_that_can_be_seeked)
+{
+    // Arrange
+    dump_t *dump = dump_create("node", TYPE_DATAHUB, "topic", "application/json");
+    data_t *data = new_data();
+
+    // Act
+    int ret = dump_set_compression(dump, DUMP_COMPRESSION_LZ4, 0);
+    for (int i = 0; i < 20000; i++) {
+        data_printf(data, "%d", i);
+        data_set_timestamp_value(data, 1000000 + 1000 * (uint64_t) i);
+        dump_write_data(dump, data);
+    }
+    delete_dump(dump);
+    delete_data(data);
+
+    // Assert
+    ASSERT_EQ(ret, 0);
+    dump = dump_open(dump_path().c_str());
+    ASSERT_EQ(dump_count(dump), 20000u);
+    ASSERT_EQ(read_value(dump), 0);
+    ASSERT_EQ(dump_seek_time(dump, 15000500), 0);
+    ASSERT_EQ(read_value(dump), 14001);
+    ASSERT_EQ(dump_seek_record(dump, 19999), 0);
+    ASSERT_EQ(read_value(dump), 19999);
+    ASSERT_EQ(read_value(dump), -1);
+    delete_dump(dump);
+}
+
+TEST_F(dump_tests, dump_mmap_partitions_cover_all_records_once)
+{
+    // Arrange
+    write_dump(1000);
+    dump_map_t *map = dump_mmap_open(dump_path().c_str());
+    int count = 0;
+    int sum = 0;
+
+    // Act
+    for (int part = 0; part < 3; part++) {
+        dump_cursor_t cursor;
+        dump_view_t view;
+        ASSERT_EQ(dump_mmap_partition(map, part, 3, &cursor), 0);
+        while (dump_mmap_next(&cursor, &view) == 0) {
+            const char *data;
+            uint32_t len;
+            ASSERT_EQ(dump_view_payload(&view, &data, &len), 0);
+            ASSERT_EQ(view.timestamp, 1000000 + 1000 * view.record);
+            sum += std::stoi(std::string(data, len));
+            count++;
+        }
+        dump_mmap_cursor_release(&cursor);
+    }
+
+    // Assert
+    ASSERT_NE(map, nullptr);
+    ASSERT_EQ(count, 1000);
+    ASSERT_EQ(sum, 999 * 1000 / 2);
+    dump_mmap_close(map);
+}
+
+TEST_F(dump_tests, dump_start_recording_returns_null_when_dumping_is_off)
+{
+    // Arrange
+    set_dumping(0);
+
+    // Act
+    dump_t *dump = dump_start_recording("node", TYPE_MESSAGEHUB, "topic",
+                                        "application/json");
+
+    // Assert
+    ASSERT_EQ(dump, nullptr);
+}
+
+TEST_F(dump_tests, dump_read_data_rejects_block_with_invalid_length)
+{
+    // Arrange
+    dump_t *dump = dump_create("node", TYPE_DATAHUB, "topic", "application/json");
+    data_t *data = new_data();
+    dump_set_compression(dump, DUMP_COMPRESSION_LZ4, 0);
+    for (int i = 0; i < 100; i++) {
+        data_printf(data, "%d", i);
+        data_set_timestamp_value(data, 1000000 + 1000 * (uint64_t) i);
+        dump_write_data(dump, data);
+    }
+    delete_dump(dump);
+    // Overwrite the uncompressed length in the prefix of the first block
+    std::string header = "#rcom-dump 2\nnode\ndatahub\ntopic\napplication/json\n";
+    unsigned char length[4] = { 0xff, 0xff, 0xff, 0xf0 };
+    FILE *fp = fopen(dump_path().c_str(), "r+b");
+    fseek(fp, (long) header.size() + 16, SEEK_SET);
+    fwrite(length, 1, sizeof(length), fp);
+    fclose(fp);
+    dump = dump_open(dump_path().c_str());
+
+    // Act
+    int ret = dump_read_data(dump, data);
+
+    // Assert
+    ASSERT_EQ(ret, -1);
+    ASSERT_EQ(r_err_fake.call_count, 1u);
+    delete_dump(dump);
+    delete_data(data);
+}
+
+TEST_F(dump_tests, dump_start_recording_uses_dumping_compression)
+{
+    // Arrange
+    struct stat st;
+    data_t *data = new_data();
+    set_dumping(1);
+    int ret = set_dumping_compression(DUMP_COMPRESSION_LZ4, 0);
+
+    // Act
+    dump_t *dump = dump_start_recording("node", TYPE_DATAHUB, "topic",
+                                        "application/json");
+    for (int i = 0; i < 20000; i++) {
+        data_printf(data, "%d", i);
+        data_set_timestamp_value(data, 1000000 + 1000 * (uint64_t) i);
+        dump_write_data(dump, data);
+    }
+    delete_dump(dump);
+    delete_data(data);
+    set_dumping(0);
+    set_dumping_compression(DUMP_COMPRESSION_NONE, 0);
+
+    // Assert
+    ASSERT_EQ(ret, 0);
+    ASSERT_NE(dump, nullptr);
+    ASSERT_EQ(stat(dump_path().c_str(), &st), 0);
+    // Uncompressed, each record takes more than 28 bytes
+    ASSERT_LT(st.st_size, 20000 * 28);
+    dump = dump_open(dump_path().c_str());
+    ASSERT_EQ(dump_count(dump), 20000u);
+    ASSERT_EQ(read_value(dump), 0);
+    ASSERT_EQ(dump_seek_record(dump, 19999), 0);
+    ASSERT_EQ(read_value(dump), 19999);
+    delete_dump(dump);
+}
+
+TEST_F(dump_tests, dump_write_frame_records_mimetype_and_time)
+{
+    // Arrange
+    char payload[64];
+    dump_record_t record;
+    const char *mimetype;
+    const char *data;
+    uint32_t len;
+    double time;
+    dump_t *dump = dump_create("node", TYPE_STREAMER, "topic", "image/jpeg");
+    dump_write_frame(dump, "jpeg", 4, "image/jpeg", 12.5);
+    delete_dump(dump);
+    dump = dump_open(dump_path().c_str());
+
+    // Act
+    int ret1 = dump_read_record(dump, &record, payload, sizeof(payload));
+    int ret2 = dump_parse_frame(payload, record.len, &mimetype, &time, &data, &len);
+
+    // Assert
+    ASSERT_EQ(ret1, 0);
+    ASSERT_EQ(ret2, 0);
+    ASSERT_EQ(record.type, DUMP_RECORD_FRAME);
+    ASSERT_STREQ(mimetype, "image/jpeg");
+    ASSERT_EQ(time, 12.5);
+    ASSERT_EQ(std::string(data, len), "jpeg");
+    delete_dump(dump);
+}
@@ -0,0 +1,210 @@
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "mem.mock.h"
+#include "log.mock.h"
+#include "clock_posix.mock.h"
+}
+
+#include "fragment.h"
+
+static int collect_fragment(void *userdata, data_t *fragment)
+{
+    auto fragments = (std::vector<data_t*> *) userdata;
+    data_t *copy = new_data();
+    data_set_data(copy, data_data(fragment), data_len(fragment));
+    fragments->push_back(copy);
+    return 0;
+}
+
+class fragment_tests : public ::testing::Test
+{
+protected:
+    reassembler_t *reassembler;
+    addr_t *sender;
+    std::vector<data_t*> fragments;
+    const char *message;
+    int len;
+
+    fragment_tests() : reassembler(nullptr), sender(nullptr), fragments(),
+                       message(nullptr), len(0) {}
+
+	~fragment_tests() override = default;
+
+	void SetUp() override
+    {
+	    RESET_FAKE(safe_malloc);
+        RESET_FAKE(safe_free);
+        RESET_FAKE(r_warn);
+        RESET_FAKE(clock_time);
+        safe_malloc_fake.custom_fake = safe_malloc_custom_fake;
+        safe_free_fake.custom_fake = safe_free_custom_fake;
+        clock_time_fake.return_val = 100.0;
+        reassembler = new_reassembler(FRAGMENT_TIMEOUT);
+        sender = new_addr("127.0.0.1", 10000);
+	}
+
+	void TearDown() override
+    {
+        clear();
+        delete_addr(sender);
+        delete_reassembler(reassembler);
+	}
+
+    // Splits a message of the given length into fragments
+    std::string split(int length, uint32_t msgid)
+    {
+        std::string s;
+        for (int i = 0; i < length; i++)
+            s += (char) ('a' + i % 26);
+        data_t *out = new_data();
+        fragment_split(s.data(), length, msgid, out, collect_fragment, &fragments);
+        delete_data(out);
+        return s;
+    }
+
+    int push(int i)
+    {
+        return reassembler_push(reassembler, sender, fragments[i], &message, &len);
+    }
+
+    void clear()
+    {
+        for (auto fragment : fragments)
+            delete_data(fragment);
+        fragments.clear();
+    }
+};
+
+TEST_F(fragment_tests, fragment_split_fails_when_message_is_too_long)
+{
+    // Arrange
+    std::vector<char> s(FRAGMENT_MESSAGE_MAXLEN + 1, 'x');
+    data_t *out = new_data();
+
+    // Act
+    int ret = fragment_split(s.data(), (int) s.size(), 0, out,
+                             collect_fragment, &fragments);
+
+    // Assert
+    ASSERT_EQ(ret, -1);
+    ASSERT_EQ(fragments.size(), 0u);
+    delete_data(out);
+}
+
+TEST_F(fragment_tests, reassembler_push_reassembles_fragments_in_any_order)
+{
+    // Arrange
+    std::string expected = split(3 * FRAGMENT_DATA_MAXLEN + 100, 1);
+
+    // Act
+    int r1 = push(3);
+    int r2 = push(1);
+    int r3 = push(0);
+    int r4 = push(2);
+
+    // Assert
+    ASSERT_EQ(fragments.size(), 4u);
+    ASSERT_TRUE(data_is_fragment(fragments[0]));
+    ASSERT_EQ(r1, 0);
+    ASSERT_EQ(r2, 0);
+    ASSERT_EQ(r3, 0);
+    ASSERT_EQ(r4, 1);
+    ASSERT_EQ(std::string(message, len), expected);
+}
+
+TEST_F(fragment_tests, reassembler_push_ignores_duplicate_fragments)
+{
+    // Arrange
+    std::string expected = split(2 * FRAGMENT_DATA_MAXLEN + 10, 1);
+
+    // Act
+    int r1 = push(0);
+    int r2 = push(0);
+    int r3 = push(1);
+    int r4 = push(1);
+    int r5 = push(2);
+
+    // Assert
+    ASSERT_EQ(r1, 0);
+    ASSERT_EQ(r2, 0);
+    ASSERT_EQ(r3, 0);
+    ASSERT_EQ(r4, 0);
+    ASSERT_EQ(r5, 1);
+    ASSERT_EQ(std::string(message, len), expected);
+}
+
+TEST_F(fragment_tests, reassembler_push_drops_messages_beyond_pending_limit)
+{
+    // Arrange: 16 incomplete messages
+    for (uint32_t msgid = 0; msgid < 16; msgid++)
+        split(FRAGMENT_DATA_MAXLEN + 1, msgid);
+    for (int i = 0; i < 16; i++)
+        push(2 * i);
+    std::string extra = split(FRAGMENT_DATA_MAXLEN + 1, 16);
+
+    // Act
+    int r1 = push(32);
+    int r2 = push(33);
+    int r3 = push(1);
+
+    // Assert
+    ASSERT_EQ(r1, 0);
+    ASSERT_EQ(r2, 0);
+    ASSERT_EQ(reassembler_dropped(reassembler), 2u);
+    // The pending messages can still be completed
+    ASSERT_EQ(r3, 1);
+    ASSERT_EQ(len, FRAGMENT_DATA_MAXLEN + 1);
+}
+
+TEST_F(fragment_tests, reassembler_push_drops_incomplete_message_after_timeout)
+{
+    // Arrange
+    split(FRAGMENT_DATA_MAXLEN + 1, 1);
+    split(FRAGMENT_DATA_MAXLEN + 1, 2);
+    push(0);
+    clock_time_fake.return_val = 100.0 + FRAGMENT_TIMEOUT + 0.1;
+
+    // Act
+    int r1 = push(2);
+    int r2 = push(1);
+
+    // Assert
+    ASSERT_EQ(r1, 0);
+    ASSERT_EQ(r2, 0);
+    ASSERT_EQ(reassembler_dropped(reassembler), 1u);
+}
+
+TEST_F(fragment_tests, reassembler_push_rejects_invalid_fragment)
+{
+    // Arrange
+    split(FRAGMENT_DATA_MAXLEN + 1, 1);
+    data_t *fragment = fragments[1];
+    // The last fragment is shorter than its header says
+    data_set_len(fragment, data_len(fragment) - 1);
+
+    // Act
+    int ret = push(1);
+
+    // Assert
+    ASSERT_EQ(ret, -1);
+    ASSERT_EQ(r_warn_fake.call_count, 1u);
+}
+
+TEST_F(fragment_tests, data_is_reserved_checks_first_byte)
+{
+    // Arrange
+    const char reserved[] = { (char) 0xff, 'x' };
+
+    // Act
+    int r1 = data_is_reserved(reserved, 2);
+    int r2 = data_is_reserved("{}", 2);
+    int r3 = data_is_reserved(reserved, 0);
+
+    // Assert
+    ASSERT_EQ(r1, 1);
+    ASSERT_EQ(r2, 0);
+    ASSERT_EQ(r3, 0);
+}
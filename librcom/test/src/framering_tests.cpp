@@ -0,0 +1,154 @@
+#include <string>
+#include <unistd.h>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "mem.mock.h"
+#include "log.mock.h"
+}
+
+#include "framering.h"
+
+struct frame_t {
+    int count;
+    std::string mimetype;
+    std::string data;
+    double timestamp;
+};
+
+static int onframe(void *userdata, const char *mimetype, const char *data,
+                   int length, double timestamp)
+{
+    frame_t *frame = (frame_t *) userdata;
+    frame->count++;
+    frame->mimetype = mimetype;
+    frame->data = std::string(data, length);
+    frame->timestamp = timestamp;
+    return 0;
+}
+
+class framering_tests : public ::testing::Test
+{
+protected:
+    std::string name;
+    frame_t frame;
+
+    framering_tests() : name(), frame()
+    {
+        name = "/rcom-framering-test-" + std::to_string(getpid());
+    }
+
+	~framering_tests() override = default;
+
+	void SetUp() override
+    {
+	    RESET_FAKE(safe_malloc);
+        RESET_FAKE(safe_free);
+        RESET_FAKE(r_err);
+        safe_malloc_fake.custom_fake = safe_malloc_custom_fake;
+        safe_free_fake.custom_fake = safe_free_custom_fake;
+        frame.count = 0;
+	}
+
+	void TearDown() override
+    {
+	}
+};
+
+TEST_F(framering_tests, written_frame_is_read_by_the_reader)
+{
+    // Arrange
+    framering_t *writer = new_framering(name.c_str(), 4, 1024);
+    framering_t *reader = open_framering(name.c_str());
+
+    // Act
+    int has_readers = framering_has_readers(writer);
+    int write_result = framering_write(writer, "jpeg", 4, "image/jpeg", 12.5);
+    int read_result = framering_read(reader, 0.0, onframe, &frame);
+    int timeout_result = framering_read(reader, 0.01, onframe, &frame);
+
+    // Assert
+    ASSERT_NE(writer, nullptr);
+    ASSERT_NE(reader, nullptr);
+    ASSERT_EQ(has_readers, 1);
+    ASSERT_EQ(write_result, 0);
+    ASSERT_EQ(read_result, RCOM_WAIT_OK);
+    ASSERT_EQ(timeout_result, RCOM_WAIT_TIMEOUT);
+    ASSERT_EQ(frame.count, 1);
+    ASSERT_EQ(frame.mimetype, "image/jpeg");
+    ASSERT_EQ(frame.data, "jpeg");
+    ASSERT_EQ(frame.timestamp, 12.5);
+    ASSERT_EQ(framering_overruns(reader), 0u);
+
+    delete_framering(reader);
+    delete_framering(writer);
+}
+
+TEST_F(framering_tests, framering_write_fails_when_frame_is_too_large)
+{
+    // Arrange
+    framering_t *writer = new_framering(name.c_str(), 2, 16);
+    std::string data(17, 'x');
+
+    // Act
+    int result = framering_write(writer, data.data(), data.size(), "image/jpeg", 0.0);
+
+    // Assert
+    ASSERT_EQ(result, -1);
+    ASSERT_EQ(r_err_fake.call_count, 1u);
+    delete_framering(writer);
+}
+
+TEST_F(framering_tests, slow_reader_skips_to_most_recent_frame)
+{
+    // Arrange
+    framering_t *writer = new_framering(name.c_str(), 4, 1024);
+    framering_t *reader = open_framering(name.c_str());
+    for (int i = 0; i < 6; i++) {
+        std::string data = std::to_string(i);
+        framering_write(writer, data.data(), data.size(), "text/plain", (double) i);
+    }
+
+    // Act
+    int result = framering_read(reader, 0.0, onframe, &frame);
+
+    // Assert
+    ASSERT_EQ(result, RCOM_WAIT_OK);
+    ASSERT_EQ(frame.count, 1);
+    ASSERT_EQ(frame.data, "5");
+    ASSERT_EQ(framering_overruns(reader), 5u);
+
+    delete_framering(reader);
+    delete_framering(writer);
+}
+
+TEST_F(framering_tests, framering_read_fails_when_writer_deleted_the_ring)
+{
+    // Arrange
+    framering_t *writer = new_framering(name.c_str(), 2, 1024);
+    framering_t *reader = open_framering(name.c_str());
+    delete_framering(writer);
+
+    // Act
+    int result = framering_read(reader, 1.0, onframe, &frame);
+
+    // Assert
+    ASSERT_EQ(result, RCOM_WAIT_ERROR);
+    ASSERT_EQ(frame.count, 0);
+    delete_framering(reader);
+}
+
+TEST_F(framering_tests, framering_has_readers_is_false_after_reader_left)
+{
+    // Arrange
+    framering_t *writer = new_framering(name.c_str(), 2, 1024);
+    framering_t *reader = open_framering(name.c_str());
+
+    // Act
+    delete_framering(reader);
+    int has_readers = framering_has_readers(writer);
+
+    // Assert
+    ASSERT_EQ(has_readers, 0);
+    delete_framering(writer);
+}
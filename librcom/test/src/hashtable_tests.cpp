@@ -0,0 +1,117 @@
+#include <string>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "mem.mock.h"
+}
+
+#include "hashtable.h"
+
+
+class hashtable_tests : public ::testing::Test
+{
+protected:
+    hashtable_tests() = default;
+
+	~hashtable_tests() override = default;
+
+	void SetUp() override
+    {
+	    RESET_FAKE(safe_malloc);
+        RESET_FAKE(safe_free);
+        safe_malloc_fake.custom_fake = safe_malloc_custom_fake;
+        safe_free_fake.custom_fake = safe_free_custom_fake;
+	}
+
+	void TearDown() override
+    {
+	}
+
+};
+
+TEST_F(hashtable_tests, new_hashtable_creates_empty_table)
+{
+    // Arrange
+
+    // Act
+    hashtable_t *table = new_hashtable(0);
+
+    // Assert
+    ASSERT_NE(table, nullptr);
+    ASSERT_EQ(hashtable_size(table), 0);
+    ASSERT_EQ(hashtable_get_str(table, "foo"), nullptr);
+    delete_hashtable(table);
+}
+
+TEST_F(hashtable_tests, new_hashtable_malloc_fails_returns_null)
+{
+    // Arrange
+    safe_malloc_fake.custom_fake = nullptr;
+    safe_malloc_fake.return_val = nullptr;
+
+    // Act
+    hashtable_t *table = new_hashtable(0);
+
+    // Assert
+    ASSERT_EQ(table, nullptr);
+}
+
+TEST_F(hashtable_tests, hashtable_set_replaces_existing_value)
+{
+    // Arrange
+    int a = 1, b = 2;
+    hashtable_t *table = new_hashtable(0);
+
+    // Act
+    hashtable_set_str(table, "foo", &a);
+    hashtable_set_str(table, "foo", &b);
+
+    // Assert
+    ASSERT_EQ(hashtable_size(table), 1);
+    ASSERT_EQ(hashtable_get_str(table, "foo"), &b);
+    delete_hashtable(table);
+}
+
+TEST_F(hashtable_tests, hashtable_grows_and_removes)
+{
+    // Arrange
+    int values[1000];
+    hashtable_t *table = new_hashtable(0);
+
+    // Act
+    for (int i = 0; i < 1000; i++) {
+        std::string key = "key-" + std::to_string(i);
+        ASSERT_EQ(hashtable_set_str(table, key.c_str(), &values[i]), 0);
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        std::string key = "key-" + std::to_string(i);
+        ASSERT_EQ(hashtable_remove_str(table, key.c_str()), &values[i]);
+    }
+
+    // Assert
+    ASSERT_EQ(hashtable_size(table), 500);
+    for (int i = 0; i < 1000; i++) {
+        std::string key = "key-" + std::to_string(i);
+        void *expected = (i % 2)? &values[i] : nullptr;
+        ASSERT_EQ(hashtable_get_str(table, key.c_str()), expected);
+    }
+    delete_hashtable(table);
+}
+
+TEST_F(hashtable_tests, hashtable_binary_keys)
+{
+    // Arrange
+    int a = 1;
+    unsigned char key1[4] = {0, 1, 2, 3};
+    unsigned char key2[4] = {0, 1, 2, 4};
+    hashtable_t *table = new_hashtable(4);
+
+    // Act
+    hashtable_set(table, key1, sizeof(key1), &a);
+
+    // Assert
+    ASSERT_EQ(hashtable_get(table, key1, sizeof(key1)), &a);
+    ASSERT_EQ(hashtable_get(table, key2, sizeof(key2)), nullptr);
+    ASSERT_EQ(hashtable_get(table, key1, 3), nullptr);
+    delete_hashtable(table);
+}
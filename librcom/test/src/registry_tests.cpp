@@ -0,0 +1,187 @@
+#include <string>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "mem.mock.h"
+#include "log.mock.h"
+}
+
+#include "registry_priv.h"
+
+
+class registry_tests : public ::testing::Test
+{
+protected:
+    registry_t *registry;
+
+    registry_tests() : registry(nullptr) {}
+
+	~registry_tests() override = default;
+
+	void SetUp() override
+    {
+	    RESET_FAKE(safe_malloc);
+        RESET_FAKE(safe_free);
+        RESET_FAKE(r_err);
+        safe_malloc_fake.custom_fake = safe_malloc_custom_fake;
+        safe_free_fake.custom_fake = safe_free_custom_fake;
+        registry = new_registry();
+	}
+
+	void TearDown() override
+    {
+        delete_registry(registry);
+	}
+
+    void insert(const char *id, const char *name, const char *topic, int type)
+    {
+        addr_t *addr = new_addr("127.0.0.1", 10000);
+        ASSERT_EQ(registry_insert(registry, id, name, topic, type, addr, nullptr), 0);
+        delete_addr(addr);
+    }
+};
+
+TEST_F(registry_tests, registry_insert_rejects_duplicate_id)
+{
+    // Arrange
+    insert("id-1", "node-a", "topic", TYPE_DATAHUB);
+    addr_t *addr = new_addr("127.0.0.1", 10001);
+
+    // Act
+    int ret = registry_insert(registry, "id-1", "node-b", "topic",
+                              TYPE_DATALINK, addr, nullptr);
+
+    // Assert
+    ASSERT_EQ(ret, -1);
+    ASSERT_EQ(registry_count(registry, nullptr, nullptr, nullptr,
+                             TYPE_ANY, nullptr, nullptr), 1);
+    ASSERT_EQ(r_err_fake.call_count, 1u);
+    delete_addr(addr);
+}
+
+TEST_F(registry_tests, registry_get_finds_entry_by_id)
+{
+    // Arrange
+    insert("id-1", "node-a", "topic-a", TYPE_DATAHUB);
+    insert("id-2", "node-b", "topic-b", TYPE_DATALINK);
+
+    // Act
+    registry_entry_t *e = registry_get(registry, "id-2");
+    registry_entry_t *missing = registry_get(registry, "id-3");
+
+    // Assert
+    ASSERT_NE(e, nullptr);
+    ASSERT_STREQ(e->name, "node-b");
+    ASSERT_EQ(missing, nullptr);
+    delete_registry_entry(e);
+}
+
+TEST_F(registry_tests, registry_select_view_returns_entries_of_topic_and_type)
+{
+    // Arrange
+    registry_view_t view;
+    insert("id-1", "link-a", "topic", TYPE_DATALINK);
+    insert("id-2", "hub-a", "topic", TYPE_DATAHUB);
+    insert("id-3", "link-b", "other", TYPE_DATALINK);
+    insert("id-4", "link-c", "topic", TYPE_DATALINK);
+
+    // Act
+    int count = registry_select_view(registry, &view, nullptr, nullptr, "topic",
+                                     TYPE_DATALINK, nullptr, nullptr);
+
+    // Assert
+    ASSERT_EQ(count, 2);
+    ASSERT_STREQ(view.entries[0]->name, "link-a");
+    ASSERT_STREQ(view.entries[1]->name, "link-c");
+    registry_release_view(registry, &view);
+}
+
+TEST_F(registry_tests, registry_select_view_of_any_type_grows_beyond_inline_entries)
+{
+    // Arrange
+    registry_view_t view;
+    for (int i = 0; i < 3 * REGISTRY_VIEW_INLINE; i++) {
+        std::string id = "id-" + std::to_string(i);
+        insert(id.c_str(), "node", "topic", (i % 2)? TYPE_DATALINK : TYPE_MESSAGELINK);
+    }
+
+    // Act
+    int count = registry_select_view(registry, &view, nullptr, "node", "topic",
+                                     TYPE_ANY, nullptr, nullptr);
+
+    // Assert
+    ASSERT_EQ(count, 3 * REGISTRY_VIEW_INLINE);
+    registry_release_view(registry, &view);
+}
+
+TEST_F(registry_tests, registry_delete_removes_entry_from_indexes)
+{
+    // Arrange
+    registry_view_t view;
+    insert("id-1", "link-a", "topic", TYPE_DATALINK);
+    insert("id-2", "link-b", "topic", TYPE_DATALINK);
+    insert("id-3", "link-c", "topic", TYPE_DATALINK);
+
+    // Act
+    int ret = registry_delete(registry, "id-2");
+
+    // Assert
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(registry_get(registry, "id-2"), nullptr);
+    ASSERT_EQ(registry_select_view(registry, &view, nullptr, nullptr, "topic",
+                                   TYPE_DATALINK, nullptr, nullptr), 2);
+    ASSERT_STREQ(view.entries[0]->name, "link-a");
+    ASSERT_STREQ(view.entries[1]->name, "link-c");
+    registry_release_view(registry, &view);
+}
+
+TEST_F(registry_tests, registry_changes_lists_each_changed_entry_once)
+{
+    // Arrange
+    uint64_t since, revision;
+    list_t *entries;
+    list_t *removed;
+    insert("id-1", "link-a", "topic", TYPE_DATALINK);
+    since = registry_revision(registry);
+    insert("id-2", "link-b", "topic", TYPE_DATALINK);
+    insert("id-3", "hub-a", "topic", TYPE_DATAHUB);
+    registry_update_addr(registry, "id-3", "127.0.0.1:10002");
+    registry_delete(registry, "id-1");
+
+    // Act
+    int ret = registry_changes(registry, since, &revision, &entries, &removed);
+
+    // Assert
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(revision, since + 4);
+    ASSERT_EQ(list_size(entries), 2);
+    ASSERT_STREQ(list_get(entries, registry_entry_t)->id, "id-2");
+    ASSERT_STREQ(list_get(list_next(entries), registry_entry_t)->id, "id-3");
+    ASSERT_EQ(list_size(removed), 1);
+    ASSERT_STREQ(list_get(removed, char), "id-1");
+    delete_registry_entry_list(entries);
+    registry_delete_id_list(removed);
+}
+
+TEST_F(registry_tests, registry_changes_fails_when_history_is_gone)
+{
+    // Arrange
+    uint64_t revision;
+    list_t *entries;
+    list_t *removed;
+    for (int i = 0; i < 1100; i++) {
+        std::string id = "id-" + std::to_string(i);
+        insert(id.c_str(), "node", "topic", TYPE_DATALINK);
+    }
+
+    // Act
+    int ret1 = registry_changes(registry, 0, &revision, &entries, &removed);
+    int ret2 = registry_changes(registry, 100, &revision, &entries, &removed);
+
+    // Assert
+    ASSERT_EQ(ret1, -1);
+    ASSERT_EQ(ret2, 0);
+    ASSERT_EQ(list_size(entries), 1000);
+    delete_registry_entry_list(entries);
+    registry_delete_id_list(removed);
+}
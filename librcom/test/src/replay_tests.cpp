@@ -0,0 +1,124 @@
+#include <string>
+#include <vector>
+#include <glob.h>
+#include <stdlib.h>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "mem.mock.h"
+#include "log.mock.h"
+#include "clock_posix.mock.h"
+}
+
+#include "replay.h"
+#include "registry_priv.h"
+
+static char *clock_datetime_custom_fake(char *buf, int len, char, char, char)
+{
+    snprintf(buf, len, "2020-01-01_00-00-00");
+    return buf;
+}
+
+static int replay_onrecord(void *userdata, dump_t *dump,
+                           dump_record_t *record, const void *payload)
+{
+    auto *records = (std::vector<std::string> *) userdata;
+    records->push_back(std::string(dump_name(dump)) + ":"
+                       + std::string((const char *) payload, record->len));
+    return 0;
+}
+
+class replay_tests : public ::testing::Test
+{
+protected:
+    char dir[64];
+    std::vector<std::string> records;
+    
+    replay_tests() = default;
+
+	~replay_tests() override = default;
+
+	void SetUp() override
+    {
+	    RESET_FAKE(safe_malloc);
+        RESET_FAKE(safe_free);
+        RESET_FAKE(r_err);
+        RESET_FAKE(clock_datetime);
+        safe_malloc_fake.custom_fake = safe_malloc_custom_fake;
+        safe_free_fake.custom_fake = safe_free_custom_fake;
+        clock_datetime_fake.custom_fake = clock_datetime_custom_fake;
+        snprintf(dir, sizeof(dir), "/tmp/replay_tests_XXXXXX");
+        mkdtemp(dir);
+        set_dumping_dir(dir);
+	}
+
+	void TearDown() override
+    {
+        std::string cmd = std::string("rm -rf ") + dir;
+        system(cmd.c_str());
+        set_dumping_dir(nullptr);
+	}
+
+    // Writes a dump with a message every 2 ms, shifted by offset µs
+    void write_dump(const char *name, uint64_t offset, int n)
+    {
+        dump_t *dump = dump_create(name, TYPE_MESSAGEHUB, "topic", "application/json");
+        for (int i = 0; i < n; i++) {
+            std::string s = std::to_string(i);
+            dump_write_record(dump, DUMP_RECORD_MESSAGE,
+                              1000000 + offset + 2000 * (uint64_t) i,
+                              s.c_str(), (uint32_t) s.length());
+        }
+        delete_dump(dump);
+    }
+
+    replay_t *create_replay()
+    {
+        glob_t g;
+        std::string pattern = std::string(dir) + "/*.dump";
+        replay_t *replay = new_replay();
+        glob(pattern.c_str(), 0, nullptr, &g);
+        for (size_t i = 0; i < g.gl_pathc; i++)
+            replay_add(replay, g.gl_pathv[i], replay_onrecord, &records);
+        globfree(&g);
+        return replay;
+    }
+};
+
+TEST_F(replay_tests, replay_run_merges_dumps_by_timestamp)
+{
+    // Arrange
+    write_dump("a", 0, 3);
+    write_dump("b", 1000, 3);
+    replay_t *replay = create_replay();
+    replay_stats_t stats;
+    replay_set_speed(replay, 0);
+
+    // Act
+    int ret = replay_run(replay);
+    replay_get_stats(replay, &stats);
+
+    // Assert
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(stats.records, 6u);
+    std::vector<std::string> expected = {"a:0", "b:0", "a:1", "b:1", "a:2", "b:2"};
+    ASSERT_EQ(records, expected);
+    delete_replay(replay);
+}
+
+TEST_F(replay_tests, replay_run_only_replays_range)
+{
+    // Arrange
+    write_dump("a", 0, 10);
+    replay_t *replay = create_replay();
+    replay_set_speed(replay, 0);
+    replay_set_range(replay, 1004000, 1010000);
+
+    // Act
+    replay_run(replay);
+
+    // Assert
+    std::vector<std::string> expected = {"a:2", "a:3", "a:4"};
+    ASSERT_EQ(records, expected);
+    delete_replay(replay);
+}
@@ -0,0 +1,149 @@
+#include <string>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "mem.mock.h"
+}
+
+#include "seqwindow.h"
+
+
+class seqwindow_tests : public ::testing::Test
+{
+protected:
+    seq_window_t seq;
+    data_t *data;
+
+    seqwindow_tests() : seq(), data(nullptr) {}
+
+	~seqwindow_tests() override = default;
+
+	void SetUp() override
+    {
+	    RESET_FAKE(safe_malloc);
+        RESET_FAKE(safe_free);
+        safe_malloc_fake.custom_fake = safe_malloc_custom_fake;
+        safe_free_fake.custom_fake = safe_free_custom_fake;
+        memset(&seq, 0, sizeof(seq));
+        data = new_data();
+        data_set_timestamp(data);
+	}
+
+	void TearDown() override
+    {
+        delete_data(data);
+	}
+
+    int receive(uint32_t seqnum)
+    {
+        data_set_seqnum(data, seqnum);
+        return seq_window_update(&seq, data);
+    }
+};
+
+TEST_F(seqwindow_tests, seq_window_update_accepts_packets_in_order)
+{
+    // Arrange
+    receive(100);
+
+    // Act
+    int stale1 = receive(101);
+    int stale2 = receive(102);
+
+    // Assert
+    ASSERT_EQ(stale1, 0);
+    ASSERT_EQ(stale2, 0);
+    ASSERT_EQ(seq.stats.received, 3u);
+    ASSERT_EQ(seq.stats.lost, 0u);
+    ASSERT_EQ(seq.stats.duplicates, 0u);
+    ASSERT_EQ(seq.stats.reordered, 0u);
+}
+
+TEST_F(seqwindow_tests, seq_window_update_counts_lost_packets)
+{
+    // Arrange
+    receive(100);
+
+    // Act
+    int stale = receive(104);
+
+    // Assert
+    ASSERT_EQ(stale, 0);
+    ASSERT_EQ(seq.stats.received, 2u);
+    ASSERT_EQ(seq.stats.lost, 3u);
+}
+
+TEST_F(seqwindow_tests, seq_window_update_marks_late_packet_stale)
+{
+    // Arrange
+    receive(100);
+    receive(103);
+
+    // Act
+    int stale = receive(101);
+
+    // Assert
+    ASSERT_EQ(stale, 1);
+    ASSERT_EQ(seq.stats.received, 3u);
+    ASSERT_EQ(seq.stats.reordered, 1u);
+    ASSERT_EQ(seq.stats.lost, 1u);
+}
+
+TEST_F(seqwindow_tests, seq_window_update_marks_duplicates_stale)
+{
+    // Arrange
+    receive(100);
+    receive(101);
+    receive(103);
+    receive(102);
+
+    // Act
+    int stale1 = receive(103);
+    int stale2 = receive(102);
+    int stale3 = receive(101);
+
+    // Assert
+    ASSERT_EQ(stale1, 1);
+    ASSERT_EQ(stale2, 1);
+    ASSERT_EQ(stale3, 1);
+    ASSERT_EQ(seq.stats.duplicates, 3u);
+    ASSERT_EQ(seq.stats.received, 4u);
+    ASSERT_EQ(seq.stats.reordered, 1u);
+    ASSERT_EQ(seq.stats.lost, 0u);
+}
+
+TEST_F(seqwindow_tests, seq_window_update_handles_wrap_around)
+{
+    // Arrange
+    receive(0xfffffffe);
+    receive(0xffffffff);
+
+    // Act
+    int stale = receive(0);
+
+    // Assert
+    ASSERT_EQ(stale, 0);
+    ASSERT_EQ(seq.stats.lost, 0u);
+    ASSERT_EQ(seq.last, 0u);
+}
+
+TEST_F(seqwindow_tests, seq_window_update_resets_when_sender_restarts)
+{
+    // Arrange
+    receive(1000000);
+    receive(1000001);
+
+    // Act
+    int stale1 = receive(5);
+    int stale2 = receive(6);
+    int stale3 = receive(3000000);
+
+    // Assert
+    ASSERT_EQ(stale1, 0);
+    ASSERT_EQ(stale2, 0);
+    ASSERT_EQ(stale3, 0);
+    ASSERT_EQ(seq.last, 3000000u);
+    ASSERT_EQ(seq.stats.lost, 0u);
+    ASSERT_EQ(seq.stats.duplicates, 0u);
+    ASSERT_EQ(seq.stats.received, 5u);
+}
@@ -0,0 +1,181 @@
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "mem.mock.h"
+}
+
+#include "shmring.h"
+
+
+class shmring_tests : public ::testing::Test
+{
+protected:
+    shmring_tests() : name()
+    {
+        name = "/rcom-test-" + std::to_string(getpid());
+    }
+
+	~shmring_tests() override = default;
+
+	void SetUp() override
+    {
+	    RESET_FAKE(safe_malloc);
+        RESET_FAKE(safe_free);
+        safe_malloc_fake.custom_fake = safe_malloc_custom_fake;
+        safe_free_fake.custom_fake = safe_free_custom_fake;
+	}
+
+	void TearDown() override
+    {
+	}
+
+    // Overwrites the length stored in the first slot of the ring. The
+    // slots are at the end of the shared memory, each holding the
+    // length followed by the packet.
+    void corrupt_first_slot(int slots, uint32_t len)
+    {
+        struct stat st;
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        ASSERT_NE(fd, -1);
+        ASSERT_EQ(fstat(fd, &st), 0);
+        void *p = mmap(nullptr, (size_t) st.st_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+        close(fd);
+        ASSERT_NE(p, MAP_FAILED);
+        size_t offset = (size_t) st.st_size - (size_t) slots * (4 + PACKET_MAXLEN);
+        memcpy((unsigned char *) p + offset, &len, 4);
+        munmap(p, (size_t) st.st_size);
+    }
+
+    std::string name;
+};
+
+TEST_F(shmring_tests, new_shm_ring_fails_on_invalid_arguments)
+{
+    // Arrange
+
+    // Act
+    shm_ring_t *no_slash = new_shm_ring("rcom-test", 4);
+    shm_ring_t *bad_slots = new_shm_ring(name.c_str(), 3);
+
+    // Assert
+    ASSERT_EQ(no_slash, nullptr);
+    ASSERT_EQ(bad_slots, nullptr);
+}
+
+TEST_F(shmring_tests, open_shm_ring_fails_when_ring_does_not_exist)
+{
+    // Arrange
+
+    // Act
+    shm_ring_t *ring = open_shm_ring(name.c_str());
+
+    // Assert
+    ASSERT_EQ(ring, nullptr);
+}
+
+TEST_F(shmring_tests, written_data_is_read_by_the_other_end)
+{
+    // Arrange
+    shm_ring_t *reader = new_shm_ring(name.c_str(), 4);
+    shm_ring_t *writer = open_shm_ring(name.c_str());
+    data_t *in = new_data();
+    data_t *out = new_data();
+    data_set_data(out, "hello", 5);
+    data_set_seqnum(out, 42);
+
+    // Act
+    int write_result = shm_ring_write(writer, out);
+    int wait_result = shm_ring_wait(reader, 0.0);
+    int read_result = shm_ring_read(reader, in);
+    int empty_result = shm_ring_read(reader, in);
+
+    // Assert
+    ASSERT_NE(reader, nullptr);
+    ASSERT_NE(writer, nullptr);
+    ASSERT_EQ(write_result, 0);
+    ASSERT_EQ(wait_result, RCOM_WAIT_OK);
+    ASSERT_EQ(read_result, 1);
+    ASSERT_EQ(empty_result, 0);
+    ASSERT_EQ(data_len(in), 5);
+    ASSERT_EQ(std::string(data_data(in), 5), "hello");
+    ASSERT_EQ(data_seqnum(in), 42u);
+
+    delete_data(in);
+    delete_data(out);
+    delete_shm_ring(writer);
+    delete_shm_ring(reader);
+}
+
+TEST_F(shmring_tests, shm_ring_write_drops_data_when_full)
+{
+    // Arrange
+    shm_ring_t *reader = new_shm_ring(name.c_str(), 2);
+    shm_ring_t *writer = open_shm_ring(name.c_str());
+    data_t *out = new_data();
+    data_set_data(out, "x", 1);
+
+    // Act
+    int r1 = shm_ring_write(writer, out);
+    int r2 = shm_ring_write(writer, out);
+    int r3 = shm_ring_write(writer, out);
+
+    // Assert
+    ASSERT_EQ(r1, 0);
+    ASSERT_EQ(r2, 0);
+    ASSERT_EQ(r3, -1);
+    ASSERT_EQ(shm_ring_dropped(reader), 1u);
+
+    delete_data(out);
+    delete_shm_ring(writer);
+    delete_shm_ring(reader);
+}
+
+TEST_F(shmring_tests, shm_ring_wait_times_out_when_empty)
+{
+    // Arrange
+    shm_ring_t *reader = new_shm_ring(name.c_str(), 2);
+
+    // Act
+    int result = shm_ring_wait(reader, 0.01);
+
+    // Assert
+    ASSERT_EQ(result, RCOM_WAIT_TIMEOUT);
+
+    delete_shm_ring(reader);
+}
+
+TEST_F(shmring_tests, shm_ring_read_skips_slot_with_invalid_length)
+{
+    // Arrange
+    shm_ring_t *reader = new_shm_ring(name.c_str(), 4);
+    shm_ring_t *writer = open_shm_ring(name.c_str());
+    data_t *in = new_data();
+    data_t *out = new_data();
+    data_set_data(out, "first", 5);
+    shm_ring_write(writer, out);
+    data_set_data(out, "second", 6);
+    shm_ring_write(writer, out);
+    corrupt_first_slot(4, PACKET_MAXLEN + 1);
+
+    // Act
+    int r1 = shm_ring_read(reader, in);
+    int r2 = shm_ring_read(reader, in);
+    int r3 = shm_ring_read(reader, in);
+
+    // Assert
+    ASSERT_EQ(r1, -1);
+    ASSERT_EQ(r2, 1);
+    ASSERT_EQ(r3, 0);
+    ASSERT_EQ(std::string(data_data(in), data_len(in)), "second");
+
+    delete_data(in);
+    delete_data(out);
+    delete_shm_ring(writer);
+    delete_shm_ring(reader);
+}